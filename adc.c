@@ -0,0 +1,152 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
+#include "adc.h"
+
+
+// adc clock: 72 MHz / 6
+#define ADC_CLOCK 12000000
+
+// circular dma buffer of two blocks, 4 byte aligned for the 32 bit transfers of the dual mode
+static uint32_t adcBuffer[ADC_BLOCK_SIZE * 2 / 4];
+
+static AdcBlockReady adcReady;
+
+// number of dma transfers of both blocks
+static uint16_t adcTransfers;
+
+// sample times in adc cycles * 2 (conversion adds 12.5 cycles), indexed by the SMP bits of ADC_SMPRx
+static const uint16_t adcSampleTimes[] = {3, 15, 27, 57, 83, 111, 143, 479};
+
+bool adcCheckConfig(const struct AdcConfig *config) {
+	return config->sampleRate > 0 && config->sampleRate <= ADC_MAX_SAMPLE_RATE && config->channel <= 9
+		&& (!config->dual || (config->channel2 <= 9 && config->channel2 != config->channel))
+		&& config->codec <= ADC_CODEC_DELTA;
+}
+
+// set the channel as analog input
+static void adcSetupPin(uint8_t channel) {
+	if (channel < 8)
+		gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG, 1 << channel);
+	else
+		gpio_set_mode(GPIOB, GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG, 1 << (channel - 8));
+}
+
+// power on, calibrate and configure an adc for single conversions of one channel
+static void adcSetup(uint32_t adc, uint8_t channel, uint8_t sampleTime, uint32_t trigger) {
+	adc_power_off(adc);
+	adc_disable_scan_mode(adc);
+	adc_set_single_conversion_mode(adc);
+	adc_set_right_aligned(adc);
+	adc_set_sample_time(adc, channel, sampleTime);
+	adc_set_regular_sequence(adc, 1, &channel);
+	adc_enable_external_trigger_regular(adc, trigger);
+	adc_power_on(adc);
+
+	// wait for the adc to stabilize (t_STAB = 1 us), then calibrate
+	uint32_t start = dwt_read_cycle_counter();
+	while (dwt_read_cycle_counter() - start < CPU_CLOCK / 1000000 * 2)
+		;
+	adc_reset_calibration(adc);
+	adc_calibrate(adc);
+}
+
+void adcStart(const struct AdcConfig *config, AdcBlockReady ready) {
+	adcStop();
+	adcReady = ready;
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_ADC1);
+	rcc_periph_clock_enable(RCC_ADC2);
+	rcc_periph_clock_enable(RCC_DMA1);
+	rcc_periph_clock_enable(RCC_TIM3);
+	rcc_set_adcpre(RCC_CFGR_ADCPRE_PCLK2_DIV6);
+
+	// longest sample time that fits into the sample period
+	uint32_t period = (CPU_CLOCK + config->sampleRate / 2) / config->sampleRate;
+	uint32_t adcCycles2 = (uint32_t)((uint64_t)ADC_CLOCK * 2 * period / CPU_CLOCK);
+	uint8_t sampleTime = 0;
+	while (sampleTime < 7 && adcSampleTimes[sampleTime + 1] + 25 <= adcCycles2)
+		++sampleTime;
+
+	// ADC1 converts on the trigger of TIM3. In dual mode ADC2 is started by ADC1 (its own trigger is set to software
+	// start, reference manual: 11.9 Dual ADC mode) and ADC1 gets both results in its data register
+	adcSetupPin(config->channel);
+	adc_set_dual_mode(config->dual ? ADC_CR1_DUALMOD_RSM : ADC_CR1_DUALMOD_IND);
+	adcSetup(ADC1, config->channel, sampleTime, ADC_CR2_EXTSEL_TIM3_TRGO);
+	if (config->dual) {
+		adcSetupPin(config->channel2);
+		adcSetup(ADC2, config->channel2, sampleTime, ADC_CR2_EXTSEL_SWSTART);
+	}
+	adc_enable_dma(ADC1);
+
+	// dma channel 1 is connected to ADC1, circular over both blocks with an interrupt at the end of each block (the
+	// addresses are 32 bit on the target, uintptr_t keeps them intact in the simulator)
+	dma_channel_reset(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL1, (uintptr_t)&ADC_DR(ADC1));
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, (uintptr_t)adcBuffer);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+	if (config->dual) {
+		adcTransfers = ADC_BLOCK_SIZE * 2 / 4;
+		dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_32BIT);
+		dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_32BIT);
+	} else {
+		adcTransfers = ADC_BLOCK_SIZE * 2 / 2;
+		dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
+		dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
+	}
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1, adcTransfers);
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL1);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
+
+	// the dma interrupt has the same priority as the usb interrupts, therefore they do not preempt each other
+	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+
+	// TIM3 runs at 72 MHz and triggers a conversion on each update
+	rcc_periph_reset_pulse(RST_TIM3);
+	timer_set_prescaler(TIM3, 0);
+	timer_set_period(TIM3, period - 1);
+	timer_set_master_mode(TIM3, TIM_CR2_MMS_UPDATE);
+	timer_enable_counter(TIM3);
+}
+
+void adcStop(void) {
+	timer_disable_counter(TIM3);
+	dma_disable_channel(DMA1, DMA_CHANNEL1);
+	nvic_disable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+	adc_power_off(ADC1);
+	adc_power_off(ADC2);
+	adcReady = NULL;
+}
+
+void dma1_channel1_isr(void) {
+	// the first block is full at half transfer, the second one at transfer complete
+	bool half = dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_HTIF);
+	bool complete = dma_get_interrupt_flag(DMA1, DMA_CHANNEL1, DMA_TCIF);
+	dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_HTIF | DMA_TCIF);
+	if (adcReady == NULL)
+		return;
+	const uint8_t *first = (const uint8_t *)adcBuffer;
+	const uint8_t *second = (const uint8_t *)adcBuffer + ADC_BLOCK_SIZE;
+	if (half && complete) {
+		// the interrupt is late by a block: dma already overwrites the older block, which is reported as dropped,
+		// the newer one is the block that dma does not write
+		bool writingFirst = dma_get_number_of_data(DMA1, DMA_CHANNEL1) > adcTransfers / 2;
+		adcReady(NULL);
+		adcReady(writingFirst ? second : first);
+	} else if (half) {
+		adcReady(first);
+	} else if (complete) {
+		adcReady(second);
+	}
+}
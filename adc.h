@@ -0,0 +1,21 @@
+#pragma once
+
+// timer triggered sampling of ADC1 (and ADC2 in dual mode) into a circular dma buffer of two blocks
+
+#include <stdbool.h>
+#include "protocol.h"
+
+
+// called from the dma interrupt when a block of ADC_BLOCK_SIZE bytes was filled. The block stays valid until the
+// other block is filled, then dma starts to overwrite it. NULL stands for a block that dma overwrote before the
+// interrupt was handled
+typedef void (*AdcBlockReady)(const uint8_t *block);
+
+// returns true if the configuration is supported
+bool adcCheckConfig(const struct AdcConfig *config);
+
+// start sampling, ready gets called for each filled block
+void adcStart(const struct AdcConfig *config, AdcBlockReady ready);
+
+// stop sampling, ready does not get called any more
+void adcStop(void);
@@ -0,0 +1,49 @@
+#include <string.h>
+#include "codec.h"
+
+
+int codecEncode(const uint16_t *samples, int count, int stride, uint8_t *data, int size) {
+	// reference samples (little endian), their deltas in the first group are 0
+	int offset = 0;
+	for (int i = 0; i < stride; ++i) {
+		data[offset++] = samples[i];
+		data[offset++] = samples[i] >> 8;
+	}
+
+	int index = 0;
+	while (index < count) {
+		// zigzag encoded deltas and the width of the largest one
+		uint32_t values[CODEC_GROUP_SIZE];
+		uint32_t bits = 0;
+		for (int i = 0; i < CODEC_GROUP_SIZE; ++i) {
+			int j = index + i;
+			int32_t delta = (int32_t)samples[j] - (int32_t)samples[j < stride ? j : j - stride];
+			uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+			values[i] = value;
+			bits |= value;
+		}
+		int width = bits == 0 ? 0 : 32 - __builtin_clz(bits);
+		if (offset + 1 + width * 2 > size)
+			break;
+
+		// pack least significant bit first, CODEC_GROUP_SIZE values always end on a byte boundary
+		data[offset++] = width;
+		uint32_t accumulator = 0;
+		int n = 0;
+		for (int i = 0; i < CODEC_GROUP_SIZE; ++i) {
+			accumulator |= values[i] << n;
+			n += width;
+			while (n >= 8) {
+				data[offset++] = accumulator;
+				accumulator >>= 8;
+				n -= 8;
+			}
+		}
+		index += CODEC_GROUP_SIZE;
+	}
+
+	// end marker, the rest is ignored by the decoder
+	if (offset < size)
+		memset(data + offset, CODEC_END, size - offset);
+	return index;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// delta and bit packing of adc samples (see compressed adc stream in protocol.h)
+
+#include <stdint.h>
+#include "protocol.h"
+
+
+// encode samples into the payload of a packet of the compressed adc stream, stride is 2 for the interleaved samples
+// of the dual mode and 1 otherwise. Groups are added while they fit into size bytes, the rest gets filled with
+// CODEC_END. count has to be a multiple of CODEC_GROUP_SIZE. Returns the number of encoded samples, a multiple of
+// CODEC_GROUP_SIZE
+int codecEncode(const uint16_t *samples, int count, int stride, uint8_t *data, int size);
@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <libopencm3/stm32/crc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/rcc.h>
+#include "crc.h"
+
+
+void crcStart(const void *data, int size) {
+	rcc_periph_clock_enable(RCC_CRC);
+	rcc_periph_clock_enable(RCC_DMA1);
+	crc_reset();
+
+	// dma channel 2 copies the words of the block to the data register of the crc unit. It has the same (low)
+	// priority as the adc on channel 1 which wins the arbitration because of its lower channel number, therefore the
+	// crc does not delay the samples (the addresses are 32 bit on the target, uintptr_t keeps them intact in the
+	// simulator)
+	dma_channel_reset(DMA1, DMA_CHANNEL2);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL2, (uintptr_t)&CRC_DR);
+	dma_set_memory_address(DMA1, DMA_CHANNEL2, (uintptr_t)data);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL2, size / 4);
+	dma_set_read_from_memory(DMA1, DMA_CHANNEL2);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL2);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL2, DMA_CCR_PSIZE_32BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL2, DMA_CCR_MSIZE_32BIT);
+	dma_enable_mem2mem_mode(DMA1, DMA_CHANNEL2);
+	dma_enable_channel(DMA1, DMA_CHANNEL2);
+}
+
+uint32_t crcResult(void) {
+	// a block of ADC_BLOCK_SIZE bytes takes about 1000 cycles, much less than sending its packets, therefore this
+	// usually does not wait
+	while (!dma_get_interrupt_flag(DMA1, DMA_CHANNEL2, DMA_TCIF))
+		;
+	dma_disable_channel(DMA1, DMA_CHANNEL2);
+	return CRC_DR;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// crc unit fed by memory to memory dma, calculates the crc of a block in the background (see block crc in
+// protocol.h)
+
+#include <stdint.h>
+
+
+// start to calculate the crc of a block, size is a multiple of 4. The block has to stay valid until crcResult()
+void crcStart(const void *data, int size);
+
+// wait until dma has fed the whole block to the crc unit and return the crc
+uint32_t crcResult(void);
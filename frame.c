@@ -0,0 +1,89 @@
+#include <string.h>
+#include "frame.h"
+
+
+// writer
+
+void frameWriterInit(struct FrameWriter *writer) {
+	writer->size = 0;
+	writer->sequence = 0;
+}
+
+bool frameFits(const struct FrameWriter *writer, int length) {
+	int size = writer->size == 0 ? (int)sizeof(struct FrameHeader) : writer->size;
+	return size + (int)sizeof(struct MessageHeader) + length <= FRAME_PACKET_SIZE;
+}
+
+bool frameWrite(struct FrameWriter *writer, int type, const void *data, int length) {
+	if (!frameFits(writer, length))
+		return false;
+	int size = writer->size;
+	if (size == 0) {
+		// start a new packet with the frame header (little endian)
+		writer->packet[0] = writer->sequence;
+		writer->packet[1] = writer->sequence >> 8;
+		size = sizeof(struct FrameHeader);
+	}
+	writer->packet[size] = type;
+	writer->packet[size + 1] = length;
+	memcpy(writer->packet + size + sizeof(struct MessageHeader), data, length);
+	writer->size = size + sizeof(struct MessageHeader) + length;
+	return true;
+}
+
+int frameFinish(struct FrameWriter *writer, bool pad) {
+	int size = writer->size;
+	if (pad && size < FRAME_PACKET_SIZE) {
+		// the rest of the packet is ignored by the receiver
+		writer->packet[size] = MESSAGE_PADDING;
+		size = FRAME_PACKET_SIZE;
+	}
+	writer->size = 0;
+	++writer->sequence;
+	return size;
+}
+
+
+// reader
+
+void frameReaderInit(struct FrameReader *reader) {
+	reader->packet = NULL;
+	reader->size = 0;
+	reader->offset = 0;
+	reader->sequence = 0;
+	reader->lost = 0;
+}
+
+void frameReadPacket(struct FrameReader *reader, const uint8_t *packet, int size) {
+	reader->packet = packet;
+	reader->size = size;
+	reader->offset = size;
+	if (size < (int)sizeof(struct FrameHeader))
+		return;
+
+	// count the packets that were skipped
+	uint16_t sequence = packet[0] | (packet[1] << 8);
+	reader->lost += (uint16_t)(sequence - reader->sequence);
+	reader->sequence = sequence + 1;
+	reader->offset = sizeof(struct FrameHeader);
+}
+
+int frameRead(struct FrameReader *reader, const uint8_t **data, int *length) {
+	int offset = reader->offset;
+	if (offset + (int)sizeof(struct MessageHeader) > reader->size || reader->packet[offset] == MESSAGE_PADDING) {
+		reader->offset = reader->size;
+		return -1;
+	}
+	int type = reader->packet[offset];
+	int l = reader->packet[offset + 1];
+	offset += sizeof(struct MessageHeader);
+	if (offset + l > reader->size) {
+		// truncated message
+		reader->offset = reader->size;
+		return -1;
+	}
+	*data = reader->packet + offset;
+	*length = l;
+	reader->offset = offset + l;
+	return type;
+}
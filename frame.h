@@ -0,0 +1,57 @@
+#pragma once
+
+// packing of messages into framed packets and unpacking of received framed packets (see framing in protocol.h)
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "protocol.h"
+
+
+// packet that gets filled with messages
+struct FrameWriter {
+	uint8_t packet[FRAME_PACKET_SIZE];
+
+	// size of the packet, 0 if it contains no messages
+	int size;
+
+	// sequence number of the next packet
+	uint16_t sequence;
+};
+
+// reset the writer, sequence numbers start at 0
+void frameWriterInit(struct FrameWriter *writer);
+
+// add a message to the packet, returns false if it does not fit
+bool frameWrite(struct FrameWriter *writer, int type, const void *data, int length);
+
+// returns true if a message with the given payload length fits into the packet
+bool frameFits(const struct FrameWriter *writer, int length);
+
+// finish the packet and return its size, optionally padded to FRAME_PACKET_SIZE so that the transfer continues. The
+// packet stays valid until the next message gets added
+int frameFinish(struct FrameWriter *writer, bool pad);
+
+
+// received packet whose messages are read one after the other
+struct FrameReader {
+	const uint8_t *packet;
+	int size;
+
+	// offset of the next message, size if there are no more messages
+	int offset;
+
+	// expected sequence number of the next packet
+	uint16_t sequence;
+
+	// number of lost packets, detected by gaps in the sequence numbers
+	uint32_t lost;
+};
+
+// reset the reader, the first packet is expected to have sequence number 0
+void frameReaderInit(struct FrameReader *reader);
+
+// start reading a received packet, the packet has to stay valid until all messages are read
+void frameReadPacket(struct FrameReader *reader, const uint8_t *packet, int size);
+
+// get the next message, returns the message type or -1 if the packet contains no more messages
+int frameRead(struct FrameReader *reader, const uint8_t **data, int *length);
@@ -0,0 +1,65 @@
+#include "BufferPool.hpp"
+#include <stdlib.h>
+#include <unistd.h>
+
+
+BufferPool::BufferPool(libusb_device_handle *handle, int size)
+	: allocations(0), deviceAllocations(0), reuses(0)
+	, handle(handle), size(size)
+{
+}
+
+BufferPool::~BufferPool() {
+	for (Buffer &buffer : this->buffers) {
+#if LIBUSB_API_VERSION >= 0x01000105
+		if (buffer.device) {
+			libusb_dev_mem_free(this->handle, buffer.data, this->size);
+			continue;
+		}
+#endif
+		free(buffer.data);
+	}
+}
+
+uint8_t *BufferPool::allocate() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	if (!this->freeList.empty()) {
+		uint8_t *data = this->freeList.back();
+		this->freeList.pop_back();
+		++this->reuses;
+		return data;
+	}
+
+	Buffer buffer = {nullptr, false};
+#if LIBUSB_API_VERSION >= 0x01000105
+	// device memory, fails if the platform or kernel does not support it
+	buffer.data = libusb_dev_mem_alloc(this->handle, this->size);
+	buffer.device = buffer.data != nullptr;
+#endif
+	if (buffer.data == nullptr) {
+		// page aligned so that the kernel can map the buffer for dma
+		void *data;
+		if (posix_memalign(&data, sysconf(_SC_PAGESIZE), this->size) != 0)
+			return nullptr;
+		buffer.data = static_cast<uint8_t *>(data);
+	}
+	this->buffers.push_back(buffer);
+	++this->allocations;
+	if (buffer.device)
+		++this->deviceAllocations;
+	return buffer.data;
+}
+
+void BufferPool::release(uint8_t *buffer) {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->freeList.push_back(buffer);
+}
+
+bool BufferPool::isDeviceMemory(uint8_t const *buffer) {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	for (Buffer const &b : this->buffers) {
+		if (b.data == buffer)
+			return b.device;
+	}
+	return false;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <libusb.h>
+
+
+/**
+	Pool of transfer buffers of equal size. Buffers are allocated in device memory using libusb_dev_mem_alloc() where
+	supported (mmap of usbfs on linux) so that the kernel transfers the data without copying it from and to user
+	space. Otherwise page aligned memory gets allocated. Released buffers are kept in a free list, therefore
+	streaming does not allocate memory once all buffers are in use
+*/
+class BufferPool {
+public:
+	/**
+		Constructor
+		@param handle handle of opened device, device memory is bound to it
+		@param size size of each buffer in bytes
+	*/
+	BufferPool(libusb_device_handle *handle, int size);
+	~BufferPool();
+
+	BufferPool(BufferPool const &) = delete;
+	BufferPool &operator =(BufferPool const &) = delete;
+
+	/**
+		Get a buffer from the free list or allocate a new one
+		@return buffer or nullptr if out of memory
+	*/
+	uint8_t *allocate();
+
+	/**
+		Return a buffer to the free list
+	*/
+	void release(uint8_t *buffer);
+
+	/**
+		Returns true if the buffer is in device memory, i.e. the kernel does not copy its data
+	*/
+	bool isDeviceMemory(uint8_t const *buffer);
+
+	int getSize() {return this->size;}
+
+	// statistics
+	std::atomic<uint64_t> allocations; // buffers allocated from the system
+	std::atomic<uint64_t> deviceAllocations; // of which in device memory
+	std::atomic<uint64_t> reuses; // buffers taken from the free list
+
+protected:
+	struct Buffer {
+		uint8_t *data;
+		bool device;
+	};
+
+	libusb_device_handle *handle;
+	int size;
+
+	std::mutex mutex;
+	std::vector<Buffer> buffers;
+	std::vector<uint8_t *> freeList;
+};
@@ -0,0 +1,317 @@
+#include "Codec.hpp"
+#include <algorithm>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CODEC_X86
+#endif
+
+
+namespace {
+
+// decodes a group of CODEC_GROUP_SIZE samples of the given width, previous points to the last samples of each adc
+typedef void (*DecodeGroup)(const uint8_t *data, int width, const int16_t *previous, int16_t *samples);
+
+// decodes the groups of a packet, data is padded so that vectors can be loaded behind the end of the payload
+typedef int (*DecodePacket)(const uint8_t *data, int size, int16_t *samples);
+
+// converts samples to float, count is a multiple of CODEC_GROUP_SIZE
+typedef void (*Convert)(const int16_t *samples, int count, float *values, float scale);
+
+// space behind the payload for loads of whole vectors
+constexpr int PADDING = 64;
+
+// inlined into the functions of each instruction set, so that the groups get decoded without a call
+template <int Stride, DecodeGroup Group>
+inline __attribute__((always_inline)) int decodePacket(const uint8_t *data, int size, int16_t *samples) {
+	int16_t reference[Stride];
+	for (int i = 0; i < Stride; ++i)
+		reference[i] = int16_t(data[i * 2] | data[i * 2 + 1] << 8);
+
+	int offset = Stride * 2;
+	if (offset > size)
+		return -1;
+	const int16_t *previous = reference;
+	int count = 0;
+	while (offset < size) {
+		int width = data[offset];
+		if (width == CODEC_END)
+			break;
+		if (width > CODEC_MAX_WIDTH || offset + 1 + width * 2 > size || count + CODEC_GROUP_SIZE > CODEC_MAX_SAMPLES)
+			return -1;
+		Group(data + offset + 1, width, previous, samples + count);
+		offset += 1 + width * 2;
+		count += CODEC_GROUP_SIZE;
+		previous = samples + count - Stride;
+	}
+	return count;
+}
+
+
+// scalar
+
+template <int Stride>
+inline void decodeGroupScalar(const uint8_t *data, int width, const int16_t *previous, int16_t *samples) {
+	uint32_t mask = (1u << width) - 1;
+	for (int i = 0; i < CODEC_GROUP_SIZE; ++i) {
+		// a value spans up to 3 bytes
+		int bit = i * width;
+		const uint8_t *d = data + (bit >> 3);
+		uint32_t value = ((d[0] | d[1] << 8 | d[2] << 16) >> (bit & 7)) & mask;
+		int delta = int(value >> 1) ^ -int(value & 1);
+		samples[i] = int16_t((i < Stride ? previous[i] : samples[i - Stride]) + delta);
+	}
+}
+
+template <int Stride>
+int decodePacketScalar(const uint8_t *data, int size, int16_t *samples) {
+	return decodePacket<Stride, decodeGroupScalar<Stride>>(data, size, samples);
+}
+
+void convertScalar(const int16_t *samples, int count, float *values, float scale) {
+	for (int i = 0; i < count; ++i)
+		values[i] = float(samples[i]) * scale;
+}
+
+
+#ifdef CODEC_X86
+
+/*
+	Tables for unpacking with pshufb: the values are unpacked as 4 quads of 4 values. A quad is loaded from the byte
+	that contains its first bit, the shuffle mask gathers the 3 bytes of each value into a 32 bit lane, then the lane
+	gets shifted right by the bit offset of the value
+*/
+struct Tables {
+	// byte offset of each quad
+	int offsets[CODEC_MAX_WIDTH + 1][4];
+
+	// shuffle mask of each quad
+	alignas(32) uint8_t shuffles[CODEC_MAX_WIDTH + 1][4][16];
+
+	// right shift of each value (AVX2) and multiplier that shifts left by 8 - shift (SSE4.1 has no variable shift)
+	alignas(32) uint32_t shifts[CODEC_MAX_WIDTH + 1][4][4];
+	alignas(32) uint32_t multipliers[CODEC_MAX_WIDTH + 1][4][4];
+
+	Tables() {
+		for (int width = 0; width <= CODEC_MAX_WIDTH; ++width) {
+			for (int quad = 0; quad < 4; ++quad) {
+				int offset = quad * 4 * width >> 3;
+				this->offsets[width][quad] = offset;
+				for (int lane = 0; lane < 4; ++lane) {
+					int bit = (quad * 4 + lane) * width - offset * 8;
+					for (int i = 0; i < 4; ++i)
+						this->shuffles[width][quad][lane * 4 + i] = i < 3 ? uint8_t((bit >> 3) + i) : 0x80;
+					this->shifts[width][quad][lane] = bit & 7;
+					this->multipliers[width][quad][lane] = 1u << (8 - (bit & 7));
+				}
+			}
+		}
+	}
+};
+const Tables tables;
+
+// shuffle masks that broadcast the last sample (Stride 1) or the last two samples (Stride 2) of a vector
+template <int Stride>
+struct Broadcast;
+template <>
+struct Broadcast<1> {
+	static __attribute__((target("sse4.1"))) __m128i mask() {
+		return _mm_set_epi8(15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14, 15, 14);
+	}
+	static __attribute__((target("sse4.1"))) __m128i load(const int16_t *previous) {
+		return _mm_set1_epi16(previous[0]);
+	}
+};
+template <>
+struct Broadcast<2> {
+	static __attribute__((target("sse4.1"))) __m128i mask() {
+		return _mm_set_epi8(15, 14, 13, 12, 15, 14, 13, 12, 15, 14, 13, 12, 15, 14, 13, 12);
+	}
+	static __attribute__((target("sse4.1"))) __m128i load(const int16_t *previous) {
+		return _mm_set1_epi32(int32_t(uint16_t(previous[0]) | uint32_t(uint16_t(previous[1])) << 16));
+	}
+};
+
+
+// SSE4.1
+
+// unpack a quad of values and undo the zigzag encoding
+__attribute__((target("sse4.1")))
+inline __m128i unpackSse4(const uint8_t *data, int width, int quad, __m128i mask) {
+	__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + tables.offsets[width][quad]));
+	v = _mm_shuffle_epi8(v, _mm_load_si128(reinterpret_cast<const __m128i *>(tables.shuffles[width][quad])));
+	v = _mm_mullo_epi32(v, _mm_load_si128(reinterpret_cast<const __m128i *>(tables.multipliers[width][quad])));
+	v = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+	return _mm_xor_si128(_mm_srli_epi32(v, 1),
+		_mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, _mm_set1_epi32(1))));
+}
+
+// prefix sum of 8 deltas with the samples of the same adc Stride lanes apart
+template <int Stride>
+__attribute__((target("sse4.1")))
+inline __m128i prefixSumSse4(__m128i x) {
+	x = _mm_add_epi16(x, _mm_slli_si128(x, 2 * Stride));
+	x = _mm_add_epi16(x, _mm_slli_si128(x, 4 * Stride));
+	if (Stride == 1)
+		x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+	return x;
+}
+
+template <int Stride>
+__attribute__((target("sse4.1")))
+inline void decodeGroupSse4(const uint8_t *data, int width, const int16_t *previous, int16_t *samples) {
+	__m128i mask = _mm_set1_epi32((1 << width) - 1);
+	__m128i lo = _mm_packs_epi32(unpackSse4(data, width, 0, mask), unpackSse4(data, width, 1, mask));
+	__m128i hi = _mm_packs_epi32(unpackSse4(data, width, 2, mask), unpackSse4(data, width, 3, mask));
+	lo = _mm_add_epi16(prefixSumSse4<Stride>(lo), Broadcast<Stride>::load(previous));
+	hi = _mm_add_epi16(prefixSumSse4<Stride>(hi), _mm_shuffle_epi8(lo, Broadcast<Stride>::mask()));
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(samples), lo);
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(samples + 8), hi);
+}
+
+template <int Stride>
+__attribute__((target("sse4.1")))
+int decodePacketSse4(const uint8_t *data, int size, int16_t *samples) {
+	return decodePacket<Stride, decodeGroupSse4<Stride>>(data, size, samples);
+}
+
+__attribute__((target("sse4.1")))
+void convertSse4(const int16_t *samples, int count, float *values, float scale) {
+	__m128 s = _mm_set1_ps(scale);
+	for (int i = 0; i < count; i += 4) {
+		__m128i v = _mm_cvtepi16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(samples + i)));
+		_mm_storeu_ps(values + i, _mm_mul_ps(_mm_cvtepi32_ps(v), s));
+	}
+}
+
+
+// AVX2
+
+// unpack two quads of values (one in each 128 bit lane) and undo the zigzag encoding
+__attribute__((target("avx2")))
+inline __m256i unpackAvx2(const uint8_t *data, int width, int quad, __m256i mask) {
+	const int *offsets = tables.offsets[width];
+	__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(
+		_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offsets[quad]))),
+		_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + offsets[quad + 1])), 1);
+	v = _mm256_shuffle_epi8(v, _mm256_load_si256(reinterpret_cast<const __m256i *>(tables.shuffles[width][quad])));
+	v = _mm256_srlv_epi32(v, _mm256_load_si256(reinterpret_cast<const __m256i *>(tables.shifts[width][quad])));
+	v = _mm256_and_si256(v, mask);
+	return _mm256_xor_si256(_mm256_srli_epi32(v, 1),
+		_mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(v, _mm256_set1_epi32(1))));
+}
+
+template <int Stride>
+__attribute__((target("avx2")))
+inline void decodeGroupAvx2(const uint8_t *data, int width, const int16_t *previous, int16_t *samples) {
+	__m256i mask = _mm256_set1_epi32((1 << width) - 1);
+
+	// packing interleaves the 64 bit parts of both vectors
+	__m256i x = _mm256_packs_epi32(unpackAvx2(data, width, 0, mask), unpackAvx2(data, width, 2, mask));
+	x = _mm256_permute4x64_epi64(x, 0xd8);
+
+	// prefix sum in each 128 bit lane, then add the sum of the lower lane to the upper lane
+	x = _mm256_add_epi16(x, _mm256_slli_si256(x, 2 * Stride));
+	x = _mm256_add_epi16(x, _mm256_slli_si256(x, 4 * Stride));
+	if (Stride == 1)
+		x = _mm256_add_epi16(x, _mm256_slli_si256(x, 8));
+	__m256i broadcast = _mm256_broadcastsi128_si256(Broadcast<Stride>::mask());
+	__m256i last = _mm256_shuffle_epi8(x, broadcast);
+	x = _mm256_add_epi16(x, _mm256_permute2x128_si256(last, last, 0x08));
+	x = _mm256_add_epi16(x, _mm256_broadcastsi128_si256(Broadcast<Stride>::load(previous)));
+	_mm256_storeu_si256(reinterpret_cast<__m256i *>(samples), x);
+}
+
+template <int Stride>
+__attribute__((target("avx2")))
+int decodePacketAvx2(const uint8_t *data, int size, int16_t *samples) {
+	return decodePacket<Stride, decodeGroupAvx2<Stride>>(data, size, samples);
+}
+
+__attribute__((target("avx2")))
+void convertAvx2(const int16_t *samples, int count, float *values, float scale) {
+	__m256 s = _mm256_set1_ps(scale);
+	for (int i = 0; i < count; i += 8) {
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(samples + i)));
+		_mm256_storeu_ps(values + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), s));
+	}
+}
+
+#endif
+
+DecodePacket getDecodePacket(int stride, SampleDecoder::Isa isa) {
+	switch (isa) {
+#ifdef CODEC_X86
+	case SampleDecoder::AVX2:
+		return stride == 2 ? decodePacketAvx2<2> : decodePacketAvx2<1>;
+	case SampleDecoder::SSE4:
+		return stride == 2 ? decodePacketSse4<2> : decodePacketSse4<1>;
+#endif
+	default:
+		return stride == 2 ? decodePacketScalar<2> : decodePacketScalar<1>;
+	}
+}
+
+Convert getConvert(SampleDecoder::Isa isa) {
+	switch (isa) {
+#ifdef CODEC_X86
+	case SampleDecoder::AVX2:
+		return convertAvx2;
+	case SampleDecoder::SSE4:
+		return convertSse4;
+#endif
+	default:
+		return convertScalar;
+	}
+}
+
+} // namespace
+
+
+SampleDecoder::SampleDecoder(int stride) : SampleDecoder(stride, AVX2) {
+}
+
+SampleDecoder::SampleDecoder(int stride, Isa isa)
+	: stride(stride == 2 ? 2 : 1), isa(std::min(isa, detectIsa()))
+{
+	this->decodePacket = getDecodePacket(this->stride, this->isa);
+	this->convert = getConvert(this->isa);
+}
+
+const char *SampleDecoder::getName(Isa isa) {
+	switch (isa) {
+	case AVX2:
+		return "avx2";
+	case SSE4:
+		return "sse4.1";
+	default:
+		return "scalar";
+	}
+}
+
+SampleDecoder::Isa SampleDecoder::detectIsa() {
+#ifdef CODEC_X86
+	if (__builtin_cpu_supports("avx2"))
+		return AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return SSE4;
+#endif
+	return SCALAR;
+}
+
+int SampleDecoder::decode(const uint8_t *payload, int size, int16_t *samples) const {
+	if (size < 0 || size > ADC_PACKET_DATA)
+		return -1;
+	alignas(32) uint8_t data[ADC_PACKET_DATA + PADDING];
+	memcpy(data, payload, size);
+	memset(data + size, 0, PADDING);
+	return this->decodePacket(data, size, samples);
+}
+
+int SampleDecoder::decode(const uint8_t *payload, int size, float *samples, float scale) const {
+	alignas(32) int16_t values[CODEC_MAX_SAMPLES];
+	int count = decode(payload, size, values);
+	if (count > 0)
+		this->convert(values, count, samples, scale);
+	return count;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include "../protocol.h"
+
+
+/**
+	Decoder of the compressed adc stream (AdcConfig.codec = ADC_CODEC_DELTA, see protocol.h). Each packet is decoded
+	on its own, so that a dropped packet does not affect the following ones. Uses AVX2 or SSE4.1 if the cpu supports
+	it, otherwise a scalar implementation
+*/
+class SampleDecoder {
+public:
+	/**
+		Instruction set of the decoder
+	*/
+	enum Isa {
+		SCALAR,
+		SSE4,
+		AVX2
+	};
+
+	/**
+		Constructor, uses the best instruction set of the cpu
+		@param stride 2 for the interleaved samples of the dual mode, 1 otherwise
+	*/
+	explicit SampleDecoder(int stride = 1);
+
+	/**
+		Constructor with a given instruction set, e.g. for comparison. Falls back to the best supported one
+	*/
+	SampleDecoder(int stride, Isa isa);
+
+	/**
+		Get the instruction set that is used
+	*/
+	Isa getIsa() const {return this->isa;}
+
+	/**
+		Get the name of an instruction set
+	*/
+	static const char *getName(Isa isa);
+
+	/**
+		Get the best instruction set of the cpu
+	*/
+	static Isa detectIsa();
+
+	/**
+		Decode the payload of a packet (behind the StreamHeader)
+		@param payload payload of the packet
+		@param size size of the payload, usually ADC_PACKET_DATA
+		@param samples array of at least CODEC_MAX_SAMPLES samples
+		@return number of samples or -1 if the payload is malformed
+	*/
+	int decode(const uint8_t *payload, int size, int16_t *samples) const;
+
+	/**
+		Decode the payload of a packet and convert the samples to float
+		@param scale factor for the samples, e.g. 3.3f / 4096 for volts
+		@return number of samples or -1 if the payload is malformed
+	*/
+	int decode(const uint8_t *payload, int size, float *samples, float scale = 1.0f) const;
+
+protected:
+	int stride;
+	Isa isa;
+
+	// implementation for the stride and instruction set
+	int (*decodePacket)(const uint8_t *data, int size, int16_t *samples);
+	void (*convert)(const int16_t *samples, int count, float *values, float scale);
+};
@@ -0,0 +1,63 @@
+#include "CommandQueue.hpp"
+#include <cstring>
+
+
+CommandQueue::CommandQueue(Device &device, int count, int transferSize, int flushTimeout)
+	: device(device), writer(device, USB_OUT | 2, transferSize, count, flushTimeout)
+	, reader([this](int type, const uint8_t *data, int length) {
+		if (type == MESSAGE_COMPLETION && length >= int(sizeof(Completion))) {
+			// the payload is not aligned
+			Completion completion;
+			memcpy(&completion, data, sizeof(completion));
+			complete(completion);
+		}
+	})
+	, completions(device.getHandle(), USB_IN | 1, count, transferSize, [this](uint8_t *data, int length) {
+		this->reader.read(data, length);
+		return 0;
+	})
+{
+	this->error = device.vendorOut(VENDOR_SET_MODE, MODE_FRAMED);
+	if (this->error >= 0)
+		this->error = device.vendorOut(VENDOR_SET_FLUSH_TIMEOUT, flushTimeout);
+	if (this->error >= 0)
+		this->error = this->completions.start();
+}
+
+CommandQueue::~CommandQueue() {
+	this->writer.finish();
+	this->completions.stop();
+
+	// commands that did not complete
+	std::unique_lock<std::mutex> lock(this->mutex);
+	for (auto &p : this->pending)
+		p.second.set_value({p.first, COMMAND_INVALID, 0, 0});
+}
+
+std::future<Completion> CommandQueue::submit(CommandOpcode opcode, CommandPort port, uint16_t mask, uint16_t value) {
+	Command command = {this->tag++, uint8_t(opcode), uint8_t(port), mask, value};
+	std::promise<Completion> promise;
+	std::future<Completion> future = promise.get_future();
+	{
+		// register before sending, the completion may arrive before write() returns
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->pending[command.tag] = std::move(promise);
+	}
+	if (this->error < 0 || this->writer.write(MESSAGE_COMMAND, &command, sizeof(command)) < 0)
+		complete({command.tag, COMMAND_INVALID, 0, 0});
+	return future;
+}
+
+size_t CommandQueue::getPending() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	return this->pending.size();
+}
+
+void CommandQueue::complete(Completion const &completion) {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	auto it = this->pending.find(completion.tag);
+	if (it == this->pending.end())
+		return;
+	it->second.set_value(completion);
+	this->pending.erase(it);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <map>
+#include <mutex>
+#include "Device.hpp"
+#include "Framing.hpp"
+#include "Pipeline.hpp"
+
+
+/**
+	Sends tagged commands to a device in framed mode (see MESSAGE_COMMAND in protocol.h) without waiting for the
+	previous ones to complete. The device executes them in order and returns the completions in batches, each
+	command gets a future that is set by the event thread when its completion arrives. Commands are collected into
+	transfers, call flush() after a batch of commands or update() periodically so that they get sent.
+	submit() and flush() must be called from one thread
+*/
+class CommandQueue {
+public:
+	/**
+		Constructor, switches the device into framed mode
+		@param device opened device
+		@param count number of transfers in flight per direction
+		@param transferSize size of each transfer, a multiple of FRAME_PACKET_SIZE
+		@param flushTimeout flush timeout in milliseconds on host and device
+	*/
+	CommandQueue(Device &device, int count = 4, int transferSize = 16 * FRAME_PACKET_SIZE, int flushTimeout = 1);
+
+	/**
+		Cancels the futures of pending commands
+	*/
+	~CommandQueue();
+
+	CommandQueue(CommandQueue const &) = delete;
+	CommandQueue &operator =(CommandQueue const &) = delete;
+
+	/**
+		Returns LIBUSB_SUCCESS if the device was switched into framed mode and the completions get received
+	*/
+	int getError() const {return this->error;}
+
+	/**
+		Queue a command, the tag gets assigned by the queue
+		@return future for the completion, gets a completion with status COMMAND_INVALID if the command could not be
+		sent or the queue was destroyed
+	*/
+	std::future<Completion> submit(CommandOpcode opcode, CommandPort port, uint16_t mask, uint16_t value = 0);
+
+	/**
+		Configure pins, see COMMAND_GPIO_MODE
+	*/
+	std::future<Completion> gpioMode(CommandPort port, uint16_t mask, uint16_t mode) {
+		return submit(COMMAND_GPIO_MODE, port, mask, mode);
+	}
+
+	/**
+		Set pins, see COMMAND_GPIO_WRITE
+	*/
+	std::future<Completion> gpioWrite(CommandPort port, uint16_t mask, uint16_t value) {
+		return submit(COMMAND_GPIO_WRITE, port, mask, value);
+	}
+
+	/**
+		Read pins, see COMMAND_GPIO_READ
+	*/
+	std::future<Completion> gpioRead(CommandPort port, uint16_t mask) {
+		return submit(COMMAND_GPIO_READ, port, mask);
+	}
+
+	/**
+		Send the queued commands
+	*/
+	int flush() {return this->writer.flush();}
+
+	/**
+		Send the queued commands if the flush timeout has elapsed
+	*/
+	int update() {return this->writer.update();}
+
+	/**
+		Get the number of commands whose completion has not arrived yet
+	*/
+	size_t getPending();
+
+protected:
+	void complete(Completion const &completion);
+
+	Device &device;
+	int error;
+	FrameWriter writer;
+
+	// pending commands by tag, accessed by the event thread
+	std::mutex mutex;
+	std::map<uint16_t, std::promise<Completion>> pending;
+	uint16_t tag = 0;
+
+	// completions get received by the event thread
+	FrameReader reader;
+	Pipeline completions;
+};
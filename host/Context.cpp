@@ -0,0 +1,42 @@
+#include "Context.hpp"
+#include <utility>
+
+
+Context::Context() {
+	this->error = libusb_init(&this->context);
+	if (this->error != LIBUSB_SUCCESS) {
+		this->context = nullptr;
+		return;
+	}
+	this->eventThread.reset(new EventThread(this->context));
+}
+
+Context::~Context() {
+	destroy();
+}
+
+Context::Context(Context &&other) noexcept
+	: context(other.context), error(other.error), eventThread(std::move(other.eventThread))
+{
+	other.context = nullptr;
+}
+
+Context &Context::operator =(Context &&other) noexcept {
+	if (this != &other) {
+		destroy();
+		this->context = other.context;
+		this->error = other.error;
+		this->eventThread = std::move(other.eventThread);
+		other.context = nullptr;
+	}
+	return *this;
+}
+
+void Context::destroy() {
+	// stop handling events before the context goes away
+	this->eventThread.reset();
+	if (this->context != nullptr) {
+		libusb_exit(this->context);
+		this->context = nullptr;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <libusb.h>
+#include "EventThread.hpp"
+
+
+/**
+	Owns a libusb context and the thread that handles its events, so that asynchronous transfers of the devices
+	opened in this context complete without the application having to poll. Move-only, all devices of the context
+	have to be closed before it gets destroyed
+*/
+class Context {
+public:
+	/**
+		Initialize libusb and start the event thread, check isValid() for success
+	*/
+	Context();
+	~Context();
+
+	Context(Context &&other) noexcept;
+	Context &operator =(Context &&other) noexcept;
+	Context(Context const &) = delete;
+	Context &operator =(Context const &) = delete;
+
+	/**
+		Returns true if libusb was initialized successfully
+	*/
+	bool isValid() const {return this->context != nullptr;}
+
+	/**
+		Returns the error code of libusb_init()
+	*/
+	int getError() const {return this->error;}
+
+	/**
+		Get the libusb context for direct use of the libusb api
+	*/
+	libusb_context *get() const {return this->context;}
+
+protected:
+	void destroy();
+
+	libusb_context *context = nullptr;
+	int error = LIBUSB_SUCCESS;
+	std::unique_ptr<EventThread> eventThread;
+};
@@ -0,0 +1,185 @@
+#include "Crc.hpp"
+#include <algorithm>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_X86
+#endif
+
+
+namespace {
+
+// x^n mod P
+uint32_t powerMod(int n) {
+	uint32_t r = 1;
+	for (int i = 0; i < n; ++i)
+		r = r & 0x80000000 ? r << 1 ^ STREAM_CRC_POLYNOMIAL : r << 1;
+	return r;
+}
+
+/*
+	Tables of slicing-by-8 and constants of the folding with carry-less multiplication. The crc is calculated most
+	significant bit first, slices[k][b] is the crc of byte b followed by k zero bytes
+*/
+struct Tables {
+	uint32_t slices[8][256];
+
+	// x^n mod P for folding by 512 and 128 bits and for the final multiplication by x^32
+	uint64_t x576, x512, x192, x128, x96, x64;
+
+	// floor(x^64 / P) and P with its x^32 term for the barrett reduction
+	uint64_t mu, polynomial;
+
+	Tables() {
+		for (int b = 0; b < 256; ++b) {
+			uint32_t crc = uint32_t(b) << 24;
+			for (int i = 0; i < 8; ++i)
+				crc = crc & 0x80000000 ? crc << 1 ^ STREAM_CRC_POLYNOMIAL : crc << 1;
+			this->slices[0][b] = crc;
+		}
+		for (int k = 1; k < 8; ++k) {
+			for (int b = 0; b < 256; ++b) {
+				uint32_t crc = this->slices[k - 1][b];
+				this->slices[k][b] = crc << 8 ^ this->slices[0][crc >> 24];
+			}
+		}
+
+		this->x576 = powerMod(576);
+		this->x512 = powerMod(512);
+		this->x192 = powerMod(192);
+		this->x128 = powerMod(128);
+		this->x96 = powerMod(96);
+		this->x64 = powerMod(64);
+
+		// long division of x^64 by P, the remainder has up to 33 bits
+		this->polynomial = 0x100000000ull | STREAM_CRC_POLYNOMIAL;
+		uint64_t r = 0;
+		this->mu = 0;
+		for (int bit = 64; bit >= 0; --bit) {
+			r = r << 1 | (bit == 64 ? 1 : 0);
+			if (r & 0x100000000ull) {
+				this->mu |= 1ull << bit;
+				r ^= this->polynomial;
+			}
+		}
+	}
+};
+const Tables tables;
+
+
+// slicing-by-8, the words are loaded in the byte order of the host which has to be little endian like the STM32
+
+uint32_t updateScalar(uint32_t crc, const uint8_t *data, int size) {
+	const uint32_t (*t)[256] = tables.slices;
+	int i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint32_t a;
+		uint32_t b;
+		memcpy(&a, data + i, 4);
+		memcpy(&b, data + i + 4, 4);
+		a ^= crc;
+		crc = t[7][a >> 24] ^ t[6][a >> 16 & 0xff] ^ t[5][a >> 8 & 0xff] ^ t[4][a & 0xff]
+			^ t[3][b >> 24] ^ t[2][b >> 16 & 0xff] ^ t[1][b >> 8 & 0xff] ^ t[0][b & 0xff];
+	}
+	if (i + 4 <= size) {
+		uint32_t a;
+		memcpy(&a, data + i, 4);
+		a ^= crc;
+		crc = t[3][a >> 24] ^ t[2][a >> 16 & 0xff] ^ t[1][a >> 8 & 0xff] ^ t[0][a & 0xff];
+	}
+	return crc;
+}
+
+
+#ifdef CRC_X86
+
+/*
+	Folding with carry-less multiplication (Intel: Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+	Instruction). A vector holds 128 bits of the message with the first bit in bit 127, reversing the order of the
+	32 bit words of a load does this for the little endian words of the crc unit
+*/
+
+__attribute__((target("pclmul"))) inline __m128i load(const uint8_t *data) {
+	return _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data)), 0x1b);
+}
+
+// multiply by x^n: k holds x^(n + 64) mod P in the upper and x^n mod P in the lower half
+__attribute__((target("pclmul"))) inline __m128i fold(__m128i x, __m128i k) {
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00));
+}
+
+__attribute__((target("pclmul"))) uint32_t updatePclmul(uint32_t crc, const uint8_t *data, int size) {
+	if (size < 64)
+		return updateScalar(crc, data, size);
+
+	// four independent folds by 512 bits, the initial value gets added to the first word
+	const __m128i k512 = _mm_set_epi64x(tables.x576, tables.x512);
+	__m128i x0 = _mm_xor_si128(load(data), _mm_set_epi32(int(crc), 0, 0, 0));
+	__m128i x1 = load(data + 16);
+	__m128i x2 = load(data + 32);
+	__m128i x3 = load(data + 48);
+	int i = 64;
+	for (; i + 64 <= size; i += 64) {
+		x0 = _mm_xor_si128(fold(x0, k512), load(data + i));
+		x1 = _mm_xor_si128(fold(x1, k512), load(data + i + 16));
+		x2 = _mm_xor_si128(fold(x2, k512), load(data + i + 32));
+		x3 = _mm_xor_si128(fold(x3, k512), load(data + i + 48));
+	}
+
+	// combine them and fold the remaining vectors by 128 bits
+	const __m128i k128 = _mm_set_epi64x(tables.x192, tables.x128);
+	__m128i x = _mm_xor_si128(fold(x0, k128), x1);
+	x = _mm_xor_si128(fold(x, k128), x2);
+	x = _mm_xor_si128(fold(x, k128), x3);
+	for (; i + 16 <= size; i += 16)
+		x = _mm_xor_si128(fold(x, k128), load(data + i));
+
+	// x * x^32 mod P: the upper half times x^96 plus the lower half shifted by 32 bits gives 96 bits, then the upper
+	// 32 bits of them times x^64 plus the lower 64 bits
+	const __m128i k64 = _mm_set_epi64x(tables.x64, tables.x96);
+	__m128i t = _mm_xor_si128(_mm_clmulepi64_si128(x, k64, 0x01), _mm_slli_si128(_mm_move_epi64(x), 4));
+	__m128i v = _mm_xor_si128(_mm_clmulepi64_si128(_mm_srli_si128(t, 8), k64, 0x10), _mm_move_epi64(t));
+
+	// barrett reduction of the 64 bits: q = floor(floor(v / x^32) * mu / x^32), crc = v + q * P
+	const __m128i barrett = _mm_set_epi64x(tables.polynomial, tables.mu);
+	__m128i q = _mm_srli_si128(_mm_clmulepi64_si128(_mm_srli_epi64(v, 32), barrett, 0x00), 4);
+	crc = uint32_t(_mm_cvtsi128_si32(_mm_xor_si128(v, _mm_clmulepi64_si128(q, barrett, 0x10))));
+
+	// remaining words
+	return updateScalar(crc, data + i, size - i);
+}
+
+#endif
+
+} // namespace
+
+
+Crc32::Crc32() : Crc32(PCLMUL) {
+}
+
+Crc32::Crc32(Isa isa) : isa(std::min(isa, detectIsa())) {
+#ifdef CRC_X86
+	if (this->isa == PCLMUL) {
+		this->update = updatePclmul;
+		return;
+	}
+#endif
+	this->update = updateScalar;
+}
+
+const char *Crc32::getName(Isa isa) {
+	switch (isa) {
+	case PCLMUL:
+		return "pclmul";
+	default:
+		return "slicing-by-8";
+	}
+}
+
+Crc32::Isa Crc32::detectIsa() {
+#ifdef CRC_X86
+	if (__builtin_cpu_supports("pclmul"))
+		return PCLMUL;
+#endif
+	return SCALAR;
+}
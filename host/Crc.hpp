@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include "../protocol.h"
+
+
+/**
+	CRC-32 as calculated by the crc unit of the STM32 (see block crc in protocol.h). Uses PCLMULQDQ if the cpu
+	supports it, otherwise slicing-by-8. The data is read as little endian 32 bit words
+*/
+class Crc32 {
+public:
+	/**
+		Instruction set of the implementation
+	*/
+	enum Isa {
+		SCALAR,
+		PCLMUL
+	};
+
+	/**
+		Constructor, uses the best instruction set of the cpu
+	*/
+	Crc32();
+
+	/**
+		Constructor with a given instruction set, e.g. for comparison. Falls back to the best supported one
+	*/
+	explicit Crc32(Isa isa);
+
+	/**
+		Get the instruction set that is used
+	*/
+	Isa getIsa() const {return this->isa;}
+
+	/**
+		Get the name of an instruction set
+	*/
+	static const char *getName(Isa isa);
+
+	/**
+		Get the best instruction set of the cpu
+	*/
+	static Isa detectIsa();
+
+	/**
+		Calculate the crc of data
+		@param data data, does not need to be aligned
+		@param size size of the data, a multiple of 4 because the crc unit processes 32 bit words
+		@param crc initial value or crc of the preceding data
+		@return crc
+	*/
+	uint32_t calculate(const void *data, int size, uint32_t crc = STREAM_CRC_INIT) const {
+		return this->update(crc, static_cast<const uint8_t *>(data), size);
+	}
+
+protected:
+	Isa isa;
+
+	// implementation for the instruction set
+	uint32_t (*update)(uint32_t crc, const uint8_t *data, int size);
+};
@@ -0,0 +1,155 @@
+#include "Device.hpp"
+#include <algorithm>
+
+
+Device::Device(libusb_device_handle *handle) {
+	if (handle != nullptr) {
+		this->state.reset(new State());
+		this->state->handle = handle;
+	}
+}
+
+Device::~Device() {
+	close();
+}
+
+Device &Device::operator =(Device &&other) noexcept {
+	if (this != &other) {
+		close();
+		this->state = std::move(other.state);
+	}
+	return *this;
+}
+
+Device Device::open(Context &context, DeviceFilter const &filter) {
+	return Device(openDevice(context.get(), filter));
+}
+
+Device Device::wait(Context &context, DeviceFilter const &filter, int timeout) {
+	return Device(waitForDevice(context.get(), filter, timeout));
+}
+
+int Device::getMaxPacketSize(uint8_t endpoint) const {
+	if (!this->state)
+		return LIBUSB_ERROR_NO_DEVICE;
+	return libusb_get_max_packet_size(libusb_get_device(this->state->handle), endpoint);
+}
+
+int Device::vendorOut(VendorRequest request, uint16_t value) {
+	if (!this->state)
+		return LIBUSB_ERROR_NO_DEVICE;
+	return ::vendorOut(this->state->handle, request, value);
+}
+
+int Device::vendorOut(VendorRequest request, uint16_t value, const void *data, int size) {
+	if (!this->state)
+		return LIBUSB_ERROR_NO_DEVICE;
+	return ::vendorOut(this->state->handle, request, value, data, size);
+}
+
+int Device::vendorIn(VendorRequest request, uint16_t value, void *data, int size) {
+	if (!this->state)
+		return LIBUSB_ERROR_NO_DEVICE;
+	return ::vendorIn(this->state->handle, request, value, data, size);
+}
+
+std::future<int> Device::read(uint8_t endpoint, void *data, int size, unsigned timeout) {
+	return submit(endpoint, data, size, 0, timeout);
+}
+
+std::future<int> Device::write(uint8_t endpoint, const void *data, int size, bool zeroPacket, unsigned timeout) {
+	// libusb does not modify the data of an out transfer
+	return submit(endpoint, const_cast<void *>(data), size, zeroPacket ? LIBUSB_TRANSFER_ADD_ZERO_PACKET : 0,
+		timeout);
+}
+
+void Device::cancel() {
+	if (!this->state)
+		return;
+	std::unique_lock<std::mutex> lock(this->state->mutex);
+	for (libusb_transfer *transfer : this->state->transfers)
+		libusb_cancel_transfer(transfer);
+}
+
+void Device::close() {
+	if (!this->state)
+		return;
+	cancel();
+
+	// wait until the event thread of the context has called the callbacks of all transfers
+	{
+		std::unique_lock<std::mutex> lock(this->state->mutex);
+		this->state->condition.wait(lock, [this] {return this->state->transfers.empty();});
+	}
+	closeDevice(this->state->handle);
+	this->state.reset();
+}
+
+std::future<int> Device::submit(uint8_t endpoint, void *data, int size, uint8_t flags, unsigned timeout) {
+	Request *request = new Request();
+	std::future<int> future = request->promise.get_future();
+	if (!this->state) {
+		request->promise.set_value(LIBUSB_ERROR_NO_DEVICE);
+		delete request;
+		return future;
+	}
+	request->state = this->state.get();
+
+	libusb_transfer *transfer = libusb_alloc_transfer(0);
+	libusb_fill_bulk_transfer(transfer, this->state->handle, endpoint, static_cast<unsigned char *>(data), size,
+		&Device::callback, request, timeout);
+	transfer->flags = flags;
+
+	// the event thread may call the callback before submit returns, it waits for the lock until the transfer is
+	// registered
+	std::unique_lock<std::mutex> lock(this->state->mutex);
+	int ret = libusb_submit_transfer(transfer);
+	if (ret == LIBUSB_SUCCESS) {
+		this->state->transfers.push_back(transfer);
+	} else {
+		libusb_free_transfer(transfer);
+		request->promise.set_value(ret);
+		delete request;
+	}
+	return future;
+}
+
+void LIBUSB_CALL Device::callback(libusb_transfer *transfer) {
+	Request *request = reinterpret_cast<Request *>(transfer->user_data);
+	State *state = request->state;
+
+	int result;
+	switch (transfer->status) {
+	case LIBUSB_TRANSFER_COMPLETED:
+		result = transfer->actual_length;
+		break;
+	case LIBUSB_TRANSFER_TIMED_OUT:
+		result = LIBUSB_ERROR_TIMEOUT;
+		break;
+	case LIBUSB_TRANSFER_CANCELLED:
+		result = LIBUSB_ERROR_INTERRUPTED;
+		break;
+	case LIBUSB_TRANSFER_STALL:
+		result = LIBUSB_ERROR_PIPE;
+		break;
+	case LIBUSB_TRANSFER_NO_DEVICE:
+		result = LIBUSB_ERROR_NO_DEVICE;
+		break;
+	case LIBUSB_TRANSFER_OVERFLOW:
+		result = LIBUSB_ERROR_OVERFLOW;
+		break;
+	default:
+		result = LIBUSB_ERROR_IO;
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(state->mutex);
+		auto &transfers = state->transfers;
+		transfers.erase(std::find(transfers.begin(), transfers.end(), transfer));
+		if (transfers.empty())
+			state->condition.notify_all();
+	}
+	libusb_free_transfer(transfer);
+	request->promise.set_value(result);
+	delete request;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <libusb.h>
+#include "Context.hpp"
+#include "usb.hpp"
+
+
+/**
+	Opened bluepill device with claimed interface 0. Move-only, the destructor cancels all transfers that are still
+	in flight and closes the device.
+	Transfers are asynchronous and return a future that gets the number of transferred bytes or a libusb error code.
+	The data is not copied, the libusb transfer works directly on the memory of the caller (use a BufferPool for
+	buffers in device memory), therefore it has to stay valid until the future is ready. Any number of transfers can
+	be in flight, e.g. a read can be started before the write whose reply it receives
+*/
+class Device {
+public:
+	/**
+		Construct a device that is not open
+	*/
+	Device() = default;
+
+	/**
+		Take ownership of a device handle with claimed interface 0 (see openDevice()). The context of the handle
+		has to be a Context so that its events get handled
+	*/
+	explicit Device(libusb_device_handle *handle);
+
+	~Device();
+
+	Device(Device &&other) noexcept = default;
+	Device &operator =(Device &&other) noexcept;
+	Device(Device const &) = delete;
+	Device &operator =(Device const &) = delete;
+
+	/**
+		Open the first device that matches the filter
+		@return device, check isOpen() for success
+	*/
+	static Device open(Context &context, DeviceFilter const &filter = DeviceFilter());
+
+	/**
+		Wait until a device that matches the filter is plugged in and open it
+		@param timeout timeout in milliseconds, negative to wait forever
+		@return device, check isOpen() for success
+	*/
+	static Device wait(Context &context, DeviceFilter const &filter, int timeout);
+
+	/**
+		Returns true if the device is open
+	*/
+	bool isOpen() const {return this->state != nullptr;}
+
+	/**
+		Get the libusb device handle for direct use of the libusb api (e.g. Pipeline)
+	*/
+	libusb_device_handle *getHandle() const {return this->state ? this->state->handle : nullptr;}
+
+	/**
+		Get the max packet size of an endpoint
+		@return max packet size or error code
+	*/
+	int getMaxPacketSize(uint8_t endpoint) const;
+
+	/**
+		Send a vendor request without data to the device (synchronous)
+		@return LIBUSB_SUCCESS or error code
+	*/
+	int vendorOut(VendorRequest request, uint16_t value);
+
+	/**
+		Send data using a vendor request (synchronous)
+		@return number of bytes sent or error code
+	*/
+	int vendorOut(VendorRequest request, uint16_t value, const void *data, int size);
+
+	/**
+		Read data using a vendor request (synchronous)
+		@return number of bytes read or error code
+	*/
+	int vendorIn(VendorRequest request, uint16_t value, void *data, int size);
+
+	/**
+		Start a bulk in transfer
+		@param endpoint endpoint address including direction, e.g. USB_IN | 1
+		@param data buffer for the data, has to stay valid until the future is ready
+		@param size size of the buffer, should be a multiple of the max packet size
+		@param timeout timeout in milliseconds, 0 for no timeout
+		@return future for the number of bytes received or error code
+	*/
+	std::future<int> read(uint8_t endpoint, void *data, int size, unsigned timeout = 0);
+
+	/**
+		Start a bulk out transfer
+		@param endpoint endpoint address including direction, e.g. USB_OUT | 2
+		@param data data to send, has to stay valid until the future is ready
+		@param size size of the data
+		@param zeroPacket end a transfer whose size is a multiple of the max packet size with a zero length packet
+		@param timeout timeout in milliseconds, 0 for no timeout
+		@return future for the number of bytes sent or error code
+	*/
+	std::future<int> write(uint8_t endpoint, const void *data, int size, bool zeroPacket = false,
+		unsigned timeout = 0);
+
+	/**
+		Cancel all transfers that are in flight, their futures get LIBUSB_ERROR_INTERRUPTED
+	*/
+	void cancel();
+
+	/**
+		Cancel all transfers, wait until they are back and close the device. Gets called by the destructor
+	*/
+	void close();
+
+protected:
+	struct State {
+		libusb_device_handle *handle;
+
+		// transfers in flight
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::vector<libusb_transfer *> transfers;
+	};
+
+	// transfer in flight, referenced by user_data of the libusb transfer
+	struct Request {
+		State *state;
+		std::promise<int> promise;
+	};
+
+	std::future<int> submit(uint8_t endpoint, void *data, int size, uint8_t flags, unsigned timeout);
+	static void LIBUSB_CALL callback(libusb_transfer *transfer);
+
+	// heap allocated so that the address stays the same when the device gets moved
+	std::unique_ptr<State> state;
+};
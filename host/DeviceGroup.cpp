@@ -0,0 +1,179 @@
+#include "DeviceGroup.hpp"
+#include <algorithm>
+
+
+uint64_t DeviceGroup::Device::getErrors() const {
+	return this->errorsBefore + (this->in ? this->in->errors.load() : 0) + (this->out ? this->out->errors.load() : 0);
+}
+
+DeviceGroup::DeviceGroup(libusb_context *context, DeviceFilter const &filter, Config const &config,
+	HandlerFactory inHandler, HandlerFactory outHandler)
+	: context(context), filter(filter), config(config)
+	, inHandler(std::move(inHandler)), outHandler(std::move(outHandler))
+	, watcher(context, filter, [this](libusb_device *device, bool connected) {
+		// only remember the device, it gets opened or closed by update() in the main thread
+		std::unique_lock<std::mutex> lock(this->mutex);
+		libusb_ref_device(device);
+		(connected ? this->arrived : this->left).push_back(device);
+	})
+{
+}
+
+DeviceGroup::~DeviceGroup() {
+	stop();
+}
+
+void DeviceGroup::start() {
+	// the watcher also reports the devices that are already present
+	this->hotplug = this->watcher.start() == LIBUSB_SUCCESS;
+}
+
+bool DeviceGroup::update() {
+	std::vector<libusb_device *> arrived;
+	std::vector<libusb_device *> left;
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		std::swap(arrived, this->arrived);
+		std::swap(left, this->left);
+	}
+	bool changed = false;
+
+	// close devices that left, or whose pipelines have ended because the device is gone (without hotplug)
+	for (auto it = this->devices.begin(); it != this->devices.end();) {
+		Device &device = **it;
+		bool gone = std::find(left.begin(), left.end(), libusb_get_device(device.handle)) != left.end()
+			|| (!device.in->isActive() && !device.out->isActive());
+		if (gone) {
+			close(device);
+			it = this->devices.erase(it);
+			changed = true;
+		} else {
+			++it;
+		}
+	}
+	for (libusb_device *device : left)
+		libusb_unref_device(device);
+
+	// without hotplug check the device list for devices that are not open yet
+	if (!this->hotplug && int(this->devices.size()) < this->config.maxDevices) {
+		libusb_device **devs;
+		if (libusb_get_device_list(this->context, &devs) >= 0) {
+			for (int i = 0; devs[i]; ++i) {
+				if (matches(devs[i], this->filter))
+					arrived.push_back(libusb_ref_device(devs[i]));
+			}
+			libusb_free_device_list(devs, 1);
+		}
+	}
+
+	// open devices that arrived
+	for (libusb_device *device : arrived) {
+		if (int(this->devices.size()) < this->config.maxDevices && !isOpen(device)) {
+			size_t count = this->devices.size();
+			open(device);
+			changed |= this->devices.size() != count;
+		}
+		libusb_unref_device(device);
+	}
+
+	if (changed)
+		rebalance();
+	return changed;
+}
+
+void DeviceGroup::stop() {
+	this->watcher.stop();
+	for (auto &device : this->devices)
+		close(*device);
+	this->devices.clear();
+
+	// release notifications that were not handled yet
+	std::unique_lock<std::mutex> lock(this->mutex);
+	for (libusb_device *device : this->arrived)
+		libusb_unref_device(device);
+	for (libusb_device *device : this->left)
+		libusb_unref_device(device);
+	this->arrived.clear();
+	this->left.clear();
+}
+
+bool DeviceGroup::isOpen(libusb_device *device) {
+	for (auto &d : this->devices) {
+		if (libusb_get_device(d->handle) == device)
+			return true;
+	}
+	return false;
+}
+
+void DeviceGroup::open(libusb_device *device) {
+	libusb_device_handle *handle = openMatchingDevice(device, this->filter);
+	if (handle == NULL)
+		return;
+
+	std::unique_ptr<Device> d(new Device());
+	d->handle = handle;
+	d->bus = libusb_get_bus_number(device);
+	d->portPath = getPortPath(device);
+
+	// serial number for reporting, only read from the device if not cached
+	d->serial = getCachedSerial(device);
+	libusb_device_descriptor desc;
+	if (d->serial.empty() && libusb_get_device_descriptor(device, &desc) == LIBUSB_SUCCESS
+		&& desc.iSerialNumber != 0)
+	{
+		unsigned char serial[128];
+		if (libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial)) > 0)
+			d->serial = reinterpret_cast<char *>(serial);
+	}
+
+	d->inHandler = this->inHandler(handle);
+	d->outHandler = this->outHandler(handle);
+
+	// pipelines get created by rebalance()
+	this->devices.push_back(std::move(d));
+}
+
+void DeviceGroup::close(Device &device) {
+	stopPipelines(device);
+	closeDevice(device.handle);
+}
+
+void DeviceGroup::stopPipelines(Device &device) {
+	// keep the statistics, the destructor of the pipelines cancels all transfers
+	device.inBytesBefore = device.getInBytes();
+	device.outBytesBefore = device.getOutBytes();
+	device.errorsBefore = device.getErrors();
+	device.out.reset();
+	device.in.reset();
+}
+
+void DeviceGroup::rebalance() {
+	for (auto &d : this->devices) {
+		Device &device = *d;
+
+		// devices on the same bus share the budget of the host controller
+		int inCount = this->config.inCount;
+		int outCount = this->config.outCount;
+		if (this->config.busBudget > 0) {
+			int count = std::count_if(this->devices.begin(), this->devices.end(),
+				[&device](std::unique_ptr<Device> const &other) {return other->bus == device.bus;});
+			inCount = std::max(std::min(this->config.busBudget / count, inCount), 1);
+			outCount = std::max(std::min(this->config.busBudget / count, outCount), 1);
+		}
+		if (device.in && inCount == device.inCount && outCount == device.outCount)
+			continue;
+
+		// replace the pipelines, the handlers are called through the device so that they keep their state
+		stopPipelines(device);
+		device.inCount = inCount;
+		device.outCount = outCount;
+		device.in.reset(new Pipeline(device.handle, USB_IN | 1, inCount, this->config.size,
+			[&device](uint8_t *data, int length) {return device.inHandler(data, length);}));
+		device.out.reset(new Pipeline(device.handle, USB_OUT | 2, outCount, this->config.size,
+			[&device](uint8_t *data, int length) {return device.outHandler(data, length);}));
+
+		// a device whose pipelines fail to start gets closed by the next update()
+		if (device.in->start() == LIBUSB_SUCCESS)
+			device.out->start();
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <libusb.h>
+#include "DeviceWatcher.hpp"
+#include "Pipeline.hpp"
+#include "usb.hpp"
+
+
+/**
+	Drives all devices that match a filter at the same time. Devices are opened when they are plugged in and closed
+	when they are removed, each device gets a pipeline for in-endpoint 1 and out-endpoint 2. The transfers of all
+	devices complete on the one thread that handles libusb events (see EventThread). Devices on the same bus share
+	the bandwidth of the host controller, therefore the number of transfers in flight can be limited per bus. The
+	pipelines get rebalanced when a device arrives or leaves
+*/
+class DeviceGroup {
+public:
+	/**
+		Creates the handler of a pipeline for a newly opened device (see Pipeline::Handler). The handler keeps its
+		state when the pipelines get rebalanced
+	*/
+	using HandlerFactory = std::function<Pipeline::Handler (libusb_device_handle *handle)>;
+
+	struct Config {
+		// maximum number of devices, further devices are ignored
+		int maxDevices = 1;
+
+		// number of transfers in flight per device for in-endpoint 1 and out-endpoint 2
+		int inCount = 4;
+		int outCount = 4;
+
+		// maximum number of transfers in flight per direction on one bus, 0 for no limit
+		int busBudget = 0;
+
+		// size of each transfer in bytes
+		int size = 64;
+	};
+
+	/**
+		Device that is driven by the group
+	*/
+	struct Device {
+		libusb_device_handle *handle;
+		int bus;
+		std::string portPath;
+		std::string serial;
+
+		// handlers of the pipelines
+		Pipeline::Handler inHandler;
+		Pipeline::Handler outHandler;
+
+		// pipelines with the number of transfers assigned by the last rebalance
+		std::unique_ptr<Pipeline> in;
+		std::unique_ptr<Pipeline> out;
+		int inCount = 0;
+		int outCount = 0;
+
+		// statistics of pipelines that were replaced by a rebalance
+		uint64_t inBytesBefore = 0;
+		uint64_t outBytesBefore = 0;
+		uint64_t errorsBefore = 0;
+
+		// statistics since the device was opened
+		uint64_t getInBytes() const {return this->inBytesBefore + (this->in ? this->in->bytes.load() : 0);}
+		uint64_t getOutBytes() const {return this->outBytesBefore + (this->out ? this->out->bytes.load() : 0);}
+		uint64_t getErrors() const;
+	};
+
+	/**
+		Constructor
+		@param context libusb context, events have to be handled by another thread (see EventThread)
+		@param filter filter for the devices
+		@param config number of devices and transfers
+		@param inHandler creates the handler for received data of each device
+		@param outHandler creates the handler that fills the data to send of each device
+	*/
+	DeviceGroup(libusb_context *context, DeviceFilter const &filter, Config const &config, HandlerFactory inHandler,
+		HandlerFactory outHandler);
+	~DeviceGroup();
+
+	DeviceGroup(DeviceGroup const &) = delete;
+	DeviceGroup &operator =(DeviceGroup const &) = delete;
+
+	/**
+		Start watching for devices using hotplug notifications. If the platform does not support hotplug, update()
+		checks the device list
+	*/
+	void start();
+
+	/**
+		Open devices that arrived, close devices that left or whose pipelines have ended and rebalance the pipelines.
+		Call regularly from the main thread because devices must not be opened in the event thread
+		@return true if the set of devices has changed
+	*/
+	bool update();
+
+	/**
+		Close all devices and stop watching. Gets called by the destructor
+	*/
+	void stop();
+
+	/**
+		Devices that are currently driven, valid until the next call of update()
+	*/
+	std::vector<std::unique_ptr<Device>> const &getDevices() const {return this->devices;}
+
+protected:
+	bool isOpen(libusb_device *device);
+	void open(libusb_device *device);
+	void close(Device &device);
+	void stopPipelines(Device &device);
+	void rebalance();
+
+	libusb_context *context;
+	DeviceFilter filter;
+	Config config;
+	HandlerFactory inHandler;
+	HandlerFactory outHandler;
+	DeviceWatcher watcher;
+	bool hotplug = false;
+
+	// devices that arrived or left, referenced until update() has handled them
+	std::mutex mutex;
+	std::vector<libusb_device *> arrived;
+	std::vector<libusb_device *> left;
+
+	std::vector<std::unique_ptr<Device>> devices;
+};
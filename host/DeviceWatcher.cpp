@@ -0,0 +1,45 @@
+#include "DeviceWatcher.hpp"
+
+
+DeviceWatcher::DeviceWatcher(libusb_context *context, DeviceFilter const &filter, Handler handler)
+	: context(context), filter(filter), handler(std::move(handler))
+{
+}
+
+DeviceWatcher::~DeviceWatcher() {
+	stop();
+}
+
+int DeviceWatcher::start() {
+	if (this->registered)
+		return LIBUSB_SUCCESS;
+	if (!libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+		return LIBUSB_ERROR_NOT_SUPPORTED;
+
+	// libusb filters by vendor/product id, the port path is checked in the callback
+	int ret = libusb_hotplug_register_callback(this->context,
+		LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT, LIBUSB_HOTPLUG_ENUMERATE,
+		this->filter.vendorId, this->filter.productId, LIBUSB_HOTPLUG_MATCH_ANY, &DeviceWatcher::callback, this,
+		&this->callbackHandle);
+	if (ret == LIBUSB_SUCCESS)
+		this->registered = true;
+	return ret;
+}
+
+void DeviceWatcher::stop() {
+	if (this->registered) {
+		libusb_hotplug_deregister_callback(this->context, this->callbackHandle);
+		this->registered = false;
+	}
+}
+
+int LIBUSB_CALL DeviceWatcher::callback(libusb_context *context, libusb_device *device, libusb_hotplug_event event,
+	void *userData)
+{
+	DeviceWatcher *watcher = reinterpret_cast<DeviceWatcher *>(userData);
+	if (matches(device, watcher->filter))
+		watcher->handler(device, event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED);
+
+	// keep the callback registered
+	return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <functional>
+#include <libusb.h>
+#include "usb.hpp"
+
+
+/**
+	Gets notified by libusb when devices that match a filter are plugged in or removed, so that no polling of the
+	device list is needed. The handler is called by the thread that handles libusb events (see EventThread), it must
+	not open the device but can signal another thread to do so
+*/
+class DeviceWatcher {
+public:
+	/**
+		Handler that gets called with the device and true when it arrived or false when it left
+	*/
+	using Handler = std::function<void (libusb_device *device, bool connected)>;
+
+	/**
+		Constructor
+		@param context libusb context
+		@param filter vendor/product id and port path of the devices to watch, the serial number is ignored
+		@param handler handler that gets called when a device arrives or leaves
+	*/
+	DeviceWatcher(libusb_context *context, DeviceFilter const &filter, Handler handler);
+	~DeviceWatcher();
+
+	DeviceWatcher(DeviceWatcher const &) = delete;
+	DeviceWatcher &operator =(DeviceWatcher const &) = delete;
+
+	/**
+		Register for hotplug notifications. The handler also gets called for devices that are already present
+		@return LIBUSB_SUCCESS, LIBUSB_ERROR_NOT_SUPPORTED if the platform does not support hotplug or other error code
+	*/
+	int start();
+
+	/**
+		Deregister from hotplug notifications. Gets called by the destructor
+	*/
+	void stop();
+
+protected:
+	static int LIBUSB_CALL callback(libusb_context *context, libusb_device *device, libusb_hotplug_event event,
+		void *userData);
+
+	libusb_context *context;
+	DeviceFilter filter;
+	Handler handler;
+	bool registered = false;
+	libusb_hotplug_callback_handle callbackHandle;
+};
@@ -0,0 +1,27 @@
+#include "EventThread.hpp"
+
+
+EventThread::EventThread(libusb_context *context)
+	: context(context), running(true)
+{
+	this->thread = std::thread(&EventThread::run, this);
+}
+
+EventThread::~EventThread() {
+	stop();
+}
+
+void EventThread::stop() {
+	if (this->thread.joinable()) {
+		this->running = false;
+		this->thread.join();
+	}
+}
+
+void EventThread::run() {
+	// handle events with a timeout so that the running flag gets checked regularly
+	while (this->running) {
+		timeval tv = {0, 100000};
+		libusb_handle_events_timeout_completed(this->context, &tv, NULL);
+	}
+}
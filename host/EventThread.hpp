@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <libusb.h>
+
+
+/**
+	Dedicated thread that handles libusb events of a context so that completion callbacks of asynchronous
+	transfers are called without the main thread having to poll
+*/
+class EventThread {
+public:
+	explicit EventThread(libusb_context *context);
+	~EventThread();
+
+	EventThread(EventThread const &) = delete;
+	EventThread &operator =(EventThread const &) = delete;
+
+	/**
+		Stop handling events and join the thread. Gets called by the destructor
+	*/
+	void stop();
+
+protected:
+	void run();
+
+	libusb_context *context;
+	std::atomic<bool> running;
+	std::thread thread;
+};
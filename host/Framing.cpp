@@ -0,0 +1,145 @@
+#include "Framing.hpp"
+#include <algorithm>
+#include <cstring>
+
+
+// FrameWriter
+
+FrameWriter::FrameWriter(Device &device, uint8_t endpoint, int transferSize, int count, int flushTimeout)
+	: device(device), endpoint(endpoint), transferSize(transferSize), count(count)
+	, flushTimeout(std::chrono::milliseconds(flushTimeout)), pool(device.getHandle(), transferSize)
+{
+}
+
+FrameWriter::~FrameWriter() {
+	finish();
+}
+
+int FrameWriter::write(int type, const void *data, int length) {
+	int result = LIBUSB_SUCCESS;
+	int messageSize = sizeof(MessageHeader) + length;
+	if (this->buffer != nullptr && this->size + messageSize > this->packetOffset + FRAME_PACKET_SIZE) {
+		// message does not fit into the current packet: pad the rest of the packet and start the next one
+		if (this->size < this->packetOffset + FRAME_PACKET_SIZE)
+			this->buffer[this->size] = MESSAGE_PADDING;
+		this->size = this->packetOffset += FRAME_PACKET_SIZE;
+		if (this->size >= this->transferSize)
+			result = flush();
+	}
+	if (this->buffer == nullptr) {
+		// start a new transfer, wait until a transfer has completed if all are in flight
+		while (int(this->inFlight.size()) >= this->count) {
+			int r = complete();
+			if (r < 0)
+				result = r;
+		}
+		this->buffer = this->pool.allocate();
+		if (this->buffer == nullptr)
+			return LIBUSB_ERROR_NO_MEM;
+		this->size = 0;
+		this->packetOffset = 0;
+		this->start = std::chrono::steady_clock::now();
+	}
+	if (this->size == this->packetOffset) {
+		// start a new packet with the frame header (little endian)
+		this->buffer[this->size] = uint8_t(this->sequence);
+		this->buffer[this->size + 1] = uint8_t(this->sequence >> 8);
+		this->size += sizeof(FrameHeader);
+		++this->sequence;
+		++this->packets;
+	}
+	uint8_t *message = this->buffer + this->size;
+	message[0] = uint8_t(type);
+	message[1] = uint8_t(length);
+	memcpy(message + sizeof(MessageHeader), data, length);
+	this->size += messageSize;
+	++this->messages;
+
+	if (this->flushTimeout.count() == 0) {
+		int r = flush();
+		if (r < 0)
+			result = r;
+	}
+	return result;
+}
+
+int FrameWriter::update() {
+	if (this->buffer == nullptr || std::chrono::steady_clock::now() - this->start < this->flushTimeout)
+		return LIBUSB_SUCCESS;
+	return flush();
+}
+
+int FrameWriter::flush() {
+	if (this->buffer == nullptr)
+		return LIBUSB_SUCCESS;
+
+	// a transfer that ends with a full packet needs no zero length packet, the device does not care about transfer
+	// boundaries
+	this->inFlight.push_back({this->buffer, this->device.write(this->endpoint, this->buffer, this->size)});
+	this->buffer = nullptr;
+	++this->transfers;
+
+	// check transfers that have completed in the meantime
+	int result = LIBUSB_SUCCESS;
+	while (!this->inFlight.empty()
+		&& this->inFlight.front().result.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+	{
+		int r = complete();
+		if (r < 0)
+			result = r;
+	}
+	return result;
+}
+
+int FrameWriter::finish() {
+	int result = flush();
+	while (!this->inFlight.empty()) {
+		int r = complete();
+		if (r < 0)
+			result = r;
+	}
+	return result;
+}
+
+int FrameWriter::complete() {
+	Transfer &transfer = this->inFlight.front();
+	int result = transfer.result.get();
+	this->pool.release(transfer.buffer);
+	this->inFlight.pop_front();
+	return result < 0 ? result : LIBUSB_SUCCESS;
+}
+
+
+// FrameReader
+
+void FrameReader::read(const uint8_t *data, int length) {
+	// a transfer consists of full packets except for the last one
+	while (length > 0) {
+		int size = std::min(length, FRAME_PACKET_SIZE);
+		readPacket(data, size);
+		data += size;
+		length -= size;
+	}
+}
+
+void FrameReader::readPacket(const uint8_t *packet, int size) {
+	if (size < int(sizeof(FrameHeader)))
+		return;
+	++this->packets;
+
+	// count the packets that were skipped
+	uint16_t sequence = packet[0] | (packet[1] << 8);
+	this->lostPackets += uint16_t(sequence - this->sequence);
+	this->sequence = sequence + 1;
+
+	int offset = sizeof(FrameHeader);
+	while (offset + int(sizeof(MessageHeader)) <= size) {
+		int type = packet[offset];
+		int length = packet[offset + 1];
+		if (type == MESSAGE_PADDING || offset + int(sizeof(MessageHeader)) + length > size)
+			break;
+		this->handler(type, packet + offset + sizeof(MessageHeader), length);
+		++this->messages;
+		offset += sizeof(MessageHeader) + length;
+	}
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include "BufferPool.hpp"
+#include "Device.hpp"
+
+
+/**
+	Packs messages into framed packets (see framing in protocol.h) and sends them as bulk out transfers of several
+	packets. A message that does not fit into the current packet starts the next one, the rest of the packet gets
+	padded so that the transfer continues. A transfer is sent when its buffer is full, by flush() or by update()
+	once the flush timeout has elapsed since the first message of the transfer was written. Not thread safe
+*/
+class FrameWriter {
+public:
+	/**
+		Constructor
+		@param device opened device
+		@param endpoint out-endpoint address, e.g. USB_OUT | 2
+		@param transferSize size of each transfer in bytes, a multiple of FRAME_PACKET_SIZE
+		@param count number of transfers in flight, write() waits for the oldest one when all are in flight
+		@param flushTimeout flush timeout in milliseconds, 0 to send each message immediately
+	*/
+	FrameWriter(Device &device, uint8_t endpoint, int transferSize, int count, int flushTimeout);
+	~FrameWriter();
+
+	FrameWriter(FrameWriter const &) = delete;
+	FrameWriter &operator =(FrameWriter const &) = delete;
+
+	/**
+		Add a message
+		@param type message type, see MessageType
+		@param data payload of the message
+		@param length length of the payload, at most MESSAGE_MAX_LENGTH
+		@return LIBUSB_SUCCESS or error code of a previous transfer
+	*/
+	int write(int type, const void *data, int length);
+
+	/**
+		Send the current transfer if the flush timeout has elapsed, call periodically when no messages are written
+		@return LIBUSB_SUCCESS or error code of a previous transfer
+	*/
+	int update();
+
+	/**
+		Send the current transfer
+		@return LIBUSB_SUCCESS or error code of a previous transfer
+	*/
+	int flush();
+
+	/**
+		Flush and wait until all transfers have completed
+		@return LIBUSB_SUCCESS or error code of a previous transfer
+	*/
+	int finish();
+
+	// statistics
+	uint64_t messages = 0;
+	uint64_t packets = 0;
+	uint64_t transfers = 0;
+
+protected:
+	struct Transfer {
+		uint8_t *buffer;
+		std::future<int> result;
+	};
+
+	// wait for the oldest transfer and return its buffer to the pool
+	int complete();
+
+	Device &device;
+	uint8_t endpoint;
+	int transferSize;
+	int count;
+	std::chrono::steady_clock::duration flushTimeout;
+
+	BufferPool pool;
+	std::deque<Transfer> inFlight;
+
+	// transfer that gets filled, size and offset of the current packet in the transfer
+	uint8_t *buffer = nullptr;
+	int size = 0;
+	int packetOffset = 0;
+	std::chrono::steady_clock::time_point start;
+
+	// sequence number of the next packet
+	uint16_t sequence = 0;
+};
+
+
+/**
+	Unpacks the messages of received framed packets (see framing in protocol.h) and detects lost packets by gaps in
+	the sequence numbers
+*/
+class FrameReader {
+public:
+	/**
+		Handler that gets called for each message
+	*/
+	using Handler = std::function<void (int type, const uint8_t *data, int length)>;
+
+	explicit FrameReader(Handler handler) : handler(std::move(handler)) {}
+
+	/**
+		Read the messages of a received transfer which consists of framed packets
+	*/
+	void read(const uint8_t *data, int length);
+
+	// statistics
+	uint64_t messages = 0;
+	uint64_t packets = 0;
+	uint64_t lostPackets = 0;
+
+protected:
+	void readPacket(const uint8_t *packet, int size);
+
+	Handler handler;
+
+	// expected sequence number of the next packet
+	uint16_t sequence = 0;
+};
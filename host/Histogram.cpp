@@ -0,0 +1,75 @@
+#include "Histogram.hpp"
+#include <algorithm>
+
+
+// number of sub-buckets per power of two
+constexpr int SUB_BITS = 3;
+constexpr int SUB_COUNT = 1 << SUB_BITS;
+
+Histogram::Histogram()
+	: buckets((64 - SUB_BITS + 1) << SUB_BITS)
+{
+}
+
+void Histogram::add(uint64_t value) {
+	++this->buckets[index(value)];
+	++this->total;
+	this->sum += value;
+	this->minValue = std::min(this->minValue, value);
+	this->maxValue = std::max(this->maxValue, value);
+}
+
+uint64_t Histogram::percentile(double fraction) const {
+	uint64_t target = uint64_t(fraction * double(this->total));
+	uint64_t count = 0;
+	for (int i = 0; i < int(this->buckets.size()); ++i) {
+		count += this->buckets[i];
+		if (count > target)
+			return std::min(upperBound(i), this->maxValue);
+	}
+	return this->maxValue;
+}
+
+void Histogram::printPercentiles(const char *name, double scale, const char *unit) const {
+	printf("%-10s p50 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f %s\n", name,
+		double(percentile(0.5)) / scale, double(percentile(0.99)) / scale, double(percentile(0.999)) / scale,
+		double(this->maxValue) / scale, unit);
+}
+
+void Histogram::printBuckets(double scale, const char *unit) const {
+	uint64_t largest = *std::max_element(this->buckets.begin(), this->buckets.end());
+	if (largest == 0)
+		return;
+	for (int i = 0; i < int(this->buckets.size()); ++i) {
+		uint64_t count = this->buckets[i];
+		if (count == 0)
+			continue;
+		int length = int(count * 50 / largest);
+		printf("%10.1f - %10.1f %s %10llu ", double(lowerBound(i)) / scale, double(upperBound(i)) / scale, unit,
+			(unsigned long long)count);
+		for (int j = 0; j < length; ++j)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+int Histogram::index(uint64_t value) {
+	if (value < SUB_COUNT)
+		return int(value);
+	int exponent = 63 - __builtin_clzll(value);
+	return ((exponent - SUB_BITS + 1) << SUB_BITS) | int((value >> (exponent - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+uint64_t Histogram::lowerBound(int index) {
+	if (index < SUB_COUNT)
+		return index;
+	int exponent = (index >> SUB_BITS) + SUB_BITS - 1;
+	return uint64_t(SUB_COUNT | (index & (SUB_COUNT - 1))) << (exponent - SUB_BITS);
+}
+
+uint64_t Histogram::upperBound(int index) {
+	if (index < SUB_COUNT)
+		return index;
+	int exponent = (index >> SUB_BITS) + SUB_BITS - 1;
+	return lowerBound(index) + (uint64_t(1) << (exponent - SUB_BITS)) - 1;
+}
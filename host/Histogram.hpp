@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+
+/**
+	Histogram with logarithmic buckets, each power of two is divided into 8 sub-buckets so that the relative
+	error of the percentiles is below 12.5%
+*/
+class Histogram {
+public:
+	Histogram();
+
+	void add(uint64_t value);
+
+	uint64_t count() const {return this->total;}
+	uint64_t min() const {return this->minValue;}
+	uint64_t max() const {return this->maxValue;}
+	double mean() const {return this->total == 0 ? 0.0 : double(this->sum) / double(this->total);}
+
+	/**
+		Get the value below which the given fraction of the values lie
+		@param fraction fraction of values in the range 0 to 1, e.g. 0.99 for the 99th percentile
+		@return upper bound of the bucket that contains the percentile
+	*/
+	uint64_t percentile(double fraction) const;
+
+	/**
+		Print p50/p99/p99.9/max
+		@param name name of the histogram
+		@param scale divisor for the values, e.g. 1000 to print nanoseconds as microseconds
+		@param unit unit of the scaled values
+	*/
+	void printPercentiles(const char *name, double scale, const char *unit) const;
+
+	/**
+		Print all non-empty buckets as bars
+	*/
+	void printBuckets(double scale, const char *unit) const;
+
+protected:
+	static int index(uint64_t value);
+	static uint64_t lowerBound(int index);
+	static uint64_t upperBound(int index);
+
+	std::vector<uint64_t> buckets;
+	uint64_t total = 0;
+	uint64_t sum = 0;
+	uint64_t minValue = UINT64_MAX;
+	uint64_t maxValue = 0;
+};
@@ -0,0 +1,125 @@
+#include "Pipeline.hpp"
+
+
+Pipeline::Pipeline(libusb_device_handle *handle, uint8_t endpoint, int count, int size, Handler handler)
+	: bytes(0), transfers(0), errors(0), copies(0), pool(handle, size)
+	, handle(handle), endpoint(endpoint), size(size), handler(std::move(handler))
+	, slots(count)
+{
+	for (int i = 0; i < count; ++i) {
+		Slot &slot = this->slots[i];
+		slot.pipeline = this;
+		slot.transfer = libusb_alloc_transfer(0);
+		slot.device = false;
+		slot.inFlight = false;
+
+		// buffer gets assigned by start()
+		libusb_fill_bulk_transfer(slot.transfer, handle, endpoint, nullptr, size, &Pipeline::callback, &slot, 0);
+	}
+}
+
+Pipeline::~Pipeline() {
+	stop();
+	for (Slot &slot : this->slots) {
+		libusb_free_transfer(slot.transfer);
+	}
+}
+
+int Pipeline::start() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->stopping = false;
+	for (Slot &slot : this->slots) {
+		if (slot.transfer->buffer == nullptr) {
+			slot.transfer->buffer = this->pool.allocate();
+			if (slot.transfer->buffer == nullptr)
+				return LIBUSB_ERROR_NO_MEM;
+			slot.device = this->pool.isDeviceMemory(slot.transfer->buffer);
+		}
+
+		int length = this->size;
+		if (!(this->endpoint & LIBUSB_ENDPOINT_IN)) {
+			// let the handler fill the buffer for the out-endpoint
+			length = this->handler(slot.transfer->buffer, this->size);
+			if (length < 0)
+				break;
+		}
+		int ret = submit(slot, length);
+		if (ret != LIBUSB_SUCCESS)
+			return ret;
+	}
+	return LIBUSB_SUCCESS;
+}
+
+void Pipeline::stop() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	this->stopping = true;
+
+	// cancel all transfers, the callbacks are called by the event thread
+	for (Slot &slot : this->slots) {
+		if (slot.inFlight)
+			libusb_cancel_transfer(slot.transfer);
+	}
+
+	// wait until all transfers are back
+	this->condition.wait(lock, [this] {return this->active == 0;});
+
+	// return the buffers to the pool
+	for (Slot &slot : this->slots) {
+		if (slot.transfer->buffer != nullptr) {
+			this->pool.release(slot.transfer->buffer);
+			slot.transfer->buffer = nullptr;
+		}
+	}
+}
+
+bool Pipeline::isActive() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	return this->active > 0;
+}
+
+void LIBUSB_CALL Pipeline::callback(libusb_transfer *transfer) {
+	Slot &slot = *reinterpret_cast<Slot *>(transfer->user_data);
+	Pipeline *pipeline = slot.pipeline;
+
+	int length = -1;
+	if (transfer->status == LIBUSB_TRANSFER_COMPLETED) {
+		pipeline->bytes += transfer->actual_length;
+		++pipeline->transfers;
+		if (!slot.device)
+			++pipeline->copies;
+
+		// handle received data or refill buffer for the next transfer
+		if (pipeline->endpoint & LIBUSB_ENDPOINT_IN)
+			length = pipeline->handler(transfer->buffer, transfer->actual_length) >= 0 ? pipeline->size : -1;
+		else
+			length = pipeline->handler(transfer->buffer, pipeline->size);
+	} else if (transfer->status == LIBUSB_TRANSFER_TIMED_OUT) {
+		// retry
+		++pipeline->errors;
+		length = transfer->length;
+	} else if (transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+		// stall, device gone or other error: take transfer out of the pipeline
+		++pipeline->errors;
+	}
+
+	std::unique_lock<std::mutex> lock(pipeline->mutex);
+	slot.inFlight = false;
+	--pipeline->active;
+	if (!pipeline->stopping && length >= 0)
+		pipeline->submit(slot, length);
+	if (pipeline->active == 0)
+		pipeline->condition.notify_all();
+}
+
+int Pipeline::submit(Slot &slot, int length) {
+	// mutex must be locked
+	slot.transfer->length = length;
+	int ret = libusb_submit_transfer(slot.transfer);
+	if (ret == LIBUSB_SUCCESS) {
+		slot.inFlight = true;
+		++this->active;
+	} else {
+		++this->errors;
+	}
+	return ret;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <libusb.h>
+#include "BufferPool.hpp"
+
+
+/**
+	Keeps a number of asynchronous bulk transfers of one endpoint in flight. Each transfer gets refilled and
+	resubmitted directly from its completion callback, so the bus never runs idle while the application
+	handles the data. The callbacks are called by the thread that handles libusb events (see EventThread).
+	The transfer buffers come from a BufferPool and are returned to it by stop(), so that a restart does not allocate
+*/
+class Pipeline {
+public:
+	/**
+		Handler that gets called for each transfer.
+		In-endpoint: Called with the received data, return a value >= 0 to continue
+		Out-endpoint: Called with the buffer to fill, return the number of bytes to send or -1 to stop
+	*/
+	using Handler = std::function<int (uint8_t *data, int length)>;
+
+	/**
+		Constructor
+		@param handle handle of opened device with claimed interface
+		@param endpoint endpoint address including direction, e.g. USB_IN | 1
+		@param count number of transfers to keep in flight
+		@param size size of each transfer in bytes
+		@param handler handler for received data or for filling data to send
+	*/
+	Pipeline(libusb_device_handle *handle, uint8_t endpoint, int count, int size, Handler handler);
+	~Pipeline();
+
+	Pipeline(Pipeline const &) = delete;
+	Pipeline &operator =(Pipeline const &) = delete;
+
+	/**
+		Submit all transfers
+		@return LIBUSB_SUCCESS, LIBUSB_ERROR_NO_MEM or error code of the first failed submit
+	*/
+	int start();
+
+	/**
+		Cancel all transfers and wait until they have completed. Gets called by the destructor
+	*/
+	void stop();
+
+	/**
+		Returns true while at least one transfer is in flight
+	*/
+	bool isActive();
+
+	// statistics, updated by the event handling thread
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> transfers;
+	std::atomic<uint64_t> errors;
+	std::atomic<uint64_t> copies; // transfers that the kernel copied because the buffer is not in device memory
+
+	// pool of the transfer buffers
+	BufferPool pool;
+
+protected:
+	struct Slot {
+		Pipeline *pipeline;
+		libusb_transfer *transfer;
+		bool device;
+		bool inFlight;
+	};
+
+	static void LIBUSB_CALL callback(libusb_transfer *transfer);
+	int submit(Slot &slot, int length);
+
+	libusb_device_handle *handle;
+	uint8_t endpoint;
+	int size;
+	Handler handler;
+	std::vector<Slot> slots;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+	int active = 0;
+};
@@ -0,0 +1,88 @@
+#include "Script.hpp"
+#include <algorithm>
+#include <cstring>
+
+
+Script &Script::delay(uint16_t microseconds) {
+	this->code.push_back(SCRIPT_DELAY);
+	add16(microseconds);
+	return *this;
+}
+
+Script &Script::spiTransfer(const void *data, int length) {
+	const uint8_t *d = static_cast<const uint8_t *>(data);
+	this->code.push_back(SCRIPT_SPI_TRANSFER);
+	this->code.push_back(uint8_t(length));
+	this->code.insert(this->code.end(), d, d + length);
+	return *this;
+}
+
+Script &Script::i2cWrite(uint8_t address, const void *data, int length) {
+	const uint8_t *d = static_cast<const uint8_t *>(data);
+	this->code.push_back(SCRIPT_I2C_WRITE);
+	this->code.push_back(address);
+	this->code.push_back(uint8_t(length));
+	this->code.insert(this->code.end(), d, d + length);
+	return *this;
+}
+
+Script &Script::i2cRead(uint8_t address, int length) {
+	this->code.push_back(SCRIPT_I2C_READ);
+	this->code.push_back(address);
+	this->code.push_back(uint8_t(length));
+	return *this;
+}
+
+Script &Script::loop(uint16_t count) {
+	this->code.push_back(SCRIPT_LOOP);
+	add16(count);
+	return *this;
+}
+
+Script &Script::loopEnd() {
+	this->code.push_back(SCRIPT_LOOP_END);
+	return *this;
+}
+
+int Script::upload(Device &device) const {
+	if (this->code.size() > SCRIPT_MAX_SIZE)
+		return LIBUSB_ERROR_INVALID_PARAM;
+	int r = device.vendorOut(VENDOR_UPLOAD_SCRIPT, 0, this->code.data(), int(this->code.size()));
+	return r < 0 ? r : LIBUSB_SUCCESS;
+}
+
+int Script::run(Device &device, ScriptResult &result, std::vector<uint8_t> &data, unsigned timeout) {
+	// buffer for the largest result, a multiple of the max packet size
+	int size = (sizeof(ScriptResult) + SCRIPT_RESULT_SIZE + 63) & ~63;
+	std::vector<uint8_t> buffer(size);
+
+	// start reading before the script gets started
+	auto received = device.read(USB_IN | 1, buffer.data(), size, timeout);
+	int r = device.vendorOut(VENDOR_RUN_SCRIPT, 0);
+	if (r < 0) {
+		device.cancel();
+		received.wait();
+		return r;
+	}
+	int length = received.get();
+	if (length < 0)
+		return length;
+	if (length < int(sizeof(ScriptResult)))
+		return LIBUSB_ERROR_IO;
+	memcpy(&result, buffer.data(), sizeof(ScriptResult));
+	data.assign(buffer.begin() + sizeof(ScriptResult), buffer.begin() + std::min(length,
+		int(sizeof(ScriptResult)) + result.size));
+	return LIBUSB_SUCCESS;
+}
+
+Script &Script::gpio(ScriptOpcode opcode, CommandPort port, uint16_t mask) {
+	this->code.push_back(opcode);
+	this->code.push_back(port);
+	add16(mask);
+	return *this;
+}
+
+void Script::add16(uint16_t value) {
+	this->code.push_back(uint8_t(value));
+	this->code.push_back(uint8_t(value >> 8));
+}
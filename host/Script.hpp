@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Device.hpp"
+
+
+/**
+	Builds a script of peripheral instructions (see ScriptOpcode in protocol.h) that the device runs at full speed
+	without a usb round trip per step. Usage:
+	Script script;
+	script.gpioClear(COMMAND_PORT_A, 1 << 4).spiTransfer(command, 2).gpioSet(COMMAND_PORT_A, 1 << 4);
+	script.upload(device);
+	... switch the device into MODE_SCRIPT
+	script.run(device, result, data);
+*/
+class Script {
+public:
+	Script &gpioSet(CommandPort port, uint16_t mask) {return gpio(SCRIPT_GPIO_SET, port, mask);}
+	Script &gpioClear(CommandPort port, uint16_t mask) {return gpio(SCRIPT_GPIO_CLEAR, port, mask);}
+
+	/**
+		Read pins, adds 2 bytes to the result
+	*/
+	Script &gpioRead(CommandPort port, uint16_t mask) {return gpio(SCRIPT_GPIO_READ, port, mask);}
+
+	/**
+		Busy wait
+	*/
+	Script &delay(uint16_t microseconds);
+
+	/**
+		Full duplex spi transfer of up to 255 bytes, adds the received bytes to the result
+	*/
+	Script &spiTransfer(const void *data, int length);
+
+	/**
+		Write up to 255 bytes to a 7 bit i2c address
+	*/
+	Script &i2cWrite(uint8_t address, const void *data, int length);
+
+	/**
+		Read up to 255 bytes from a 7 bit i2c address, adds the bytes to the result
+	*/
+	Script &i2cRead(uint8_t address, int length);
+
+	/**
+		Repeat the instructions up to the matching loopEnd() count times
+	*/
+	Script &loop(uint16_t count);
+	Script &loopEnd();
+
+	/**
+		Get the bytecode
+	*/
+	std::vector<uint8_t> const &getCode() const {return this->code;}
+
+	/**
+		Upload the script, the device keeps it until the next upload
+		@return LIBUSB_SUCCESS or error code
+	*/
+	int upload(Device &device) const;
+
+	/**
+		Run the uploaded script and wait for its result, the device has to be in MODE_SCRIPT
+		@param result is set to the header of the result which contains the status
+		@param data is set to the data read by the script
+		@param timeout timeout in milliseconds
+		@return LIBUSB_SUCCESS or error code
+	*/
+	static int run(Device &device, ScriptResult &result, std::vector<uint8_t> &data, unsigned timeout = 1000);
+
+protected:
+	Script &gpio(ScriptOpcode opcode, CommandPort port, uint16_t mask);
+	void add16(uint16_t value);
+
+	std::vector<uint8_t> code;
+};
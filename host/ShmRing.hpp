@@ -0,0 +1,263 @@
+#pragma once
+
+// header-only so that consumer processes can attach to the ring without linking the bluepill library or libusb
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/**
+	Header at the start of the shared memory, followed by the data of the ring. The cursors are byte positions in
+	the stream that only increase, each sits on its own cache line so that the producer writing the cursors does
+	not slow down consumers that read the constant fields
+*/
+struct ShmRingHeader {
+	static constexpr uint32_t MAGIC = 0x676e6952; // "Ring"
+	static constexpr uint32_t VERSION = 1;
+
+	// offset of the data in the shared memory (one page)
+	static constexpr size_t DATA_OFFSET = 4096;
+
+	uint32_t magic;
+	uint32_t version;
+
+	// size of the data in bytes, a power of two and a multiple of the page size
+	uint64_t size;
+
+	// the producer is writing data up to this position, data before position reserved - size may be overwritten
+	alignas(64) std::atomic<uint64_t> reserved;
+
+	// data is complete up to this position
+	alignas(64) std::atomic<uint64_t> committed;
+};
+static_assert(sizeof(ShmRingHeader) <= ShmRingHeader::DATA_OFFSET, "header must fit into the first page");
+
+/**
+	Single producer/multi consumer ring in shared memory (e.g. /dev/shm/<name> on Linux). The producer never waits
+	for consumers, each consumer keeps its own read position and loses data if it falls behind by more than the ring
+	size. The data is mapped twice in a row so that every range of up to size bytes is contiguous in memory and can
+	be read in place without copying
+*/
+class ShmRing {
+public:
+	ShmRing() = default;
+	~ShmRing() {close();}
+
+	ShmRing(ShmRing const &) = delete;
+	ShmRing &operator =(ShmRing const &) = delete;
+
+	/**
+		Returns true if the ring is mapped
+	*/
+	bool isOpen() const {return this->header != nullptr;}
+
+	/**
+		Unmap the ring
+	*/
+	void close() {
+		if (this->base != nullptr)
+			munmap(this->base, ShmRingHeader::DATA_OFFSET + this->size * 2);
+		this->base = nullptr;
+		this->header = nullptr;
+		this->data = nullptr;
+		this->size = 0;
+	}
+
+	/**
+		Get the size of the ring in bytes
+	*/
+	size_t getSize() const {return this->size;}
+
+protected:
+	// map header and data twice into a contiguous range of the address space
+	bool map(int fd, size_t size, bool writable) {
+		size_t length = ShmRingHeader::DATA_OFFSET + size * 2;
+		int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+		void *base = mmap(nullptr, length, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			return false;
+		uint8_t *b = static_cast<uint8_t *>(base);
+		if (mmap(b, ShmRingHeader::DATA_OFFSET, prot, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+			|| mmap(b + ShmRingHeader::DATA_OFFSET, size, prot, MAP_SHARED | MAP_FIXED, fd,
+				ShmRingHeader::DATA_OFFSET) == MAP_FAILED
+			|| mmap(b + ShmRingHeader::DATA_OFFSET + size, size, prot, MAP_SHARED | MAP_FIXED, fd,
+				ShmRingHeader::DATA_OFFSET) == MAP_FAILED)
+		{
+			munmap(base, length);
+			return false;
+		}
+		this->base = b;
+		this->header = reinterpret_cast<ShmRingHeader *>(b);
+		this->data = b + ShmRingHeader::DATA_OFFSET;
+		this->size = size;
+		return true;
+	}
+
+	uint8_t *base = nullptr;
+	ShmRingHeader *header = nullptr;
+	uint8_t *data = nullptr;
+	size_t size = 0;
+};
+
+/**
+	Producer side of the ring, only one producer per ring is allowed
+*/
+class ShmRingWriter : public ShmRing {
+public:
+	/**
+		Create the ring or recreate it if it exists. The shared memory stays after the producer has exited so that
+		consumers can read the rest of the data, use ShmRingWriter::remove() to delete it
+		@param name name of the shared memory, e.g. "/bluepill"
+		@param size size of the ring in bytes, a power of two and a multiple of the page size
+		@return true on success
+	*/
+	bool open(std::string const &name, size_t size) {
+		close();
+		if (size < ShmRingHeader::DATA_OFFSET || (size & (size - 1)) != 0)
+			return false;
+		int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+		if (fd < 0)
+			return false;
+
+		// mark as invalid until the header is initialized
+		bool success = ftruncate(fd, 0) == 0 && ftruncate(fd, ShmRingHeader::DATA_OFFSET + size) == 0
+			&& map(fd, size, true);
+		::close(fd);
+		if (!success)
+			return false;
+		this->header->size = size;
+		this->header->reserved.store(0, std::memory_order_relaxed);
+		this->header->committed.store(0, std::memory_order_relaxed);
+		this->header->version = ShmRingHeader::VERSION;
+		std::atomic_thread_fence(std::memory_order_release);
+		this->header->magic = ShmRingHeader::MAGIC;
+		this->position = 0;
+		return true;
+	}
+
+	/**
+		Append data to the ring, data larger than half of the ring gets written in several parts
+	*/
+	void write(const void *data, size_t length) {
+		const uint8_t *d = static_cast<const uint8_t *>(data);
+		while (length > 0) {
+			size_t n = std::min(length, this->size / 2);
+
+			// announce the range that gets overwritten before writing it, like the sequence number of a seqlock
+			this->header->reserved.store(this->position + n, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			memcpy(this->data + (this->position & (this->size - 1)), d, n);
+
+			// publish the data
+			this->position += n;
+			this->header->committed.store(this->position, std::memory_order_release);
+			d += n;
+			length -= n;
+		}
+	}
+
+	/**
+		Delete the shared memory, mapped rings stay valid until they are closed
+	*/
+	static void remove(std::string const &name) {
+		shm_unlink(name.c_str());
+	}
+
+protected:
+	uint64_t position = 0;
+};
+
+/**
+	Consumer side of the ring, any number of consumers can read at their own pace. Usage:
+	const uint8_t *data;
+	size_t length = reader.peek(data);
+	... process data in place ...
+	if (!reader.consume(length)) ... data was overwritten while it was processed
+*/
+class ShmRingReader : public ShmRing {
+public:
+	/**
+		Attach to a ring created by a ShmRingWriter, reading starts at the current end of the stream
+		@return true on success
+	*/
+	bool open(std::string const &name) {
+		close();
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		bool success = false;
+		if (fstat(fd, &st) == 0 && size_t(st.st_size) > ShmRingHeader::DATA_OFFSET) {
+			size_t size = st.st_size - ShmRingHeader::DATA_OFFSET;
+			success = (size & (size - 1)) == 0 && map(fd, size, false);
+		}
+		::close(fd);
+		if (!success)
+			return false;
+		if (this->header->magic != ShmRingHeader::MAGIC || this->header->version != ShmRingHeader::VERSION
+			|| this->header->size != this->size)
+		{
+			close();
+			return false;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		this->position = this->header->committed.load(std::memory_order_acquire);
+		this->lost = 0;
+		return true;
+	}
+
+	/**
+		Get the data that is available at the read position, contiguous in memory. If the producer has overtaken
+		the read position, reading continues with the more recent half of the ring and the skipped bytes are added
+		to the lost bytes
+		@param data is set to the available data
+		@return number of available bytes
+	*/
+	size_t peek(const uint8_t *&data) {
+		uint64_t committed = this->header->committed.load(std::memory_order_acquire);
+		if (committed - this->position > this->size) {
+			uint64_t position = committed - this->size / 2;
+			this->lost += position - this->position;
+			this->position = position;
+		}
+		data = this->data + (this->position & (this->size - 1));
+		return size_t(committed - this->position);
+	}
+
+	/**
+		Advance the read position after the data returned by peek() was processed
+		@return false if the producer has overwritten the data in the meantime, then it has to be discarded
+	*/
+	bool consume(size_t length) {
+		// check the reserved position after reading the data like the sequence number of a seqlock
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t reserved = this->header->reserved.load(std::memory_order_relaxed);
+		bool valid = reserved - this->position <= this->size;
+		this->position += length;
+		if (!valid)
+			this->lost += length;
+		return valid;
+	}
+
+	/**
+		Get the read position in the stream
+	*/
+	uint64_t getPosition() const {return this->position;}
+
+	/**
+		Get the number of bytes that were lost because the consumer was too slow
+	*/
+	uint64_t getLost() const {return this->lost;}
+
+protected:
+	uint64_t position = 0;
+	uint64_t lost = 0;
+};
@@ -0,0 +1,128 @@
+#include "Timeline.hpp"
+#include <algorithm>
+
+
+namespace {
+
+// frame number in USB_FNR and StreamTimestamp
+constexpr int FRAME_MASK = 0x7ff;
+
+// LCK of USB_FNR: the device has seen at least two consecutive sofs and is locked to them
+constexpr int FRAME_LOCKED = 1 << 13;
+
+double cyclesToNs(int64_t cycles) {
+	return double(cycles) * 1e9 / CPU_CLOCK;
+}
+
+} // namespace
+
+
+void Timeline::add(StreamTimestamp const &timestamp, double arrival) {
+	bool locked = (timestamp.frame & FRAME_LOCKED) != 0;
+	if (!locked)
+		++this->unlocked;
+	if (this->points.empty()) {
+		this->points.push_back({timestamp.cycles, timestamp.sofCycles, timestamp.sofFrame, 0.0, locked});
+		this->firstArrival = arrival;
+	} else {
+		// the cycle counters wrap around after 2^32 cycles, the frame number after 2048 frames
+		Point const &previous = this->points.back();
+		this->points.push_back({
+			previous.cycles + uint32_t(timestamp.cycles - this->last.cycles),
+			previous.sofCycles + uint32_t(timestamp.sofCycles - this->last.sofCycles),
+			previous.sofFrame + ((timestamp.sofFrame - this->last.sofFrame) & FRAME_MASK),
+			arrival - this->firstArrival,
+			locked});
+	}
+	this->last = timestamp;
+}
+
+double Timeline::getDeviceTime(size_t index) const {
+	return double(this->points[index].cycles - this->points[0].cycles) / CPU_CLOCK;
+}
+
+int64_t Timeline::getFrame(size_t index) const {
+	return this->points[index].sofFrame;
+}
+
+double Timeline::getFrameDrift() const {
+	auto isLocked = [](Point const &point) {return point.locked;};
+	auto firstLocked = std::find_if(this->points.begin(), this->points.end(), isLocked);
+	auto lastLocked = std::find_if(this->points.rbegin(), this->points.rend(), isLocked);
+	if (firstLocked == this->points.end())
+		return 0.0;
+	Point const &first = *firstLocked;
+	Point const &last = *lastLocked;
+	int64_t frames = last.sofFrame - first.sofFrame;
+	if (frames <= 0)
+		return 0.0;
+	double cyclesPerFrame = double(last.sofCycles - first.sofCycles) / double(frames);
+	return (cyclesPerFrame / (CPU_CLOCK / 1000) - 1.0) * 1e6;
+}
+
+double Timeline::getHostDrift() const {
+	double offset;
+	double slope;
+	fit(offset, slope);
+	return (1.0 / slope - 1.0) * 1e6;
+}
+
+Histogram Timeline::getIntervals() const {
+	Histogram histogram;
+	for (size_t i = 1; i < this->points.size(); ++i)
+		histogram.add(uint64_t(cyclesToNs(this->points[i].cycles - this->points[i - 1].cycles)));
+	return histogram;
+}
+
+Histogram Timeline::getFramePositions() const {
+	Histogram histogram;
+	for (Point const &point : this->points)
+		histogram.add(uint64_t(cyclesToNs(std::max(point.cycles - point.sofCycles, int64_t(0)))));
+	return histogram;
+}
+
+Histogram Timeline::getArrivalJitter() const {
+	double offset;
+	double slope;
+	fit(offset, slope);
+	std::vector<double> deviations;
+	deviations.reserve(this->points.size());
+	for (size_t i = 0; i < this->points.size(); ++i) {
+		if (this->points[i].locked)
+			deviations.push_back(this->points[i].arrival - (offset + slope * getDeviceTime(i)));
+	}
+
+	Histogram histogram;
+	if (!deviations.empty()) {
+		double minimum = *std::min_element(deviations.begin(), deviations.end());
+		for (double deviation : deviations)
+			histogram.add(uint64_t((deviation - minimum) * 1e9));
+	}
+	return histogram;
+}
+
+void Timeline::fit(double &offset, double &slope) const {
+	// least squares with the mean subtracted for numerical stability
+	size_t n = this->points.size() - this->unlocked;
+	double meanX = 0.0;
+	double meanY = 0.0;
+	for (size_t i = 0; i < this->points.size(); ++i) {
+		if (this->points[i].locked) {
+			meanX += getDeviceTime(i);
+			meanY += this->points[i].arrival;
+		}
+	}
+	meanX /= std::max(n, size_t(1));
+	meanY /= std::max(n, size_t(1));
+	double sxy = 0.0;
+	double sxx = 0.0;
+	for (size_t i = 0; i < this->points.size(); ++i) {
+		if (!this->points[i].locked)
+			continue;
+		double dx = getDeviceTime(i) - meanX;
+		sxy += dx * (this->points[i].arrival - meanY);
+		sxx += dx * dx;
+	}
+	slope = sxx > 0.0 ? sxy / sxx : 1.0;
+	offset = meanY - slope * meanX;
+}
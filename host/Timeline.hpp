@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Histogram.hpp"
+#include "../protocol.h"
+
+
+/**
+	Device clock timeline of an adc stream with timestamps (AdcConfig.timestamp, see protocol.h). Unwraps the frame
+	numbers and cycle counters of the packets, estimates the drift of the device clock against the usb frames and
+	against the clock of the host and collects the jitter of the packets. The gap between two packets has to be less
+	than 2048 frames. Packets stamped while the device was not locked to the sofs (LCK of USB_FNR is clear) are
+	left out of the drift and jitter
+*/
+class Timeline {
+public:
+	/**
+		Add the timestamp of a packet, the packets have to be added in the order of the stream
+		@param timestamp timestamp of the packet
+		@param arrival arrival time of the packet on the host in seconds, e.g. when its transfer has completed
+	*/
+	void add(StreamTimestamp const &timestamp, double arrival);
+
+	/**
+		Get the number of packets
+	*/
+	size_t count() const {return this->points.size();}
+
+	/**
+		Get the number of packets that were stamped while the device was not locked to the sofs, e.g. after a reset
+		or when sofs were missed
+	*/
+	size_t getUnlocked() const {return this->unlocked;}
+
+	/**
+		Get the device time of a packet
+		@param index index of the packet
+		@return time in seconds since the first packet
+	*/
+	double getDeviceTime(size_t index) const;
+
+	/**
+		Get the frame of the last sof before a packet. All devices on a bus see the same frames, therefore the frame
+		relates the timelines of several devices
+		@param index index of the packet
+		@return frame number without wrap-around, the first packet has the frame number of its timestamp
+	*/
+	int64_t getFrame(size_t index) const;
+
+	/**
+		Get the drift of the device clock against the sofs of the host controller between the first and the last
+		locked packet
+		@return drift in ppm, positive if the device clock is fast
+	*/
+	double getFrameDrift() const;
+
+	/**
+		Get the drift of the device clock against the clock of the host, a linear regression of the arrival times
+		over the device times
+		@return drift in ppm, positive if the device clock is fast
+	*/
+	double getHostDrift() const;
+
+	/**
+		Get the device time between consecutive packets in nanoseconds
+	*/
+	Histogram getIntervals() const;
+
+	/**
+		Get the position of the packets in their frame (time since the sof) in nanoseconds
+	*/
+	Histogram getFramePositions() const;
+
+	/**
+		Get the jitter of the arrival times in nanoseconds: the deviation from the regression line over the device
+		times minus the smallest deviation
+	*/
+	Histogram getArrivalJitter() const;
+
+protected:
+	// linear regression arrival = offset + slope * device time over the locked packets
+	void fit(double &offset, double &slope) const;
+
+	struct Point {
+		// cycle counters and sof frame without wrap-around
+		int64_t cycles;
+		int64_t sofCycles;
+		int64_t sofFrame;
+
+		// arrival time relative to the first packet
+		double arrival;
+
+		// the device was locked to the sofs
+		bool locked;
+	};
+	std::vector<Point> points;
+	size_t unlocked = 0;
+
+	// timestamp of the previous packet and arrival time of the first one
+	StreamTimestamp last = {};
+	double firstArrival = 0;
+};
@@ -0,0 +1,132 @@
+#include "Trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+
+namespace {
+
+// device tracks: one per endpoint, then the state of the control endpoint and the bus events
+constexpr int STATE_TRACK = STATS_ENDPOINT_COUNT;
+constexpr int BUS_TRACK = STATS_ENDPOINT_COUNT + 1;
+
+// states of the control endpoint in the order of enum UsbMode in usb.c
+const char *const STATE_NAMES[] = {"IDLE", "SET_ADDRESS", "AWAIT_TX", "GET_DESCRIPTOR", "RECEIVE_DATA"};
+
+const char *getStateName(int state) {
+	return state < int(sizeof(STATE_NAMES) / sizeof(STATE_NAMES[0])) ? STATE_NAMES[state] : "unknown";
+}
+
+} // namespace
+
+
+void Trace::addRecords(const void *data, int size, double arrival) {
+	auto d = static_cast<const uint8_t *>(data);
+	size_t first = this->records.size();
+	for (int i = 0; i + int(sizeof(TraceRecord)) <= size; i += sizeof(TraceRecord)) {
+		TraceRecord record;
+		memcpy(&record, d + i, sizeof(TraceRecord));
+
+		// the cycle counter wraps around after 2^32 cycles
+		this->cycles = this->started ? this->cycles + uint32_t(record.cycles - this->lastCycles) : record.cycles;
+		this->lastCycles = record.cycles;
+		this->started = true;
+		if (record.event == TRACE_LOST) {
+			this->lost += record.value;
+			continue;
+		}
+		this->records.push_back({this->cycles, record.event, record.arg, record.value});
+	}
+
+	// the last record of the transfer was written before the transfer arrived
+	if (this->records.size() > first) {
+		double offset = arrival - double(this->records.back().cycles) / CPU_CLOCK;
+		if (!this->aligned || offset < this->offset)
+			this->offset = offset;
+		this->aligned = true;
+	}
+}
+
+void Trace::addHostEvent(const char *track, const char *name, double time, int bytes) {
+	this->hostEvents.push_back({track, name, time, bytes});
+}
+
+double Trace::getHostTime(size_t index) const {
+	return double(this->records[index].cycles) / CPU_CLOCK + this->offset;
+}
+
+bool Trace::writeJson(FILE *file) const {
+	// the trace starts at the earliest event
+	double start = this->records.empty() ? 0.0 : getHostTime(0);
+	for (HostEvent const &event : this->hostEvents)
+		start = std::min(start, event.time);
+	auto us = [start](double time) {return (time - start) * 1e6;};
+
+	fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"device\"}},\n");
+	for (int ep = 0; ep < STATS_ENDPOINT_COUNT; ++ep) {
+		fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": "
+			"\"ep%d\"}},\n", ep, ep);
+	}
+	fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": "
+		"\"control state\"}},\n", STATE_TRACK);
+	fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": "
+		"\"bus\"}},\n", BUS_TRACK);
+
+	// a state lasts until the next state change or the end of the trace
+	std::vector<double> stateEnds(this->records.size());
+	double end = this->records.empty() ? 0.0 : getHostTime(this->records.size() - 1);
+	for (size_t i = this->records.size(); i > 0; --i) {
+		stateEnds[i - 1] = end;
+		if (this->records[i - 1].event == TRACE_STATE)
+			end = getHostTime(i - 1);
+	}
+
+	// records of the device
+	for (size_t i = 0; i < this->records.size(); ++i) {
+		Record const &record = this->records[i];
+		double ts = us(getHostTime(i));
+		switch (record.event) {
+		case TRACE_RESET:
+			fprintf(file, "{\"name\": \"reset\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, "
+				"\"tid\": %d},\n", ts, BUS_TRACK);
+			break;
+		case TRACE_SETUP:
+			fprintf(file, "{\"name\": \"setup 0x%02x 0x%02x\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, "
+				"\"tid\": 0, \"args\": {\"bmRequestType\": %d, \"bRequest\": %d}},\n", record.arg, record.value, ts,
+				record.arg, record.value);
+			break;
+		case TRACE_CTR_RX:
+		case TRACE_CTR_TX:
+			fprintf(file, "{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d, "
+				"\"args\": {\"register\": \"0x%04x\"}},\n", record.event == TRACE_CTR_RX ? "rx" : "tx", ts,
+				record.arg, record.value);
+			break;
+		case TRACE_STATE:
+			fprintf(file, "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d, "
+				"\"args\": {\"previous\": \"%s\"}},\n", getStateName(record.arg), ts, us(stateEnds[i]) - ts,
+				STATE_TRACK, getStateName(record.value));
+			break;
+		case TRACE_STALL:
+			fprintf(file, "{\"name\": \"stall\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 1, "
+				"\"tid\": %d},\n", ts, record.arg);
+			break;
+		}
+	}
+
+	// events of the host, a track per name in the order of appearance
+	fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"host\"}}");
+	std::map<std::string, int> tracks;
+	for (HostEvent const &event : this->hostEvents) {
+		auto it = tracks.find(event.track);
+		if (it == tracks.end()) {
+			it = tracks.emplace(event.track, int(tracks.size())).first;
+			fprintf(file, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 2, \"tid\": %d, \"args\": {\"name\": "
+				"\"%s\"}}", it->second, event.track.c_str());
+		}
+		fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, \"pid\": 2, \"tid\": %d, "
+			"\"args\": {\"bytes\": %d}}", event.name.c_str(), us(event.time), it->second, event.bytes);
+	}
+	fprintf(file, "\n]}\n");
+	return !ferror(file);
+}
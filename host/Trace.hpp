@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "../protocol.h"
+
+
+/**
+	Event trace of the device (see event trace in protocol.h) next to events of the host. Unwraps the cycle counter of
+	the records, places them on the clock of the host and writes everything as Chrome trace JSON that can be opened
+	in Perfetto (ui.perfetto.dev) or chrome://tracing. Not thread safe, e.g. call it only from the thread that
+	handles the events of the context
+*/
+class Trace {
+public:
+	/**
+		Add the records of a transfer from the trace endpoint, the transfers have to be added in the order of arrival
+		@param data records, does not need to be aligned
+		@param size size of the data in bytes, a multiple of sizeof(TraceRecord)
+		@param arrival arrival time of the transfer on the host in seconds
+	*/
+	void addRecords(const void *data, int size, double arrival);
+
+	/**
+		Add an event of the host, e.g. a completed transfer
+		@param track name of the track in the trace, e.g. "ep1 in"
+		@param name name of the event
+		@param time time in seconds on the clock of the arrival times
+		@param bytes number of bytes, e.g. of the transfer
+	*/
+	void addHostEvent(const char *track, const char *name, double time, int bytes);
+
+	/**
+		Get the number of records of the device, TRACE_LOST records are not included
+	*/
+	size_t count() const {return this->records.size();}
+
+	/**
+		Get the number of records that the device has overwritten before they were sent
+	*/
+	uint64_t getLost() const {return this->lost;}
+
+	/**
+		Get the event of a record
+		@param index index of the record
+	*/
+	TraceEvent getEvent(size_t index) const {return TraceEvent(this->records[index].event);}
+
+	/**
+		Get the time of a record on the clock of the host. A record was written before the transfer that contains it
+		arrived, therefore the offset between the clocks is the smallest difference between the arrival of a transfer
+		and the device time of its last record. The drift of the device clock is not corrected
+		@param index index of the record
+		@return time in seconds
+	*/
+	double getHostTime(size_t index) const;
+
+	/**
+		Write the trace as Chrome trace JSON. The device is one process with a track per endpoint, the state of the
+		control endpoint and the bus events, the host is another process with the tracks of the host events
+		@param file file opened for writing
+		@return true on success
+	*/
+	bool writeJson(FILE *file) const;
+
+protected:
+	struct Record {
+		// cycle counter without wrap-around
+		int64_t cycles;
+
+		uint8_t event;
+		uint8_t arg;
+		uint16_t value;
+	};
+	std::vector<Record> records;
+
+	struct HostEvent {
+		std::string track;
+		std::string name;
+		double time;
+		int bytes;
+	};
+	std::vector<HostEvent> hostEvents;
+
+	// cycle counter of the previous record as received and without wrap-around
+	uint32_t lastCycles = 0;
+	int64_t cycles = 0;
+	bool started = false;
+
+	// smallest arrival minus device time in seconds, valid when aligned is set
+	double offset = 0;
+	bool aligned = false;
+
+	uint64_t lost = 0;
+};
@@ -0,0 +1,981 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <libusb.h>
+#include "BufferPool.hpp"
+#include "Codec.hpp"
+#include "CommandQueue.hpp"
+#include "Context.hpp"
+#include "Crc.hpp"
+#include "Device.hpp"
+#include "Framing.hpp"
+#include "Pipeline.hpp"
+#include "Script.hpp"
+#include "Timeline.hpp"
+#include "Trace.hpp"
+#include "usb.hpp"
+extern "C" {
+#include "../codec.h"
+}
+
+// bulk throughput benchmark using the source/sink mode of the firmware, similar to linux gadget zero
+
+
+// checks that received data follows the pattern
+struct PatternChecker {
+	int maxPacketSize;
+	bool synced = false;
+	uint8_t offset = 0;
+	uint64_t packets = 0;
+	uint64_t skipped = 0;
+	uint64_t errors = 0;
+
+	void check(uint8_t const *data, int length) {
+		this->packets += length == 0 ? 1 : (length + this->maxPacketSize - 1) / this->maxPacketSize;
+
+		// a short packet that was queued before the mode switch may arrive first, therefore sync to the first
+		// transfer that consists of full packets
+		if (!this->synced) {
+			if (length == 0 || length % this->maxPacketSize != 0) {
+				++this->skipped;
+				return;
+			}
+			this->synced = true;
+			this->offset = data[0] % PATTERN_LENGTH;
+		}
+
+		uint8_t offset = this->offset;
+		for (int i = 0; i < length; ++i) {
+			if (data[i] != offset)
+				++this->errors;
+			offset = offset == PATTERN_LENGTH - 1 ? 0 : offset + 1;
+		}
+		this->offset = offset;
+	}
+};
+
+// generates the pattern
+struct PatternGenerator {
+	int maxPacketSize;
+	uint8_t offset = 0;
+	uint64_t packets = 0;
+
+	int fill(uint8_t *data, int length) {
+		this->packets += (length + this->maxPacketSize - 1) / this->maxPacketSize;
+
+		uint8_t offset = this->offset;
+		for (int i = 0; i < length; ++i) {
+			data[i] = offset;
+			offset = offset == PATTERN_LENGTH - 1 ? 0 : offset + 1;
+		}
+		this->offset = offset;
+		return length;
+	}
+};
+
+static void printResult(const char *name, uint64_t bytes, uint64_t packets, uint64_t errors, double seconds) {
+	printf("%-4s %8.3f MB/s %10.0f packets/s %llu errors\n", name, double(bytes) / seconds * 1e-6,
+		double(packets) / seconds, (unsigned long long)errors);
+}
+
+static void printBuffers(BufferPool &pool, uint64_t copies) {
+	printf("     buffers: %llu allocated (%llu in device memory), %llu reused, %llu kernel copies\n",
+		(unsigned long long)pool.allocations, (unsigned long long)pool.deviceAllocations,
+		(unsigned long long)pool.reuses, (unsigned long long)copies);
+}
+
+// send transfers to the device in loopback mode and check the data that comes back
+static int benchmarkLoopback(Device &device, int duration, int size) {
+	int r = device.vendorOut(VENDOR_SET_MODE, MODE_LOOPBACK);
+	if (r < 0) {
+		fprintf(stderr, "set mode error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+
+	// transfer buffers, in device memory if possible. The device ends a reply of LOOPBACK_SIZE bytes with a zero length
+	// packet, the in buffer has room for one more packet so that the zero length packet ends the read instead of the
+	// full buffer and does not get left over for the next read
+	constexpr int IN_SIZE = LOOPBACK_SIZE + 64;
+	BufferPool pool(device.getHandle(), IN_SIZE);
+	uint8_t *outData = pool.allocate();
+	uint8_t *inData = pool.allocate();
+	if (outData == nullptr || inData == nullptr) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	bool deviceMemory = pool.isDeviceMemory(outData) && pool.isDeviceMemory(inData);
+
+	// drain data that was queued before the mode switch
+	while (device.read(USB_IN | 1, inData, IN_SIZE, 100).get() >= 0)
+		;
+
+	// a transfer that fills the buffer of the device ends without zero length packet
+	bool zeroPacket = size < LOOPBACK_SIZE;
+
+	uint64_t transfers = 0;
+	uint64_t errors = 0;
+	auto start = std::chrono::steady_clock::now();
+	auto end = start + std::chrono::seconds(duration);
+	while (std::chrono::steady_clock::now() < end) {
+		for (int i = 0; i < size; ++i)
+			outData[i] = uint8_t(i + transfers);
+
+		// start the read first so that the host controller polls for the reply immediately
+		auto received = device.read(USB_IN | 1, inData, IN_SIZE, 1000);
+		auto sent = device.write(USB_OUT | 2, outData, size, zeroPacket, 1000);
+		if (sent.get() != size) {
+			// the device does not send anything back
+			device.cancel();
+			received.wait();
+			++errors;
+			break;
+		}
+		if (received.get() != size || memcmp(inData, outData, size) != 0)
+			++errors;
+		++transfers;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("loopback: %llu transfers of %d bytes, duration %.3f s\n", (unsigned long long)transfers, size, seconds);
+	printf("%8.3f MB/s each direction, %8.1f us per round trip, %llu errors\n",
+		double(transfers * size) / seconds * 1e-6, seconds / double(transfers) * 1e6, (unsigned long long)errors);
+	printBuffers(pool, deviceMemory ? 0 : transfers * 2);
+
+	// back to default mode
+	device.vendorOut(VENDOR_SET_MODE, MODE_LED);
+	return errors == 0 ? 0 : 1;
+}
+
+// send small messages to the device and count the replies, once with one message per packet in echo mode and once
+// with many messages per packet in framed mode
+static int benchmarkMessages(Device &device, int duration, int count, int messageSize, int flushTimeout) {
+	libusb_device_handle *handle = device.getHandle();
+	int maxPacketSize = device.getMaxPacketSize(USB_IN | 1);
+	uint64_t echoMessages = 0;
+	double echoSeconds = 0;
+
+	// echo mode: each message is a transfer of one packet, the device sends each packet back
+	int r = device.vendorOut(VENDOR_SET_MODE, MODE_ECHO);
+	if (r < 0) {
+		fprintf(stderr, "set mode error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+	{
+		Pipeline replies(handle, USB_IN | 1, count, maxPacketSize, [](uint8_t *data, int length) {
+			return 0;
+		});
+		Pipeline requests(handle, USB_OUT | 2, count, maxPacketSize, [messageSize](uint8_t *data, int length) {
+			memset(data, 0, messageSize);
+			return messageSize;
+		});
+		auto start = std::chrono::steady_clock::now();
+		replies.start();
+		requests.start();
+		usleep(duration * 1000000);
+		requests.stop();
+		replies.stop();
+		echoSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		echoMessages = replies.transfers;
+	}
+
+	// framed mode: messages are packed into packets, the device packs the replies the same way
+	r = device.vendorOut(VENDOR_SET_MODE, MODE_FRAMED);
+	if (r >= 0)
+		r = device.vendorOut(VENDOR_SET_FLUSH_TIMEOUT, flushTimeout);
+	if (r < 0) {
+		fprintf(stderr, "set mode error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+	uint64_t errors = 0;
+	uint64_t framedMessages = 0;
+	uint64_t framedPackets = 0;
+	uint64_t lostPackets = 0;
+	double framedSeconds = 0;
+	{
+		// the replies are checked by the event thread
+		uint32_t expected = 0;
+		FrameReader reader([&expected, &errors](int type, const uint8_t *data, int length) {
+			uint32_t sequence;
+			memcpy(&sequence, data, sizeof(sequence));
+			if (type != MESSAGE_ECHO || sequence != expected)
+				++errors;
+			expected = sequence + 1;
+		});
+		Pipeline replies(handle, USB_IN | 1, count, 64 * maxPacketSize, [&reader](uint8_t *data, int length) {
+			reader.read(data, length);
+			return 0;
+		});
+		FrameWriter writer(device, USB_OUT | 2, 64 * FRAME_PACKET_SIZE, count, flushTimeout);
+		uint8_t message[MESSAGE_MAX_LENGTH] = {};
+		uint32_t sequence = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		auto end = start + std::chrono::seconds(duration);
+		replies.start();
+		while (std::chrono::steady_clock::now() < end) {
+			for (int i = 0; i < 1000; ++i, ++sequence) {
+				memcpy(message, &sequence, sizeof(sequence));
+				if (writer.write(MESSAGE_ECHO, message, messageSize) < 0)
+					++errors;
+			}
+			writer.update();
+		}
+		writer.finish();
+
+		// wait for the replies of the last packets that the device sends after its flush timeout
+		usleep((flushTimeout + 10) * 1000);
+		replies.stop();
+		framedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		framedMessages = reader.messages;
+		framedPackets = reader.packets;
+		lostPackets = reader.lostPackets;
+	}
+
+	printf("messages of %d bytes, %d transfers in flight, flush timeout %d ms\n", messageSize, count, flushTimeout);
+	printf("echo   %10.0f messages/s, 1 message per packet\n", double(echoMessages) / echoSeconds);
+	printf("framed %10.0f messages/s, %.1f messages per packet, %llu lost packets, %llu errors\n",
+		double(framedMessages) / framedSeconds, framedPackets > 0 ? double(framedMessages) / framedPackets : 0.0,
+		(unsigned long long)lostPackets, (unsigned long long)errors);
+
+	// back to default mode
+	device.vendorOut(VENDOR_SET_MODE, MODE_LED);
+	return errors == 0 && lostPackets == 0 ? 0 : 1;
+}
+
+// execute gpio commands, once waiting for each completion and once with up to count * 64 commands in flight
+static int benchmarkCommands(Device &device, int duration, int count, int flushTimeout) {
+	int errors = 0;
+	uint64_t syncCommands = 0;
+	uint64_t pipelinedCommands = 0;
+	double syncSeconds = 0;
+	double pipelinedSeconds = 0;
+	{
+		CommandQueue queue(device, count, 16 * FRAME_PACKET_SIZE, flushTimeout);
+		if (queue.getError() < 0) {
+			fprintf(stderr, "command queue error: %s\n", libusb_error_name(queue.getError()));
+			return 1;
+		}
+
+		// toggle PB5 which is not connected on the bluepill board
+		queue.gpioMode(COMMAND_PORT_B, 1 << 5, 2);
+		queue.flush();
+
+		// synchronous: one round trip per command
+		auto start = std::chrono::steady_clock::now();
+		auto end = start + std::chrono::seconds(duration) / 2;
+		while (std::chrono::steady_clock::now() < end) {
+			auto completion = queue.gpioWrite(COMMAND_PORT_B, 1 << 5, uint16_t(syncCommands << 5));
+			queue.flush();
+			if (completion.get().status != COMMAND_OK)
+				++errors;
+			++syncCommands;
+		}
+		syncSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// pipelined: a batch of writes each followed by a read that checks the written value
+		int batch = count * 64;
+		std::vector<std::future<Completion>> completions;
+		start = std::chrono::steady_clock::now();
+		end = start + std::chrono::seconds(duration) / 2;
+		while (std::chrono::steady_clock::now() < end) {
+			completions.clear();
+			for (int i = 0; i < batch; i += 2) {
+				completions.push_back(queue.gpioWrite(COMMAND_PORT_B, 1 << 5, uint16_t(i << 4)));
+				completions.push_back(queue.gpioRead(COMMAND_PORT_B, 1 << 5));
+			}
+			queue.flush();
+			for (int i = 0; i < batch; i += 2) {
+				Completion write = completions[i].get();
+				Completion read = completions[i + 1].get();
+				if (write.status != COMMAND_OK || read.status != COMMAND_OK || read.value != ((i << 4) & (1 << 5)))
+					++errors;
+			}
+			pipelinedCommands += batch;
+		}
+		pipelinedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	printf("gpio commands, flush timeout %d ms\n", flushTimeout);
+	printf("synchronous %10.0f commands/s, %8.1f us per command\n", double(syncCommands) / syncSeconds,
+		syncSeconds / double(syncCommands) * 1e6);
+	printf("pipelined   %10.0f commands/s, %8.1f us per command, %d errors\n",
+		double(pipelinedCommands) / pipelinedSeconds, pipelinedSeconds / double(pipelinedCommands) * 1e6, errors);
+
+	// back to default mode
+	device.vendorOut(VENDOR_SET_MODE, MODE_LED);
+	return errors == 0 ? 0 : 1;
+}
+
+// run a sequence of gpio steps, once with one round trip per step and once as a script
+static int benchmarkScript(Device &device, int steps) {
+	int errors = 0;
+	double commandSeconds;
+	{
+		// synchronous commands: toggle PB5 and read it back
+		CommandQueue queue(device, 1, 16 * FRAME_PACKET_SIZE, 0);
+		if (queue.getError() < 0) {
+			fprintf(stderr, "command queue error: %s\n", libusb_error_name(queue.getError()));
+			return 1;
+		}
+		queue.gpioMode(COMMAND_PORT_B, 1 << 5, 2);
+		queue.flush();
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < steps; ++i) {
+			auto write = queue.gpioWrite(COMMAND_PORT_B, 1 << 5, uint16_t(i << 5));
+			queue.flush();
+			auto read = queue.gpioRead(COMMAND_PORT_B, 1 << 5);
+			queue.flush();
+			if (write.get().status != COMMAND_OK || read.get().value != ((i << 5) & (1 << 5)))
+				++errors;
+		}
+		commandSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// the same steps as script
+	Script script;
+	script.loop(uint16_t(steps / 2)).gpioClear(COMMAND_PORT_B, 1 << 5).gpioRead(COMMAND_PORT_B, 1 << 5)
+		.gpioSet(COMMAND_PORT_B, 1 << 5).gpioRead(COMMAND_PORT_B, 1 << 5).loopEnd();
+	int r = device.vendorOut(VENDOR_SET_MODE, MODE_SCRIPT);
+	if (r >= 0)
+		r = script.upload(device);
+	if (r < 0) {
+		fprintf(stderr, "upload script error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+
+	// drain data that was queued before the mode switch
+	uint8_t drain[64];
+	while (device.read(USB_IN | 1, drain, sizeof(drain), 100).get() >= 0)
+		;
+
+	ScriptResult result = {};
+	std::vector<uint8_t> data;
+	auto start = std::chrono::steady_clock::now();
+	r = Script::run(device, result, data);
+	double scriptSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (r < 0) {
+		fprintf(stderr, "run script error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+	if (result.status != SCRIPT_OK) {
+		fprintf(stderr, "script failed with status %d at offset %d\n", result.status, result.offset);
+		return 1;
+	}
+	for (size_t i = 0; i + 1 < data.size(); i += 2) {
+		uint16_t value = data[i] | (data[i + 1] << 8);
+		if (value != ((i / 2) % 2 == 0 ? 0 : 1 << 5))
+			++errors;
+	}
+
+	printf("%d gpio steps (write and read back)\n", steps);
+	printf("commands %10.3f ms\n", commandSeconds * 1e3);
+	printf("script   %10.3f ms including the round trip, %.3f ms on the device, %d errors\n",
+		scriptSeconds * 1e3, double(result.cycles) / CPU_CLOCK * 1e3, errors);
+
+	// back to default mode
+	device.vendorOut(VENDOR_SET_MODE, MODE_LED);
+	return errors == 0 ? 0 : 1;
+}
+
+// checks the sequence numbers of the adc stream, decodes compressed packets and verifies the crc of each block
+struct StreamChecker {
+	const SampleDecoder *decoder = nullptr;
+	const Crc32 *crc = nullptr;
+	Timeline *timeline = nullptr;
+	bool synced = false;
+	uint16_t sequence = 0;
+
+	// packets of samples
+	uint64_t packets = 0;
+	uint64_t samples = 0;
+	uint64_t dropped = 0;
+	uint64_t skipped = 0;
+	uint64_t errors = 0;
+
+	// samples of the current block, size counts beyond ADC_BLOCK_SIZE if the start of the block was missed
+	uint8_t block[ADC_BLOCK_SIZE];
+	int blockSize = 0;
+
+	// blocks with matching crc, with crc error and incomplete blocks that could not be verified
+	uint64_t blocks = 0;
+	uint64_t crcErrors = 0;
+	uint64_t unverified = 0;
+
+	void check(uint8_t const *data, int length) {
+		double arrival = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		int offset = 0;
+		for (; offset + 64 <= length; offset += 64) {
+			StreamHeader header;
+			memcpy(&header, data + offset, sizeof(header));
+			next(header.sequence);
+			++this->packets;
+
+			// the timestamp is followed by fewer samples
+			const uint8_t *payload = data + offset + sizeof(header);
+			int size = ADC_PACKET_DATA;
+			if (this->timeline != nullptr) {
+				StreamTimestamp timestamp;
+				memcpy(&timestamp, payload, sizeof(timestamp));
+				this->timeline->add(timestamp, arrival);
+				payload += sizeof(timestamp);
+				size = ADC_TIMESTAMP_PACKET_DATA;
+			}
+
+			int16_t samples[CODEC_MAX_SAMPLES];
+			int count = size / 2;
+			if (this->decoder != nullptr) {
+				count = this->decoder->decode(payload, size, samples);
+				if (count < 0) {
+					++this->errors;
+					count = 0;
+				}
+			} else {
+				memcpy(samples, payload, size);
+			}
+			this->samples += count;
+			if (this->blockSize + count * 2 <= ADC_BLOCK_SIZE)
+				memcpy(this->block + this->blockSize, samples, count * 2);
+			this->blockSize += count * 2;
+		}
+
+		if (offset < length) {
+			if (this->crc != nullptr && length - offset == int(sizeof(StreamCrc))) {
+				// the crc packet ends the block
+				StreamCrc crc;
+				memcpy(&crc, data + offset, sizeof(crc));
+				next(crc.sequence);
+				if (this->blockSize != ADC_BLOCK_SIZE)
+					++this->unverified;
+				else if (this->crc->calculate(this->block, ADC_BLOCK_SIZE) == crc.crc)
+					++this->blocks;
+				else
+					++this->crcErrors;
+				this->blockSize = 0;
+			} else {
+				// a short packet that was queued before the mode switch
+				++this->skipped;
+			}
+		}
+	}
+
+	void next(uint16_t sequence) {
+		// a gap means that the rest of a block was dropped, the next block starts with this packet
+		if (this->synced && sequence != this->sequence) {
+			this->dropped += uint16_t(sequence - this->sequence);
+			this->blockSize = 0;
+		}
+		this->synced = true;
+		this->sequence = sequence + 1;
+	}
+};
+
+// stream adc samples and check for dropped packets
+static int benchmarkAdc(Device &device, int duration, int count, int size, uint32_t sampleRate, bool dual,
+	int codec, bool crc, bool timestamp)
+{
+	AdcConfig config = {sampleRate, 0, 1, uint8_t(dual), uint8_t(codec), uint8_t(crc), uint8_t(timestamp)};
+	int r = device.vendorOut(VENDOR_SET_ADC_CONFIG, 0, &config, sizeof(config));
+	if (r < 0) {
+		fprintf(stderr, "set adc config error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+
+	SampleDecoder decoder(dual ? 2 : 1);
+	Crc32 blockCrc;
+	StreamChecker checker;
+	if (codec == ADC_CODEC_DELTA)
+		checker.decoder = &decoder;
+	if (crc)
+		checker.crc = &blockCrc;
+	Timeline timeline;
+	if (timestamp)
+		checker.timeline = &timeline;
+	Pipeline stream(device.getHandle(), USB_IN | 1, count, size & ~63, [&checker](uint8_t *data, int length) {
+		checker.check(data, length);
+		return 0;
+	});
+	stream.start();
+	r = device.vendorOut(VENDOR_SET_MODE, MODE_ADC);
+	if (r < 0) {
+		fprintf(stderr, "set mode error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+	auto start = std::chrono::steady_clock::now();
+	usleep(duration * 1000000);
+	Counters counters = {};
+	r = device.vendorIn(VENDOR_GET_COUNTERS, 0, &counters, sizeof(counters));
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	device.vendorOut(VENDOR_SET_MODE, MODE_LED);
+	stream.stop();
+	if (r < int(sizeof(counters)))
+		fprintf(stderr, "get counters error: %s\n", libusb_error_name(r));
+
+	double samples = double(checker.samples) / (dual ? 2 : 1);
+	printf("adc %s mode at %u samples/s, duration %.3f s\n", dual ? "dual" : "single", sampleRate, seconds);
+	printf("%10.0f samples/s received, %8.3f MB/s, %llu packets dropped\n", samples / seconds,
+		double(checker.packets) * 64 / seconds * 1e-6, (unsigned long long)checker.dropped);
+	if (codec == ADC_CODEC_DELTA) {
+		printf("     %s decoder, %.2f bits/sample, %llu malformed packets\n", SampleDecoder::getName(decoder.getIsa()),
+			double(checker.packets) * (timestamp ? ADC_TIMESTAMP_PACKET_DATA : ADC_PACKET_DATA) * 8
+				/ std::max(double(checker.samples), 1.0),
+			(unsigned long long)checker.errors);
+	}
+	if (crc) {
+		printf("     %s crc, %llu blocks verified, %llu crc errors, %llu incomplete\n",
+			Crc32::getName(blockCrc.getIsa()), (unsigned long long)checker.blocks,
+			(unsigned long long)checker.crcErrors, (unsigned long long)checker.unverified);
+	}
+	if (timestamp && timeline.count() > 0) {
+		// the device clock against the usb frames and the host clock, the arrival jitter is mainly caused by the host
+		// controller which reports completed transfers once per frame or less often
+		printf("     %.3f s device time, device clock %+.1f ppm against usb frames, %+.1f ppm against host\n",
+			timeline.getDeviceTime(timeline.count() - 1), timeline.getFrameDrift(), timeline.getHostDrift());
+		printf("     %zu of %zu packets stamped without lock to the sofs, left out of drift and jitter\n",
+			timeline.getUnlocked(), timeline.count());
+		timeline.getIntervals().printPercentiles("interval", 1000.0, "us");
+		timeline.getFramePositions().printPercentiles("in frame", 1000.0, "us");
+		Histogram jitter = timeline.getArrivalJitter();
+		jitter.printPercentiles("arrival", 1000.0, "us");
+		jitter.printBuckets(1000.0, "us");
+	}
+	printf("device: %u blocks, %u with backpressure, %u dropped\n", counters.adcBlocks, counters.adcBackpressure,
+		counters.adcOverflows);
+	return checker.dropped == 0 && checker.errors == 0 && checker.crcErrors == 0 ? 0 : 1;
+}
+
+// encode a synthetic 12 bit signal like the firmware does and measure the decoder, needs no device
+static int benchmarkCodec(int duration, bool dual) {
+	int stride = dual ? 2 : 1;
+
+	// noisy sine waves, the second channel with a different frequency
+	std::vector<uint16_t> signal(ADC_BLOCK_SIZE / 2 * 64);
+	uint32_t random = 1;
+	for (size_t i = 0; i < signal.size(); ++i) {
+		random = random * 1664525 + 1013904223;
+		double frequency = i % stride == 0 ? 0.001 : 0.0037;
+		double value = 2048 + 1500 * sin(double(i / stride) * 2 * M_PI * frequency) + int(random >> 29) - 4;
+		signal[i] = uint16_t(value);
+	}
+
+	// encode into packet payloads, each block separately as the firmware does
+	std::vector<uint8_t> payloads;
+	std::vector<int> counts;
+	for (size_t block = 0; block < signal.size(); block += ADC_BLOCK_SIZE / 2) {
+		int offset = 0;
+		while (offset < ADC_BLOCK_SIZE / 2) {
+			uint8_t payload[ADC_PACKET_DATA];
+			int count = codecEncode(signal.data() + block + offset, ADC_BLOCK_SIZE / 2 - offset, stride, payload,
+				ADC_PACKET_DATA);
+			payloads.insert(payloads.end(), payload, payload + ADC_PACKET_DATA);
+			counts.push_back(count);
+			offset += count;
+		}
+	}
+	int packets = int(counts.size());
+	printf("codec %s mode: %.2f bits/sample, ratio %.2f\n", dual ? "dual" : "single",
+		double(payloads.size()) * 8 / signal.size(), double(signal.size()) * 2 / payloads.size());
+
+	int errors = 0;
+	for (int isa = SampleDecoder::SCALAR; isa <= SampleDecoder::detectIsa(); ++isa) {
+		SampleDecoder decoder(stride, SampleDecoder::Isa(isa));
+
+		// check the round trip once
+		int16_t samples[CODEC_MAX_SAMPLES];
+		const uint16_t *expected = signal.data();
+		for (int packet = 0; packet < packets; ++packet) {
+			int count = decoder.decode(payloads.data() + packet * ADC_PACKET_DATA, ADC_PACKET_DATA, samples);
+			if (count != counts[packet] || memcmp(samples, expected, count * 2) != 0) {
+				++errors;
+				break;
+			}
+			expected += count;
+		}
+
+		// decode repeatedly for the given duration
+		uint64_t decoded = 0;
+		auto start = std::chrono::steady_clock::now();
+		double seconds;
+		do {
+			for (int packet = 0; packet < packets; ++packet)
+				decoded += decoder.decode(payloads.data() + packet * ADC_PACKET_DATA, ADC_PACKET_DATA, samples);
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} while (seconds < duration);
+		printf("%6s: %8.1f Msamples/s, %6.3f GB/s decoded\n", SampleDecoder::getName(SampleDecoder::Isa(isa)),
+			double(decoded) / seconds * 1e-6, double(decoded) * 2 / seconds * 1e-9);
+	}
+	if (errors > 0)
+		printf("     %d decoders failed the round trip\n", errors);
+	return errors == 0 ? 0 : 1;
+}
+
+// measure the crc of adc blocks, needs no device. Full speed carries at most 19 bulk packets of 64 bytes per frame
+static int benchmarkCrc(int duration) {
+	std::vector<uint8_t> blocks(ADC_BLOCK_SIZE * 64);
+	uint32_t random = 1;
+	for (uint8_t &value : blocks) {
+		random = random * 1664525 + 1013904223;
+		value = uint8_t(random >> 24);
+	}
+	int count = int(blocks.size() / ADC_BLOCK_SIZE);
+	std::vector<uint32_t> expected;
+
+	int errors = 0;
+	for (int isa = Crc32::SCALAR; isa <= Crc32::detectIsa(); ++isa) {
+		Crc32 crc{Crc32::Isa(isa)};
+
+		// all implementations have to match the first one
+		for (int block = 0; block < count; ++block) {
+			uint32_t value = crc.calculate(blocks.data() + block * ADC_BLOCK_SIZE, ADC_BLOCK_SIZE);
+			if (isa == Crc32::SCALAR)
+				expected.push_back(value);
+			else if (value != expected[block])
+				++errors;
+		}
+
+		uint64_t bytes = 0;
+		uint32_t sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		double seconds;
+		do {
+			for (int block = 0; block < count; ++block)
+				sum += crc.calculate(blocks.data() + block * ADC_BLOCK_SIZE, ADC_BLOCK_SIZE);
+			bytes += blocks.size();
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		} while (seconds < duration);
+		double rate = double(bytes) / seconds;
+		printf("%12s: %7.3f GB/s, %8.0f boards at full speed line rate (checksum %08x)\n",
+			Crc32::getName(Crc32::Isa(isa)), rate * 1e-9, rate / (19 * 64 * 1000), sum);
+	}
+	if (errors > 0)
+		printf("     %d blocks with different crc\n", errors);
+	return errors == 0 ? 0 : 1;
+}
+
+// stream the pattern through the uart bridge, USART1 tx (PA9) has to be connected to rx (PA10)
+static int benchmarkUart(Device &device, int duration, int count, int size, uint32_t baudRate) {
+	UartConfig config = {baudRate, UART_PARITY_NONE, 1, 0};
+	int r = device.vendorOut(VENDOR_SET_UART_CONFIG, 0, &config, sizeof(config));
+	if (r < 0) {
+		fprintf(stderr, "set uart config error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+	r = device.vendorOut(VENDOR_SET_MODE, MODE_UART);
+	if (r < 0) {
+		fprintf(stderr, "set mode error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+
+	// the bridge forwards bursts as short transfers, the checker syncs to the first transfer of full packets
+	PatternChecker checker;
+	checker.maxPacketSize = device.getMaxPacketSize(USB_IN | 1);
+	PatternGenerator generator;
+	generator.maxPacketSize = device.getMaxPacketSize(USB_OUT | 2);
+	Pipeline source(device.getHandle(), USB_IN | 1, count, size, [&checker](uint8_t *data, int length) {
+		checker.check(data, length);
+		return 0;
+	});
+	Pipeline sink(device.getHandle(), USB_OUT | 2, count, size, [&generator](uint8_t *data, int length) {
+		return generator.fill(data, length);
+	});
+	auto start = std::chrono::steady_clock::now();
+	source.start();
+	sink.start();
+	usleep(duration * 1000000);
+	sink.stop();
+
+	// wait for the data that is still on the line
+	usleep(100000);
+	source.stop();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	Counters counters = {};
+	r = device.vendorIn(VENDOR_GET_COUNTERS, 0, &counters, sizeof(counters));
+	device.vendorOut(VENDOR_SET_MODE, MODE_LED);
+	if (r < int(sizeof(counters)))
+		fprintf(stderr, "get counters error: %s\n", libusb_error_name(r));
+
+	printf("uart bridge at %u baud, duration %.3f s\n", baudRate, seconds);
+	printResult("out", sink.bytes, generator.packets, 0, seconds);
+	printResult("in", source.bytes, checker.packets, checker.errors, seconds);
+	printf("device: %u bytes sent, %u received, %u dropped, %u bursts with errors\n", counters.uartTxBytes,
+		counters.uartRxBytes, counters.uartRxDropped, counters.uartErrors);
+	return checker.errors == 0 && counters.uartRxDropped == 0 ? 0 : 1;
+}
+
+// print cycles of the packet memory copy routines measured by the device
+static int benchmarkPma(libusb_device_handle *handle) {
+	PmaBenchmark benchmark = {};
+	int r = vendorIn(handle, VENDOR_GET_PMA_BENCHMARK, 0, &benchmark, sizeof(benchmark));
+	if (r < int(sizeof(benchmark))) {
+		fprintf(stderr, "get pma benchmark error: %s\n", libusb_error_name(r));
+		return 1;
+	}
+	const char *names[] = {"bytes", "half words", "words"};
+	printf("packet memory copy in cpu cycles (write/read)\n");
+	printf("%-10s", "size");
+	for (int s = 0; s < PMA_SIZE_COUNT; ++s)
+		printf(" %11d", 8 << s);
+	printf("\n");
+	for (int variant = 0; variant < PMA_VARIANT_COUNT; ++variant) {
+		printf("%-10s", names[variant]);
+		for (int s = 0; s < PMA_SIZE_COUNT; ++s)
+			printf(" %5u/%5u", benchmark.writeCycles[variant][s], benchmark.readCycles[variant][s]);
+		printf("\n");
+	}
+	return 0;
+}
+
+int main(int argc, const char **argv) {
+	// direction to benchmark, loopback or packet memory copy benchmark
+	bool in = false;
+	bool out = false;
+	bool loopback = false;
+	bool messages = false;
+	bool commands = false;
+	bool script = false;
+	bool adc = false;
+	bool uart = false;
+	bool pma = false;
+	bool codec = false;
+	bool crc = false;
+
+	// duration in seconds, number of transfers in flight per endpoint and size of each transfer. Each transfer
+	// consists of many packets, large transfers reduce the per transfer overhead of the host
+	int duration = 10;
+	int count = 8;
+	int size = 16384;
+
+	// sample rate, dual mode, codec, block crc and timestamps of the adc stream
+	uint32_t sampleRate = 500000;
+	bool dual = false;
+	int adcCodec = ADC_CODEC_NONE;
+	bool adcCrc = false;
+	bool adcTimestamp = false;
+
+	// baud rate of the uart bridge
+	uint32_t baudRate = 2000000;
+
+	// payload size of each message and flush timeout in milliseconds of the framed mode
+	int messageSize = 4;
+	int flushTimeout = 1;
+
+	// file for the event trace of the device next to the transfers of the host (firmware built with TRACE=1)
+	const char *traceFile = nullptr;
+
+	int i = 1;
+	if (argc >= 2) {
+		if (strcmp(argv[1], "in") == 0) {
+			in = true;
+		} else if (strcmp(argv[1], "out") == 0) {
+			out = true;
+		} else if (strcmp(argv[1], "both") == 0) {
+			in = true;
+			out = true;
+		} else if (strcmp(argv[1], "loopback") == 0) {
+			loopback = true;
+		} else if (strcmp(argv[1], "messages") == 0) {
+			messages = true;
+		} else if (strcmp(argv[1], "commands") == 0) {
+			commands = true;
+		} else if (strcmp(argv[1], "script") == 0) {
+			script = true;
+		} else if (strcmp(argv[1], "adc") == 0) {
+			adc = true;
+		} else if (strcmp(argv[1], "uart") == 0) {
+			uart = true;
+		} else if (strcmp(argv[1], "pma") == 0) {
+			pma = true;
+		} else if (strcmp(argv[1], "codec") == 0) {
+			codec = true;
+		} else if (strcmp(argv[1], "crc") == 0) {
+			crc = true;
+		}
+		++i;
+	}
+	for (; i < argc - 1; i += 2) {
+		if (strcmp(argv[i], "-t") == 0) {
+			duration = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-c") == 0) {
+			count = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-s") == 0) {
+			size = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-r") == 0) {
+			sampleRate = strtoul(argv[i + 1], nullptr, 10);
+		} else if (strcmp(argv[i], "-d") == 0) {
+			dual = atoi(argv[i + 1]) != 0;
+		} else if (strcmp(argv[i], "-z") == 0) {
+			adcCodec = atoi(argv[i + 1]) != 0 ? ADC_CODEC_DELTA : ADC_CODEC_NONE;
+		} else if (strcmp(argv[i], "-k") == 0) {
+			adcCrc = atoi(argv[i + 1]) != 0;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			adcTimestamp = atoi(argv[i + 1]) != 0;
+		} else if (strcmp(argv[i], "-b") == 0) {
+			baudRate = strtoul(argv[i + 1], nullptr, 10);
+		} else if (strcmp(argv[i], "-m") == 0) {
+			messageSize = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-f") == 0) {
+			flushTimeout = atoi(argv[i + 1]);
+		} else if (strcmp(argv[i], "-T") == 0) {
+			traceFile = argv[i + 1];
+		} else {
+			in = out = false;
+		}
+	}
+	if (!in && !out && !loopback && !messages && !commands && !script && !adc && !uart && !pma && !codec && !crc) {
+		fprintf(stderr, "usage: bench in|out|both [-t seconds] [-c transfers] [-s transfer-size]\n"
+			"           [-T trace.json]\n");
+		fprintf(stderr, "       bench loopback [-t seconds] [-s transfer-size]\n");
+		fprintf(stderr, "       bench messages [-t seconds] [-c transfers] [-m message-size] [-f flush-timeout-ms]\n");
+		fprintf(stderr, "       bench commands [-t seconds] [-c transfers] [-f flush-timeout-ms]\n");
+		fprintf(stderr, "       bench script [-c steps]\n");
+		fprintf(stderr, "       bench adc [-t seconds] [-c transfers] [-s transfer-size] [-r sample-rate] [-d 0|1]\n"
+			"           [-z 0|1] [-k 0|1] [-p 0|1]\n");
+		fprintf(stderr, "       bench uart [-t seconds] [-c transfers] [-s transfer-size] [-b baud-rate]\n");
+		fprintf(stderr, "       bench pma\n");
+		fprintf(stderr, "       bench codec [-t seconds] [-d 0|1]\n");
+		fprintf(stderr, "       bench crc [-t seconds]\n");
+		return 1;
+	}
+
+	// the codec and crc benchmarks run on the host only
+	if (codec)
+		return benchmarkCodec(duration, dual);
+	if (crc)
+		return benchmarkCrc(duration);
+
+	// libusb and its event thread, then the device (gets closed first)
+	Context context;
+	if (!context.isValid())
+		return context.getError();
+	Device device = Device::open(context);
+	if (!device.isOpen()) {
+		fprintf(stderr, "no device found\n");
+		return 1;
+	}
+	libusb_device_handle *handle = device.getHandle();
+
+	if (loopback)
+		return benchmarkLoopback(device, duration, std::min(size, LOOPBACK_SIZE));
+	if (messages) {
+		return benchmarkMessages(device, duration, count,
+			std::max(int(sizeof(uint32_t)), std::min(messageSize, int(MESSAGE_MAX_LENGTH))), flushTimeout);
+	}
+	if (commands)
+		return benchmarkCommands(device, duration, count, flushTimeout);
+	if (script)
+		return benchmarkScript(device, std::max(count, 2));
+	if (adc)
+		return benchmarkAdc(device, duration, count, size, sampleRate, dual, adcCodec, adcCrc, adcTimestamp);
+	if (uart)
+		return benchmarkUart(device, duration, count, size, baudRate);
+	if (pma)
+		return benchmarkPma(handle);
+
+	// switch firmware into source/sink mode, also resets the counters of the device
+	int r = device.vendorOut(VENDOR_SET_MODE, MODE_SOURCE_SINK);
+	if (r < 0) {
+		fprintf(stderr, "set mode error: %s\n", libusb_error_name(r));
+	} else {
+		PatternChecker checker;
+		checker.maxPacketSize = device.getMaxPacketSize(USB_IN | 1);
+		PatternGenerator generator;
+		generator.maxPacketSize = device.getMaxPacketSize(USB_OUT | 2);
+
+		// event trace of the device next to the completed transfers, the trace is only used by the event thread
+		Trace trace;
+		auto now = [] {
+			return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		};
+		std::unique_ptr<Pipeline> tracer;
+		if (traceFile != nullptr) {
+			tracer.reset(new Pipeline(handle, USB_IN | TRACE_ENDPOINT, 2, 4096, [&trace, now](uint8_t *data, int length) {
+				trace.addRecords(data, length, now());
+				return 0;
+			}));
+			tracer->start();
+		}
+
+		// the completion callbacks are called by the event thread of the context
+		bool tracing = traceFile != nullptr;
+		Pipeline source(handle, USB_IN | 1, count, size, [&](uint8_t *data, int length) {
+			checker.check(data, length);
+			if (tracing)
+				trace.addHostEvent("ep1 in", "transfer", now(), length);
+			return 0;
+		});
+		Pipeline sink(handle, USB_OUT | 2, count, size, [&](uint8_t *data, int length) {
+			// called when a transfer has completed and its buffer gets refilled
+			if (tracing)
+				trace.addHostEvent("ep2 out", "transfer", now(), length);
+			return generator.fill(data, length);
+		});
+
+		auto start = std::chrono::steady_clock::now();
+		if (in)
+			source.start();
+		if (out)
+			sink.start();
+
+		// report progress once per second
+		uint64_t inBytes = 0;
+		uint64_t outBytes = 0;
+		for (int t = 0; t < duration; ++t) {
+			usleep(1000000);
+			uint64_t i = source.bytes;
+			uint64_t o = sink.bytes;
+			printf("%3d s: in %8.3f MB/s out %8.3f MB/s\n", t + 1, double(i - inBytes) * 1e-6,
+				double(o - outBytes) * 1e-6);
+			inBytes = i;
+			outBytes = o;
+		}
+
+		sink.stop();
+		source.stop();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (tracer)
+			tracer->stop();
+
+		// get counters of the sink
+		Counters counters = {};
+		r = device.vendorIn(VENDOR_GET_COUNTERS, 0, &counters, sizeof(counters));
+		if (r < int(sizeof(counters)))
+			fprintf(stderr, "get counters error: %s\n", libusb_error_name(r));
+
+		printf("transfers: %d x %d bytes, duration %.3f s\n", count, size, seconds);
+		if (in) {
+			printResult("in", source.bytes, checker.packets, checker.errors, seconds);
+			printf("     %llu transfer errors, %llu skipped\n", (unsigned long long)source.errors,
+				(unsigned long long)checker.skipped);
+			printBuffers(source.pool, source.copies);
+		}
+		if (out) {
+			printResult("out", sink.bytes, generator.packets, counters.sinkErrors, seconds);
+			printf("     %llu transfer errors, device received %u of %llu bytes\n", (unsigned long long)sink.errors,
+				counters.sinkBytes, (unsigned long long)sink.bytes);
+			printBuffers(sink.pool, sink.copies);
+		}
+		if (traceFile != nullptr) {
+			FILE *file = fopen(traceFile, "w");
+			if (file == nullptr || !trace.writeJson(file)) {
+				fprintf(stderr, "write trace error: %s\n", traceFile);
+			} else if (trace.count() == 0) {
+				fprintf(stderr, "no trace records, the firmware has to be built with TRACE=1\n");
+			} else {
+				printf("trace: %llu records, %llu lost, written to %s\n", (unsigned long long)trace.count(),
+					(unsigned long long)trace.getLost(), traceFile);
+			}
+			if (file != nullptr)
+				fclose(file);
+		}
+
+		// back to default mode
+		device.vendorOut(VENDOR_SET_MODE, MODE_LED);
+	}
+	return 0;
+}
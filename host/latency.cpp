@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libusb.h>
+#include "BufferPool.hpp"
+#include "Histogram.hpp"
+#include "usb.hpp"
+
+// round-trip latency benchmark using the echo mode of the firmware
+
+
+// state of one ping
+struct Ping {
+	// number of transfers (in and out) that are still in flight
+	int pending;
+
+	// time when the reply arrived
+	std::chrono::steady_clock::time_point received;
+};
+
+static void LIBUSB_CALL outCallback(libusb_transfer *transfer) {
+	Ping &ping = *reinterpret_cast<Ping *>(transfer->user_data);
+	--ping.pending;
+}
+
+static void LIBUSB_CALL inCallback(libusb_transfer *transfer) {
+	Ping &ping = *reinterpret_cast<Ping *>(transfer->user_data);
+	ping.received = std::chrono::steady_clock::now();
+	--ping.pending;
+}
+
+static double cyclesToNs(uint32_t cycles) {
+	return double(cycles) * 1e9 / CPU_CLOCK;
+}
+
+// send pings and print the statistics
+static void measure(libusb_device_handle *handle, int count, int size, int maxPacketSize, bool buckets) {
+	// transfer buffers, in device memory if possible
+	BufferPool pool(handle, maxPacketSize);
+	uint8_t *outData = pool.allocate();
+	uint8_t *inData = pool.allocate();
+	if (outData == nullptr || inData == nullptr) {
+		fprintf(stderr, "out of memory\n");
+		return;
+	}
+	memset(outData, 0, maxPacketSize);
+
+	// drain data that was queued before the mode switch
+	int transferred;
+	while (libusb_bulk_transfer(handle, USB_IN | 1, inData, maxPacketSize, &transferred, 100) == LIBUSB_SUCCESS)
+		;
+
+	Ping ping;
+	libusb_transfer *out = libusb_alloc_transfer(0);
+	libusb_transfer *in = libusb_alloc_transfer(0);
+	libusb_fill_bulk_transfer(out, handle, USB_OUT | 2, outData, size, &outCallback, &ping, 1000);
+	libusb_fill_bulk_transfer(in, handle, USB_IN | 1, inData, maxPacketSize, &inCallback, &ping, 1000);
+
+	// round trip time, time spent in the firmware and remaining time (mainly waiting for usb frames)
+	Histogram roundTrip;
+	Histogram firmware;
+	Histogram dispatch;
+	Histogram usb;
+	int errors = 0;
+
+	for (int i = 0; i < count; ++i) {
+		EchoPacket &request = *reinterpret_cast<EchoPacket *>(outData);
+		request.sequence = i;
+
+		// submit in-transfer first so that the host controller polls for the reply immediately
+		ping.pending = 2;
+		if (libusb_submit_transfer(in) != LIBUSB_SUCCESS) {
+			++errors;
+			break;
+		}
+		auto sent = std::chrono::steady_clock::now();
+		if (libusb_submit_transfer(out) != LIBUSB_SUCCESS) {
+			libusb_cancel_transfer(in);
+			ping.pending = 1;
+		}
+
+		// handle events in this thread to avoid the latency of waking up another thread
+		while (ping.pending > 0)
+			libusb_handle_events(NULL);
+
+		EchoPacket const &reply = *reinterpret_cast<EchoPacket *>(inData);
+		if (in->status != LIBUSB_TRANSFER_COMPLETED || out->status != LIBUSB_TRANSFER_COMPLETED
+			|| in->actual_length != size || reply.sequence != uint32_t(i))
+		{
+			++errors;
+			continue;
+		}
+
+		double rtt = double(std::chrono::duration_cast<std::chrono::nanoseconds>(ping.received - sent).count());
+		roundTrip.add(uint64_t(rtt));
+		if (size >= int(sizeof(EchoPacket))) {
+			double fw = cyclesToNs(reply.dispatchCycles) + cyclesToNs(reply.turnaroundCycles);
+			firmware.add(uint64_t(fw));
+			dispatch.add(uint64_t(cyclesToNs(reply.dispatchCycles)));
+			usb.add(uint64_t(std::max(rtt - fw, 0.0)));
+		}
+	}
+
+	libusb_free_transfer(out);
+	libusb_free_transfer(in);
+
+	printf("%llu pings of %d bytes, %d errors\n", (unsigned long long)roundTrip.count(), size, errors);
+	roundTrip.printPercentiles("round trip", 1000.0, "us");
+	if (firmware.count() > 0) {
+		usb.printPercentiles("usb", 1000.0, "us");
+		firmware.printPercentiles("firmware", 1000.0, "us");
+		dispatch.printPercentiles("  dispatch", 1000.0, "us");
+	}
+
+	// latency from entering the usb interrupt until the reply was ready to send, measured by the device
+	Latency latency = {};
+	int r = vendorIn(handle, VENDOR_GET_LATENCY, 0, &latency, sizeof(latency));
+	if (r < int(sizeof(latency))) {
+		fprintf(stderr, "get latency error: %s\n", libusb_error_name(r));
+	} else if (latency.count > 0) {
+		printf("interrupt to packet ready: min %.3f us, mean %.3f us, max %.3f us (%u packets)\n",
+			cyclesToNs(latency.minCycles) * 1e-3, double(latency.totalCycles) * 1e6 / CPU_CLOCK / latency.count,
+			cyclesToNs(latency.maxCycles) * 1e-3, latency.count);
+	}
+	if (buckets) {
+		printf("round trip histogram:\n");
+		roundTrip.printBuckets(1000.0, "us");
+	}
+}
+
+int main(int argc, const char **argv) {
+	// number of pings and size of each ping
+	int count = 100000;
+	int size = sizeof(EchoPacket);
+	bool buckets = false;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-b") == 0) {
+			buckets = true;
+		} else {
+			fprintf(stderr, "usage: latency [-n count] [-s size] [-b]\n");
+			return 1;
+		}
+	}
+	if (size < int(sizeof(uint32_t)))
+		size = sizeof(uint32_t);
+
+	int r = libusb_init(NULL);
+	if (r < 0)
+		return r;
+
+	libusb_device_handle *handle = openDevice(NULL);
+	if (handle == NULL) {
+		fprintf(stderr, "no device found\n");
+		libusb_exit(NULL);
+		return 1;
+	}
+	int maxPacketSize = libusb_get_max_packet_size(libusb_get_device(handle), USB_IN | 1);
+	if (size > maxPacketSize)
+		size = maxPacketSize;
+
+	r = vendorOut(handle, VENDOR_SET_MODE, MODE_ECHO);
+	if (r < 0) {
+		fprintf(stderr, "set mode error: %s\n", libusb_error_name(r));
+	} else {
+		measure(handle, count, size, maxPacketSize, buckets);
+
+		// back to default mode
+		vendorOut(handle, VENDOR_SET_MODE, MODE_LED);
+	}
+
+	closeDevice(handle);
+	libusb_exit(NULL);
+	return 0;
+}
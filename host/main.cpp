@@ -1,24 +1,28 @@
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <map>
+#include <memory>
 #include <libusb.h>
-
-// transfer direction
-enum UsbDirection {
-	USB_OUT = 0, // to device
-	USB_IN = 0x80 // to host
-};
+#include "DeviceGroup.hpp"
+#include "EventThread.hpp"
+#include "ShmRing.hpp"
+#include "usb.hpp"
 
 
 // https://github.com/libusb/libusb/blob/master/examples/listdevs.c
-static void printDevices(libusb_device **devs)
+static void printDevices(libusb_device **devs, DeviceFilter const &filter)
 {
 	libusb_device *dev;
 	int i = 0, j = 0;
 	uint8_t path[8]; 
 
-	// iterate over devices
+	// iterate over matching devices
 	while ((dev = devs[i++]) != NULL) {
+		if (!matches(dev, filter))
+			continue;
 		struct libusb_device_descriptor desc;
 		int r = libusb_get_device_descriptor(dev, &desc);
 		if (r < 0) {
@@ -36,6 +40,11 @@ static void printDevices(libusb_device **devs)
 			for (j = 1; j < r; j++)
 				printf(".%d", path[j]);
 		}
+
+		// serial number as cached by the operating system, the device does not get opened
+		std::string serial = getCachedSerial(dev);
+		if (!serial.empty())
+			printf(" serial: %s", serial.c_str());
 		printf("\n");
 	}
 }
@@ -74,6 +83,13 @@ static int printDevice(libusb_device *dev, int level)
 			if (ret > 0)
 				printf("\t\tProduct: %s\n", string);
 		}
+
+		// serial number
+		if (desc.iSerialNumber) {
+			ret = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, string, sizeof(string));
+			if (ret > 0)
+				printf("\t\tSerialNumber: %s\n", string);
+		}
 		
 	
 		libusb_close(handle);
@@ -136,71 +152,249 @@ static int printDevice(libusb_device *dev, int level)
 	return 0;
 }
 
+// print the statistics of the device (struct Stats) once per second as differences to the previous read. The
+// minimum and maximum cycles of the handlers get restarted by each read and therefore cover the last second
+static int printStats(libusb_device_handle *handle) {
+	const char *names[STATS_HANDLER_COUNT] = {"reset", "sof", "ep0 in", "ep0 out", "ep1 in", "ep1 out", "ep2 in",
+		"ep2 out", "ep3 in", "ep3 out", "interrupt"};
+	Stats last = {};
+	int r = vendorIn(handle, VENDOR_GET_STATS, 1, &last, sizeof(last));
+	while (r == int(sizeof(Stats))) {
+		usleep(1000000);
+		Stats stats = {};
+		r = vendorIn(handle, VENDOR_GET_STATS, 1, &stats, sizeof(stats));
+		if (r != int(sizeof(Stats)))
+			break;
+
+		// the counters wrap around, the unsigned differences don't
+		printf("setups %u stalls %u in naks %u out naks %u errors %u overruns %u wakeups %u\n",
+			stats.setups - last.setups, stats.stalls - last.stalls, stats.inNaks - last.inNaks,
+			stats.outNaks - last.outNaks, stats.errors - last.errors, stats.overruns - last.overruns,
+			stats.wakeups - last.wakeups);
+		for (int i = 0; i < STATS_HANDLER_COUNT; ++i) {
+			HandlerStats const &handler = stats.handlers[i];
+			uint32_t count = handler.count - last.handlers[i].count;
+			if (count == 0)
+				continue;
+			uint32_t total = handler.totalCycles - last.handlers[i].totalCycles;
+			printf("  %-9s %7u/s cycles min %5u avg %7.1f max %5u\n", names[i], count, handler.minCycles,
+				double(total) / count, handler.maxCycles);
+		}
+		last = stats;
+	}
+	fprintf(stderr, "get stats error: %s\n", libusb_error_name(r < 0 ? r : LIBUSB_ERROR_IO));
+	return 1;
+}
+
+
+// size of the shared memory ring of each device in bytes
+constexpr size_t RING_SIZE = 4 * 1024 * 1024;
 
-int main(void) {
+// throughput of the devices on one bus (host controller)
+struct BusStatistics {
+	int devices = 0;
+	uint64_t in = 0;
+	uint64_t out = 0;
+};
+
+int main(int argc, const char **argv) {
 	libusb_device **devs;
 	int r;
 	ssize_t cnt;
 
+	// number of devices, transfers in flight for in-endpoint 1 and out-endpoint 2 and size of each transfer
+	DeviceGroup::Config config;
+
+	// device selection, list matching devices, wait for device to be plugged in
+	DeviceFilter filter;
+	bool list = false;
+	bool wait = false;
+
+	// name of the shared memory rings that receive the data of in-endpoint 1, empty to discard the data
+	std::string ringName;
+
+	// print the statistics of the device instead of running the pipelines
+	bool stats = argc >= 2 && strcmp(argv[1], "stats") == 0;
+	for (int i = stats ? 2 : 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+			config.inCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			config.outCount = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			config.size = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-a") == 0) {
+			config.maxDevices = INT_MAX;
+		} else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+			config.busBudget = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc) {
+			filter.serial = argv[++i];
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			filter.portPath = argv[++i];
+		} else if (strcmp(argv[i], "-l") == 0) {
+			list = true;
+		} else if (strcmp(argv[i], "-w") == 0) {
+			wait = true;
+		} else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+			ringName = argv[++i];
+		} else {
+			fprintf(stderr, "usage: host [-i in-transfers] [-o out-transfers] [-s transfer-size] [-S serial] "
+				"[-p port-path] [-a] [-b bus-transfers] [-l] [-w] [-r ring-name]\n");
+			fprintf(stderr, "       host stats [-S serial] [-p port-path]\n");
+			return 1;
+		}
+	}
+
 	r = libusb_init(NULL);
 	if (r < 0)
 		return r;
 
-	cnt = libusb_get_device_list(NULL, &devs);
-	if (cnt < 0){
-		libusb_exit(NULL);
-		return (int) cnt;
-	}
-
-	// print list of devices
-	printDevices(devs);
-
-	for (int i = 0; devs[i]; ++i) {
-		printDevice(devs[i], 0);
-	}
-
+	if (list) {
+		cnt = libusb_get_device_list(NULL, &devs);
+		if (cnt < 0){
+			libusb_exit(NULL);
+			return (int) cnt;
+		}
 
-	for (int i = 0; devs[i]; ++i) {
-		libusb_device *dev = devs[i];
-		libusb_device_descriptor desc;
+		// print list of matching devices, only these get opened to print their details
+		printDevices(devs, filter);
 
-		int ret = libusb_get_device_descriptor(dev, &desc);
-		if (ret < 0) {
-			fprintf(stderr, "failed to get device descriptor");
-			return -1;
+		for (int i = 0; devs[i]; ++i) {
+			if (matches(devs[i], filter))
+				printDevice(devs[i], 0);
 		}
-		if (desc.idVendor == 0x0483 && desc.idProduct == 0x5722) {
-			libusb_device_handle *handle;
-			ret = libusb_open(dev, &handle);
-			if (ret == LIBUSB_SUCCESS) {
 
-				// set configuration (reset alt_setting, reset toggles)
-				libusb_set_configuration(handle, 1);
+		libusb_free_device_list(devs, 1);
+		libusb_exit(NULL);
+		return 0;
+	}
 
-				// claim interface with bInterfaceNumber = 0
-				ret = libusb_claim_interface(handle, 0);
-				printf("claim interface %d\n", ret);
+	if (stats) {
+		libusb_device_handle *handle = openDevice(NULL, filter);
+		if (handle == NULL) {
+			fprintf(stderr, "no device found\n");
+			libusb_exit(NULL);
+			return 1;
+		}
+		r = printStats(handle);
+		closeDevice(handle);
+		libusb_exit(NULL);
+		return r;
+	}
 
-				//ret = libusb_set_interface_alt_setting(handle, 0, 0);
-				//printf("set alternate setting %d\n", ret);
+	// handle completion callbacks of the pipelines and hotplug notifications of all devices
+	EventThread eventThread(NULL);
+
+	bool multipleDevices = config.maxDevices > 1;
+	DeviceGroup group(NULL, filter, config,
+		[&ringName, multipleDevices](libusb_device_handle *handle) -> Pipeline::Handler {
+			if (ringName.empty()) {
+				// receive data from in-endpoint 1 and discard it
+				return [](uint8_t *data, int length) {
+					return 0;
+				};
+			}
 
+			// fan out the data of in-endpoint 1 to other processes, each device gets its own ring
+			std::string name = ringName;
+			if (multipleDevices) {
+				libusb_device *device = libusb_get_device(handle);
+				std::string serial = getCachedSerial(device);
+				name += '-' + (serial.empty() ? getPortPath(device) : serial);
+			}
+			auto ring = std::make_shared<ShmRingWriter>();
+			if (!ring->open(name, RING_SIZE)) {
+				fprintf(stderr, "failed to create ring %s\n", name.c_str());
+				return [](uint8_t *data, int length) {
+					return -1;
+				};
+			}
+			printf("ring %s\n", name.c_str());
+			return [ring](uint8_t *data, int length) {
+				ring->write(data, length);
+				return 0;
+			};
+		},
+		[](libusb_device_handle *handle) -> Pipeline::Handler {
+			// send led state to out-endpoint 2, each device has its own state
+			uint8_t led = 0;
+			return [led](uint8_t *data, int length) mutable {
+				memset(data, 0, 4);
+				data[0] = led;
+				led = (led + 1) & 3;
+				return 4;
+			};
+		});
+	group.start();
+	group.update();
+
+	// statistics of the last report, by port path
+	std::map<std::string, std::pair<uint64_t, uint64_t>> reported;
+	bool waiting = false;
+	while (true) {
+		auto &devices = group.getDevices();
+		if (devices.empty()) {
+			if (!wait) {
+				fprintf(stderr, "no device found\n");
+				break;
+			}
+			if (!waiting)
+				printf("waiting for device\n");
+			waiting = true;
+		} else {
+			waiting = false;
+		}
 
-				uint8_t data[4] = {};
-				while (true) {
-					int transferred = 0;
-					//
-					ret = libusb_bulk_transfer(handle, USB_OUT | 2, data, 4, &transferred, 0);
-					printf("%d transferred %d 0x%x\n", ret, transferred, data[0]);
-					data[0] = (data[0] + 1) & 3;
-					usleep(1000000);
+		// check for arrived and removed devices every 100ms
+		for (int i = 0; i < 10; ++i) {
+			usleep(100000);
+			if (group.update()) {
+				printf("%d devices\n", int(group.getDevices().size()));
+				for (auto &device : group.getDevices()) {
+					printf("  %s %s: %d/%d transfers\n", device->portPath.c_str(), device->serial.c_str(),
+						device->inCount, device->outCount);
 				}
 			}
 		}
-	}
 
+		// report throughput once per second per device and per bus to see how it scales with the device count
+		std::map<int, BusStatistics> buses;
+		uint64_t inTotal = 0;
+		uint64_t outTotal = 0;
+		for (auto &device : group.getDevices()) {
+			auto &last = reported[device->portPath];
+			uint64_t i = device->getInBytes();
+			uint64_t o = device->getOutBytes();
+			uint64_t in = i >= last.first ? i - last.first : i;
+			uint64_t out = o >= last.second ? o - last.second : o;
+			last = {i, o};
+			if (group.getDevices().size() > 1) {
+				printf("%s: in %llu B/s out %llu B/s errors %llu\n", device->portPath.c_str(), (unsigned long long)in,
+					(unsigned long long)out, (unsigned long long)device->getErrors());
+			}
+			BusStatistics &bus = buses[device->bus];
+			++bus.devices;
+			bus.in += in;
+			bus.out += out;
+			inTotal += in;
+			outTotal += out;
+		}
+		if (buses.size() > 1) {
+			for (auto &bus : buses) {
+				printf("bus %d: %d devices in %llu B/s out %llu B/s\n", bus.first, bus.second.devices,
+					(unsigned long long)bus.second.in, (unsigned long long)bus.second.out);
+			}
+		}
+		if (!group.getDevices().empty()) {
+			uint64_t errors = 0;
+			for (auto &device : group.getDevices())
+				errors += device->getErrors();
+			printf("in %llu B/s out %llu B/s errors %llu\n", (unsigned long long)inTotal,
+				(unsigned long long)outTotal, (unsigned long long)errors);
+		}
+	}
 
-	libusb_free_device_list(devs, 1);
-
+	group.stop();
+	eventThread.stop();
 	libusb_exit(NULL);
 	return 0;
 }
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+#include "ShmRing.hpp"
+
+// consumer of the shared memory ring written by "host -r name", only uses the header-only reader. Reports the
+// throughput and lost bytes once per second, optionally passes the raw stream on to stdout
+
+
+int main(int argc, const char **argv) {
+	const char *name = nullptr;
+	bool output = false;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-o") == 0) {
+			output = true;
+		} else if (name == nullptr && argv[i][0] != '-') {
+			name = argv[i];
+		} else {
+			name = nullptr;
+			break;
+		}
+	}
+	if (name == nullptr) {
+		fprintf(stderr, "usage: ringreader ring-name [-o]\n");
+		return 1;
+	}
+
+	ShmRingReader reader;
+	if (!reader.open(name)) {
+		fprintf(stderr, "failed to open ring %s\n", name);
+		return 1;
+	}
+
+	// report on stderr if the stream goes to stdout
+	FILE *report = output ? stderr : stdout;
+	fprintf(report, "ring %s: %llu bytes\n", name, (unsigned long long)reader.getSize());
+	uint64_t bytes = 0;
+	uint64_t lost = 0;
+	auto next = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (true) {
+		// process the data in place
+		const uint8_t *data;
+		size_t length = reader.peek(data);
+		if (length > 0) {
+			if (output && fwrite(data, 1, length, stdout) != length)
+				return 1;
+			if (reader.consume(length))
+				bytes += length;
+		} else {
+			usleep(1000);
+		}
+
+		auto now = std::chrono::steady_clock::now();
+		if (now >= next) {
+			fprintf(report, "%llu B/s, %llu bytes lost\n", (unsigned long long)bytes,
+				(unsigned long long)(reader.getLost() - lost));
+			bytes = 0;
+			lost = reader.getLost();
+			next += std::chrono::seconds(1);
+		}
+	}
+}
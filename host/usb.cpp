@@ -0,0 +1,154 @@
+#include "usb.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include "DeviceWatcher.hpp"
+
+
+std::string getPortPath(libusb_device *device) {
+	std::string path = std::to_string(libusb_get_bus_number(device));
+	uint8_t ports[8];
+	int count = libusb_get_port_numbers(device, ports, sizeof(ports));
+	for (int i = 0; i < count; ++i) {
+		path += i == 0 ? '-' : '.';
+		path += std::to_string(ports[i]);
+	}
+	return path;
+}
+
+std::string getCachedSerial(libusb_device *device) {
+	std::string serial;
+#ifdef __linux__
+	// the kernel reads the string descriptors during enumeration and provides them in sysfs
+	std::ifstream file("/sys/bus/usb/devices/" + getPortPath(device) + "/serial");
+	std::getline(file, serial);
+#endif
+	return serial;
+}
+
+bool matches(libusb_device *device, DeviceFilter const &filter) {
+	// the device descriptor is cached by libusb, no request to the device is needed
+	libusb_device_descriptor desc;
+	if (libusb_get_device_descriptor(device, &desc) < 0)
+		return false;
+	if (desc.idVendor != filter.vendorId || desc.idProduct != filter.productId)
+		return false;
+	if (!filter.portPath.empty() && getPortPath(device) != filter.portPath)
+		return false;
+
+	// serial number of the device, gets read from the device on open if not cached
+	if (!filter.serial.empty() && desc.iSerialNumber != 0) {
+		std::string serial = getCachedSerial(device);
+		if (!serial.empty() && serial != filter.serial)
+			return false;
+	}
+	return true;
+}
+
+libusb_device_handle *openDevice(libusb_context *context) {
+	return openDevice(context, DeviceFilter());
+}
+
+libusb_device_handle *openDevice(libusb_context *context, DeviceFilter const &filter) {
+	libusb_device **devs;
+	ssize_t cnt = libusb_get_device_list(context, &devs);
+	if (cnt < 0)
+		return NULL;
+
+	libusb_device_handle *handle = NULL;
+	for (int i = 0; devs[i] && handle == NULL; ++i) {
+		if (matches(devs[i], filter))
+			handle = openMatchingDevice(devs[i], filter);
+	}
+
+	libusb_free_device_list(devs, 1);
+	return handle;
+}
+
+libusb_device_handle *openMatchingDevice(libusb_device *device, DeviceFilter const &filter) {
+	libusb_device_handle *handle;
+	if (libusb_open(device, &handle) != LIBUSB_SUCCESS)
+		return NULL;
+
+	// check serial number if matches() could not check it
+	if (!filter.serial.empty() && getCachedSerial(device).empty()) {
+		libusb_device_descriptor desc;
+		unsigned char serial[128];
+		if (libusb_get_device_descriptor(device, &desc) < 0 || desc.iSerialNumber == 0
+			|| libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial)) < 0
+			|| filter.serial != reinterpret_cast<char *>(serial))
+		{
+			libusb_close(handle);
+			return NULL;
+		}
+	}
+
+	// set configuration (reset alt_setting, reset toggles)
+	libusb_set_configuration(handle, 1);
+
+	// claim interface with bInterfaceNumber = 0
+	if (libusb_claim_interface(handle, 0) != LIBUSB_SUCCESS) {
+		libusb_close(handle);
+		return NULL;
+	}
+	return handle;
+}
+
+libusb_device_handle *waitForDevice(libusb_context *context, DeviceFilter const &filter, int timeout) {
+	auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool arrived = false;
+
+	// get notified when a matching device arrives
+	DeviceWatcher watcher(context, filter, [&](libusb_device *device, bool connected) {
+		if (connected) {
+			std::unique_lock<std::mutex> lock(mutex);
+			arrived = true;
+			condition.notify_all();
+		}
+	});
+	bool hotplug = watcher.start() == LIBUSB_SUCCESS;
+
+	while (true) {
+		// open the device in this thread because libusb_open() must not be called from a hotplug callback
+		libusb_device_handle *handle = openDevice(context, filter);
+		if (handle != NULL)
+			return handle;
+
+		// wait for the next arrival, poll the device list if hotplug is not supported
+		std::unique_lock<std::mutex> lock(mutex);
+		auto wakeup = hotplug ? end : std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+		if (timeout >= 0 && end < wakeup)
+			wakeup = end;
+		if (hotplug && timeout < 0)
+			condition.wait(lock, [&arrived] {return arrived;});
+		else
+			condition.wait_until(lock, wakeup, [&arrived] {return arrived;});
+		if (!arrived && timeout >= 0 && std::chrono::steady_clock::now() >= end)
+			return NULL;
+		arrived = false;
+	}
+}
+
+void closeDevice(libusb_device_handle *handle) {
+	libusb_release_interface(handle, 0);
+	libusb_close(handle);
+}
+
+int vendorOut(libusb_device_handle *handle, VendorRequest request, uint16_t value) {
+	return libusb_control_transfer(handle, USB_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+		request, value, 0, NULL, 0, 1000);
+}
+
+int vendorOut(libusb_device_handle *handle, VendorRequest request, uint16_t value, const void *data, int size) {
+	// libusb does not modify the data of an out transfer
+	return libusb_control_transfer(handle, USB_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+		request, value, 0, static_cast<unsigned char *>(const_cast<void *>(data)), size, 1000);
+}
+
+int vendorIn(libusb_device_handle *handle, VendorRequest request, uint16_t value, void *data, int size) {
+	return libusb_control_transfer(handle, USB_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+		request, value, 0, static_cast<unsigned char *>(data), size, 1000);
+}
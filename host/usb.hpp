@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <libusb.h>
+#include "../protocol.h"
+
+
+// transfer direction
+enum UsbDirection {
+	USB_OUT = 0, // to device
+	USB_IN = 0x80 // to host
+};
+
+// vendor and product id of the bluepill firmware
+constexpr uint16_t VENDOR_ID = 0x0483;
+constexpr uint16_t PRODUCT_ID = 0x5722;
+
+/**
+	Selects devices by vendor/product id and optionally by serial number and port path
+*/
+struct DeviceFilter {
+	uint16_t vendorId = VENDOR_ID;
+	uint16_t productId = PRODUCT_ID;
+
+	// serial number, empty to match any device. Checked using the serial number cached by the operating system if
+	// available, otherwise when opening a device
+	std::string serial;
+
+	// port path in the form bus-port.port (as in /sys/bus/usb/devices), empty to match any device
+	std::string portPath;
+};
+
+/**
+	Get the port path of a device in the form bus-port.port, e.g. "1-2.4"
+*/
+std::string getPortPath(libusb_device *device);
+
+/**
+	Get the serial number of a device that the operating system has cached during enumeration (Linux: sysfs), the
+	device does not get opened
+	@return serial number or empty string if not available
+*/
+std::string getCachedSerial(libusb_device *device);
+
+/**
+	Check if a device matches the filter. Uses only cached information, the device does not get opened. The serial
+	number is only checked if it is cached by the operating system
+*/
+bool matches(libusb_device *device, DeviceFilter const &filter);
+
+/**
+	Find the first bluepill device, open it, set the configuration and claim interface 0
+	@return device handle or NULL if no device was found
+*/
+libusb_device_handle *openDevice(libusb_context *context);
+
+/**
+	Find the first device that matches the filter, open it, set the configuration and claim interface 0. Devices
+	that don't match the cached information are not opened
+	@return device handle or NULL if no device was found
+*/
+libusb_device_handle *openDevice(libusb_context *context, DeviceFilter const &filter);
+
+/**
+	Open a device that matches the filter, set the configuration and claim interface 0. Reads the serial number from
+	the device if it is not cached
+	@return device handle or NULL if the device could not be opened or the serial number does not match
+*/
+libusb_device_handle *openMatchingDevice(libusb_device *device, DeviceFilter const &filter);
+
+/**
+	Wait until a device that matches the filter is plugged in and open it. Uses hotplug notifications if the
+	platform supports them, otherwise the device list is checked every 100ms. Events of the context have to be
+	handled by another thread (see EventThread)
+	@param timeout timeout in milliseconds, negative to wait forever
+	@return device handle or NULL on timeout
+*/
+libusb_device_handle *waitForDevice(libusb_context *context, DeviceFilter const &filter, int timeout);
+
+/**
+	Release interface 0 and close the device
+*/
+void closeDevice(libusb_device_handle *handle);
+
+/**
+	Send a vendor request without data to the device
+	@return LIBUSB_SUCCESS or error code
+*/
+int vendorOut(libusb_device_handle *handle, VendorRequest request, uint16_t value);
+
+/**
+	Send data using a vendor request
+	@return number of bytes sent or error code
+*/
+int vendorOut(libusb_device_handle *handle, VendorRequest request, uint16_t value, const void *data, int size);
+
+/**
+	Read data using a vendor request
+	@return number of bytes read or error code
+*/
+int vendorIn(libusb_device_handle *handle, VendorRequest request, uint16_t value, void *data, int size);
@@ -0,0 +1,183 @@
+#include <stdint.h>
+#include <libopencm3/cm3/dwt.h>
+#include "protocol.h"
+#include "pma.h"
+
+
+// bytes
+
+void pmaWriteBytes(uint8_t *pma, const void *data, int size) {
+	const uint8_t *src = (const uint8_t*)data;
+	uint16_t *dst = (uint16_t*)pma;
+	int count = size / 2;
+	for (int i = 0; i < count; ++i) {
+		*dst = src[0] | (src[1] << 8);
+		src += 2;
+		dst += 2; // ABP1 bus is 32 bit only
+	}
+	if (size & 1)
+		*dst = src[0];
+}
+
+void pmaReadBytes(void *data, const uint8_t *pma, int size) {
+	const uint16_t *src = (const uint16_t*)pma;
+	uint8_t *dst = (uint8_t*)data;
+	int count = size / 2;
+	for (int i = 0; i < count; ++i) {
+		uint16_t value = *src;
+		dst[0] = value;
+		dst[1] = value >> 8;
+		src += 2; // ABP1 bus is 32 bit only
+		dst += 2;
+	}
+	if (size & 1)
+		dst[0] = *src;
+}
+
+
+// half words
+
+void pmaWriteHalfWords(uint8_t *pma, const void *data, int size) {
+	const uint16_t *src = (const uint16_t*)data;
+	uint16_t *dst = (uint16_t*)pma;
+	int count = size / 2;
+	for (int i = 0; i < count; ++i) {
+		*dst = *src;
+		++src;
+		dst += 2; // ABP1 bus is 32 bit only
+	}
+
+	// last byte of odd size, don't read beyond the end of data
+	if (size & 1)
+		*dst = *(const uint8_t*)src;
+}
+
+void pmaReadHalfWords(void *data, const uint8_t *pma, int size) {
+	const uint16_t *src = (const uint16_t*)pma;
+	uint16_t *dst = (uint16_t*)data;
+	int count = size / 2;
+	for (int i = 0; i < count; ++i) {
+		*dst = *src;
+		src += 2; // ABP1 bus is 32 bit only
+		++dst;
+	}
+
+	// last byte of odd size, don't write beyond the end of data
+	if (size & 1)
+		*(uint8_t*)dst = *src;
+}
+
+
+// words
+
+void pmaWriteWords(uint8_t *pma, const void *data, int size) {
+	const uint32_t *src = (const uint32_t*)data;
+	uint16_t *dst = (uint16_t*)pma;
+
+	// one word of data goes into two words of packet memory
+	int i = size;
+	for (; i >= 8; i -= 8) {
+		uint32_t w0 = src[0];
+		uint32_t w1 = src[1];
+		dst[0] = w0;
+		dst[2] = w0 >> 16;
+		dst[4] = w1;
+		dst[6] = w1 >> 16;
+		src += 2;
+		dst += 8;
+	}
+
+	// remaining bytes
+	pmaWriteHalfWords((uint8_t*)dst, src, i);
+}
+
+void pmaReadWords(void *data, const uint8_t *pma, int size) {
+	const uint16_t *src = (const uint16_t*)pma;
+	uint32_t *dst = (uint32_t*)data;
+
+	// two words of packet memory go into one word of data
+	int i = size;
+	for (; i >= 8; i -= 8) {
+		dst[0] = src[0] | ((uint32_t)src[2] << 16);
+		dst[1] = src[4] | ((uint32_t)src[6] << 16);
+		src += 8;
+		dst += 2;
+	}
+
+	// remaining bytes
+	pmaReadHalfWords(dst, (const uint8_t*)src, i);
+}
+
+
+// dispatch on alignment
+
+void pmaWrite(uint8_t *pma, const void *data, int size) {
+	uintptr_t address = (uintptr_t)data;
+	if ((address & 3) == 0)
+		pmaWriteWords(pma, data, size);
+	else if ((address & 1) == 0)
+		pmaWriteHalfWords(pma, data, size);
+	else
+		pmaWriteBytes(pma, data, size);
+}
+
+void pmaRead(void *data, const uint8_t *pma, int size) {
+	uintptr_t address = (uintptr_t)data;
+	if ((address & 3) == 0)
+		pmaReadWords(data, pma, size);
+	else if ((address & 1) == 0)
+		pmaReadHalfWords(data, pma, size);
+	else
+		pmaReadBytes(data, pma, size);
+}
+
+
+// benchmark
+
+typedef void (*PmaWriteFunction)(uint8_t *pma, const void *data, int size);
+typedef void (*PmaReadFunction)(void *data, const uint8_t *pma, int size);
+
+static const PmaWriteFunction writeFunctions[PMA_VARIANT_COUNT] = {
+	pmaWriteBytes, pmaWriteHalfWords, pmaWriteWords};
+static const PmaReadFunction readFunctions[PMA_VARIANT_COUNT] = {
+	pmaReadBytes, pmaReadHalfWords, pmaReadWords};
+
+// each measurement copies a packet several times, the fastest of several runs is taken to filter out disturbances
+#define PMA_BENCHMARK_RUNS 8
+#define PMA_BENCHMARK_COPIES 16
+
+static uint16_t toCycles(uint32_t best) {
+	uint32_t cycles = best / PMA_BENCHMARK_COPIES;
+	return cycles > 0xffff ? 0xffff : cycles;
+}
+
+void pmaBenchmark(struct PmaBenchmark *result, uint8_t *pma) {
+	uint32_t data[64 / 4];
+	for (int i = 0; i < 64; ++i)
+		((uint8_t*)data)[i] = i;
+
+	for (int variant = 0; variant < PMA_VARIANT_COUNT; ++variant) {
+		for (int s = 0; s < PMA_SIZE_COUNT; ++s) {
+			int size = 8 << s;
+			uint32_t bestWrite = UINT32_MAX;
+			uint32_t bestRead = UINT32_MAX;
+			for (int run = 0; run < PMA_BENCHMARK_RUNS; ++run) {
+				uint32_t start = dwt_read_cycle_counter();
+				for (int i = 0; i < PMA_BENCHMARK_COPIES; ++i)
+					writeFunctions[variant](pma, data, size);
+				uint32_t cycles = dwt_read_cycle_counter() - start;
+				if (cycles < bestWrite)
+					bestWrite = cycles;
+
+				start = dwt_read_cycle_counter();
+				for (int i = 0; i < PMA_BENCHMARK_COPIES; ++i)
+					readFunctions[variant](data, pma, size);
+				cycles = dwt_read_cycle_counter() - start;
+				if (cycles < bestRead)
+					bestRead = cycles;
+			}
+			result->writeCycles[variant][s] = toCycles(bestWrite);
+			result->readCycles[variant][s] = toCycles(bestRead);
+		}
+	}
+}
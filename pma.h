@@ -0,0 +1,29 @@
+#pragma once
+
+// copy routines for the packet memory of the usb peripheral. The packet memory consists of 16 bit half words that
+// each occupy 32 bit of the address space (ABP1 bus is 32 bit only), pma points to the start of a buffer as returned
+// by USB_GET_EP_TX_BUFF() or USB_GET_EP_RX_BUFF(). Odd sizes are supported without accessing bytes beyond size
+
+#include <stdint.h>
+
+struct PmaBenchmark;
+
+
+// copy bytes, works for any alignment of data
+void pmaWriteBytes(uint8_t *pma, const void *data, int size);
+void pmaReadBytes(void *data, const uint8_t *pma, int size);
+
+// copy half words, data must be 2 byte aligned
+void pmaWriteHalfWords(uint8_t *pma, const void *data, int size);
+void pmaReadHalfWords(void *data, const uint8_t *pma, int size);
+
+// copy words, unrolled to 8 bytes per iteration, data must be 4 byte aligned
+void pmaWriteWords(uint8_t *pma, const void *data, int size);
+void pmaReadWords(void *data, const uint8_t *pma, int size);
+
+// copy data using the fastest variant for the alignment of data
+void pmaWrite(uint8_t *pma, const void *data, int size);
+void pmaRead(void *data, const uint8_t *pma, int size);
+
+// measure the cpu cycles of each variant and packet size, pma points to 64 bytes of unused packet memory
+void pmaBenchmark(struct PmaBenchmark *result, uint8_t *pma);
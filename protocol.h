@@ -0,0 +1,582 @@
+#pragma once
+
+// protocol between the firmware (main.c) and the host tools (host/), included by both sides
+
+#include <stdint.h>
+
+
+// vendor specific control requests to the device (bmRequestType = USB_REQUEST_TYPE_VENDOR | USB_RECIPIENT_DEVICE)
+enum VendorRequest {
+	// out: set the operating mode of the bulk endpoints (wValue = enum Mode)
+	VENDOR_SET_MODE = 0x01,
+
+	// in: get struct Counters
+	VENDOR_GET_COUNTERS = 0x02,
+
+	// in: get struct Latency
+	VENDOR_GET_LATENCY = 0x03,
+
+	// in: run the packet memory copy benchmark and get struct PmaBenchmark
+	VENDOR_GET_PMA_BENCHMARK = 0x04,
+
+	// out: set the flush timeout of the framed mode in ms (wValue), 0 to flush after each received packet
+	VENDOR_SET_FLUSH_TIMEOUT = 0x05,
+
+	// out with data stage: upload a script of up to SCRIPT_MAX_SIZE bytes (see ScriptOpcode)
+	VENDOR_UPLOAD_SCRIPT = 0x06,
+
+	// out: run the uploaded script (MODE_SCRIPT only), stalls while a script is running
+	VENDOR_RUN_SCRIPT = 0x07,
+
+	// out with data stage: set struct AdcConfig, takes effect when MODE_ADC is set. Stalls if the configuration is
+	// not supported
+	VENDOR_SET_ADC_CONFIG = 0x08,
+
+	// out with data stage: set struct UartConfig, takes effect when MODE_UART is set. Stalls if the configuration is
+	// not supported
+	VENDOR_SET_UART_CONFIG = 0x09,
+
+	// in: get struct Stats, wValue = 1 restarts the minimum and maximum cycles of the handlers after reading
+	VENDOR_GET_STATS = 0x0a
+};
+
+// operating mode of the bulk endpoints
+enum Mode {
+	// in 1 repeatedly sends the first 4 bytes of the device descriptor, out 2 switches the led
+	MODE_LED = 0,
+
+	// in 1 streams the pattern continuously, out 2 counts the received data and checks the pattern
+	MODE_SOURCE_SINK = 1,
+
+	// each packet received on out 2 is sent back on in 1, the device fills in its fields of struct EchoPacket if the
+	// packet is large enough
+	MODE_ECHO = 2,
+
+	// each transfer of up to LOOPBACK_SIZE bytes received on out 2 is sent back on in 1. Transfers end with a short
+	// packet or zero length packet, on out 2 a transfer of LOOPBACK_SIZE bytes ends without zero length packet
+	MODE_LOOPBACK = 3,
+
+	// out 2 receives framed packets of messages, the replies are sent as framed packets on in 1 (see MessageType)
+	MODE_FRAMED = 4,
+
+	// each run of the script (VENDOR_RUN_SCRIPT) sends struct ScriptResult and the data read by the script as one
+	// transfer on in 1
+	MODE_SCRIPT = 5,
+
+	// in 1 streams adc samples continuously (see adc streaming)
+	MODE_ADC = 6,
+
+	// usb-uart bridge: out 2 is sent on USART1, data received on USART1 is sent on in 1 (see uart bridge)
+	MODE_UART = 7
+};
+
+// size of the transfer buffer of the loopback mode
+#define LOOPBACK_SIZE 4096
+
+// byte n of the source and sink streams has the value n % PATTERN_LENGTH (like pattern 1 of linux gadget zero)
+#define PATTERN_LENGTH 63
+
+// cpu clock of the device, unit of the cycle counts
+#define CPU_CLOCK 72000000
+
+// packet of the echo mode. The host fills in the sequence number, the device fills in the remaining fields
+struct EchoPacket {
+	uint32_t sequence;
+
+	// usb frame number at which the device detected the packet
+	uint16_t frame;
+	uint16_t reserved;
+
+	// cycles from entering the usb interrupt until the echo handler started
+	uint32_t dispatchCycles;
+
+	// cycles from detecting the packet until the reply was ready to send
+	uint32_t turnaroundCycles;
+};
+
+// counters of the device, reset when the mode is set
+struct Counters {
+	// packets sent by the source
+	uint32_t sourcePackets;
+
+	// packets and bytes received by the sink
+	uint32_t sinkPackets;
+	uint32_t sinkBytes;
+
+	// number of received bytes that did not match the pattern
+	uint32_t sinkErrors;
+
+	// adc stream: blocks filled by dma, blocks that were ready while both tx buffers were in use (the host lags
+	// behind) and blocks that were dropped because dma overwrote them before they were sent
+	uint32_t adcBlocks;
+	uint32_t adcBackpressure;
+	uint32_t adcOverflows;
+
+	// uart bridge: bytes received on USART1, bytes sent on USART1, received bytes that were dropped because the rx
+	// buffer overflowed and bursts of received data with errors (framing, noise, overrun)
+	uint32_t uartRxBytes;
+	uint32_t uartTxBytes;
+	uint32_t uartRxDropped;
+	uint32_t uartErrors;
+};
+
+// cycles from entering the usb interrupt until an in packet was ready to send, reset when the mode is set. Packets
+// made ready in the dma and usart interrupts or in the main loop are not included
+struct Latency {
+	uint32_t count;
+	uint32_t minCycles;
+	uint32_t maxCycles;
+	uint32_t reserved;
+	uint64_t totalCycles;
+};
+
+// number of endpoints: control endpoint 0, bulk in endpoint 1, bulk out endpoint 2 and trace endpoint 3
+#define STATS_ENDPOINT_COUNT 4
+
+// handlers of usb events whose cpu cycles are measured (struct Stats)
+enum StatsHandler {
+	// usb reset and start of frame
+	STATS_RESET,
+	STATS_SOF,
+
+	// correct transfer of an endpoint, STATS_CTR + 2 * endpoint for in (tx) and STATS_CTR + 2 * endpoint + 1 for out
+	// (rx), setup packets are counted as out
+	STATS_CTR,
+
+	// whole usb interrupt including the loop over the pending events
+	STATS_INTERRUPT = STATS_CTR + 2 * STATS_ENDPOINT_COUNT,
+
+	STATS_HANDLER_COUNT
+};
+
+// count and cpu cycles of a handler. The total wraps around, the average follows from the differences of count and
+// total between two reads
+struct HandlerStats {
+	uint32_t count;
+	uint32_t minCycles;
+	uint32_t maxCycles;
+	uint32_t totalCycles;
+};
+
+// statistics since power on, not reset when the mode is set. All counters wrap around and are meant to be read
+// periodically to get the differences. Resets, sofs and correct transfers per endpoint are the counts of the handlers
+struct Stats {
+	// setup packets and control requests that were answered with a stall
+	uint32_t setups;
+	uint32_t stalls;
+
+	// the usb peripheral does not count the naks it sends, instead these count the times when the host starts to get
+	// naks: in endpoint 1 ran out of packets, out endpoint 2 has both buffers full
+	uint32_t inNaks;
+	uint32_t outNaks;
+
+	// ERR interrupts (crc, bit stuffing or framing error, timeout) and PMAOVR interrupts (packet memory not accessed
+	// in time)
+	uint32_t errors;
+	uint32_t overruns;
+
+	// wakeups of the main loop from wfi
+	uint32_t wakeups;
+	uint32_t reserved;
+
+	struct HandlerStats handlers[STATS_HANDLER_COUNT];
+};
+
+/*
+	Event trace
+	Firmware built with TRACE=1 writes a record for each usb event into a ring buffer of TRACE_SIZE records in SRAM
+	and sends the records on bulk in endpoint 3 while the host reads from it, without TRACE the endpoint only naks.
+	When the ring overflows the oldest records get overwritten and the next packet starts with a TRACE_LOST record.
+	The cycle counter of the records wraps around after 2^32 cycles (about 60 s), the host unwraps it by the
+	differences of consecutive records
+*/
+
+// endpoint and max packet size of the trace, the packet memory only has room for a small buffer
+#define TRACE_ENDPOINT 3
+#define TRACE_PACKET_SIZE 32
+
+// number of records in the ring of the firmware, a power of two
+#define TRACE_SIZE 256
+
+enum TraceEvent {
+	// usb reset
+	TRACE_RESET = 1,
+
+	// setup packet: arg = bmRequestType, value = bRequest
+	TRACE_SETUP = 2,
+
+	// correct transfer received and sent: arg = endpoint, value = endpoint register before the handler. The packets
+	// of the trace endpoint are not recorded
+	TRACE_CTR_RX = 3,
+	TRACE_CTR_TX = 4,
+
+	// state of the control endpoint changed: arg = new state, value = old state (IDLE, SET_ADDRESS, AWAIT_TX,
+	// GET_DESCRIPTOR, RECEIVE_DATA)
+	TRACE_STATE = 5,
+
+	// control request answered with a stall: arg = endpoint
+	TRACE_STALL = 6,
+
+	// records that were overwritten before they were sent: value = number of records (saturated), the cycles are
+	// those of the next record
+	TRACE_LOST = 7
+};
+
+// record of the trace
+struct TraceRecord {
+	// cpu cycle counter (CPU_CLOCK)
+	uint32_t cycles;
+
+	// enum TraceEvent and its arguments
+	uint8_t event;
+	uint8_t arg;
+	uint16_t value;
+};
+
+// variants of the packet memory copy routines (pma.h)
+enum PmaVariant {
+	PMA_BYTES,
+	PMA_HALF_WORDS,
+	PMA_WORDS,
+	PMA_VARIANT_COUNT
+};
+
+// number of packet sizes of the benchmark, size i is 8 << i (8 to 64 bytes)
+#define PMA_SIZE_COUNT 4
+
+// cpu cycles to copy one packet into (write) and out of (read) the packet memory
+struct PmaBenchmark {
+	uint16_t writeCycles[PMA_VARIANT_COUNT][PMA_SIZE_COUNT];
+	uint16_t readCycles[PMA_VARIANT_COUNT][PMA_SIZE_COUNT];
+};
+
+/*
+	Framing
+	A framed packet starts with struct FrameHeader followed by messages that each consist of struct MessageHeader and
+	length bytes of payload. A message never spans two packets. MESSAGE_PADDING ends the messages of a packet, it
+	pads a packet to the max packet size so that the transfer continues. A packet is sent when the next message does
+	not fit or when the flush timeout has elapsed. A short packet ends the transfer, a full packet is followed by a
+	zero length packet if no further messages arrive within the flush timeout
+*/
+#define FRAME_PACKET_SIZE 64
+
+// header of a framed packet, the sequence number is incremented for each packet so that lost packets are detected
+struct FrameHeader {
+	uint16_t sequence;
+};
+
+// header of a message inside a framed packet
+struct MessageHeader {
+	uint8_t type;
+	uint8_t length;
+};
+
+// maximum payload size of a message
+#define MESSAGE_MAX_LENGTH (FRAME_PACKET_SIZE - sizeof(struct FrameHeader) - sizeof(struct MessageHeader))
+
+// type of a message
+enum MessageType {
+	// no more messages in this packet
+	MESSAGE_PADDING = 0,
+
+	// out: switch the led, the first byte of the payload is the state
+	MESSAGE_LED = 1,
+
+	// out: send the message back, in: the reply
+	MESSAGE_ECHO = 2,
+
+	// out: struct Command, executed in the order of arrival
+	MESSAGE_COMMAND = 3,
+
+	// in: struct Completion of a command. Completions are batched like all replies, they are sent when a packet is
+	// full or when the flush timeout has elapsed
+	MESSAGE_COMPLETION = 4
+};
+
+// operation of a command
+enum CommandOpcode {
+	// configure the pins of mask, value is mode | cnf << 2 as in the configuration register of the STM32F103 (e.g.
+	// 2 for push-pull output with 2 MHz, 4 for floating input)
+	COMMAND_GPIO_MODE = 0,
+
+	// set the pins of mask to the corresponding bits of value
+	COMMAND_GPIO_WRITE = 1,
+
+	// read the pins of mask, the completion contains their state
+	COMMAND_GPIO_READ = 2
+};
+
+// gpio port of a command
+enum CommandPort {
+	COMMAND_PORT_A = 0,
+	COMMAND_PORT_B = 1,
+	COMMAND_PORT_C = 2
+};
+
+// status of a completion
+enum CommandStatus {
+	COMMAND_OK = 0,
+
+	// unknown opcode or port
+	COMMAND_INVALID = 1,
+
+	// the pins are reserved (PA11 and PA12 are used by usb)
+	COMMAND_RESERVED = 2
+};
+
+// command, the tag is chosen by the host and returned in the completion
+struct Command {
+	uint16_t tag;
+	uint8_t opcode;
+	uint8_t port;
+	uint16_t mask;
+	uint16_t value;
+};
+
+// completion of a command
+struct Completion {
+	uint16_t tag;
+	uint8_t status;
+	uint8_t reserved;
+
+	// state of the pins for COMMAND_GPIO_READ
+	uint16_t value;
+};
+
+/*
+	Scripts
+	A script is a sequence of instructions, each consists of an opcode byte followed by its operands (multi-byte
+	operands are little endian). The firmware runs it in the main loop at full cpu speed, the usb interrupts stay
+	active. Data read by the script is appended to the result in the order of the instructions.
+	SPI1 uses PA5 (SCK), PA6 (MISO) and PA7 (MOSI) in mode 0 at 9 MHz, chip select is done with gpio instructions.
+	I2C1 uses PB6 (SCL) and PB7 (SDA) at 100 kHz
+*/
+#define SCRIPT_MAX_SIZE 1024
+
+// maximum size of the data in the result
+#define SCRIPT_RESULT_SIZE 4096
+
+// maximum nesting of loops
+#define SCRIPT_LOOP_DEPTH 4
+
+// time in microseconds after which an i2c instruction gives up waiting for the bus
+#define SCRIPT_I2C_TIMEOUT 1000
+
+enum ScriptOpcode {
+	// end of script, also implied at the end of the uploaded data
+	SCRIPT_END = 0,
+
+	// port (enum CommandPort), mask (2): set or clear the pins of mask
+	SCRIPT_GPIO_SET = 1,
+	SCRIPT_GPIO_CLEAR = 2,
+
+	// port, mask (2): read the pins of mask, result: state (2)
+	SCRIPT_GPIO_READ = 3,
+
+	// microseconds (2): busy wait
+	SCRIPT_DELAY = 4,
+
+	// length (1), data (length): full duplex transfer on SPI1, result: received data (length)
+	SCRIPT_SPI_TRANSFER = 5,
+
+	// address (1), length (1), data (length): write to a 7 bit address on I2C1
+	SCRIPT_I2C_WRITE = 6,
+
+	// address (1), length (1): read from a 7 bit address on I2C1, result: data (length)
+	SCRIPT_I2C_READ = 7,
+
+	// count (2): repeat the instructions up to the matching SCRIPT_LOOP_END count times (at least once)
+	SCRIPT_LOOP = 8,
+	SCRIPT_LOOP_END = 9
+};
+
+enum ScriptStatus {
+	SCRIPT_OK = 0,
+
+	// unknown opcode or operands beyond the end of the script
+	SCRIPT_INVALID = 1,
+
+	// loops nested too deep or SCRIPT_LOOP_END without SCRIPT_LOOP
+	SCRIPT_LOOP_ERROR = 2,
+
+	// the data read by the script exceeds SCRIPT_RESULT_SIZE
+	SCRIPT_OVERFLOW = 3,
+
+	// gpio instruction on a pin used by usb (PA11, PA12)
+	SCRIPT_RESERVED = 4,
+
+	// the i2c device did not acknowledge its address or a byte that was written
+	SCRIPT_I2C_NACK = 5,
+
+	// i2c bus error, lost arbitration or no progress within SCRIPT_I2C_TIMEOUT microseconds, e.g. a device that holds
+	// the clock low
+	SCRIPT_I2C_ERROR = 6
+};
+
+// header of the result of a script run, followed by size bytes of data
+struct ScriptResult {
+	// enum ScriptStatus
+	uint8_t status;
+	uint8_t reserved;
+
+	// offset of the instruction that failed
+	uint16_t offset;
+
+	// size of the data
+	uint16_t size;
+	uint16_t reserved2;
+
+	// run time in cpu cycles
+	uint32_t cycles;
+};
+
+/*
+	ADC streaming
+	A timer triggers the conversions of ADC1 (or ADC1 and ADC2 in dual mode), dma writes the samples into a circular
+	buffer of two blocks. Each filled block is sent as packets of struct StreamHeader followed by ADC_PACKET_DATA
+	bytes of samples, a sample is a 12 bit value in a uint16_t (dual mode: ADC1 followed by ADC2). The stream
+	consists of full packets only, therefore the host should read transfers of a multiple of the max packet size.
+	With AdcConfig.crc a short packet of struct StreamCrc follows the packets of each block and ends the transfer.
+	With AdcConfig.timestamp a struct StreamTimestamp follows the StreamHeader and the packet holds
+	ADC_TIMESTAMP_PACKET_DATA bytes of samples
+*/
+#define ADC_PACKET_DATA 60
+
+// packets per dma block
+#define ADC_BLOCK_PACKETS 32
+#define ADC_BLOCK_SIZE (ADC_PACKET_DATA * ADC_BLOCK_PACKETS)
+
+// bytes of samples in a packet with timestamp, a block consists of ADC_BLOCK_SIZE / ADC_TIMESTAMP_PACKET_DATA packets
+#define ADC_TIMESTAMP_PACKET_DATA 48
+
+// maximum sample rate: 12 MHz adc clock and 1.5 + 12.5 cycles per conversion. Full speed usb carries up to 19 bulk
+// packets per frame, i.e. about 570000 samples/s (half of it in dual mode), above that blocks get dropped unless
+// ADC_CODEC_DELTA compresses the samples
+#define ADC_MAX_SAMPLE_RATE 857142
+
+// configuration of the adc stream
+struct AdcConfig {
+	// sample rate in Hz, the actual rate is 72 MHz / round(72 MHz / sampleRate)
+	uint32_t sampleRate;
+
+	// channel of ADC1 and in dual mode of ADC2 (a different one): 0-7 are PA0-PA7, 8 and 9 are PB0 and PB1
+	uint8_t channel;
+	uint8_t channel2;
+
+	// 1 for dual mode: ADC1 and ADC2 convert simultaneously
+	uint8_t dual;
+
+	// enum AdcCodec
+	uint8_t codec;
+
+	// 1 to end each block with a struct StreamCrc
+	uint8_t crc;
+
+	// 1 to stamp each packet with a struct StreamTimestamp
+	uint8_t timestamp;
+	uint16_t reserved;
+};
+
+// encoding of the samples in the packets of the adc stream
+enum AdcCodec {
+	// 12 bit samples in uint16_t
+	ADC_CODEC_NONE = 0,
+
+	// delta and bit packing (see compressed adc stream)
+	ADC_CODEC_DELTA = 1
+};
+
+// header of each packet of the adc stream
+struct StreamHeader {
+	// position of the packet in the stream, dropped packets show up as gaps (with ADC_CODEC_DELTA a dropped block
+	// advances the sequence by one)
+	uint16_t sequence;
+
+	// number of dropped blocks (lower 16 bits of Counters.adcOverflows)
+	uint16_t overflows;
+};
+
+// timestamp of a packet of the adc stream if AdcConfig.timestamp is set. All devices on a bus see the same start of
+// frame (sof) from the host, therefore the frame numbers relate the cycle counters of the devices to each other. The
+// sof values are valid after the first sof
+struct StreamTimestamp {
+	// USB_FNR when the packet was written: frame number in bits 0-10, number of lost sofs in bits 11-12, bit 13 is
+	// set while the frame timer is locked to the sofs of the host
+	uint16_t frame;
+
+	// frame number of the last sof that the firmware has handled, differs from the frame number if the sof interrupt
+	// was pending when the packet was written
+	uint16_t sofFrame;
+
+	// cpu cycle counter (CPU_CLOCK) at the sof interrupt of sofFrame and when the packet was written, the difference
+	// is the position of the packet in the frame
+	uint32_t sofCycles;
+	uint32_t cycles;
+};
+
+/*
+	Block crc
+	The crc unit of the STM32 calculates a CRC-32 with polynomial 0x04C11DB7, initial value 0xffffffff, no
+	reflection and no final xor. It processes 32 bit words most significant bit first, the words are little endian
+	in memory, i.e. the bytes of each word are processed in reverse order compared to CRC-32/MPEG-2
+*/
+#define STREAM_CRC_POLYNOMIAL 0x04C11DB7
+#define STREAM_CRC_INIT 0xffffffff
+
+// short packet that ends a block of the adc stream if AdcConfig.crc is set
+struct StreamCrc {
+	// sequence number and overflows as in StreamHeader, the crc packet counts as packet of the stream. If the block
+	// gets dropped before its crc packet was sent, the sequence advances by one for the crc packet
+	uint16_t sequence;
+	uint16_t overflows;
+
+	// crc of the ADC_BLOCK_SIZE bytes of samples of the block (with ADC_CODEC_DELTA of the decoded samples)
+	uint32_t crc;
+};
+
+/*
+	Compressed adc stream
+	With ADC_CODEC_DELTA the ADC_PACKET_DATA bytes after the StreamHeader of each packet can be decoded on their own:
+	the first sample (dual mode: the first sample of ADC1 and ADC2) as uint16_t, followed by groups of
+	CODEC_GROUP_SIZE samples. Each group starts with a byte that holds the width w of the group (0 to
+	CODEC_MAX_WIDTH), followed by 2 * w bytes that hold the deltas to the previous sample of the same adc. The deltas
+	are zigzag encoded (0, -1, 1, -2, ... become 0, 1, 2, 3, ...) and packed as w bit values, least significant bit
+	first. CODEC_END or the end of the packet ends the groups
+*/
+#define CODEC_GROUP_SIZE 16
+#define CODEC_MAX_WIDTH 13
+#define CODEC_END 0xff
+
+// maximum number of samples in a packet: groups of width 0 behind one reference sample
+#define CODEC_MAX_SAMPLES ((ADC_PACKET_DATA - 2) * CODEC_GROUP_SIZE)
+
+/*
+	UART bridge
+	USART1 (PA9 tx, PA10 rx) without flow control. Transfers received on out 2 are sent by dma while the next
+	transfer is received, out 2 naks while the transmitter is busy so that no data gets lost. Received data is written
+	by dma into a circular buffer and sent on in 1 as full packets, the rest follows as a short packet when the line
+	becomes idle (a zero length packet if the last packet was full), so that a read of the host completes after each
+	burst of data
+*/
+#define UART_MIN_BAUD_RATE 1200
+
+// 72 MHz / 16
+#define UART_MAX_BAUD_RATE 4500000
+
+enum UartParity {
+	UART_PARITY_NONE = 0,
+	UART_PARITY_ODD = 1,
+	UART_PARITY_EVEN = 2
+};
+
+// configuration of the uart bridge, always 8 data bits
+struct UartConfig {
+	uint32_t baudRate;
+
+	// enum UartParity
+	uint8_t parity;
+
+	// 1 or 2
+	uint8_t stopBits;
+	uint16_t reserved;
+};
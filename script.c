@@ -0,0 +1,267 @@
+#include <stdbool.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include "script.h"
+
+
+// gpio ports of the instructions, indexed by enum CommandPort
+static const uint32_t scriptPorts[] = {GPIOA, GPIOB, GPIOC};
+
+// configure SPI1 and I2C1 and their pins for a script run
+static void scriptAcquire(void) {
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_GPIOB);
+	rcc_periph_clock_enable(RCC_AFIO);
+	rcc_periph_clock_enable(RCC_SPI1);
+	rcc_periph_clock_enable(RCC_I2C1);
+
+	// SPI1: SCK and MOSI are driven by the peripheral, MISO is an input
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_SPI1_SCK | GPIO_SPI1_MOSI);
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_FLOAT, GPIO_SPI1_MISO);
+
+	// mode 0 with 72 MHz / 8 = 9 MHz, chip select is done by the script
+	spi_init_master(SPI1, SPI_CR1_BAUDRATE_FPCLK_DIV_8, SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE,
+		SPI_CR1_CPHA_CLK_TRANSITION_1, SPI_CR1_DFF_8BIT, SPI_CR1_MSBFIRST);
+	spi_enable_software_slave_management(SPI1);
+	spi_set_nss_high(SPI1);
+	spi_enable(SPI1);
+
+	// I2C1: open drain with external pull-ups, 100 kHz
+	gpio_set_mode(GPIOB, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_OPENDRAIN, GPIO_I2C1_SCL | GPIO_I2C1_SDA);
+	i2c_peripheral_disable(I2C1);
+	i2c_set_speed(I2C1, i2c_speed_sm_100k, rcc_apb1_frequency / 1000000);
+	i2c_peripheral_enable(I2C1);
+}
+
+// stop SPI1 and I2C1 and release their pins as analog inputs, the state of unused pins which is also what the adc
+// needs on PA5 to PA7 (the mode can switch to the adc stream while a script runs)
+static void scriptRelease(void) {
+	spi_disable(SPI1);
+	i2c_peripheral_disable(I2C1);
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG, GPIO_SPI1_SCK | GPIO_SPI1_MISO | GPIO_SPI1_MOSI);
+	gpio_set_mode(GPIOB, GPIO_MODE_INPUT, GPIO_CNF_INPUT_ANALOG, GPIO_I2C1_SCL | GPIO_I2C1_SDA);
+}
+
+// get the number of operand bytes of the instruction at offset, -1 if the instruction is invalid or incomplete
+static int scriptOperandSize(const uint8_t *code, int offset, int size) {
+	int remaining = size - offset - 1;
+	const uint8_t *operands = code + offset + 1;
+	int n;
+	switch (code[offset]) {
+	case SCRIPT_GPIO_SET:
+	case SCRIPT_GPIO_CLEAR:
+	case SCRIPT_GPIO_READ:
+		n = 3;
+		break;
+	case SCRIPT_DELAY:
+	case SCRIPT_I2C_READ:
+	case SCRIPT_LOOP:
+		n = 2;
+		break;
+	case SCRIPT_SPI_TRANSFER:
+		n = remaining >= 1 ? 1 + operands[0] : 1;
+		break;
+	case SCRIPT_I2C_WRITE:
+		n = remaining >= 2 ? 2 + operands[1] : 2;
+		break;
+	case SCRIPT_LOOP_END:
+		n = 0;
+		break;
+	default:
+		return -1;
+	}
+	return n <= remaining ? n : -1;
+}
+
+// busy wait using the cycle counter
+static void scriptDelay(uint32_t microseconds) {
+	uint32_t start = dwt_read_cycle_counter();
+	uint32_t cycles = microseconds * (CPU_CLOCK / 1000000);
+	while (dwt_read_cycle_counter() - start < cycles)
+		;
+}
+
+// wait until one of the flags is set in I2C1_SR1, returns SCRIPT_OK or an i2c status (see enum ScriptStatus)
+static int scriptI2cWait(uint32_t flags) {
+	uint32_t start = dwt_read_cycle_counter();
+	while (true) {
+		uint32_t sr1 = I2C_SR1(I2C1);
+		if (sr1 & I2C_SR1_AF)
+			return SCRIPT_I2C_NACK;
+		if (sr1 & (I2C_SR1_BERR | I2C_SR1_ARLO))
+			return SCRIPT_I2C_ERROR;
+		if (sr1 & flags)
+			return SCRIPT_OK;
+		if (dwt_read_cycle_counter() - start >= SCRIPT_I2C_TIMEOUT * (CPU_CLOCK / 1000000))
+			return SCRIPT_I2C_ERROR;
+	}
+}
+
+// start condition and address (reference manual: 26.3.3 I2C master mode)
+static int scriptI2cStart(uint8_t address, uint8_t direction) {
+	i2c_send_start(I2C1);
+	int status = scriptI2cWait(I2C_SR1_SB);
+	if (status != SCRIPT_OK)
+		return status;
+	i2c_send_7bit_address(I2C1, address, direction);
+	status = scriptI2cWait(I2C_SR1_ADDR);
+
+	// reading SR2 after SR1 clears ADDR
+	(void)I2C_SR2(I2C1);
+	return status;
+}
+
+static int scriptI2cWrite(uint8_t address, const uint8_t *data, int size) {
+	int status = scriptI2cStart(address, I2C_WRITE);
+	for (int i = 0; i < size && status == SCRIPT_OK; ++i) {
+		i2c_send_data(I2C1, data[i]);
+		status = scriptI2cWait(I2C_SR1_BTF);
+	}
+	return status;
+}
+
+static int scriptI2cRead(uint8_t address, uint8_t *data, int size) {
+	i2c_enable_ack(I2C1);
+	int status = scriptI2cStart(address, I2C_READ);
+	for (int i = 0; i < size && status == SCRIPT_OK; ++i) {
+		// no acknowledge after the last byte so that the device releases the bus
+		if (i == size - 1)
+			i2c_disable_ack(I2C1);
+		status = scriptI2cWait(I2C_SR1_RxNE);
+		if (status == SCRIPT_OK)
+			data[i] = i2c_get_data(I2C1);
+	}
+	return status;
+}
+
+// end the transfer also after an error and clear the error flags for the next one
+static void scriptI2cStop(void) {
+	i2c_send_stop(I2C1);
+	I2C_SR1(I2C1) &= ~(I2C_SR1_AF | I2C_SR1_BERR | I2C_SR1_ARLO);
+}
+
+int scriptRun(const uint8_t *code, int size, uint8_t *result) {
+	struct ScriptResult *header = (struct ScriptResult *)result;
+	uint8_t *data = result + sizeof(struct ScriptResult);
+	int count = 0;
+
+	// start offset and remaining iterations of the active loops
+	struct {
+		int start;
+		uint16_t remaining;
+	} loops[SCRIPT_LOOP_DEPTH];
+	int depth = 0;
+
+	uint32_t start = dwt_read_cycle_counter();
+	scriptAcquire();
+	int status = SCRIPT_OK;
+	int offset = 0;
+	while (offset < size && code[offset] != SCRIPT_END) {
+		int n = scriptOperandSize(code, offset, size);
+		if (n < 0) {
+			status = SCRIPT_INVALID;
+			break;
+		}
+		const uint8_t *operands = code + offset + 1;
+		int next = offset + 1 + n;
+
+		// number of bytes the instruction adds to the result
+		int resultSize = 0;
+		switch (code[offset]) {
+		case SCRIPT_GPIO_READ:
+			resultSize = 2;
+			break;
+		case SCRIPT_SPI_TRANSFER:
+			resultSize = operands[0];
+			break;
+		case SCRIPT_I2C_READ:
+			resultSize = operands[1];
+			break;
+		}
+		if (count + resultSize > SCRIPT_RESULT_SIZE) {
+			status = SCRIPT_OVERFLOW;
+			break;
+		}
+
+		switch (code[offset]) {
+		case SCRIPT_GPIO_SET:
+		case SCRIPT_GPIO_CLEAR:
+		case SCRIPT_GPIO_READ: {
+			uint16_t mask = operands[1] | (operands[2] << 8);
+			if (operands[0] > COMMAND_PORT_C) {
+				status = SCRIPT_INVALID;
+				break;
+			}
+			uint32_t port = scriptPorts[operands[0]];
+			if (code[offset] == SCRIPT_GPIO_READ) {
+				uint16_t state = gpio_get(port, mask);
+				data[count++] = state;
+				data[count++] = state >> 8;
+			} else if (operands[0] == COMMAND_PORT_A && (mask & (GPIO11 | GPIO12))) {
+				// usb data lines
+				status = SCRIPT_RESERVED;
+			} else if (code[offset] == SCRIPT_GPIO_SET) {
+				gpio_set(port, mask);
+			} else {
+				gpio_clear(port, mask);
+			}
+			break;
+		}
+		case SCRIPT_DELAY:
+			scriptDelay(operands[0] | (operands[1] << 8));
+			break;
+		case SCRIPT_SPI_TRANSFER:
+			for (int i = 0; i < operands[0]; ++i)
+				data[count++] = spi_xfer(SPI1, operands[1 + i]);
+			break;
+		case SCRIPT_I2C_WRITE:
+			status = scriptI2cWrite(operands[0], operands + 2, operands[1]);
+			scriptI2cStop();
+			break;
+		case SCRIPT_I2C_READ:
+			status = scriptI2cRead(operands[0], data + count, operands[1]);
+			scriptI2cStop();
+			if (status == SCRIPT_OK)
+				count += operands[1];
+			break;
+		case SCRIPT_LOOP:
+			if (depth == SCRIPT_LOOP_DEPTH) {
+				status = SCRIPT_LOOP_ERROR;
+				break;
+			}
+			loops[depth].start = next;
+			loops[depth].remaining = operands[0] | (operands[1] << 8);
+			++depth;
+			break;
+		case SCRIPT_LOOP_END:
+			if (depth == 0) {
+				status = SCRIPT_LOOP_ERROR;
+			} else if (loops[depth - 1].remaining > 1) {
+				--loops[depth - 1].remaining;
+				next = loops[depth - 1].start;
+			} else {
+				--depth;
+			}
+			break;
+		}
+		if (status != SCRIPT_OK)
+			break;
+		offset = next;
+	}
+	if (status == SCRIPT_OK && depth > 0) {
+		// loop without end
+		status = SCRIPT_LOOP_ERROR;
+	}
+	scriptRelease();
+
+	header->status = status;
+	header->reserved = 0;
+	header->offset = offset;
+	header->size = count;
+	header->reserved2 = 0;
+	header->cycles = dwt_read_cycle_counter() - start;
+	return sizeof(struct ScriptResult) + count;
+}
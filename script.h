@@ -0,0 +1,14 @@
+#pragma once
+
+// interpreter for scripts uploaded by the host (see scripts in protocol.h)
+
+#include <stdint.h>
+#include "protocol.h"
+
+
+// size of the result of a script run: struct ScriptResult followed by the data read by the script
+#define SCRIPT_RESULT_BUFFER_SIZE (sizeof(struct ScriptResult) + SCRIPT_RESULT_SIZE)
+
+// run a script and write the result into result (SCRIPT_RESULT_BUFFER_SIZE bytes, 4 byte aligned), returns the size
+// of the result. SPI1 and I2C1 drive their pins only while the script runs
+int scriptRun(const uint8_t *code, int size, uint8_t *result);
@@ -0,0 +1,12 @@
+#pragma once
+
+// simulated cycle counter, counts in units of the 72MHz cpu clock derived from the monotonic clock of the host
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool dwt_enable_cycle_counter(void);
+uint32_t dwt_read_cycle_counter(void);
+
+// cycle counter register, reads the simulated counter
+#define DWT_CYCCNT dwt_read_cycle_counter()
@@ -0,0 +1,23 @@
+#pragma once
+
+// simulated interrupt controller, the test harness calls the interrupt handlers of enabled interrupts
+
+#include <stdint.h>
+
+#define NVIC_DMA1_CHANNEL1_IRQ 11
+#define NVIC_DMA1_CHANNEL4_IRQ 14
+#define NVIC_DMA1_CHANNEL5_IRQ 15
+#define NVIC_USB_HP_CAN_TX_IRQ 19
+#define NVIC_USB_LP_CAN_RX0_IRQ 20
+#define NVIC_USART1_IRQ 37
+
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+
+// interrupt handlers implemented by the firmware
+void usb_hp_can_tx_isr(void);
+void usb_lp_can_rx0_isr(void);
+void dma1_channel1_isr(void);
+void dma1_channel4_isr(void);
+void dma1_channel5_isr(void);
+void usart1_isr(void);
@@ -0,0 +1,29 @@
+#pragma once
+
+// simulated adc, conversions are simulated by the dma (see simAdcConvert() in usbfs.h)
+
+#include <stdint.h>
+
+#define ADC1 0
+#define ADC2 1
+
+extern uint32_t simAdcDr[2];
+#define ADC_DR(adc) simAdcDr[adc]
+
+#define ADC_CR1_DUALMOD_IND 0
+#define ADC_CR1_DUALMOD_RSM (6 << 16)
+#define ADC_CR2_EXTSEL_TIM3_TRGO (4 << 17)
+#define ADC_CR2_EXTSEL_SWSTART (7 << 17)
+
+void adc_power_on(uint32_t adc);
+void adc_power_off(uint32_t adc);
+void adc_disable_scan_mode(uint32_t adc);
+void adc_set_single_conversion_mode(uint32_t adc);
+void adc_set_right_aligned(uint32_t adc);
+void adc_set_sample_time(uint32_t adc, uint8_t channel, uint8_t time);
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[]);
+void adc_enable_external_trigger_regular(uint32_t adc, uint32_t trigger);
+void adc_reset_calibration(uint32_t adc);
+void adc_calibrate(uint32_t adc);
+void adc_set_dual_mode(uint32_t mode);
+void adc_enable_dma(uint32_t adc);
@@ -0,0 +1,11 @@
+#pragma once
+
+// simulated crc unit, written by the firmware or by dma in memory to memory mode
+
+#include <stdint.h>
+
+extern uint32_t simCrcDr;
+#define CRC_DR simCrcDr
+
+void crc_reset(void);
+uint32_t crc_calculate(uint32_t data);
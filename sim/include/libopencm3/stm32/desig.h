@@ -0,0 +1,8 @@
+#pragma once
+
+// simulated device electronic signature
+
+#include <stdint.h>
+
+void desig_get_unique_id(uint32_t *result);
+void desig_get_unique_id_as_string(char *string, unsigned int string_len);
@@ -0,0 +1,42 @@
+#pragma once
+
+// simulated dma controller, simAdcConvert(), simUartReceive() and simUartTransmit() (see usbfs.h) transfer data,
+// memory to memory transfers complete when the channel gets enabled
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DMA1 0
+#define DMA_CHANNEL1 1
+#define DMA_CHANNEL2 2
+#define DMA_CHANNEL4 4
+#define DMA_CHANNEL5 5
+
+#define DMA_TCIF (1 << 1)
+#define DMA_HTIF (1 << 2)
+
+#define DMA_CCR_PSIZE_8BIT (0 << 8)
+#define DMA_CCR_PSIZE_16BIT (1 << 8)
+#define DMA_CCR_PSIZE_32BIT (2 << 8)
+#define DMA_CCR_MSIZE_8BIT (0 << 10)
+#define DMA_CCR_MSIZE_16BIT (1 << 10)
+#define DMA_CCR_MSIZE_32BIT (2 << 10)
+
+void dma_channel_reset(uint32_t dma, uint8_t channel);
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel, uintptr_t address);
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uintptr_t address);
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number);
+uint16_t dma_get_number_of_data(uint32_t dma, uint8_t channel);
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel);
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel);
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel);
+void dma_enable_circular_mode(uint32_t dma, uint8_t channel);
+void dma_enable_mem2mem_mode(uint32_t dma, uint8_t channel);
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel, uint32_t size);
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t size);
+void dma_enable_half_transfer_interrupt(uint32_t dma, uint8_t channel);
+void dma_enable_transfer_complete_interrupt(uint32_t dma, uint8_t channel);
+void dma_enable_channel(uint32_t dma, uint8_t channel);
+void dma_disable_channel(uint32_t dma, uint8_t channel);
+bool dma_get_interrupt_flag(uint32_t dma, uint8_t channel, uint32_t interrupts);
+void dma_clear_interrupt_flags(uint32_t dma, uint8_t channel, uint32_t interrupts);
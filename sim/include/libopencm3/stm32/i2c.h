@@ -0,0 +1,43 @@
+#pragma once
+
+// simulated i2c with an eeprom of 256 bytes at address 0x50: a write sets the address pointer with the first byte
+// and stores the following bytes, a read continues at the address pointer. Other addresses are not acknowledged,
+// with simI2cStuck (see usbfs.h) the bus is held low and no start condition gets generated
+
+#include <stdint.h>
+
+#define I2C1 0
+
+#define I2C_WRITE 0
+#define I2C_READ 1
+
+#define I2C_SR1_SB (1 << 0)
+#define I2C_SR1_ADDR (1 << 1)
+#define I2C_SR1_BTF (1 << 2)
+#define I2C_SR1_RxNE (1 << 6)
+#define I2C_SR1_TxE (1 << 7)
+#define I2C_SR1_BERR (1 << 8)
+#define I2C_SR1_ARLO (1 << 9)
+#define I2C_SR1_AF (1 << 10)
+
+// registers that the firmware accesses directly
+extern uint32_t simI2cSr1;
+extern uint32_t simI2cSr2;
+#define I2C_SR1(i2c) simI2cSr1
+#define I2C_SR2(i2c) simI2cSr2
+
+enum i2c_speeds {
+	i2c_speed_sm_100k,
+	i2c_speed_fm_400k
+};
+
+void i2c_peripheral_enable(uint32_t i2c);
+void i2c_peripheral_disable(uint32_t i2c);
+void i2c_set_speed(uint32_t i2c, enum i2c_speeds speed, uint32_t clock_megahz);
+void i2c_send_start(uint32_t i2c);
+void i2c_send_stop(uint32_t i2c);
+void i2c_send_7bit_address(uint32_t i2c, uint8_t slave, uint8_t readwrite);
+void i2c_send_data(uint32_t i2c, uint8_t data);
+uint8_t i2c_get_data(uint32_t i2c);
+void i2c_enable_ack(uint32_t i2c);
+void i2c_disable_ack(uint32_t i2c);
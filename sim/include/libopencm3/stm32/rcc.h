@@ -0,0 +1,34 @@
+#pragma once
+
+// simulated reset and clock control, all functions do nothing
+
+#include <stdint.h>
+
+enum rcc_periph_clken {
+	RCC_GPIOA,
+	RCC_GPIOB,
+	RCC_GPIOC,
+	RCC_AFIO,
+	RCC_CRC,
+	RCC_SPI1,
+	RCC_I2C1,
+	RCC_ADC1,
+	RCC_ADC2,
+	RCC_DMA1,
+	RCC_TIM3,
+	RCC_USART1,
+	RCC_USB
+};
+
+enum rcc_periph_rst {
+	RST_TIM3
+};
+
+#define RCC_CFGR_ADCPRE_PCLK2_DIV6 2
+
+extern uint32_t rcc_apb1_frequency;
+
+void rcc_clock_setup_in_hse_8mhz_out_72mhz(void);
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst);
+void rcc_set_adcpre(uint32_t adcpre);
@@ -0,0 +1,20 @@
+#pragma once
+
+// simulated spi, MOSI is connected to MISO so that each transfer returns the sent data
+
+#include <stdint.h>
+
+#define SPI1 0
+
+#define SPI_CR1_BAUDRATE_FPCLK_DIV_8 (0x02 << 3)
+#define SPI_CR1_CPOL_CLK_TO_0_WHEN_IDLE 0
+#define SPI_CR1_CPHA_CLK_TRANSITION_1 0
+#define SPI_CR1_DFF_8BIT 0
+#define SPI_CR1_MSBFIRST 0
+
+int spi_init_master(uint32_t spi, uint32_t br, uint32_t cpol, uint32_t cpha, uint32_t dff, uint32_t lsbfirst);
+void spi_enable_software_slave_management(uint32_t spi);
+void spi_set_nss_high(uint32_t spi);
+void spi_enable(uint32_t spi);
+void spi_disable(uint32_t spi);
+uint16_t spi_xfer(uint32_t spi, uint16_t data);
@@ -0,0 +1,98 @@
+#pragma once
+
+// simulated usb full speed device peripheral, replaces the libopencm3 header of the same name when the firmware is
+// compiled natively. All register accesses go through GET_REG and SET_REG so that the simulator can emulate the
+// toggle-on-write and clear-only bits, the packet memory is a plain array with the 16-bit-in-32-bit layout of the
+// STM32F103
+
+#include <stdint.h>
+#include "../../../usbfs.h"
+
+#define USB_PMA_BASE ((uint8_t *)simPma)
+
+#define USB_EP_REG(EP) (&simUsb[EP])
+#define USB_CNTR_REG (&simUsb[0x40 / 4])
+#define USB_ISTR_REG (&simUsb[0x44 / 4])
+#define USB_FNR_REG (&simUsb[0x48 / 4])
+#define USB_DADDR_REG (&simUsb[0x4C / 4])
+#define USB_BTABLE_REG (&simUsb[0x50 / 4])
+
+#define GET_REG(REG) simGetReg(REG)
+#define SET_REG(REG, VAL) simSetReg(REG, VAL)
+
+// USB_CNTR
+#define USB_CNTR_CTRM 0x8000
+#define USB_CNTR_PMAOVRM 0x4000
+#define USB_CNTR_ERRM 0x2000
+#define USB_CNTR_WKUPM 0x1000
+#define USB_CNTR_SUSPM 0x0800
+#define USB_CNTR_RESETM 0x0400
+#define USB_CNTR_SOFM 0x0200
+#define USB_CNTR_ESOFM 0x0100
+#define USB_CNTR_RESUME 0x0010
+#define USB_CNTR_FSUSP 0x0008
+#define USB_CNTR_LP_MODE 0x0004
+#define USB_CNTR_PWDN 0x0002
+#define USB_CNTR_FRES 0x0001
+
+// USB_ISTR
+#define USB_ISTR_CTR 0x8000
+#define USB_ISTR_PMAOVR 0x4000
+#define USB_ISTR_ERR 0x2000
+#define USB_ISTR_WKUP 0x1000
+#define USB_ISTR_SUSP 0x0800
+#define USB_ISTR_RESET 0x0400
+#define USB_ISTR_SOF 0x0200
+#define USB_ISTR_ESOF 0x0100
+#define USB_ISTR_DIR 0x0010
+#define USB_ISTR_EP_ID 0x000F
+
+// USB_FNR
+#define USB_FNR_RXDP (1 << 15)
+#define USB_FNR_RXDM (1 << 14)
+#define USB_FNR_LCK (1 << 13)
+#define USB_FNR_LSOF_SHIFT 11
+#define USB_FNR_LSOF (3 << USB_FNR_LSOF_SHIFT)
+#define USB_FNR_FN (0x7FF << 0)
+
+// USB_DADDR
+#define USB_DADDR_EF (1 << 7)
+#define USB_DADDR_ADDR 0x007F
+
+// USB_EP
+#define USB_EP_RX_CTR 0x8000
+#define USB_EP_RX_DTOG 0x4000
+#define USB_EP_RX_STAT 0x3000
+#define USB_EP_SETUP 0x0800
+#define USB_EP_TYPE 0x0600
+#define USB_EP_KIND 0x0100
+#define USB_EP_TX_CTR 0x0080
+#define USB_EP_TX_DTOG 0x0040
+#define USB_EP_TX_STAT 0x0030
+#define USB_EP_ADDR 0x000F
+
+#define USB_EP_RX_STAT_DISABLED 0x0000
+#define USB_EP_RX_STAT_STALL 0x1000
+#define USB_EP_RX_STAT_NAK 0x2000
+#define USB_EP_RX_STAT_VALID 0x3000
+
+#define USB_EP_TX_STAT_DISABLED 0x0000
+#define USB_EP_TX_STAT_STALL 0x0010
+#define USB_EP_TX_STAT_NAK 0x0020
+#define USB_EP_TX_STAT_VALID 0x0030
+
+#define USB_EP_TYPE_BULK 0x0000
+#define USB_EP_TYPE_CONTROL 0x0200
+#define USB_EP_TYPE_ISO 0x0400
+#define USB_EP_TYPE_INTERRUPT 0x0600
+
+// buffer descriptor table in packet memory
+#define USB_EP_TX_ADDR(EP) ((uint32_t *)(USB_PMA_BASE + (GET_REG(USB_BTABLE_REG) + (EP) * 8 + 0) * 2))
+#define USB_EP_TX_COUNT(EP) ((uint32_t *)(USB_PMA_BASE + (GET_REG(USB_BTABLE_REG) + (EP) * 8 + 2) * 2))
+#define USB_EP_RX_ADDR(EP) ((uint32_t *)(USB_PMA_BASE + (GET_REG(USB_BTABLE_REG) + (EP) * 8 + 4) * 2))
+#define USB_EP_RX_COUNT(EP) ((uint32_t *)(USB_PMA_BASE + (GET_REG(USB_BTABLE_REG) + (EP) * 8 + 6) * 2))
+
+#define USB_GET_EP_TX_ADDR(EP) GET_REG(USB_EP_TX_ADDR(EP))
+#define USB_GET_EP_RX_ADDR(EP) GET_REG(USB_EP_RX_ADDR(EP))
+#define USB_GET_EP_TX_BUFF(EP) (USB_PMA_BASE + USB_GET_EP_TX_ADDR(EP) * 2)
+#define USB_GET_EP_RX_BUFF(EP) (USB_PMA_BASE + USB_GET_EP_RX_ADDR(EP) * 2)
@@ -0,0 +1,15 @@
+#pragma once
+
+// simulated timer, all functions do nothing
+
+#include <stdint.h>
+
+#define TIM3 0
+
+#define TIM_CR2_MMS_UPDATE (2 << 4)
+
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value);
+void timer_set_period(uint32_t timer_peripheral, uint32_t period);
+void timer_set_master_mode(uint32_t timer_peripheral, uint32_t mode);
+void timer_enable_counter(uint32_t timer_peripheral);
+void timer_disable_counter(uint32_t timer_peripheral);
@@ -0,0 +1,46 @@
+#pragma once
+
+// simulated usart, simUartReceive(), simUartIdle() and simUartTransmit() (see usbfs.h) move the data
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define USART1 0
+
+#define USART_SR_PE (1 << 0)
+#define USART_SR_FE (1 << 1)
+#define USART_SR_NE (1 << 2)
+#define USART_SR_ORE (1 << 3)
+#define USART_SR_IDLE (1 << 4)
+
+#define USART_CR1_IDLEIE (1 << 4)
+
+#define USART_PARITY_NONE 0
+#define USART_PARITY_EVEN (1 << 10)
+#define USART_PARITY_ODD (3 << 9)
+
+#define USART_STOPBITS_1 (0 << 12)
+#define USART_STOPBITS_2 (2 << 12)
+
+#define USART_MODE_TX_RX (3 << 2)
+
+#define USART_FLOWCONTROL_NONE 0
+
+// registers that the firmware accesses directly
+extern uint32_t simUsartDr;
+extern uint32_t simUsartCr1;
+#define USART_DR(usart) simUsartDr
+#define USART_CR1(usart) simUsartCr1
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud);
+void usart_set_databits(uint32_t usart, uint32_t bits);
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits);
+void usart_set_parity(uint32_t usart, uint32_t parity);
+void usart_set_mode(uint32_t usart, uint32_t mode);
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol);
+void usart_enable(uint32_t usart);
+void usart_disable(uint32_t usart);
+void usart_enable_rx_dma(uint32_t usart);
+void usart_enable_tx_dma(uint32_t usart);
+bool usart_get_flag(uint32_t usart, uint32_t flag);
+uint16_t usart_recv(uint32_t usart);
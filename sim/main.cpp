@@ -0,0 +1,1420 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "usbfs.h"
+#include "../host/Codec.hpp"
+#include "../host/Crc.hpp"
+#include "../host/Timeline.hpp"
+#include "../host/Trace.hpp"
+#include "../protocol.h"
+extern "C" {
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/crc.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/st_usbfs.h>
+#include "../codec.h"
+#include "../frame.h"
+#include "../pma.h"
+#include "../script.h"
+#include "../uart.h"
+#include "../usb.h"
+}
+
+// test harness that plays the role of the host: enumerates the simulated firmware and exercises the bulk modes
+
+
+// transfer direction
+enum UsbDirection {
+	USB_OUT = 0, // to device
+	USB_IN = 0x80 // to host
+};
+
+// setup packet
+struct Setup {
+	uint8_t bmRequestType;
+	uint8_t bRequest;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+};
+
+// duration of interrupt handler calls
+struct IsrStatistics {
+	uint64_t count = 0;
+	uint64_t totalNs = 0;
+	uint64_t maxNs = 0;
+
+	void add(uint64_t ns) {
+		++this->count;
+		this->totalNs += ns;
+		this->maxNs = std::max(this->maxNs, ns);
+	}
+
+	void print(const char *name) {
+		printf("%-6s %8llu calls, avg %6.1f ns, max %6llu ns\n", name, (unsigned long long)this->count,
+			this->count == 0 ? 0.0 : double(this->totalNs) / double(this->count), (unsigned long long)this->maxNs);
+	}
+};
+
+// interrupts of the usb peripheral, the firmware sleeps in between
+static IsrStatistics lpIsr;
+static IsrStatistics hpIsr;
+
+// transactions after which no interrupt was pending (e.g. nak) and the firmware kept sleeping
+static uint64_t wakeupsSaved = 0;
+
+// current device address and data toggles of the bulk endpoints as seen by the host
+static uint8_t address = 0;
+static int inToggle = 0;
+static int outToggle = 0;
+
+// max packet size of the bulk endpoints from the configuration descriptor
+static int bulkPacketSize = 0;
+
+static int failures = 0;
+
+static void check(bool condition, const char *message) {
+	if (!condition) {
+		printf("FAIL: %s\n", message);
+		++failures;
+	}
+}
+
+// call the interrupt handler of the firmware if a usb interrupt is pending and enabled
+static void interrupt() {
+	int irq = simPendingIrq();
+	if (irq < 0 || !(simNvic & (1 << irq))) {
+		++wakeupsSaved;
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	if (irq == NVIC_USB_HP_CAN_TX_IRQ)
+		usb_hp_can_tx_isr();
+	else
+		usb_lp_can_rx0_isr();
+	uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	(irq == NVIC_USB_HP_CAN_TX_IRQ ? hpIsr : lpIsr).add(ns);
+
+	// the handler has to process all events, otherwise the interrupt would fire again immediately
+	check(simPendingIrq() < 0, "interrupt still pending after handler returned");
+}
+
+// repeat a transaction while the device answers with NAK, the firmware may handle interrupts in between
+template <typename F>
+static SimResult retry(F transaction) {
+	SimResult result = SIM_NAK;
+	for (int i = 0; i < 100 && result == SIM_NAK; ++i) {
+		result = transaction();
+		if (result == SIM_NAK)
+			interrupt();
+	}
+	return result;
+}
+
+static bool controlIn(Setup const &setup, void *data, int &length) {
+	if (simSetup(address, 0, &setup) != SIM_ACK)
+		return false;
+	interrupt();
+
+	// data stage starts with DATA1
+	uint8_t *d = static_cast<uint8_t *>(data);
+	length = 0;
+	int expectedToggle = 1;
+	while (true) {
+		uint8_t packet[64];
+		int size = 0;
+		int toggle;
+		if (retry([&] {return simIn(address, 0, &toggle, packet, &size);}) != SIM_ACK)
+			return false;
+		interrupt();
+		if (toggle != expectedToggle)
+			return false;
+		expectedToggle ^= 1;
+		int n = std::min(size, setup.wLength - length);
+		memcpy(d + length, packet, n);
+		length += n;
+		if (size < 64 || length >= setup.wLength)
+			break;
+	}
+
+	// status stage: zero length packet with DATA1
+	if (retry([&] {return simOut(address, 0, 1, nullptr, 0);}) != SIM_ACK)
+		return false;
+	interrupt();
+	return true;
+}
+
+static bool controlOut(Setup const &setup, const void *data = nullptr) {
+	if (simSetup(address, 0, &setup) != SIM_ACK)
+		return false;
+	interrupt();
+
+	// data stage of wLength bytes starts with DATA1
+	const uint8_t *d = static_cast<const uint8_t *>(data);
+	int toggle = 1;
+	for (int offset = 0; offset < setup.wLength; offset += 64) {
+		int n = std::min(setup.wLength - offset, 64);
+		if (retry([&] {return simOut(address, 0, toggle, d + offset, n);}) != SIM_ACK)
+			return false;
+		interrupt();
+		toggle ^= 1;
+	}
+
+	// status stage: zero length packet with DATA1
+	uint8_t packet[64];
+	int size = -1;
+	if (retry([&] {return simIn(address, 0, &toggle, packet, &size);}) != SIM_ACK)
+		return false;
+	interrupt();
+	return size == 0 && toggle == 1;
+}
+
+static SimResult bulkIn(void *data, int &size) {
+	int toggle;
+	SimResult result = retry([&] {return simIn(address, 1, &toggle, data, &size);});
+	if (result == SIM_ACK) {
+		interrupt();
+		check(toggle == inToggle, "bulk in data toggle");
+		inToggle ^= 1;
+	}
+	return result;
+}
+
+static SimResult bulkOut(const void *data, int size) {
+	SimResult result = retry([&] {return simOut(address, 2, outToggle, data, size);});
+	if (result == SIM_ACK) {
+		interrupt();
+		outToggle ^= 1;
+	}
+	return result;
+}
+
+// send a transfer as packets of max size, ended by a short packet or a zero length packet if zlp is true
+static bool bulkWrite(const uint8_t *data, int size, bool zlp) {
+	int offset = 0;
+	while (true) {
+		int n = std::min(size - offset, bulkPacketSize);
+		if (n == 0 && !zlp)
+			return true;
+		if (bulkOut(data + offset, n) != SIM_ACK)
+			return false;
+		offset += n;
+		if (n < bulkPacketSize)
+			return true;
+	}
+}
+
+// receive a transfer until a short packet arrives or the buffer is full like libusb, returns the number of received
+// bytes or -1 on error
+static int bulkRead(uint8_t *data, int size) {
+	int offset = 0;
+	while (offset < size) {
+		uint8_t packet[64];
+		int n;
+		if (bulkIn(packet, n) != SIM_ACK || offset + n > size)
+			return -1;
+		memcpy(data + offset, packet, n);
+		offset += n;
+		if (n < bulkPacketSize)
+			return offset;
+	}
+	return offset;
+}
+
+static bool setMode(Mode mode) {
+	Setup setup = {USB_OUT | 0x40, VENDOR_SET_MODE, uint16_t(mode), 0, 0};
+	return controlOut(setup);
+}
+
+static void enumerate() {
+	printf("enumerate\n");
+
+	// bus reset
+	simReset();
+	interrupt();
+	address = 0;
+
+	// get device descriptor
+	uint8_t descriptor[256];
+	int length;
+	Setup getDevice = {USB_IN, 0x06, 0x0100, 0, 64};
+	check(controlIn(getDevice, descriptor, length), "get device descriptor");
+	check(length == 18 && descriptor[0] == 18 && descriptor[1] == 0x01, "device descriptor");
+	check(descriptor[8] == 0x83 && descriptor[9] == 0x04, "vendor id");
+
+	// set address
+	Setup setAddress = {USB_OUT, 0x05, 5, 0, 0};
+	check(controlOut(setAddress), "set address");
+	address = 5;
+
+	// get configuration descriptor
+	Setup getConfiguration = {USB_IN, 0x06, 0x0200, 0, 255};
+	check(controlIn(getConfiguration, descriptor, length), "get configuration descriptor");
+	check(length >= 32 && length == (descriptor[2] | descriptor[3] << 8), "configuration descriptor length");
+	bulkPacketSize = descriptor[9 + 9 + 4] | descriptor[9 + 9 + 5] << 8;
+
+	// set configuration, resets the data toggles of the bulk endpoints
+	Setup setConfiguration = {USB_OUT, 0x09, 1, 0, 0};
+	check(controlOut(setConfiguration), "set configuration");
+	inToggle = 0;
+	outToggle = 0;
+}
+
+// get a string descriptor and convert it to ascii, returns the length of the descriptor or -1 on error
+static int getString(int index, char *string, int wLength) {
+	uint8_t descriptor[256];
+	int length;
+	Setup getString = {USB_IN, 0x06, uint16_t(0x0300 | index), 0x0409, uint16_t(wLength)};
+	if (!controlIn(getString, descriptor, length) || length < 2 || descriptor[1] != 0x03)
+		return -1;
+	int count = (std::min(length, int(descriptor[0])) - 2) / 2;
+	for (int i = 0; i < count; ++i)
+		string[i] = descriptor[2 + i * 2];
+	string[count] = 0;
+	return length;
+}
+
+static void testStrings() {
+	printf("string descriptors\n");
+
+	// device descriptor refers to manufacturer, product and serial number
+	uint8_t descriptor[64];
+	int length;
+	Setup getDevice = {USB_IN, 0x06, 0x0100, 0, 18};
+	check(controlIn(getDevice, descriptor, length) && length == 18, "get device descriptor");
+	check(descriptor[14] == 1 && descriptor[15] == 2 && descriptor[16] == 3, "string indices");
+
+	// languages: english (united states)
+	char string[128];
+	Setup getLanguages = {USB_IN, 0x06, 0x0300, 0, 255};
+	check(controlIn(getLanguages, descriptor, length) && length == 4 && descriptor[2] == 0x09
+		&& descriptor[3] == 0x04, "languages");
+
+	// serial number is the unique id of the chip
+	check(getString(3, string, 255) == 50 && strcmp(string, "431922373436524B00FF3F06") == 0, "serial number");
+
+	// product string needs two packets in the data stage
+	length = getString(2, string, 255);
+	check(length > 64 && length == 2 + 2 * int(strlen(string)), "multi packet product string");
+
+	// data stage shortened by the host, the first packet is full
+	check(getString(2, string, 64) == 64, "truncated product string");
+}
+
+static void testLed() {
+	printf("led mode\n");
+
+	// in-endpoint 1 sends the first 4 bytes of the device descriptor
+	uint8_t data[64];
+	int size = 0;
+	check(bulkIn(data, size) == SIM_ACK && size == 4 && data[0] == 18, "led mode in");
+
+	// out-endpoint 2 switches the led (active low)
+	uint8_t on[4] = {1};
+	check(bulkOut(on, 4) == SIM_ACK && !(simGpio[2] & (1 << 13)), "led on");
+	uint8_t off[4] = {0};
+	check(bulkOut(off, 4) == SIM_ACK && (simGpio[2] & (1 << 13)), "led off");
+}
+
+static void testSourceSink() {
+	printf("source/sink mode\n");
+	check(setMode(MODE_SOURCE_SINK), "set source/sink mode");
+
+	// source: skip packet that was queued before the mode switch, then check the pattern
+	uint8_t data[64];
+	int size = 0;
+	int offset = -1;
+	int errors = 0;
+	for (int i = 0; i < 20; ++i) {
+		if (bulkIn(data, size) != SIM_ACK) {
+			++errors;
+			break;
+		}
+		if (size < bulkPacketSize)
+			continue;
+		if (offset < 0)
+			offset = data[0];
+		for (int j = 0; j < size; ++j) {
+			if (data[j] != offset)
+				++errors;
+			offset = (offset + 1) % PATTERN_LENGTH;
+		}
+	}
+	check(errors == 0 && offset >= 0, "source pattern");
+
+	// sink: send the pattern and check the counters
+	offset = 0;
+	int sent = 0;
+	for (int i = 0; i < 20; ++i) {
+		for (int j = 0; j < bulkPacketSize; ++j) {
+			data[j] = offset;
+			offset = (offset + 1) % PATTERN_LENGTH;
+		}
+		check(bulkOut(data, bulkPacketSize) == SIM_ACK, "sink out");
+		sent += bulkPacketSize;
+	}
+	Counters counters;
+	int length;
+	Setup getCounters = {USB_IN | 0x40, VENDOR_GET_COUNTERS, 0, 0, sizeof(Counters)};
+	check(controlIn(getCounters, &counters, length) && length == sizeof(Counters), "get counters");
+	check(counters.sinkBytes == uint32_t(sent) && counters.sinkErrors == 0, "sink counters");
+}
+
+static void testEcho() {
+	printf("echo mode\n");
+	check(setMode(MODE_ECHO), "set echo mode");
+
+	// drain packet that was queued before the mode switch
+	uint8_t data[64];
+	int size;
+	while (bulkIn(data, size) == SIM_ACK)
+		;
+
+	int errors = 0;
+	for (uint32_t i = 0; i < 100; ++i) {
+		EchoPacket request = {};
+		request.sequence = i;
+		EchoPacket reply = {};
+		if (bulkOut(&request, sizeof(request)) != SIM_ACK || bulkIn(&reply, size) != SIM_ACK
+			|| size != sizeof(EchoPacket) || reply.sequence != i)
+		{
+			++errors;
+		}
+	}
+	check(errors == 0, "echo");
+
+	// every reply was made ready in the interrupt handler that received the request
+	Latency latency;
+	int length;
+	Setup getLatency = {USB_IN | 0x40, VENDOR_GET_LATENCY, 0, 0, sizeof(Latency)};
+	check(controlIn(getLatency, &latency, length) && length == sizeof(Latency), "get latency");
+	check(latency.count == 100 && latency.minCycles <= latency.maxCycles, "latency");
+	if (latency.count > 0) {
+		printf("interrupt to packet ready (native): min %u, avg %.0f, max %u cycles\n", latency.minCycles,
+			double(latency.totalCycles) / latency.count, latency.maxCycles);
+	}
+
+	// packets larger than EchoPacket come back whole, smaller ones unchanged
+	uint8_t request[64];
+	for (int i = 0; i < 64; ++i)
+		request[i] = uint8_t(i + 0x40);
+	uint8_t reply[64];
+	check(bulkOut(request, 64) == SIM_ACK && bulkIn(reply, size) == SIM_ACK && size == 64
+		&& memcmp(reply, request, 4) == 0 && memcmp(reply + 16, request + 16, 48) == 0, "echo full packet");
+	check(bulkOut(request, 6) == SIM_ACK && bulkIn(reply, size) == SIM_ACK && size == 6
+		&& memcmp(reply, request, 6) == 0, "echo short packet");
+
+	check(setMode(MODE_LED), "set led mode");
+}
+
+static void testLoopback() {
+	printf("loopback mode\n");
+	check(setMode(MODE_LOOPBACK), "set loopback mode");
+
+	// drain packet that was queued before the mode switch
+	uint8_t data[LOOPBACK_SIZE];
+	int size;
+	while (bulkIn(data, size) == SIM_ACK)
+		;
+
+	// transfers that end with a short packet, a zero length packet or a full buffer. The replies always end with a
+	// short packet or zero length packet, the read buffer has room for one more packet like the one of bench
+	// loopback so that the zero length packet ends the read and nothing is left over for the next one
+	const int sizes[] = {0, 1, 63, 64, 65, 128, 1000, LOOPBACK_SIZE - 64, LOOPBACK_SIZE};
+	int errors = 0;
+	uint8_t reply[LOOPBACK_SIZE + 64];
+	for (int size : sizes) {
+		uint8_t transfer[LOOPBACK_SIZE];
+		for (int i = 0; i < size; ++i)
+			transfer[i] = uint8_t(i * 13 + size);
+		if (!bulkWrite(transfer, size, size < LOOPBACK_SIZE)) {
+			++errors;
+			continue;
+		}
+		int length = bulkRead(reply, sizeof(reply));
+		if (length != size || memcmp(reply, transfer, size) != 0 || bulkIn(data, length) != SIM_NAK)
+			++errors;
+	}
+	check(errors == 0, "loopback");
+
+	// a read into a buffer of exactly LOOPBACK_SIZE bytes ends with the full buffer and leaves the zero length packet
+	uint8_t transfer[LOOPBACK_SIZE] = {};
+	check(bulkWrite(transfer, LOOPBACK_SIZE, false) && bulkRead(reply, LOOPBACK_SIZE) == LOOPBACK_SIZE
+		&& bulkIn(data, size) == SIM_ACK && size == 0 && bulkIn(data, size) == SIM_NAK, "loopback zero length packet");
+	check(setMode(MODE_LED), "set led mode");
+}
+
+// receive a framed packet and append the payloads of its echo messages, returns false on error
+static bool framedRead(FrameReader &reader, uint32_t *values, int &count, int &size) {
+	uint8_t packet[64];
+	if (bulkIn(packet, size) != SIM_ACK)
+		return false;
+	frameReadPacket(&reader, packet, size);
+	const uint8_t *data;
+	int length;
+	int type;
+	while ((type = frameRead(&reader, &data, &length)) >= 0) {
+		if (type != MESSAGE_ECHO || length != 4)
+			return false;
+		memcpy(&values[count++], data, 4);
+	}
+	return true;
+}
+
+static void testFramed() {
+	printf("framed mode\n");
+	check(setMode(MODE_FRAMED), "set framed mode");
+
+	// drain packet that was queued before the mode switch
+	uint8_t data[64];
+	int size;
+	while (bulkIn(data, size) == SIM_ACK)
+		;
+
+	// flush timeout of 2 frames
+	Setup setFlushTimeout = {USB_OUT | 0x40, VENDOR_SET_FLUSH_TIMEOUT, 2, 0, 0};
+	check(controlOut(setFlushTimeout), "set flush timeout");
+
+	// led message
+	FrameWriter writer;
+	frameWriterInit(&writer);
+	uint8_t on = 1;
+	frameWrite(&writer, MESSAGE_LED, &on, 1);
+	int n = frameFinish(&writer, false);
+	check(bulkOut(writer.packet, n) == SIM_ACK && !(simGpio[2] & (1 << 13)), "framed led on");
+
+	// three packets of 10 echo messages each: the first two replies are sent padded as soon as the next message does
+	// not fit, the last one when the flush timeout has elapsed
+	uint32_t value = 0;
+	for (int p = 0; p < 3; ++p) {
+		for (int i = 0; i < 10; ++i, ++value)
+			frameWrite(&writer, MESSAGE_ECHO, &value, 4);
+		n = frameFinish(&writer, false);
+		check(bulkOut(writer.packet, n) == SIM_ACK, "framed out");
+	}
+	FrameReader reader;
+	frameReaderInit(&reader);
+	uint32_t values[30];
+	int count = 0;
+	check(framedRead(reader, values, count, size) && size == 64, "first framed packet is padded");
+	check(framedRead(reader, values, count, size) && size == 64, "second framed packet is padded");
+	check(bulkIn(data, size) == SIM_NAK, "no framed packet before flush timeout");
+	simFrame();
+	interrupt();
+	check(bulkIn(data, size) == SIM_NAK, "no framed packet before flush timeout");
+	simFrame();
+	interrupt();
+	check(framedRead(reader, values, count, size) && size == 62, "framed packet after flush timeout");
+	int errors = 0;
+	for (int i = 0; i < count; ++i) {
+		if (values[i] != uint32_t(i))
+			++errors;
+	}
+	check(count == 30 && errors == 0 && reader.lost == 0, "framed echo");
+
+	// without timeout the replies to each packet are sent immediately
+	setFlushTimeout.wValue = 0;
+	check(controlOut(setFlushTimeout), "set flush timeout");
+	frameWrite(&writer, MESSAGE_ECHO, &value, 4);
+	n = frameFinish(&writer, false);
+	count = 0;
+	check(bulkOut(writer.packet, n) == SIM_ACK && framedRead(reader, values, count, size) && count == 1
+		&& values[0] == value && reader.lost == 0, "framed echo without timeout");
+
+	check(setMode(MODE_LED), "set led mode");
+}
+
+static void testCommands() {
+	printf("commands\n");
+	check(setMode(MODE_FRAMED), "set framed mode");
+	uint8_t data[64];
+	int size;
+	while (bulkIn(data, size) == SIM_ACK)
+		;
+
+	// completions of the commands of a packet are sent as soon as the packet is processed
+	Setup setFlushTimeout = {USB_OUT | 0x40, VENDOR_SET_FLUSH_TIMEOUT, 0, 0, 0};
+	check(controlOut(setFlushTimeout), "set flush timeout");
+
+	// commands and expected completions, pipelined over several packets
+	std::vector<Command> commands;
+	std::vector<Completion> expected;
+	auto add = [&](uint8_t opcode, uint8_t port, uint16_t mask, uint16_t value, uint8_t status, uint16_t result) {
+		uint16_t tag = uint16_t(1000 + commands.size());
+		commands.push_back({tag, opcode, port, mask, value});
+		expected.push_back({tag, status, 0, result});
+	};
+	add(COMMAND_GPIO_MODE, COMMAND_PORT_B, 0x00f0, 2, COMMAND_OK, 0);
+	for (int i = 0; i < 16; ++i) {
+		add(COMMAND_GPIO_WRITE, COMMAND_PORT_B, 0x00f0, uint16_t(i << 4), COMMAND_OK, 0);
+		add(COMMAND_GPIO_READ, COMMAND_PORT_B, 0x00f0, 0, COMMAND_OK, uint16_t(i << 4));
+	}
+	add(COMMAND_GPIO_WRITE, COMMAND_PORT_A, 1 << 12, 0, COMMAND_RESERVED, 0);
+	add(COMMAND_GPIO_WRITE, 3, 1, 0, COMMAND_INVALID, 0);
+	add(7, COMMAND_PORT_B, 1, 0, COMMAND_INVALID, 0);
+
+	// completions arrive in order, several per packet
+	FrameReader reader;
+	frameReaderInit(&reader);
+	std::vector<Completion> completions;
+	int packets = 0;
+	auto receive = [&]() {
+		if (bulkIn(data, size) != SIM_ACK)
+			return false;
+		++packets;
+		frameReadPacket(&reader, data, size);
+		const uint8_t *message;
+		int length;
+		while (frameRead(&reader, &message, &length) == MESSAGE_COMPLETION && length == sizeof(Completion)) {
+			Completion completion;
+			memcpy(&completion, message, sizeof(completion));
+			completions.push_back(completion);
+		}
+		return true;
+	};
+
+	// send the commands without waiting for completions, only when the device runs out of tx buffers it naks
+	// further commands until completions were read
+	FrameWriter writer;
+	frameWriterInit(&writer);
+	auto send = [&](bool pad) {
+		int n = frameFinish(&writer, pad);
+		SimResult result;
+		while ((result = bulkOut(writer.packet, n)) == SIM_NAK && receive())
+			;
+		check(result == SIM_ACK, "command out");
+	};
+	for (Command const &command : commands) {
+		if (!frameWrite(&writer, MESSAGE_COMMAND, &command, sizeof(command))) {
+			send(true);
+			frameWrite(&writer, MESSAGE_COMMAND, &command, sizeof(command));
+		}
+	}
+	send(false);
+	while (completions.size() < expected.size() && receive())
+		;
+
+	int errors = 0;
+	for (size_t i = 0; i < completions.size(); ++i) {
+		Completion const &c = completions[i];
+		Completion const &e = expected[i];
+		if (c.tag != e.tag || c.status != e.status || c.value != e.value)
+			++errors;
+	}
+	check(completions.size() == expected.size() && errors == 0 && reader.lost == 0, "completions");
+	check(packets < int(completions.size()) / 4, "batched completions");
+	check((simGpio[1] & 0x00f0) == 0x00f0, "gpio state");
+
+	check(setMode(MODE_LED), "set led mode");
+}
+
+static void testScript() {
+	printf("script\n");
+
+	// running needs the script mode
+	Setup runScript = {USB_OUT | 0x40, VENDOR_RUN_SCRIPT, 0, 0, 0};
+	check(!controlOut(runScript), "run script outside of script mode stalls");
+	check(simGpioConfig[0][5] != (GPIO_CNF_OUTPUT_ALTFN_PUSHPULL << 2 | GPIO_MODE_OUTPUT_50_MHZ)
+		&& simGpioConfig[1][6] != (GPIO_CNF_OUTPUT_ALTFN_OPENDRAIN << 2 | GPIO_MODE_OUTPUT_50_MHZ), "script pins idle");
+	check(setMode(MODE_SCRIPT), "set script mode");
+	uint8_t data[64];
+	int size;
+	while (bulkIn(data, size) == SIM_ACK)
+		;
+
+	// chip select on PB4 around three spi transfers of 40 bytes (the simulated spi returns the sent data), then write
+	// to the i2c eeprom and read back, longer than one packet so that the data stage has several packets
+	std::vector<uint8_t> code = {
+		SCRIPT_GPIO_CLEAR, COMMAND_PORT_B, 0x10, 0x00,
+		SCRIPT_LOOP, 3, 0,
+		SCRIPT_SPI_TRANSFER, 40};
+	for (int i = 0; i < 40; ++i)
+		code.push_back(uint8_t(i * 3));
+	const uint8_t rest[] = {
+		SCRIPT_LOOP_END,
+		SCRIPT_GPIO_SET, COMMAND_PORT_B, 0x10, 0x00,
+		SCRIPT_I2C_WRITE, 0x50, 4, 0x20, 0x11, 0x22, 0x33,
+		SCRIPT_I2C_WRITE, 0x50, 1, 0x20,
+		SCRIPT_I2C_READ, 0x50, 3,
+		SCRIPT_GPIO_READ, COMMAND_PORT_B, 0x10, 0x00,
+		SCRIPT_DELAY, 10, 0,
+		SCRIPT_END};
+	code.insert(code.end(), rest, rest + sizeof(rest));
+	Setup upload = {USB_OUT | 0x40, VENDOR_UPLOAD_SCRIPT, 0, 0, uint16_t(code.size())};
+	check(controlOut(upload, code.data()), "upload script");
+
+	// the result is sent as one transfer after the main loop has run the script
+	memset(simGpioConfig, 0xff, sizeof(simGpioConfig));
+	check(controlOut(runScript) && usbScriptPending(), "run script");
+	check(!controlOut(runScript), "run script while a script is pending stalls");
+	usbRunScript();
+	uint8_t result[sizeof(ScriptResult) + SCRIPT_RESULT_SIZE];
+	int length = bulkRead(result, sizeof(result));
+	ScriptResult header;
+	memcpy(&header, result, sizeof(header));
+	const uint8_t *d = result + sizeof(ScriptResult);
+	int errors = 0;
+	for (int i = 0; i < 120; ++i) {
+		if (d[i] != uint8_t(i % 40 * 3))
+			++errors;
+	}
+	check(length == int(sizeof(ScriptResult)) + 125 && header.status == SCRIPT_OK && header.size == 125,
+		"script result");
+	check(errors == 0 && d[120] == 0x11 && d[121] == 0x22 && d[122] == 0x33 && d[123] == 0x10 && d[124] == 0,
+		"script data");
+	check(simEeprom[0x20] == 0x11 && (simGpio[1] & 0x10), "script effects");
+
+	// the spi and i2c pins are only driven while the script runs
+	check(simGpioConfig[0][5] == GPIO_CNF_INPUT_ANALOG << 2 && simGpioConfig[0][7] == GPIO_CNF_INPUT_ANALOG << 2
+		&& simGpioConfig[1][6] == GPIO_CNF_INPUT_ANALOG << 2 && simGpioConfig[1][7] == GPIO_CNF_INPUT_ANALOG << 2,
+		"script pins released");
+
+	// the usb data lines are reserved, the result contains the offset of the failed instruction
+	const uint8_t reserved[] = {SCRIPT_GPIO_READ, COMMAND_PORT_A, 0, 0x18, SCRIPT_GPIO_CLEAR, COMMAND_PORT_A, 0, 0x18};
+	upload.wLength = sizeof(reserved);
+	check(controlOut(upload, reserved) && controlOut(runScript), "run reserved script");
+	usbRunScript();
+	length = bulkRead(result, sizeof(result));
+	memcpy(&header, result, sizeof(header));
+	check(length == int(sizeof(ScriptResult)) + 2 && header.status == SCRIPT_RESERVED && header.offset == 4,
+		"reserved pins");
+
+	// no device at 0x51 acknowledges, the data of the failed read is not in the result
+	const uint8_t nack[] = {SCRIPT_I2C_READ, 0x50, 1, SCRIPT_I2C_READ, 0x51, 2, SCRIPT_I2C_WRITE, 0x50, 1, 0x20};
+	upload.wLength = sizeof(nack);
+	Latency before;
+	Setup getLatency = {USB_IN | 0x40, VENDOR_GET_LATENCY, 0, 0, sizeof(Latency)};
+	check(controlIn(getLatency, &before, length), "get latency");
+	check(controlOut(upload, nack) && controlOut(runScript), "run nack script");
+	usbRunScript();
+	length = bulkRead(result, sizeof(result));
+	memcpy(&header, result, sizeof(header));
+	check(length == int(sizeof(ScriptResult)) + 1 && header.status == SCRIPT_I2C_NACK && header.offset == 3
+		&& header.size == 1, "i2c nack");
+
+	// the result packet was made ready in the main loop, outside of the usb interrupt that the latency refers to
+	Latency after;
+	check(controlIn(getLatency, &after, length) && after.count == before.count, "script result not in latency");
+
+	// a bus that is held low times out, the next script can run
+	simI2cStuck = true;
+	check(controlOut(runScript), "run script on stuck bus");
+	usbRunScript();
+	simI2cStuck = false;
+	length = bulkRead(result, sizeof(result));
+	memcpy(&header, result, sizeof(header));
+	check(length == int(sizeof(ScriptResult)) && header.status == SCRIPT_I2C_ERROR && header.offset == 0
+		&& header.cycles >= SCRIPT_I2C_TIMEOUT * (CPU_CLOCK / 1000000), "i2c timeout");
+	check(controlOut(runScript), "run script after timeout");
+	usbRunScript();
+	length = bulkRead(result, sizeof(result));
+	memcpy(&header, result, sizeof(header));
+	check(header.status == SCRIPT_I2C_NACK && header.offset == 3, "i2c after timeout");
+
+	check(setMode(MODE_LED), "set led mode");
+}
+
+// convert samples and call the dma interrupt handler when a block is full
+static void adcConvert(int count) {
+	for (int i = 0; i < count; ++i) {
+		simAdcConvert();
+		if (simDmaPending(1))
+			dma1_channel1_isr();
+	}
+}
+
+// receive packets of the adc stream and check that the samples of ADC1 are a sawtooth (ADC2 the inverted one)
+struct AdcChecker {
+	bool dual;
+	bool timestamp = false;
+	std::vector<StreamTimestamp> timestamps;
+	int packets = 0;
+	int gaps = 0;
+	int errors = 0;
+	uint16_t sequence = 0;
+	int value = -1;
+	uint16_t overflows = 0;
+
+	bool read(int count) {
+		for (int i = 0; i < count; ++i) {
+			uint8_t packet[64];
+			int size;
+			if (bulkIn(packet, size) != SIM_ACK || size != 64)
+				return false;
+			StreamHeader header;
+			memcpy(&header, packet, sizeof(header));
+			int offset = sizeof(header);
+			int packetData = ADC_PACKET_DATA;
+			if (this->timestamp) {
+				StreamTimestamp timestamp;
+				memcpy(&timestamp, packet + offset, sizeof(timestamp));
+				this->timestamps.push_back(timestamp);
+				offset += sizeof(timestamp);
+				packetData = ADC_TIMESTAMP_PACKET_DATA;
+			}
+			if (header.sequence != this->sequence) {
+				// packets were dropped, the sawtooth continues after the gap
+				++this->gaps;
+				this->value += (uint16_t(header.sequence - this->sequence) * packetData) / (this->dual ? 4 : 2);
+			}
+			this->sequence = header.sequence + 1;
+			this->overflows = header.overflows;
+			uint16_t samples[ADC_PACKET_DATA / 2];
+			memcpy(samples, packet + offset, packetData);
+			for (int j = 0; j < packetData / 2; j += this->dual ? 2 : 1) {
+				if (this->value >= 0 && samples[j] != (this->value & 0xfff))
+					++this->errors;
+				if (this->dual && samples[j + 1] != 0xfff - samples[j])
+					++this->errors;
+				this->value = samples[j] + 1;
+			}
+			++this->packets;
+		}
+		return true;
+	}
+};
+
+// receive the adc stream with block crc until the device naks and verify the crc of each block with every
+// implementation of the host
+struct CrcChecker {
+	const SampleDecoder *decoder = nullptr;
+	uint16_t sequence = 0;
+	int gaps = 0;
+	int blocks = 0;
+	int errors = 0;
+	std::vector<uint8_t> block;
+
+	void read() {
+		uint8_t packet[64];
+		int size;
+		while (bulkIn(packet, size) == SIM_ACK) {
+			StreamHeader header;
+			memcpy(&header, packet, sizeof(header));
+			if (header.sequence != this->sequence) {
+				// the rest of a block was dropped, the next block starts with this packet
+				++this->gaps;
+				this->block.clear();
+			}
+			this->sequence = header.sequence + 1;
+
+			if (size == int(sizeof(StreamCrc))) {
+				StreamCrc crc;
+				memcpy(&crc, packet, sizeof(crc));
+				bool valid = this->block.size() == ADC_BLOCK_SIZE;
+				for (int isa = Crc32::SCALAR; isa <= Crc32::detectIsa() && valid; ++isa)
+					valid = Crc32(Crc32::Isa(isa)).calculate(this->block.data(), ADC_BLOCK_SIZE) == crc.crc;
+				if (valid)
+					++this->blocks;
+				else
+					++this->errors;
+				this->block.clear();
+			} else if (this->decoder != nullptr) {
+				int16_t samples[CODEC_MAX_SAMPLES];
+				int count = this->decoder->decode(packet + sizeof(header), ADC_PACKET_DATA, samples);
+				this->block.insert(this->block.end(), (uint8_t *)samples, (uint8_t *)(samples + std::max(count, 0)));
+			} else {
+				this->block.insert(this->block.end(), packet + sizeof(header), packet + size);
+			}
+		}
+	}
+};
+
+static void testAdc() {
+	printf("adc stream\n");
+
+	// configuration is checked
+	AdcConfig config = {ADC_MAX_SAMPLE_RATE + 1, 0, 1, 0, 0};
+	Setup setConfig = {USB_OUT | 0x40, VENDOR_SET_ADC_CONFIG, 0, 0, sizeof(AdcConfig)};
+	check(!controlOut(setConfig, &config), "unsupported adc config stalls");
+	config.sampleRate = 500000;
+	check(controlOut(setConfig, &config), "set adc config");
+
+	check(setMode(MODE_ADC), "set adc mode");
+	uint8_t data[64];
+	int size;
+	while (bulkIn(data, size) == SIM_ACK)
+		;
+	const int blockSamples = ADC_BLOCK_SIZE / 2;
+
+	// one block is sent as ADC_BLOCK_PACKETS packets
+	AdcChecker checker;
+	checker.dual = false;
+	adcConvert(blockSamples);
+	check(checker.read(ADC_BLOCK_PACKETS) && bulkIn(data, size) == SIM_NAK, "adc block");
+
+	// the next block arrives while the last two packets wait in the tx buffers: backpressure
+	adcConvert(blockSamples);
+	check(checker.read(ADC_BLOCK_PACKETS - 2), "adc block");
+	adcConvert(blockSamples);
+	check(checker.read(ADC_BLOCK_PACKETS + 2), "adc block with backpressure");
+
+	// two more blocks without reading: the first one gets dropped except for the packets in the tx buffers
+	adcConvert(blockSamples * 2);
+	check(checker.read(ADC_BLOCK_PACKETS + 2) && bulkIn(data, size) == SIM_NAK, "adc block after overflow");
+	check(checker.errors == 0 && checker.gaps == 1 && checker.overflows == 1, "adc samples");
+
+	Counters counters;
+	int length;
+	Setup getCounters = {USB_IN | 0x40, VENDOR_GET_COUNTERS, 0, 0, sizeof(Counters)};
+	check(controlIn(getCounters, &counters, length) && counters.adcBlocks == 5 && counters.adcBackpressure == 1
+		&& counters.adcOverflows == 1, "adc counters");
+
+	// two blocks before the interrupt gets handled: the older one is dropped as a whole, the newer one is sent
+	for (int i = 0; i < blockSamples * 2; ++i)
+		simAdcConvert();
+	dma1_channel1_isr();
+	check(checker.read(ADC_BLOCK_PACKETS) && bulkIn(data, size) == SIM_NAK && checker.errors == 0
+		&& checker.gaps == 2 && checker.overflows == 2, "adc block after late interrupt");
+	adcConvert(blockSamples);
+	check(checker.read(ADC_BLOCK_PACKETS), "adc block");
+	for (int i = 0; i < blockSamples * 2; ++i)
+		simAdcConvert();
+	dma1_channel1_isr();
+	check(checker.read(ADC_BLOCK_PACKETS) && bulkIn(data, size) == SIM_NAK && checker.errors == 0
+		&& checker.gaps == 3 && checker.overflows == 3, "adc block after late interrupt");
+	check(controlIn(getCounters, &counters, length) && counters.adcBlocks == 10 && counters.adcOverflows == 3,
+		"adc counters after late interrupt");
+
+	// both adcs can not convert the same channel
+	config.dual = 1;
+	config.channel2 = config.channel;
+	check(!controlOut(setConfig, &config), "dual adc config with one channel stalls");
+	config.channel2 = 1;
+
+	// dual mode: samples of ADC1 and ADC2 alternate
+	config.dual = 1;
+	check(controlOut(setConfig, &config) && setMode(MODE_ADC), "set dual adc mode");
+	AdcChecker dualChecker;
+	dualChecker.dual = true;
+	adcConvert(blockSamples / 2);
+	check(dualChecker.read(ADC_BLOCK_PACKETS) && dualChecker.errors == 0 && dualChecker.gaps == 0, "dual adc block");
+
+	// compressed: the sawtooth needs 2 bits per delta, except for the group with the jump from 4095 to 0
+	config.dual = 0;
+	config.codec = ADC_CODEC_DELTA;
+	check(controlOut(setConfig, &config) && setMode(MODE_ADC), "set compressed adc mode");
+	SampleDecoder decoder;
+	adcConvert(blockSamples);
+	int packets = 0;
+	int samples = 0;
+	int errors = 0;
+	int value = -1;
+	while (bulkIn(data, size) == SIM_ACK && size == 64) {
+		int16_t decoded[CODEC_MAX_SAMPLES];
+		int count = decoder.decode(data + sizeof(StreamHeader), ADC_PACKET_DATA, decoded);
+		for (int i = 0; i < count; ++i) {
+			if (value >= 0 && decoded[i] != ((value + 1) & 0xfff))
+				++errors;
+			value = decoded[i];
+		}
+		samples += std::max(count, 0);
+		++packets;
+	}
+	check(samples == blockSamples && errors == 0 && packets < ADC_BLOCK_PACKETS / 2, "compressed adc block");
+
+	// the crc unit model and the host implementations give the known result for one word
+	crc_reset();
+	uint32_t word = 0x12345678;
+	bool known = crc_calculate(word) == 0xdf8a8a2b;
+	for (int isa = Crc32::SCALAR; isa <= Crc32::detectIsa(); ++isa)
+		known = known && Crc32(Crc32::Isa(isa)).calculate(&word, 4) == 0xdf8a8a2b;
+	check(known, "crc of one word");
+
+	// block crc: a short packet ends each block
+	config.codec = ADC_CODEC_NONE;
+	config.crc = 1;
+	check(controlOut(setConfig, &config) && setMode(MODE_ADC), "set adc mode with crc");
+	CrcChecker crcChecker;
+	adcConvert(blockSamples);
+	crcChecker.read();
+	check(crcChecker.blocks == 1 && crcChecker.errors == 0 && crcChecker.gaps == 0, "adc block with crc");
+
+	// the dropped rest of a block includes its crc packet, the following block gets verified
+	adcConvert(blockSamples * 2);
+	crcChecker.read();
+	check(crcChecker.blocks == 2 && crcChecker.errors == 0 && crcChecker.gaps == 1
+		&& crcChecker.sequence == 2 * (ADC_BLOCK_PACKETS + 1) + ADC_BLOCK_PACKETS + 1, "adc block with crc after overflow");
+
+	// compressed: the crc covers the decoded samples
+	config.codec = ADC_CODEC_DELTA;
+	check(controlOut(setConfig, &config) && setMode(MODE_ADC), "set compressed adc mode with crc");
+	CrcChecker compressedChecker;
+	compressedChecker.decoder = &decoder;
+	adcConvert(blockSamples);
+	compressedChecker.read();
+	check(compressedChecker.blocks == 1 && compressedChecker.errors == 0, "compressed adc block with crc");
+
+	// timestamps: each packet carries the frame number and the cycle counter of the last sof
+	config.codec = ADC_CODEC_NONE;
+	config.crc = 0;
+	config.timestamp = 1;
+	check(controlOut(setConfig, &config) && setMode(MODE_ADC), "set adc mode with timestamps");
+	simFrame();
+	interrupt();
+	uint16_t frame = *USB_FNR_REG & USB_FNR_FN;
+	AdcChecker timestampChecker;
+	timestampChecker.dual = false;
+	timestampChecker.timestamp = true;
+	const int timestampPackets = ADC_BLOCK_SIZE / ADC_TIMESTAMP_PACKET_DATA;
+	adcConvert(blockSamples);
+	check(timestampChecker.read(timestampPackets / 2), "adc packets with timestamp");
+	simFrame();
+	interrupt();
+	check(timestampChecker.read(timestampPackets - timestampPackets / 2) && bulkIn(data, size) == SIM_NAK
+		&& timestampChecker.errors == 0 && timestampChecker.gaps == 0, "adc block with timestamps");
+	int stampErrors = 0;
+	for (int i = 0; i < timestampPackets; ++i) {
+		// the first two packets were written before the first read, the next frame starts two packets after the read
+		const StreamTimestamp &t = timestampChecker.timestamps[i];
+		uint16_t expected = i < timestampPackets / 2 + 2 ? frame : (frame + 1) & USB_FNR_FN;
+		if (t.frame != (expected | USB_FNR_LCK) || t.sofFrame != expected || int32_t(t.cycles - t.sofCycles) < 0
+			|| (i > 0 && int32_t(t.cycles - timestampChecker.timestamps[i - 1].cycles) < 0))
+		{
+			++stampErrors;
+		}
+	}
+	check(stampErrors == 0, "adc timestamps");
+
+	// the timeline of the host counts a packet stamped without lock to the sofs and leaves it out of drift and jitter
+	Timeline timeline;
+	for (int i = 0; i < timestampPackets; ++i)
+		timeline.add(timestampChecker.timestamps[i], i * 1e-4);
+	double drift = timeline.getFrameDrift();
+	StreamTimestamp unlocked = timestampChecker.timestamps.back();
+	unlocked.frame &= ~USB_FNR_LCK;
+	unlocked.sofFrame = (unlocked.sofFrame + 1) & USB_FNR_FN;
+	unlocked.sofCycles += CPU_CLOCK;
+	unlocked.cycles += CPU_CLOCK;
+	timeline.add(unlocked, 10.0);
+	check(timeline.count() == size_t(timestampPackets) + 1 && timeline.getUnlocked() == 1
+		&& timeline.getFrameDrift() == drift && timeline.getArrivalJitter().count() == uint64_t(timestampPackets),
+		"timeline without sof lock");
+
+	// no more blocks after the mode switch
+	check(setMode(MODE_LED), "set led mode");
+	adcConvert(blockSamples);
+	check(!simDmaPending(1), "adc stopped");
+}
+
+// receive data on the usart and call the dma interrupt handler at each half of the rx buffer
+static void uartReceive(const uint8_t *data, int size, bool error = false) {
+	for (int i = 0; i < size; ++i) {
+		simUartReceive(data + i, 1, error && i == size - 1);
+		if (simDmaPending(5))
+			dma1_channel5_isr();
+	}
+}
+
+// the rx line becomes idle, the usart interrupt handler flushes the received data
+static void uartIdle() {
+	simUartIdle();
+	if (simUartPending())
+		usart1_isr();
+}
+
+// transmit the data that dma feeds to the usart and call the dma interrupt handler when a send has finished
+static int uartTransmit(uint8_t *data, int size) {
+	int count = 0;
+	while (true) {
+		count += simUartTransmit(data + count, size - count);
+		if (!simDmaPending(4))
+			return count;
+		dma1_channel4_isr();
+	}
+}
+
+static void testUart() {
+	printf("uart bridge\n");
+
+	// configuration is checked
+	UartConfig config = {UART_MAX_BAUD_RATE + 1, UART_PARITY_NONE, 1, 0};
+	Setup setConfig = {USB_OUT | 0x40, VENDOR_SET_UART_CONFIG, 0, 0, sizeof(UartConfig)};
+	check(!controlOut(setConfig, &config), "unsupported uart config stalls");
+	config.baudRate = 2000000;
+	check(controlOut(setConfig, &config), "set uart config");
+
+	check(setMode(MODE_UART), "set uart mode");
+	uint8_t data[64];
+	int size;
+	while (bulkIn(data, size) == SIM_ACK)
+		;
+	check(simUartBaudRate == 2000000, "uart baud rate");
+
+	uint8_t pattern[4096];
+	for (int i = 0; i < int(sizeof(pattern)); ++i)
+		pattern[i] = uint8_t(i % 251);
+
+	// out 2 to usart: two transfers fill both buffers, one more packet waits in the usb peripheral, then out 2 naks
+	// until dma has sent a buffer
+	static uint8_t sent[4096];
+	check(bulkWrite(pattern, 1000, false) && bulkOut(pattern + 1000, 64) == SIM_ACK, "uart bridge out");
+	check(bulkOut(pattern + 1064, 36) == SIM_NAK, "uart bridge out naks while both buffers are filled");
+	int length = uartTransmit(sent, sizeof(sent));
+	check(bulkOut(pattern + 1064, 36) == SIM_ACK, "uart bridge out after send");
+	length += uartTransmit(sent + length, sizeof(sent) - length);
+	check(length == 1100 && memcmp(sent, pattern, length) == 0, "uart bridge tx data");
+
+	// usart to in 1: nothing is sent until the line becomes idle or half of the rx buffer is filled
+	uint8_t received[4096];
+	uartReceive(pattern, 100);
+	check(bulkIn(data, size) == SIM_NAK, "uart bridge waits for idle line");
+	uartIdle();
+	length = bulkRead(received, sizeof(received));
+	check(length == 100 && memcmp(received, pattern, length) == 0, "uart bridge flush on idle line");
+
+	// a burst of full packets ends with a zero length packet
+	uartReceive(pattern, 128);
+	uartIdle();
+	length = bulkRead(received, sizeof(received));
+	check(length == 128 && memcmp(received, pattern, length) == 0, "uart bridge zero length packet");
+
+	// full packets are sent before the line becomes idle, the rest after
+	uartReceive(pattern, 1200);
+	length = 0;
+	while (length < 1152 && bulkIn(received + length, size) == SIM_ACK)
+		length += size;
+	check(length == 1152 && bulkIn(data, size) == SIM_NAK, "uart bridge full packets");
+	uartIdle();
+	length += bulkRead(received + length, sizeof(received) - length);
+	check(length == 1200 && memcmp(received, pattern, length) == 0, "uart bridge rx data");
+
+	// the host does not read: dma overtakes the data that was not sent yet, the bridge continues with the more recent
+	// half of the rx buffer. The first two packets were already in the tx buffers
+	uartReceive(pattern, 3000, true);
+	uartIdle();
+	length = bulkRead(received, sizeof(received));
+	int dropped = 3000 - length;
+	check(length >= 128 + UART_RX_BUFFER_SIZE / 2 && dropped > 0 && memcmp(received, pattern, 128) == 0
+		&& memcmp(received + 128, pattern + 3000 - (length - 128), length - 128) == 0, "uart bridge rx overflow");
+
+	Counters counters;
+	Setup getCounters = {USB_IN | 0x40, VENDOR_GET_COUNTERS, 0, 0, sizeof(Counters)};
+	check(controlIn(getCounters, &counters, length) && counters.uartTxBytes == 1100
+		&& counters.uartRxBytes == uint32_t(100 + 128 + 1200 + 3000 - dropped)
+		&& counters.uartRxDropped == uint32_t(dropped) && counters.uartErrors == 1, "uart counters");
+
+	// the usart is disabled after the mode switch
+	check(setMode(MODE_LED), "set led mode");
+	check(simUartReceive(pattern, 1, false) == 0, "uart stopped");
+}
+
+// encode samples into packets and decode them with all instruction sets, returns the number of packets or -1 on error
+static int codecRoundTrip(const std::vector<uint16_t> &samples, int stride) {
+	int packets = 0;
+	for (int offset = 0; offset < int(samples.size()); ++packets) {
+		uint8_t payload[ADC_PACKET_DATA];
+		int count = codecEncode(samples.data() + offset, int(samples.size()) - offset, stride, payload,
+			ADC_PACKET_DATA);
+		for (int isa = SampleDecoder::SCALAR; isa <= SampleDecoder::detectIsa(); ++isa) {
+			SampleDecoder decoder(stride, SampleDecoder::Isa(isa));
+			int16_t decoded[CODEC_MAX_SAMPLES];
+			float values[CODEC_MAX_SAMPLES];
+			if (decoder.decode(payload, ADC_PACKET_DATA, decoded) != count
+				|| decoder.decode(payload, ADC_PACKET_DATA, values, 0.5f) != count)
+			{
+				return -1;
+			}
+			for (int i = 0; i < count; ++i) {
+				if (decoded[i] != samples[offset + i] || values[i] != samples[offset + i] * 0.5f)
+					return -1;
+			}
+		}
+		offset += count;
+	}
+	return packets;
+}
+
+static void testCodec() {
+	printf("codec\n");
+
+	// noisy sine (correlated like a sensor signal), random 12 bit values (worst case), constant and sawtooth
+	std::mt19937 random(1);
+	const int count = 960 * 16;
+	std::vector<uint16_t> sine(count);
+	std::vector<uint16_t> noise(count);
+	std::vector<uint16_t> constant(count, 0x123);
+	std::vector<uint16_t> sawtooth(count);
+	for (int i = 0; i < count; ++i) {
+		sine[i] = uint16_t(2048 + 1500 * std::sin(i * 0.01) + int(random() % 16) - 8);
+		noise[i] = uint16_t(random() & 0xfff);
+		sawtooth[i] = uint16_t(i & 0xfff);
+	}
+	struct Signal {
+		const char *name;
+		std::vector<uint16_t> &samples;
+	};
+	Signal signals[] = {{"sine", sine}, {"noise", noise}, {"constant", constant}, {"sawtooth", sawtooth}};
+	for (Signal &signal : signals) {
+		for (int stride = 1; stride <= 2; ++stride) {
+			int packets = codecRoundTrip(signal.samples, stride);
+			check(packets > 0, "codec round trip");
+			if (stride == 1) {
+				printf("%-8s %5.2f bits/sample\n", signal.name,
+					double(packets) * ADC_PACKET_DATA * 8 / double(signal.samples.size()));
+			}
+		}
+	}
+
+	// malformed payloads
+	SampleDecoder decoder;
+	int16_t decoded[CODEC_MAX_SAMPLES];
+	uint8_t payload[ADC_PACKET_DATA] = {0, 0, CODEC_MAX_WIDTH + 1};
+	check(decoder.decode(payload, ADC_PACKET_DATA, decoded) == -1, "codec invalid width");
+	payload[2] = CODEC_MAX_WIDTH;
+	check(decoder.decode(payload, 20, decoded) == -1, "codec truncated group");
+	memset(payload + 2, CODEC_END, ADC_PACKET_DATA - 2);
+	check(decoder.decode(payload, ADC_PACKET_DATA, decoded) == 0, "codec empty packet");
+
+	// throughput of the encoder of the firmware and the decoders (native)
+	std::vector<uint8_t> packets;
+	auto start = std::chrono::steady_clock::now();
+	for (int offset = 0; offset < count;) {
+		packets.resize(packets.size() + ADC_PACKET_DATA);
+		offset += codecEncode(sine.data() + offset, count - offset, 1, &packets[packets.size() - ADC_PACKET_DATA],
+			ADC_PACKET_DATA);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("encode   %8.1f Msamples/s\n", count / seconds * 1e-6);
+	for (int isa = SampleDecoder::SCALAR; isa <= SampleDecoder::detectIsa(); ++isa) {
+		SampleDecoder decoder(1, SampleDecoder::Isa(isa));
+		int total = 0;
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < 100; ++i) {
+			for (size_t offset = 0; offset < packets.size(); offset += ADC_PACKET_DATA)
+				total += decoder.decode(&packets[offset], ADC_PACKET_DATA, decoded);
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("decode %-6s %8.1f Msamples/s\n", SampleDecoder::getName(SampleDecoder::Isa(isa)),
+			total / seconds * 1e-6);
+	}
+}
+
+static void testPma() {
+	printf("packet memory copy\n");
+
+	// copy through the free packet memory with all alignments and odd sizes
+	typedef void (*Write)(uint8_t *pma, const void *data, int size);
+	typedef void (*Read)(void *data, const uint8_t *pma, int size);
+	struct Variant {
+		Write write;
+		Read read;
+		int alignment;
+	};
+	const Variant variants[] = {
+		{pmaWriteBytes, pmaReadBytes, 1},
+		{pmaWriteHalfWords, pmaReadHalfWords, 2},
+		{pmaWriteWords, pmaReadWords, 4},
+		{pmaWrite, pmaRead, 1}};
+	uint8_t *pma = reinterpret_cast<uint8_t *>(simPma) + 448 * 2;
+	int errors = 0;
+	for (Variant const &variant : variants) {
+		for (int offset = 0; offset < 4; offset += variant.alignment) {
+			for (int size = 0; size <= 64; ++size) {
+				alignas(4) uint8_t src[72];
+				alignas(4) uint8_t dst[72];
+				for (int i = 0; i < 72; ++i) {
+					src[i] = uint8_t(i * 7 + size);
+					dst[i] = 0xaa;
+				}
+
+				// guard half word behind the packet in packet memory, a packet of 63 or 64 bytes ends with the packet
+				// memory
+				uint8_t guard[2] = {0x55, 0x55};
+				bool guarded = ((size + 1) & ~1) < 64;
+				if (guarded)
+					pmaWriteBytes(pma + ((size + 1) & ~1) * 2, guard, 2);
+
+				variant.write(pma, src + offset, size);
+				variant.read(dst + offset, pma, size);
+				uint8_t check[2] = {0x55, 0x55};
+				if (guarded)
+					pmaReadBytes(check, pma + ((size + 1) & ~1) * 2, 2);
+				if (memcmp(dst + offset, src + offset, size) != 0 || dst[offset + size] != 0xaa
+					|| (offset > 0 && dst[offset - 1] != 0xaa) || check[0] != 0x55 || check[1] != 0x55)
+				{
+					++errors;
+				}
+			}
+		}
+	}
+	check(errors == 0, "packet memory copy");
+
+	// benchmark of the device, native cycles are derived from the monotonic clock
+	PmaBenchmark benchmark;
+	int length;
+	Setup getBenchmark = {USB_IN | 0x40, VENDOR_GET_PMA_BENCHMARK, 0, 0, sizeof(PmaBenchmark)};
+	check(controlIn(getBenchmark, &benchmark, length) && length == sizeof(PmaBenchmark), "get pma benchmark");
+	const char *names[] = {"bytes", "half words", "words"};
+	printf("packet memory copy (native cycles):\n");
+	for (int variant = 0; variant < PMA_VARIANT_COUNT; ++variant) {
+		printf("%-10s", names[variant]);
+		for (int s = 0; s < PMA_SIZE_COUNT; ++s)
+			printf(" %2d: %5u/%5u", 8 << s, benchmark.writeCycles[variant][s], benchmark.readCycles[variant][s]);
+		printf(" (write/read)\n");
+	}
+}
+
+static bool getStats(Stats &stats, bool restart) {
+	int length;
+	Setup getStats = {USB_IN | 0x40, VENDOR_GET_STATS, uint16_t(restart ? 1 : 0), 0, sizeof(Stats)};
+	return controlIn(getStats, &stats, length) && length == sizeof(Stats);
+}
+
+static void testStats() {
+	printf("statistics\n");
+
+	// all modes ran and the device was reset twice
+	Stats before;
+	check(getStats(before, true), "get stats");
+	check(before.handlers[STATS_RESET].count == 2 && before.setups > 0, "resets and setups");
+	int errors = 0;
+	for (int ep = 0; ep < TRACE_ENDPOINT; ++ep) {
+		HandlerStats const &in = before.handlers[STATS_CTR + 2 * ep];
+		HandlerStats const &out = before.handlers[STATS_CTR + 2 * ep + 1];
+		// endpoint 1 is in only and endpoint 2 out only
+		if ((in.count == 0) != (ep == 2) || (out.count == 0) != (ep == 1))
+			++errors;
+		if ((in.count > 0 && in.minCycles > in.maxCycles) || (out.count > 0 && out.minCycles > out.maxCycles))
+			++errors;
+	}
+	check(errors == 0, "ctr events per endpoint");
+	check(before.handlers[STATS_SOF].count > 0 && before.inNaks > 0, "sofs and in naks");
+
+	// an unsupported request gets stalled, bus errors and packet memory overruns only get counted
+	int length;
+	uint8_t data[64];
+	Setup unsupported = {USB_IN | 0x40, 0x7f, 0, 0, sizeof(data)};
+	check(!controlIn(unsupported, data, length), "unsupported request stalls");
+	*USB_ISTR_REG |= USB_ISTR_ERR;
+	interrupt();
+	*USB_ISTR_REG |= USB_ISTR_ERR | USB_ISTR_PMAOVR;
+	interrupt();
+
+	Stats after;
+	check(getStats(after, false), "get stats");
+	check(after.stalls == before.stalls + 1 && after.setups == before.setups + 2, "stall count");
+	check(after.errors == before.errors + 2 && after.overruns == before.overruns + 1, "error count");
+
+	// the minimum and maximum were restarted by the first read and cover only the requests since then
+	HandlerStats const &interrupts = after.handlers[STATS_INTERRUPT];
+	check(interrupts.count > before.handlers[STATS_INTERRUPT].count && interrupts.minCycles <= interrupts.maxCycles,
+		"interrupt cycles");
+	printf("usb interrupt (native): min %u, avg %.0f, max %u cycles\n", interrupts.minCycles,
+		double(interrupts.totalCycles - before.handlers[STATS_INTERRUPT].totalCycles)
+		/ (interrupts.count - before.handlers[STATS_INTERRUPT].count), interrupts.maxCycles);
+}
+
+// read the trace endpoint until it naks, returns the number of bytes
+static int readTrace(Trace &trace, std::vector<TraceRecord> &records) {
+	int total = 0;
+	uint8_t packet[TRACE_PACKET_SIZE];
+	int size;
+	int toggle;
+	while (simIn(address, TRACE_ENDPOINT, &toggle, packet, &size) == SIM_ACK) {
+		interrupt();
+		double arrival = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		trace.addRecords(packet, size, arrival);
+		for (int i = 0; i + int(sizeof(TraceRecord)) <= size; i += sizeof(TraceRecord)) {
+			TraceRecord record;
+			memcpy(&record, packet + i, sizeof(TraceRecord));
+			records.push_back(record);
+		}
+		total += size;
+	}
+	return total;
+}
+
+static void testTrace() {
+	printf("event trace\n");
+
+	// the ring has overflowed, the first packet reports the lost records
+	Trace trace;
+	std::vector<TraceRecord> records;
+	readTrace(trace, records);
+	check(trace.getLost() > 0 && !records.empty() && records[0].event == TRACE_LOST, "trace lost records");
+
+	// an unsupported request and a get descriptor
+	int length;
+	uint8_t data[64];
+	Setup unsupported = {USB_IN | 0x40, 0x7f, 0, 0, sizeof(data)};
+	check(!controlIn(unsupported, data, length), "unsupported request stalls");
+	Setup getDevice = {USB_IN, 0x06, 0x0100, 0, 64};
+	check(controlIn(getDevice, data, length) && length == 18, "get device descriptor");
+	records.clear();
+	size_t first = trace.count();
+	readTrace(trace, records);
+
+	// expected events without the ctr events of the in data and status stages
+	const uint8_t expected[][3] = {
+		{TRACE_CTR_RX, 0, 0}, {TRACE_SETUP, USB_IN | 0x40, 0x7f}, {TRACE_STALL, 0, 0},
+		{TRACE_CTR_RX, 0, 0}, {TRACE_SETUP, USB_IN, 0x06}, {TRACE_STATE, 3, 0}, {TRACE_CTR_TX, 0, 0},
+		{TRACE_CTR_RX, 0, 0}, {TRACE_STATE, 0, 3}};
+	size_t index = 0;
+	uint32_t cycles = records.empty() ? 0 : records[0].cycles;
+	bool ordered = true;
+	for (TraceRecord const &record : records) {
+		ordered = ordered && int32_t(record.cycles - cycles) >= 0;
+		cycles = record.cycles;
+		if (index < sizeof(expected) / sizeof(expected[0]) && record.event == expected[index][0]
+			&& record.arg == expected[index][1] && (record.event == TRACE_CTR_RX || record.event == TRACE_CTR_TX
+			|| record.value == expected[index][2]))
+		{
+			++index;
+		}
+	}
+	check(index == sizeof(expected) / sizeof(expected[0]) && ordered, "trace events");
+	check(trace.count() == first + records.size() && trace.getHostTime(first) <= trace.getHostTime(trace.count() - 1),
+		"trace decoder");
+
+	// json for perfetto next to a host event
+	trace.addHostEvent("ep0", "get descriptor", trace.getHostTime(trace.count() - 1), length);
+	FILE *file = tmpfile();
+	check(file != nullptr && trace.writeJson(file), "write trace json");
+	if (file != nullptr) {
+		std::vector<char> json(size_t(ftell(file)) + 1);
+		rewind(file);
+		json.resize(fread(json.data(), 1, json.size(), file));
+		json.push_back(0);
+		fclose(file);
+		check(strncmp(json.data(), "{\"displayTimeUnit\"", 18) == 0 && strstr(json.data(), "\"GET_DESCRIPTOR\"")
+			&& strstr(json.data(), "\"setup 0xc0 0x7f\"") && strstr(json.data(), "\"get descriptor\"")
+			&& strcmp(json.data() + json.size() - 5, "\n]}\n") == 0, "trace json");
+	}
+}
+
+int main() {
+	usbInit();
+
+	enumerate();
+	testStrings();
+	testLed();
+	testSourceSink();
+	testEcho();
+	testLoopback();
+	testFramed();
+	testCommands();
+	testScript();
+	testAdc();
+	testUart();
+	testCodec();
+	testPma();
+
+	// enumerate again after bus reset
+	enumerate();
+	testLed();
+	testStats();
+	testTrace();
+
+	printf("interrupt handler duration (native):\n");
+	lpIsr.print("lp");
+	hpIsr.print("hp");
+	printf("%llu transactions without interrupt\n", (unsigned long long)wakeupsSaved);
+
+	printf("%s: %d failures\n", failures == 0 ? "ok" : "FAILED", failures);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,502 @@
+#include <string.h>
+#include <time.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/crc.h>
+#include <libopencm3/stm32/desig.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/spi.h>
+#include <libopencm3/stm32/timer.h>
+#include <libopencm3/stm32/usart.h>
+#include "../protocol.h"
+#include "usbfs.h"
+
+// simulated peripherals other than usb
+
+
+// gpio
+
+uint16_t simGpio[3];
+uint8_t simGpioConfig[3][16];
+
+void gpio_set(uint32_t gpioport, uint16_t gpios) {
+	simGpio[gpioport] |= gpios;
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios) {
+	simGpio[gpioport] &= ~gpios;
+}
+
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios) {
+	return simGpio[gpioport] & gpios;
+}
+
+void gpio_toggle(uint32_t gpioport, uint16_t gpios) {
+	simGpio[gpioport] ^= gpios;
+}
+
+void gpio_set_mode(uint32_t gpioport, uint8_t mode, uint8_t cnf, uint16_t gpios) {
+	for (int i = 0; i < 16; ++i) {
+		if (gpios & (1 << i))
+			simGpioConfig[gpioport][i] = cnf << 2 | mode;
+	}
+}
+
+
+// rcc
+
+uint32_t rcc_apb1_frequency = 36000000;
+
+void rcc_clock_setup_in_hse_8mhz_out_72mhz(void) {
+}
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken) {
+}
+
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst) {
+}
+
+void rcc_set_adcpre(uint32_t adcpre) {
+}
+
+
+// spi
+
+int spi_init_master(uint32_t spi, uint32_t br, uint32_t cpol, uint32_t cpha, uint32_t dff, uint32_t lsbfirst) {
+	return 0;
+}
+
+void spi_enable_software_slave_management(uint32_t spi) {
+}
+
+void spi_set_nss_high(uint32_t spi) {
+}
+
+void spi_enable(uint32_t spi) {
+}
+
+void spi_disable(uint32_t spi) {
+}
+
+uint16_t spi_xfer(uint32_t spi, uint16_t data) {
+	return data;
+}
+
+
+// i2c
+
+uint8_t simEeprom[256];
+bool simI2cStuck;
+uint32_t simI2cSr1;
+uint32_t simI2cSr2;
+static uint8_t simEepromAddress;
+
+// the eeprom acknowledged its address, the first byte of a write sets the address pointer
+static bool simI2cSelected;
+static bool simI2cPointer;
+
+void i2c_peripheral_enable(uint32_t i2c) {
+}
+
+void i2c_peripheral_disable(uint32_t i2c) {
+}
+
+void i2c_set_speed(uint32_t i2c, enum i2c_speeds speed, uint32_t clock_megahz) {
+}
+
+void i2c_send_start(uint32_t i2c) {
+	if (!simI2cStuck)
+		simI2cSr1 |= I2C_SR1_SB;
+}
+
+void i2c_send_stop(uint32_t i2c) {
+	simI2cSr1 &= ~(I2C_SR1_SB | I2C_SR1_ADDR | I2C_SR1_BTF | I2C_SR1_RxNE | I2C_SR1_TxE);
+	simI2cSelected = false;
+}
+
+void i2c_send_7bit_address(uint32_t i2c, uint8_t slave, uint8_t readwrite) {
+	simI2cSr1 &= ~I2C_SR1_SB;
+	simI2cSelected = slave == 0x50;
+	simI2cPointer = readwrite == I2C_WRITE;
+	if (!simI2cSelected)
+		simI2cSr1 |= I2C_SR1_AF;
+	else if (readwrite == I2C_WRITE)
+		simI2cSr1 |= I2C_SR1_ADDR | I2C_SR1_TxE;
+	else
+		simI2cSr1 |= I2C_SR1_ADDR | I2C_SR1_RxNE;
+}
+
+void i2c_send_data(uint32_t i2c, uint8_t data) {
+	simI2cSr1 &= ~I2C_SR1_ADDR;
+	if (!simI2cSelected)
+		return;
+	if (simI2cPointer)
+		simEepromAddress = data;
+	else
+		simEeprom[simEepromAddress++] = data;
+	simI2cPointer = false;
+	simI2cSr1 |= I2C_SR1_BTF;
+}
+
+uint8_t i2c_get_data(uint32_t i2c) {
+	simI2cSr1 &= ~I2C_SR1_ADDR;
+	return simEeprom[simEepromAddress++];
+}
+
+void i2c_enable_ack(uint32_t i2c) {
+}
+
+void i2c_disable_ack(uint32_t i2c) {
+}
+
+
+// adc: ADC1 converts a sawtooth, ADC2 the inverted sawtooth
+
+uint32_t simAdcDr[2];
+static uint16_t simAdcValue;
+
+void adc_power_on(uint32_t adc) {
+}
+
+void adc_power_off(uint32_t adc) {
+}
+
+void adc_disable_scan_mode(uint32_t adc) {
+}
+
+void adc_set_single_conversion_mode(uint32_t adc) {
+}
+
+void adc_set_right_aligned(uint32_t adc) {
+}
+
+void adc_set_sample_time(uint32_t adc, uint8_t channel, uint8_t time) {
+}
+
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[]) {
+}
+
+void adc_enable_external_trigger_regular(uint32_t adc, uint32_t trigger) {
+}
+
+void adc_reset_calibration(uint32_t adc) {
+}
+
+void adc_calibrate(uint32_t adc) {
+}
+
+void adc_set_dual_mode(uint32_t mode) {
+}
+
+void adc_enable_dma(uint32_t adc) {
+}
+
+
+// crc unit
+
+uint32_t simCrcDr;
+
+void crc_reset(void) {
+	simCrcDr = 0xffffffff;
+}
+
+uint32_t crc_calculate(uint32_t data) {
+	// bitwise, most significant bit first
+	uint32_t crc = simCrcDr ^ data;
+	for (int i = 0; i < 32; ++i)
+		crc = crc & 0x80000000 ? crc << 1 ^ STREAM_CRC_POLYNOMIAL : crc << 1;
+	simCrcDr = crc;
+	return crc;
+}
+
+
+// dma: channel 1 transfers the adc results, channel 2 feeds the crc unit, channels 4 and 5 the usart data
+
+static struct SimDmaChannel {
+	uintptr_t peripheral;
+	uintptr_t memory;
+	uint16_t number;
+	uint16_t index;
+	int size;
+	bool fromMemory;
+	bool circular;
+	bool mem2mem;
+	bool enabled;
+	uint32_t interrupts;
+	uint32_t flags;
+} simDma[8];
+
+void dma_channel_reset(uint32_t dma, uint8_t channel) {
+	memset(&simDma[channel], 0, sizeof(simDma[channel]));
+	simDma[channel].size = 1;
+}
+
+void dma_set_peripheral_address(uint32_t dma, uint8_t channel, uintptr_t address) {
+	simDma[channel].peripheral = address;
+}
+
+void dma_set_memory_address(uint32_t dma, uint8_t channel, uintptr_t address) {
+	simDma[channel].memory = address;
+}
+
+void dma_set_number_of_data(uint32_t dma, uint8_t channel, uint16_t number) {
+	simDma[channel].number = number;
+	simDma[channel].index = 0;
+}
+
+uint16_t dma_get_number_of_data(uint32_t dma, uint8_t channel) {
+	return simDma[channel].number - simDma[channel].index;
+}
+
+void dma_set_read_from_peripheral(uint32_t dma, uint8_t channel) {
+	simDma[channel].fromMemory = false;
+}
+
+void dma_set_read_from_memory(uint32_t dma, uint8_t channel) {
+	simDma[channel].fromMemory = true;
+}
+
+void dma_enable_memory_increment_mode(uint32_t dma, uint8_t channel) {
+}
+
+void dma_enable_circular_mode(uint32_t dma, uint8_t channel) {
+	simDma[channel].circular = true;
+}
+
+void dma_enable_mem2mem_mode(uint32_t dma, uint8_t channel) {
+	simDma[channel].mem2mem = true;
+}
+
+void dma_set_peripheral_size(uint32_t dma, uint8_t channel, uint32_t size) {
+	simDma[channel].size = size == DMA_CCR_PSIZE_32BIT ? 4 : size == DMA_CCR_PSIZE_16BIT ? 2 : 1;
+}
+
+void dma_set_memory_size(uint32_t dma, uint8_t channel, uint32_t size) {
+}
+
+void dma_enable_half_transfer_interrupt(uint32_t dma, uint8_t channel) {
+	simDma[channel].interrupts |= DMA_HTIF;
+}
+
+void dma_enable_transfer_complete_interrupt(uint32_t dma, uint8_t channel) {
+	simDma[channel].interrupts |= DMA_TCIF;
+}
+
+// transfer one item between the data register of the peripheral and the memory, returns false if the channel is idle
+static bool simDmaTransfer(int channel, void *data) {
+	struct SimDmaChannel *c = &simDma[channel];
+	if (!c->enabled || c->index >= c->number)
+		return false;
+	uint8_t *memory = (uint8_t *)c->memory + c->index * c->size;
+	if (c->fromMemory)
+		memcpy(data, memory, c->size);
+	else
+		memcpy(memory, data, c->size);
+	++c->index;
+	if (c->index == c->number / 2)
+		c->flags |= DMA_HTIF;
+	if (c->index == c->number) {
+		c->flags |= DMA_TCIF;
+		if (c->circular)
+			c->index = 0;
+	}
+	return true;
+}
+
+void dma_enable_channel(uint32_t dma, uint8_t channel) {
+	simDma[channel].enabled = true;
+
+	// memory to memory: transfer everything at once, only the crc unit is supported as destination
+	uint32_t value;
+	while (simDma[channel].mem2mem && simDmaTransfer(channel, &value)) {
+		if (simDma[channel].peripheral == (uintptr_t)&CRC_DR)
+			crc_calculate(value);
+	}
+}
+
+void dma_disable_channel(uint32_t dma, uint8_t channel) {
+	simDma[channel].enabled = false;
+}
+
+bool dma_get_interrupt_flag(uint32_t dma, uint8_t channel, uint32_t interrupts) {
+	return (simDma[channel].flags & interrupts) != 0;
+}
+
+void dma_clear_interrupt_flags(uint32_t dma, uint8_t channel, uint32_t interrupts) {
+	simDma[channel].flags &= ~interrupts;
+}
+
+void simAdcConvert(void) {
+	uint16_t value[2] = {simAdcValue, (uint16_t)(0xfff - simAdcValue)};
+	if (simDmaTransfer(1, value))
+		simAdcValue = (simAdcValue + 1) & 0xfff;
+}
+
+bool simDmaPending(int channel) {
+	return (simDma[channel].flags & simDma[channel].interrupts)
+		&& (simNvic & (1ull << (NVIC_DMA1_CHANNEL1_IRQ - 1 + channel)));
+}
+
+
+// usart: dma channel 5 receives, channel 4 transmits
+
+uint32_t simUsartDr;
+uint32_t simUsartCr1;
+uint32_t simUartBaudRate;
+static uint32_t simUsartSr;
+static bool simUsartEnabled;
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud) {
+	simUartBaudRate = baud;
+}
+
+void usart_set_databits(uint32_t usart, uint32_t bits) {
+}
+
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits) {
+}
+
+void usart_set_parity(uint32_t usart, uint32_t parity) {
+}
+
+void usart_set_mode(uint32_t usart, uint32_t mode) {
+}
+
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol) {
+}
+
+void usart_enable(uint32_t usart) {
+	simUsartEnabled = true;
+}
+
+void usart_disable(uint32_t usart) {
+	simUsartEnabled = false;
+	simUsartSr = 0;
+	simUsartCr1 = 0;
+}
+
+void usart_enable_rx_dma(uint32_t usart) {
+}
+
+void usart_enable_tx_dma(uint32_t usart) {
+}
+
+bool usart_get_flag(uint32_t usart, uint32_t flag) {
+	return (simUsartSr & flag) != 0;
+}
+
+uint16_t usart_recv(uint32_t usart) {
+	// reading SR and then DR clears the idle and error flags
+	simUsartSr = 0;
+	return simUsartDr;
+}
+
+int simUartReceive(const void *data, int size, bool error) {
+	if (!simUsartEnabled)
+		return 0;
+	const uint8_t *d = (const uint8_t *)data;
+	int count = 0;
+	for (int i = 0; i < size; ++i) {
+		uint8_t value = d[i];
+		simUsartDr = value;
+		if (simDmaTransfer(5, &value))
+			++count;
+		else
+			simUsartSr |= USART_SR_ORE;
+	}
+	if (error)
+		simUsartSr |= USART_SR_FE;
+	return count;
+}
+
+void simUartIdle(void) {
+	if (simUsartEnabled)
+		simUsartSr |= USART_SR_IDLE;
+}
+
+bool simUartPending(void) {
+	return (simUsartSr & USART_SR_IDLE) && (simUsartCr1 & USART_CR1_IDLEIE)
+		&& (simNvic & (1ull << NVIC_USART1_IRQ));
+}
+
+int simUartTransmit(void *data, int size) {
+	if (!simUsartEnabled)
+		return 0;
+	uint8_t *d = (uint8_t *)data;
+	int count = 0;
+	while (count < size && simDmaTransfer(4, &d[count]))
+		++count;
+	return count;
+}
+
+
+// timer
+
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value) {
+}
+
+void timer_set_period(uint32_t timer_peripheral, uint32_t period) {
+}
+
+void timer_set_master_mode(uint32_t timer_peripheral, uint32_t mode) {
+}
+
+void timer_enable_counter(uint32_t timer_peripheral) {
+}
+
+void timer_disable_counter(uint32_t timer_peripheral) {
+}
+
+
+// nvic
+
+uint64_t simNvic;
+
+void nvic_enable_irq(uint8_t irqn) {
+	simNvic |= 1ull << irqn;
+}
+
+void nvic_disable_irq(uint8_t irqn) {
+	simNvic &= ~(1ull << irqn);
+}
+
+
+// desig
+
+// unique id of the simulated chip
+static const uint32_t simUniqueId[3] = {0x00ff3f06, 0x3436524b, 0x43192237};
+
+void desig_get_unique_id(uint32_t *result) {
+	result[0] = simUniqueId[2];
+	result[1] = simUniqueId[1];
+	result[2] = simUniqueId[0];
+}
+
+void desig_get_unique_id_as_string(char *string, unsigned int string_len) {
+	// most significant byte first like libopencm3
+	static const char digits[] = "0123456789ABCDEF";
+	uint32_t id[3];
+	desig_get_unique_id(id);
+	unsigned int i = 0;
+	for (; i < 24 && i + 1 < string_len; ++i)
+		string[i] = digits[(id[i / 8] >> (28 - (i % 8) * 4)) & 0xf];
+	string[i] = 0;
+}
+
+
+// dwt
+
+bool dwt_enable_cycle_counter(void) {
+	return true;
+}
+
+uint32_t dwt_read_cycle_counter(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return (uint32_t)(ns * (CPU_CLOCK / 1000000) / 1000);
+}
@@ -0,0 +1,247 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/st_usbfs.h>
+#include "usbfs.h"
+
+// reference manual: 23.5 USB registers
+
+uint32_t simUsb[0x54 / 4];
+uint32_t simPma[256];
+
+enum {
+	CNTR = 0x40 / 4,
+	ISTR = 0x44 / 4,
+	FNR = 0x48 / 4,
+	DADDR = 0x4C / 4,
+	BTABLE = 0x50 / 4
+};
+
+// bits of the endpoint registers that toggle when written with 1
+#define EP_TOGGLE (USB_EP_RX_DTOG | USB_EP_RX_STAT | USB_EP_TX_DTOG | USB_EP_TX_STAT)
+
+// bits of the endpoint registers that can only be cleared
+#define EP_CLEAR (USB_EP_RX_CTR | USB_EP_TX_CTR)
+
+// bits of the endpoint registers that are read/write
+#define EP_WRITE (USB_EP_TYPE | USB_EP_KIND | USB_EP_ADDR)
+
+
+// register access of the firmware
+
+uint16_t simGetReg(volatile uint32_t *reg) {
+	if (reg == &simUsb[ISTR]) {
+		// CTR, DIR and EP_ID are derived from the endpoint registers
+		uint16_t istr = simUsb[ISTR] & ~(USB_ISTR_CTR | USB_ISTR_DIR | USB_ISTR_EP_ID);
+		for (int i = 0; i < 8; ++i) {
+			uint32_t ep = simUsb[i];
+			if (ep & (USB_EP_RX_CTR | USB_EP_TX_CTR)) {
+				istr |= USB_ISTR_CTR | i;
+				if (ep & USB_EP_RX_CTR)
+					istr |= USB_ISTR_DIR;
+				break;
+			}
+		}
+		return istr;
+	}
+	return (uint16_t)*reg;
+}
+
+void simSetReg(volatile uint32_t *reg, uint32_t value) {
+	value &= 0xffff;
+	if (reg >= &simUsb[0] && reg < &simUsb[8]) {
+		// endpoint register
+		uint32_t old = *reg;
+		*reg = ((old ^ value) & EP_TOGGLE) | (old & value & EP_CLEAR) | (value & EP_WRITE) | (old & USB_EP_SETUP);
+	} else if (reg == &simUsb[ISTR]) {
+		// interrupt flags can only be cleared, CTR, DIR and EP_ID are read only
+		simUsb[ISTR] &= value;
+	} else if (reg == &simUsb[FNR]) {
+		// read only
+	} else {
+		// other registers and packet memory
+		*reg = value;
+	}
+}
+
+
+// interrupts
+
+// check if the endpoint is a double buffered bulk endpoint
+static bool isDoubleBuffered(uint32_t reg) {
+	return (reg & USB_EP_TYPE) == USB_EP_TYPE_BULK && (reg & USB_EP_KIND);
+}
+
+int simPendingIrq(void) {
+	// the interrupt mask bits of CNTR are at the same positions as the flags in ISTR
+	uint16_t istr = simGetReg(&simUsb[ISTR]);
+	if (!(istr & simUsb[CNTR] & 0xff00))
+		return -1;
+	if ((istr & USB_ISTR_CTR) && isDoubleBuffered(simUsb[istr & USB_ISTR_EP_ID]))
+		return NVIC_USB_HP_CAN_TX_IRQ;
+	return NVIC_USB_LP_CAN_RX0_IRQ;
+}
+
+
+// packet memory
+
+static void pmaWrite(int address, const uint8_t *data, int size) {
+	uint8_t *pma = (uint8_t *)simPma;
+	for (int i = 0; i < size; ++i) {
+		int a = address + i;
+		pma[(a & ~1) * 2 + (a & 1)] = data[i];
+	}
+}
+
+static void pmaRead(int address, uint8_t *data, int size) {
+	const uint8_t *pma = (const uint8_t *)simPma;
+	for (int i = 0; i < size; ++i) {
+		int a = address + i;
+		data[i] = pma[(a & ~1) * 2 + (a & 1)];
+	}
+}
+
+// get entry of buffer descriptor table (USB_ADDRn_TX, USB_COUNTn_TX, USB_ADDRn_RX, USB_COUNTn_RX)
+static uint16_t *bufferDescriptor(int ep, int index) {
+	return (uint16_t *)&simPma[(simUsb[BTABLE] + ep * 8 + index * 2) / 2];
+}
+
+// get size of receive buffer from BL_SIZE and NUM_BLOCK
+static int rxBufferSize(uint16_t count) {
+	int numBlock = (count >> 10) & 0x1f;
+	return (count & 0x8000) ? (numBlock + 1) * 32 : numBlock * 2;
+}
+
+
+// host side
+
+// find endpoint register for given address and endpoint number
+static uint32_t *findEndpoint(uint8_t address, int ep) {
+	if (simUsb[CNTR] & USB_CNTR_FRES)
+		return NULL;
+	uint32_t daddr = simUsb[DADDR];
+	if (!(daddr & USB_DADDR_EF) || (daddr & USB_DADDR_ADDR) != address)
+		return NULL;
+	for (int i = 0; i < 8; ++i) {
+		if ((simUsb[i] & USB_EP_ADDR) == ep)
+			return &simUsb[i];
+	}
+	return NULL;
+}
+
+// write received data into the rx buffer given by the buffer descriptor (0: tx entries, 2: rx entries), returns
+// false on buffer overrun
+static bool receive(int index, int buffer, const void *data, int size) {
+	uint16_t *count = bufferDescriptor(index, buffer + 1);
+	if (size > rxBufferSize(*count)) {
+		simUsb[ISTR] |= USB_ISTR_PMAOVR;
+		return false;
+	}
+	pmaWrite(*bufferDescriptor(index, buffer), (const uint8_t *)data, size);
+	*count = (*count & 0xfc00) | size;
+	return true;
+}
+
+void simReset(void) {
+	for (int i = 0; i < 8; ++i)
+		simUsb[i] = 0;
+	simUsb[DADDR] = 0;
+	simUsb[ISTR] |= USB_ISTR_RESET;
+}
+
+void simFrame(void) {
+	simUsb[FNR] = ((simUsb[FNR] + 1) & USB_FNR_FN) | USB_FNR_LCK;
+	simUsb[ISTR] |= USB_ISTR_SOF;
+}
+
+enum SimResult simSetup(uint8_t address, int ep, const void *data) {
+	uint32_t *reg = findEndpoint(address, ep);
+	if (reg == NULL || (*reg & USB_EP_TYPE) != USB_EP_TYPE_CONTROL || (*reg & USB_EP_RX_STAT) == USB_EP_RX_STAT_DISABLED
+		|| (*reg & USB_EP_RX_CTR))
+	{
+		return SIM_TIMEOUT;
+	}
+	int index = reg - simUsb;
+	if (!receive(index, 2, data, 8))
+		return SIM_TIMEOUT;
+
+	// a setup transaction is accepted in any state, both directions continue with DATA1 and get NAKed until the
+	// firmware has handled the request
+	uint32_t value = *reg & ~(EP_TOGGLE | USB_EP_SETUP);
+	*reg = value | USB_EP_RX_CTR | USB_EP_SETUP | USB_EP_RX_DTOG | USB_EP_TX_DTOG | USB_EP_RX_STAT_NAK
+		| USB_EP_TX_STAT_NAK;
+	return SIM_ACK;
+}
+
+enum SimResult simOut(uint8_t address, int ep, int toggle, const void *data, int size) {
+	uint32_t *reg = findEndpoint(address, ep);
+	if (reg == NULL)
+		return SIM_TIMEOUT;
+	switch (*reg & USB_EP_RX_STAT) {
+	case USB_EP_RX_STAT_DISABLED:
+		return SIM_TIMEOUT;
+	case USB_EP_RX_STAT_STALL:
+		return SIM_STALL;
+	case USB_EP_RX_STAT_NAK:
+		return SIM_NAK;
+	}
+
+	// double buffered: DTOG_RX selects the buffer of the usb peripheral, DTOG_TX is SW_BUF of the firmware
+	bool doubleBuffered = isDoubleBuffered(*reg);
+	if (doubleBuffered && !(*reg & USB_EP_RX_DTOG) == !(*reg & USB_EP_TX_DTOG))
+		return SIM_NAK;
+
+	// data toggle mismatch: the host repeats a packet that was already received, acknowledge and discard
+	if (toggle != !!(*reg & USB_EP_RX_DTOG))
+		return SIM_ACK;
+
+	int index = reg - simUsb;
+	if (doubleBuffered) {
+		// stays valid, the firmware releases buffers by toggling SW_BUF
+		if (!receive(index, (*reg & USB_EP_RX_DTOG) ? 2 : 0, data, size))
+			return SIM_TIMEOUT;
+		*reg = ((*reg & ~USB_EP_SETUP) ^ USB_EP_RX_DTOG) | USB_EP_RX_CTR;
+		return SIM_ACK;
+	}
+	if (!receive(index, 2, data, size))
+		return SIM_TIMEOUT;
+	*reg = ((*reg & ~(USB_EP_SETUP | USB_EP_RX_STAT)) ^ USB_EP_RX_DTOG) | USB_EP_RX_CTR | USB_EP_RX_STAT_NAK;
+	return SIM_ACK;
+}
+
+enum SimResult simIn(uint8_t address, int ep, int *toggle, void *data, int *size) {
+	uint32_t *reg = findEndpoint(address, ep);
+	if (reg == NULL)
+		return SIM_TIMEOUT;
+	switch (*reg & USB_EP_TX_STAT) {
+	case USB_EP_TX_STAT_DISABLED:
+		return SIM_TIMEOUT;
+	case USB_EP_TX_STAT_STALL:
+		return SIM_STALL;
+	case USB_EP_TX_STAT_NAK:
+		return SIM_NAK;
+	}
+
+	int index = reg - simUsb;
+	if (isDoubleBuffered(*reg)) {
+		// DTOG_TX selects the buffer of the usb peripheral, DTOG_RX is SW_BUF of the firmware
+		if (!(*reg & USB_EP_TX_DTOG) == !(*reg & USB_EP_RX_DTOG))
+			return SIM_NAK;
+		int buffer = (*reg & USB_EP_TX_DTOG) ? 2 : 0;
+		int count = *bufferDescriptor(index, buffer + 1) & 0x3ff;
+		pmaRead(*bufferDescriptor(index, buffer), (uint8_t *)data, count);
+		*size = count;
+		*toggle = !!(*reg & USB_EP_TX_DTOG);
+
+		// stays valid, the firmware releases buffers by toggling SW_BUF
+		*reg = (*reg ^ USB_EP_TX_DTOG) | USB_EP_TX_CTR;
+		return SIM_ACK;
+	}
+	int count = *bufferDescriptor(index, 1) & 0x3ff;
+	pmaRead(*bufferDescriptor(index, 0), (uint8_t *)data, count);
+	*size = count;
+	*toggle = !!(*reg & USB_EP_TX_DTOG);
+	*reg = ((*reg & ~USB_EP_TX_STAT) ^ USB_EP_TX_DTOG) | USB_EP_TX_CTR | USB_EP_TX_STAT_NAK;
+	return SIM_ACK;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+// simulator of the usb full speed device peripheral of the STM32F103. The firmware accesses the registers through
+// the st_usbfs.h replacement in include/, a test harness plays the role of the host and injects tokens
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// usb registers (0x40005C00) and packet memory (0x40006000, 256 half words each occupying 32 bit)
+extern uint32_t simUsb[0x54 / 4];
+extern uint32_t simPma[256];
+
+// register access of the firmware
+uint16_t simGetReg(volatile uint32_t *reg);
+void simSetReg(volatile uint32_t *reg, uint32_t value);
+
+// result of a transaction as seen by the host
+enum SimResult {
+	SIM_ACK,
+	SIM_NAK,
+	SIM_STALL,
+
+	// no handshake: wrong address, endpoint disabled, usb in reset or buffer overrun
+	SIM_TIMEOUT
+};
+
+// pending usb interrupt: NVIC_USB_HP_CAN_TX_IRQ for a correct transfer on a double buffered bulk endpoint,
+// NVIC_USB_LP_CAN_RX0_IRQ for other events enabled in USB_CNTR_REG or -1 if no interrupt is pending
+int simPendingIrq(void);
+
+// host side: bus reset
+void simReset(void);
+
+// host side: start of frame, increments the frame number
+void simFrame(void);
+
+// host side: setup transaction with 8 bytes of data (always DATA0)
+enum SimResult simSetup(uint8_t address, int ep, const void *data);
+
+// host side: out transaction, the device discards the data if toggle does not match its DTOG_RX
+enum SimResult simOut(uint8_t address, int ep, int toggle, const void *data, int size);
+
+// host side: in transaction, returns the data and the data toggle sent by the device
+enum SimResult simIn(uint8_t address, int ep, int *toggle, void *data, int *size);
+
+// state of the gpio output data registers of port A, B and C
+extern uint16_t simGpio[3];
+
+// configuration of each pin of port A, B and C as in GPIOx_CRL/CRH: cnf << 2 | mode
+extern uint8_t simGpioConfig[3][16];
+
+// enabled interrupts, bit n is set if irq n is enabled
+extern uint64_t simNvic;
+
+// memory of the simulated i2c eeprom at address 0x50
+extern uint8_t simEeprom[256];
+
+// the i2c bus is held low, e.g. by a device that stretches the clock forever
+extern bool simI2cStuck;
+
+// simulate one conversion of the adc (two in dual mode) that gets transferred by dma
+void simAdcConvert(void);
+
+// returns true if the interrupt of a dma channel is pending and enabled
+bool simDmaPending(int channel);
+
+// baud rate of the usart
+extern uint32_t simUartBaudRate;
+
+// receive data on the usart that gets transferred by dma, with error a framing error gets flagged. Returns the
+// number of bytes that dma took, the rest is lost as overrun
+int simUartReceive(const void *data, int size, bool error);
+
+// the rx line becomes idle
+void simUartIdle(void);
+
+// returns true if the usart interrupt is pending and enabled
+bool simUartPending(void);
+
+// transmit up to size bytes that dma feeds to the usart, returns the number of bytes
+int simUartTransmit(void *data, int size);
+
+#ifdef __cplusplus
+}
+#endif
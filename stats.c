@@ -0,0 +1,11 @@
+#include "stats.h"
+
+
+struct Stats stats;
+
+void statsRestart(void) {
+	for (int i = 0; i < STATS_HANDLER_COUNT; ++i) {
+		stats.handlers[i].minCycles = UINT32_MAX;
+		stats.handlers[i].maxCycles = 0;
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// statistics and cycle profiling of the usb events (struct Stats in protocol.h). The counters are updated in the
+// interrupt handlers and the main loop with plain increments, reading them is done by vendor request
+
+#include <stdint.h>
+#include "protocol.h"
+
+
+extern struct Stats stats;
+
+// restart the minimum and maximum cycles of all handlers, count and total keep running
+void statsRestart(void);
+
+// add a measurement of a handler, takes only a few cycles
+static inline void statsAdd(int handler, uint32_t cycles) {
+	struct HandlerStats *h = &stats.handlers[handler];
+	++h->count;
+	h->totalCycles += cycles;
+	if (cycles < h->minCycles)
+		h->minCycles = cycles;
+	if (cycles > h->maxCycles)
+		h->maxCycles = cycles;
+}
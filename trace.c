@@ -0,0 +1,26 @@
+#include "trace.h"
+
+#ifdef TRACE
+
+struct TraceRecord traceRing[TRACE_SIZE];
+
+// number of records written and read, they wrap around together
+uint32_t traceHead;
+static uint32_t traceTail;
+
+int traceRead(struct TraceRecord *records, int count) {
+	int n = 0;
+	uint32_t available = traceHead - traceTail;
+	if (available > TRACE_SIZE) {
+		// the oldest records were overwritten, continue with the oldest one that is still in the ring
+		uint32_t lost = available - TRACE_SIZE;
+		traceTail = traceHead - TRACE_SIZE;
+		uint32_t cycles = traceRing[traceTail & (TRACE_SIZE - 1)].cycles;
+		records[n++] = (struct TraceRecord){cycles, TRACE_LOST, 0, lost < 0xffff ? lost : 0xffff};
+	}
+	while (n < count && traceTail != traceHead)
+		records[n++] = traceRing[traceTail++ & (TRACE_SIZE - 1)];
+	return n;
+}
+
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+// event trace of the usb events in a ring buffer (see event trace in protocol.h), compiled in when TRACE is defined.
+// Records are written and read at the priority of the usb interrupts, which don't preempt each other
+
+#include <stdint.h>
+#include "protocol.h"
+
+#ifdef TRACE
+
+#include <libopencm3/cm3/dwt.h>
+
+
+extern struct TraceRecord traceRing[TRACE_SIZE];
+extern uint32_t traceHead;
+
+// add a record, overwrites the oldest one if the ring is full. Reads the cycle counter directly and is inlined to
+// stay below 20 cycles
+static inline void trace(int event, int arg, int value) {
+	struct TraceRecord *record = &traceRing[traceHead++ & (TRACE_SIZE - 1)];
+	record->cycles = DWT_CYCCNT;
+	record->event = event;
+	record->arg = arg;
+	record->value = value;
+}
+
+// copy up to count records that were not read yet, starts with a TRACE_LOST record if records were overwritten.
+// Returns the number of records
+int traceRead(struct TraceRecord *records, int count);
+
+#else
+
+#define trace(event, arg, value)
+
+#endif
@@ -0,0 +1,192 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/usart.h>
+#include "uart.h"
+
+
+// circular rx buffer written by dma channel 5
+static uint8_t uartRxBuffer[UART_RX_BUFFER_SIZE];
+
+// bytes written by dma and taken by uartRead() since the start, the position in the buffer is the count modulo the
+// buffer size
+static uint32_t uartRxWritten;
+static uint32_t uartRxRead;
+
+static uint32_t uartRxDropped;
+static uint32_t uartRxErrors;
+
+// dma channel 4 is sending
+static bool uartTxBusy;
+
+static UartReceived uartReceived;
+static UartSent uartSent;
+
+bool uartCheckConfig(const struct UartConfig *config) {
+	return config->baudRate >= UART_MIN_BAUD_RATE && config->baudRate <= UART_MAX_BAUD_RATE
+		&& config->parity <= UART_PARITY_EVEN && (config->stopBits == 1 || config->stopBits == 2);
+}
+
+void uartStart(const struct UartConfig *config, UartReceived received, UartSent sent) {
+	uartStop();
+	uartReceived = received;
+	uartSent = sent;
+	uartRxWritten = 0;
+	uartRxRead = 0;
+	uartRxDropped = 0;
+	uartRxErrors = 0;
+	uartTxBusy = false;
+
+	rcc_periph_clock_enable(RCC_GPIOA);
+	rcc_periph_clock_enable(RCC_USART1);
+	rcc_periph_clock_enable(RCC_DMA1);
+
+	// tx as alternate function, rx with pull-up so that an open input stays idle
+	gpio_set_mode(GPIOA, GPIO_MODE_OUTPUT_50_MHZ, GPIO_CNF_OUTPUT_ALTFN_PUSHPULL, GPIO_USART1_TX);
+	gpio_set_mode(GPIOA, GPIO_MODE_INPUT, GPIO_CNF_INPUT_PULL_UPDOWN, GPIO_USART1_RX);
+	gpio_set(GPIOA, GPIO_USART1_RX);
+
+	// the parity bit counts as data bit (reference manual: 27.3.7 Parity control)
+	static const uint32_t parities[] = {USART_PARITY_NONE, USART_PARITY_ODD, USART_PARITY_EVEN};
+	usart_set_baudrate(USART1, config->baudRate);
+	usart_set_databits(USART1, config->parity == UART_PARITY_NONE ? 8 : 9);
+	usart_set_parity(USART1, parities[config->parity]);
+	usart_set_stopbits(USART1, config->stopBits == 2 ? USART_STOPBITS_2 : USART_STOPBITS_1);
+	usart_set_mode(USART1, USART_MODE_TX_RX);
+	usart_set_flow_control(USART1, USART_FLOWCONTROL_NONE);
+
+	// dma channel 5 is connected to USART1_RX, circular over the rx buffer with an interrupt at each half so that
+	// the write position gets tracked before dma wraps around (the addresses are 32 bit on the target, uintptr_t
+	// keeps them intact in the simulator)
+	dma_channel_reset(DMA1, DMA_CHANNEL5);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL5, (uintptr_t)&USART_DR(USART1));
+	dma_set_memory_address(DMA1, DMA_CHANNEL5, (uintptr_t)uartRxBuffer);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL5, UART_RX_BUFFER_SIZE);
+	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL5);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL5);
+	dma_enable_circular_mode(DMA1, DMA_CHANNEL5);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL5, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL5, DMA_CCR_MSIZE_8BIT);
+	dma_enable_half_transfer_interrupt(DMA1, DMA_CHANNEL5);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL5);
+	dma_enable_channel(DMA1, DMA_CHANNEL5);
+
+	// dma channel 4 is connected to USART1_TX, started by uartSend()
+	dma_channel_reset(DMA1, DMA_CHANNEL4);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL4, (uintptr_t)&USART_DR(USART1));
+	dma_set_read_from_memory(DMA1, DMA_CHANNEL4);
+	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL4);
+	dma_set_peripheral_size(DMA1, DMA_CHANNEL4, DMA_CCR_PSIZE_8BIT);
+	dma_set_memory_size(DMA1, DMA_CHANNEL4, DMA_CCR_MSIZE_8BIT);
+	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL4);
+
+	// the idle line interrupt flushes data that does not fill half of the rx buffer. The interrupts have the same
+	// priority as the usb interrupts, therefore they do not preempt each other
+	USART_CR1(USART1) |= USART_CR1_IDLEIE;
+	usart_enable_rx_dma(USART1);
+	usart_enable_tx_dma(USART1);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+	nvic_enable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+	nvic_enable_irq(NVIC_USART1_IRQ);
+	usart_enable(USART1);
+}
+
+void uartStop(void) {
+	nvic_disable_irq(NVIC_USART1_IRQ);
+	nvic_disable_irq(NVIC_DMA1_CHANNEL4_IRQ);
+	nvic_disable_irq(NVIC_DMA1_CHANNEL5_IRQ);
+	usart_disable(USART1);
+	dma_disable_channel(DMA1, DMA_CHANNEL4);
+	dma_disable_channel(DMA1, DMA_CHANNEL5);
+	uartReceived = NULL;
+	uartSent = NULL;
+}
+
+// advance the write count to the current dma position, gets called at least twice per round of dma
+static void uartUpdate(void) {
+	uint32_t position = UART_RX_BUFFER_SIZE - dma_get_number_of_data(DMA1, DMA_CHANNEL5);
+	uartRxWritten += (position - uartRxWritten) & (UART_RX_BUFFER_SIZE - 1);
+
+	// dma has overtaken the read position: continue with the more recent half of the buffer
+	if (uartRxWritten - uartRxRead > UART_RX_BUFFER_SIZE) {
+		uint32_t read = uartRxWritten - UART_RX_BUFFER_SIZE / 2;
+		uartRxDropped += read - uartRxRead;
+		uartRxRead = read;
+	}
+}
+
+int uartAvailable(void) {
+	uartUpdate();
+	return uartRxWritten - uartRxRead;
+}
+
+int uartRead(void *data, int size) {
+	int count = uartAvailable();
+	if (count > size)
+		count = size;
+
+	// copy in up to two parts if the data wraps around the end of the buffer
+	uint32_t offset = uartRxRead & (UART_RX_BUFFER_SIZE - 1);
+	int first = UART_RX_BUFFER_SIZE - offset;
+	if (first > count)
+		first = count;
+	memcpy(data, uartRxBuffer + offset, first);
+	memcpy((uint8_t *)data + first, uartRxBuffer, count - first);
+	uartRxRead += count;
+	return count;
+}
+
+uint32_t uartDropped(void) {
+	return uartRxDropped;
+}
+
+uint32_t uartErrors(void) {
+	return uartRxErrors;
+}
+
+bool uartSendReady(void) {
+	return !uartTxBusy;
+}
+
+void uartSend(const void *data, int size) {
+	uartTxBusy = true;
+	dma_disable_channel(DMA1, DMA_CHANNEL4);
+	dma_set_memory_address(DMA1, DMA_CHANNEL4, (uintptr_t)data);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL4, size);
+	dma_enable_channel(DMA1, DMA_CHANNEL4);
+}
+
+void dma1_channel4_isr(void) {
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL4, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL4, DMA_TCIF);
+		uartTxBusy = false;
+		if (uartSent != NULL)
+			uartSent();
+	}
+}
+
+void dma1_channel5_isr(void) {
+	// half of the rx buffer was filled
+	if (dma_get_interrupt_flag(DMA1, DMA_CHANNEL5, DMA_HTIF | DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, DMA_CHANNEL5, DMA_HTIF | DMA_TCIF);
+		uartUpdate();
+		if (uartReceived != NULL)
+			uartReceived(false);
+	}
+}
+
+void usart1_isr(void) {
+	if (usart_get_flag(USART1, USART_SR_IDLE)) {
+		// errors of the received data, cleared together with the idle flag by reading SR and then DR
+		if (usart_get_flag(USART1, USART_SR_FE | USART_SR_NE | USART_SR_ORE))
+			++uartRxErrors;
+		usart_recv(USART1);
+		uartUpdate();
+		if (uartReceived != NULL)
+			uartReceived(true);
+	}
+}
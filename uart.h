@@ -0,0 +1,45 @@
+#pragma once
+
+// USART1 with dma in both directions: rx into a circular buffer, tx from the memory of the caller
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "protocol.h"
+
+
+// size of the circular rx buffer, a power of two. 4 ms of data at the maximum baud rate
+#define UART_RX_BUFFER_SIZE 2048
+
+// called from the dma and usart interrupts when data was received. idle is true if the line has become idle after
+// the received data, then no more data follows for now
+typedef void (*UartReceived)(bool idle);
+
+// called from the dma interrupt when all data of uartSend() was sent
+typedef void (*UartSent)(void);
+
+// returns true if the configuration is supported
+bool uartCheckConfig(const struct UartConfig *config);
+
+// start the usart, the callbacks get called for received data and finished sends
+void uartStart(const struct UartConfig *config, UartReceived received, UartSent sent);
+
+// stop the usart, the callbacks do not get called any more
+void uartStop(void);
+
+// number of received bytes that wait in the rx buffer
+int uartAvailable(void);
+
+// take up to size received bytes out of the rx buffer, returns the number of bytes
+int uartRead(void *data, int size);
+
+// number of received bytes that were dropped because dma overwrote them before they were read
+uint32_t uartDropped(void);
+
+// number of receive errors (framing, noise, overrun)
+uint32_t uartErrors(void);
+
+// returns true if no send is in progress
+bool uartSendReady(void);
+
+// send data by dma, only allowed if uartSendReady() returns true. The data has to stay valid until sent gets called
+void uartSend(const void *data, int size);
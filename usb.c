@@ -0,0 +1,1664 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <libopencm3/cm3/dwt.h>
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/stm32/desig.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/st_usbfs.h>
+#include "adc.h"
+#include "codec.h"
+#include "crc.h"
+#include "frame.h"
+#include "pma.h"
+#include "protocol.h"
+#include "script.h"
+#include "stats.h"
+#include "trace.h"
+#include "uart.h"
+#include "usb.h"
+
+// stm32f103xx reference manual, usb: chapter 23, page 622
+// usb overview: https://www.beyondlogic.org/usbnutshell/usb5.shtml
+// libopencm3 example: https://github.com/libopencm3/libopencm3-examples/blob/master/examples/stm32/f1/stm32-maple/usb_cdcacm/cdcacm.c
+// other usb example: https://github.com/Erlkoenig90/f1usb
+// usbmon: https://www.kernel.org/doc/Documentation/usb/usbmon.txt
+
+
+static void ledOn() {
+	gpio_clear(GPIOC, GPIO13);
+}
+
+static void ledOff() {
+	gpio_set(GPIOC, GPIO13);
+}
+
+static void ledToggle() {
+	gpio_toggle(GPIOC, GPIO13);
+}
+
+
+static inline int min(int a, int b) {
+	return a < b ? a : b;
+}
+
+
+// USB
+// ------------------------------------
+
+// transfer direction
+enum UsbDirection {
+	USB_OUT = 0, // to device
+	USB_IN = 0x80 // to host
+};
+
+enum UsbDescriptorType {
+	USB_DESCRIPTOR_DEVICE = 0x01,
+	USB_DESCRIPTOR_CONFIGURATION = 0x02,
+	USB_DESCRIPTOR_STRING = 0x03,
+	USB_DESCRIPTOR_INTERFACE = 0x04,
+	USB_DESCRIPTOR_ENDPOINT = 0x05
+};
+
+enum UsbEndpointType {
+	USB_ENDPOINT_CONTROL = 0,
+	USB_ENDPOINT_ISOCHRONOUS = 1,
+	USB_ENDPOINT_BULK = 2,
+	USB_ENDPOINT_INTERRUPT = 3
+};
+
+struct UsbDeviceDescriptor {
+	uint8_t  bLength;
+	uint8_t  bDescriptorType;
+	uint16_t bcdUSB;
+	uint8_t  bDeviceClass;
+	uint8_t  bDeviceSubClass;
+	uint8_t  bDeviceProtocol;
+	uint8_t  bMaxPacketSize0;
+	uint16_t idVendor;
+	uint16_t idProduct;
+	uint16_t bcdDevice;
+	uint8_t  iManufacturer;
+	uint8_t  iProduct;
+	uint8_t  iSerialNumber;
+	uint8_t  bNumConfigurations;
+} __attribute__((packed));
+
+struct UsbConfigDescriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint16_t wTotalLength;
+	uint8_t bNumInterfaces;
+	uint8_t bConfigurationValue;
+	uint8_t iConfiguration;
+	uint8_t bmAttributes;
+	uint8_t bMaxPower;
+} __attribute__((packed));
+
+struct UsbInterfaceDescriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint8_t bInterfaceNumber;
+	uint8_t bAlternateSetting;
+	uint8_t bNumEndpoints;
+	uint8_t bInterfaceClass;
+	uint8_t bInterfaceSubClass;
+	uint8_t bInterfaceProtocol;
+	uint8_t iInterface;
+} __attribute__((packed));
+
+struct UsbEndpointDescriptor {
+	uint8_t bLength;
+	uint8_t bDescriptorType;
+	uint8_t bEndpointAddress;
+	uint8_t bmAttributes;
+	uint16_t wMaxPacketSize;
+	uint8_t bInterval;
+} __attribute__((packed));
+
+
+// max packet size of the bulk endpoints
+#define BULK_PACKET_SIZE 64
+
+// index into the string table
+enum UsbString {
+	USB_STRING_LANGUAGES = 0,
+	USB_STRING_MANUFACTURER = 1,
+	USB_STRING_PRODUCT = 2,
+	USB_STRING_SERIAL = 3,
+	USB_STRING_COUNT
+};
+
+// device descriptor
+static const struct UsbDeviceDescriptor usbDevice = {
+	.bLength = sizeof(struct UsbDeviceDescriptor),
+	.bDescriptorType = USB_DESCRIPTOR_DEVICE,
+	.bcdUSB = 0x0200, // USB 2.0
+	.bDeviceClass = 0xff, // no class
+	.bDeviceSubClass = 0xff,
+	.bDeviceProtocol = 0xff,
+	.bMaxPacketSize0 = 64, // max packet size for endpoint 0
+	.idVendor = 0x0483, // STMicroelectronics
+	.idProduct = 0x5722, // Bulk Demo
+	.bcdDevice = 0x0100, // device version
+	.iManufacturer = USB_STRING_MANUFACTURER, // index into string table
+	.iProduct = USB_STRING_PRODUCT, // index into string table
+	.iSerialNumber = USB_STRING_SERIAL, // index into string table
+	.bNumConfigurations = 1
+};
+
+// configuration descriptor
+struct UsbConfiguration {
+	struct UsbConfigDescriptor config;
+	struct UsbInterfaceDescriptor interface;
+	struct UsbEndpointDescriptor endpoint1;
+	struct UsbEndpointDescriptor endpoint2;
+	struct UsbEndpointDescriptor endpoint3;
+} __attribute__((packed));
+
+static const struct UsbConfiguration usbConfiguration = {
+	.config = {
+		.bLength = sizeof(struct UsbConfigDescriptor),
+		.bDescriptorType = USB_DESCRIPTOR_CONFIGURATION,
+		.wTotalLength = sizeof(struct UsbConfiguration),
+		.bNumInterfaces = 1,
+		.bConfigurationValue = 1,
+		.iConfiguration = 0,
+		.bmAttributes = 0x80, // bus powered
+		.bMaxPower = 50 // 100 mA
+	},
+	.interface = {
+		.bLength = sizeof(struct UsbInterfaceDescriptor),
+		.bDescriptorType = USB_DESCRIPTOR_INTERFACE,
+		.bInterfaceNumber = 0,
+		.bAlternateSetting = 0,
+		.bNumEndpoints = 3,
+		.bInterfaceClass = 0xff, // no class
+		.bInterfaceSubClass = 0xff,
+		.bInterfaceProtocol = 0xff,
+		.iInterface = 0
+	},
+	.endpoint1 = {
+		.bLength = sizeof(struct UsbEndpointDescriptor),
+		.bDescriptorType = USB_DESCRIPTOR_ENDPOINT,
+		.bEndpointAddress = USB_IN | 1, // in 1 (tx)
+		.bmAttributes = USB_ENDPOINT_BULK,
+		.wMaxPacketSize = BULK_PACKET_SIZE,
+		.bInterval = 1 // polling interval
+	},
+	.endpoint2 = {
+		.bLength = sizeof(struct UsbEndpointDescriptor),
+		.bDescriptorType = USB_DESCRIPTOR_ENDPOINT,
+		.bEndpointAddress = USB_OUT | 2, // out 2 (rx)
+		.bmAttributes = USB_ENDPOINT_BULK,
+		.wMaxPacketSize = BULK_PACKET_SIZE,
+		.bInterval = 1 // polling interval
+	},
+	.endpoint3 = {
+		.bLength = sizeof(struct UsbEndpointDescriptor),
+		.bDescriptorType = USB_DESCRIPTOR_ENDPOINT,
+		.bEndpointAddress = USB_IN | TRACE_ENDPOINT, // in 3 (tx), event trace
+		.bmAttributes = USB_ENDPOINT_BULK,
+		.wMaxPacketSize = TRACE_PACKET_SIZE,
+		.bInterval = 1 // polling interval
+	}
+};
+
+// serial number, the 96 bit unique id of the chip as 24 hex digits, set in usbInit()
+static char usbSerial[25];
+
+// string table, strings are converted to string descriptors when requested
+static const char *const usbStrings[USB_STRING_COUNT] = {
+	NULL, // table of supported languages
+	"BluePill",
+	"BluePill USB bulk transfer benchmark and test device",
+	usbSerial
+};
+
+// maximum number of characters of a string descriptor
+#define USB_STRING_MAX_LENGTH 63
+
+// buffer for the string descriptor that is currently sent (bLength and bDescriptorType, then UTF-16 characters)
+static uint16_t usbStringDescriptor[1 + USB_STRING_MAX_LENGTH];
+
+// control request type  
+enum UsbRequestType {
+	USB_REQUEST_TYPE_MASK = (0x03 << 5),
+	USB_REQUEST_TYPE_STANDARD = (0x00 << 5),
+	USB_REQUEST_TYPE_CLASS = (0x01 << 5),
+	USB_REQUEST_TYPE_VENDOR = (0x02 << 5),
+	USB_REQUEST_TYPE_RESERVED = (0x03 << 5)
+};
+
+// control request recipient
+enum UsbRequestRecipient {
+	USB_RECIPIENT_MASK = 0x1f,
+	USB_RECIPIENT_DEVICE = 0x00,
+	USB_RECIPIENT_INTERFACE = 0x01,
+	USB_RECIPIENT_ENDPOINT = 0x02,
+	USB_RECIPIENT_OTHER = 0x03
+};
+
+// control request data, transferred in the setup packet
+struct UsbRequest {
+	uint8_t bmRequestType; // combination of UsbDirection, UsbRequestType and UsbRequestRecipient
+	uint8_t bRequest;
+	uint16_t wValue;
+	uint16_t wIndex;
+	uint16_t wLength;
+};
+
+// endpoint of the device, the endpoint number is also the index of the endpoint register
+struct UsbEndpoint {
+	// endpoint type, USB_EP_TYPE_BULK | USB_EP_KIND for a double buffered bulk endpoint
+	uint16_t type;
+
+	// offsets of the tx and rx buffers in packet memory (buffer 0 and 1 for a double buffered endpoint)
+	uint16_t txAddress;
+	uint16_t rxAddress;
+
+	// size of the tx buffers (max packet size), 0 for an out endpoint
+	uint16_t txSize;
+
+	// size of the rx buffers, 0 for an in endpoint
+	uint16_t rxSize;
+
+	// called when a packet was sent to the host (tx ctr flag is set)
+	void (*sent)(int ep);
+
+	// called when a packet was received from the host (rx ctr flag is set)
+	void (*received)(int ep);
+};
+
+// endpoint table indexed by USB_ISTR_EP_ID, defined after the handlers
+#define USB_ENDPOINT_COUNT 4
+static const struct UsbEndpoint usbEndpoints[USB_ENDPOINT_COUNT];
+
+// offset of the free packet memory behind the endpoint buffers
+#define USB_PMA_FREE 448
+
+/*
+	Double buffered bulk endpoints (reference manual: 23.4.3 Double-buffered endpoints)
+	Buffer 0 uses the tx address/count and buffer 1 the rx address/count entries of the buffer table. The usb
+	peripheral uses the buffer indicated by DTOG and the application the buffer indicated by SW_BUF. For an in
+	endpoint SW_BUF is the DTOG_RX bit, for an out endpoint it is the DTOG_TX bit. The endpoint is NAKed while
+	DTOG == SW_BUF, i.e. while the usb peripheral has no buffer to send from or receive into.
+*/
+#define USB_EP_TX_SW_BUF USB_EP_RX_DTOG
+#define USB_EP_RX_SW_BUF USB_EP_TX_DTOG
+
+// transfer state of a double buffered bulk endpoint
+struct UsbBulkState {
+	// in: usb peripheral owns a filled buffer
+	bool txBusy;
+
+	// in: the buffer of the application is filled and waits until the usb peripheral is free
+	bool txPending;
+
+	// out: a received packet waits in the buffer of the application
+	bool rxReady;
+};
+static struct UsbBulkState usbBulkStates[USB_ENDPOINT_COUNT];
+
+// called when a transfer has finished, length is the number of bytes that were sent or received
+typedef void (*UsbTransferDone)(int ep, int length);
+
+// transfer of a buffer as a sequence of packets on a double buffered bulk endpoint
+struct UsbTransfer {
+	uint8_t *data;
+	int size;
+
+	// number of bytes that were sent or received so far
+	int offset;
+
+	// transfer is in progress
+	bool active;
+
+	UsbTransferDone done;
+};
+static struct UsbTransfer usbTransfers[USB_ENDPOINT_COUNT];
+
+// setup buffers and endpoint register of an endpoint according to the endpoint table
+static void usbSetupEndpoint(int ep) {
+	const struct UsbEndpoint *endpoint = &usbEndpoints[ep];
+	bool doubleBuffered = (endpoint->type & USB_EP_KIND) != 0;
+
+	// rx buffer size in blocks of 32 or 2 bytes
+	uint16_t rxCount = endpoint->rxSize >= 64
+		? 0x8000 | ((endpoint->rxSize / 32 - 1) << 10)
+		: (endpoint->rxSize / 2) << 10;
+
+	// setup buffers (tx count is set when actually sending data)
+	SET_REG(USB_EP_TX_ADDR(ep), endpoint->txAddress);
+	SET_REG(USB_EP_TX_COUNT(ep), doubleBuffered ? rxCount : 0);
+	SET_REG(USB_EP_RX_ADDR(ep), endpoint->rxAddress);
+	SET_REG(USB_EP_RX_COUNT(ep), rxCount);
+
+	// target state of the toggle bits
+	uint16_t target;
+	if (!doubleBuffered) {
+		// control endpoint: ready to receive, tx is set when sending data. In endpoint: nak until data is sent
+		target = endpoint->rxSize > 0 ? USB_EP_RX_STAT_VALID : USB_EP_TX_STAT_NAK;
+	} else if (endpoint->rxSize > 0) {
+		// out endpoint: valid, DTOG = 0 and SW_BUF = 1 (receive into buffer 0), tx disabled
+		target = USB_EP_RX_STAT_VALID | USB_EP_RX_SW_BUF;
+	} else {
+		// in endpoint: valid, DTOG = SW_BUF = 0 (nak until the first buffer is filled), rx disabled
+		target = USB_EP_TX_STAT_VALID;
+	}
+
+	// clear rx and tx flags, endpoint type, kind and address
+	uint16_t clear = USB_EP_RX_CTR | USB_EP_TX_CTR | USB_EP_TYPE | USB_EP_KIND | USB_EP_ADDR;
+
+	uint16_t epReg = GET_REG(USB_EP_REG(ep));
+	SET_REG(USB_EP_REG(ep), ((epReg ^ target) & ~clear) | endpoint->type | ep);
+	usbBulkStates[ep] = (struct UsbBulkState){0};
+	usbTransfers[ep] = (struct UsbTransfer){0};
+}
+
+// setup usb and control endpoints (assumes that usb just exited reset state)
+void usbSetup() {
+	// clear interrupts of usb
+	SET_REG(USB_ISTR_REG, 0);
+
+	// set buffer table address inside packet memory (relative to USB_PMA_BASE), see usbEndpoints for the layout
+	SET_REG(USB_BTABLE_REG, 0);
+	
+	// setup control endpoint 0
+	usbSetupEndpoint(0);
+
+	// enable usb at usb address 0
+	SET_REG(USB_DADDR_REG, USB_DADDR_EF | 0);
+}
+
+// start of the current usb interrupt and latency until in packets are ready to send, in cpu cycles. Sends outside of
+// the usb interrupt (inEvent is false) are not measured because eventStart is stale there
+static uint32_t eventStart;
+static bool inEvent;
+static struct Latency latency;
+
+// setup the data endpoints
+void usbSetupEndpoints() {
+	for (int ep = 1; ep < USB_ENDPOINT_COUNT; ++ep)
+		usbSetupEndpoint(ep);
+}
+
+/**
+	Note:
+	These flags of USB_EP_REG toggle when written with 1 and don't change when written with 0
+	USB_EP_RX_DTOG
+	USB_EP_RX_STAT
+	USB_EP_TX_DTOG
+	USB_EP_TX_STAT
+	These flags can only be cleared and should be written with 1 to keep current state
+	USB_EP_RX_CTR
+	USB_EP_TX_CTR
+*/
+
+// send data to the host
+void usbSend(int ep, const void *data, int size) {
+	// copy data from flash into tx buffer
+	pmaWrite(USB_GET_EP_TX_BUFF(ep), data, size);
+	
+	// set size of packet in tx buffer
+	SET_REG(USB_EP_TX_COUNT(ep), size);
+	
+	// clear tx flag and don't change other toggle flags (see note above)
+	uint16_t clear = USB_EP_TX_CTR | USB_EP_RX_DTOG | USB_EP_TX_DTOG | USB_EP_RX_STAT;
+
+	// don't clear rx flag (see note above)
+	uint16_t set = USB_EP_RX_CTR;
+
+	// indicate that we are ready to send
+	uint16_t epReg = GET_REG(USB_EP_REG(ep));
+	SET_REG(USB_EP_REG(ep), ((epReg ^ USB_EP_TX_STAT_VALID) & ~clear) | set);
+}
+
+// acknowledge send requests with a stall to indicate unsupported request
+void usbSendStall() {
+	// clear tx flag and don't change other toggle flags (see note above)
+	uint16_t clear = USB_EP_TX_CTR | USB_EP_RX_DTOG | USB_EP_TX_DTOG | USB_EP_RX_STAT;
+
+	// don't clear rx flag (see note above)
+	uint16_t set = USB_EP_RX_CTR;
+
+	// indicate that we are ready to send
+	uint16_t epReg = GET_REG(USB_EP_REG(0));
+	SET_REG(USB_EP_REG(0), ((epReg ^ USB_EP_TX_STAT_STALL) & ~clear) | set);
+}
+
+// indicate that we want to receive data from the host
+void usbReceive(int ep) {
+	// clear rx flag and don't change other toggle flags (see note above)
+	uint16_t clear = USB_EP_RX_CTR | USB_EP_RX_DTOG | USB_EP_TX_DTOG | USB_EP_TX_STAT;
+
+	// don't clear tx flag (see note above)
+	uint16_t set = USB_EP_TX_CTR;
+
+	// indicate that we are ready to receive
+	uint16_t epReg = GET_REG(USB_EP_REG(ep));
+	SET_REG(USB_EP_REG(ep), ((epReg ^ USB_EP_RX_STAT_VALID) & ~clear) | set);
+}
+
+// clear ctr flags without changing the state of the endpoint
+static void usbClearCtr(int ep, uint16_t ctr) {
+	// keep type, kind and address and the other ctr flag (see note above)
+	uint16_t epReg = GET_REG(USB_EP_REG(ep));
+	SET_REG(USB_EP_REG(ep), (epReg & (USB_EP_TYPE | USB_EP_KIND | USB_EP_ADDR))
+		| ((USB_EP_RX_CTR | USB_EP_TX_CTR) & ~ctr));
+}
+
+// toggle SW_BUF of a double buffered endpoint and clear the ctr flag of its direction
+static void usbToggleSwBuf(int ep, uint16_t swBuf, uint16_t ctr) {
+	// keep type, kind and address and the ctr flag of the other direction (see note above)
+	uint16_t epReg = GET_REG(USB_EP_REG(ep));
+	SET_REG(USB_EP_REG(ep), (epReg & (USB_EP_TYPE | USB_EP_KIND | USB_EP_ADDR)) | ((USB_EP_RX_CTR | USB_EP_TX_CTR) & ~ctr)
+		| swBuf);
+}
+
+// check if the application buffer of a double buffered in endpoint is free
+bool usbBulkSendReady(int ep) {
+	return !usbBulkStates[ep].txPending;
+}
+
+// send data to the host on a double buffered in endpoint, only allowed if usbBulkSendReady() returns true
+void usbBulkSend(int ep, const void *data, int size) {
+	// copy data into the buffer indicated by SW_BUF
+	if (GET_REG(USB_EP_REG(ep)) & USB_EP_TX_SW_BUF) {
+		pmaWrite(USB_GET_EP_RX_BUFF(ep), data, size);
+		SET_REG(USB_EP_RX_COUNT(ep), size);
+	} else {
+		pmaWrite(USB_GET_EP_TX_BUFF(ep), data, size);
+		SET_REG(USB_EP_TX_COUNT(ep), size);
+	}
+
+	// measure the time since the usb interrupt was entered
+	if (inEvent) {
+		uint32_t cycles = dwt_read_cycle_counter() - eventStart;
+		if (latency.count == 0 || cycles < latency.minCycles)
+			latency.minCycles = cycles;
+		if (cycles > latency.maxCycles)
+			latency.maxCycles = cycles;
+		latency.totalCycles += cycles;
+		++latency.count;
+	}
+
+	struct UsbBulkState *state = &usbBulkStates[ep];
+	if (!state->txBusy) {
+		// hand the buffer over to the usb peripheral
+		usbToggleSwBuf(ep, USB_EP_TX_SW_BUF, 0);
+		state->txBusy = true;
+	} else {
+		// hand over when the usb peripheral has sent the other buffer
+		state->txPending = true;
+	}
+}
+
+// handle completed send of a double buffered in endpoint, call when the tx ctr flag is set
+void usbBulkSendDone(int ep) {
+	struct UsbBulkState *state = &usbBulkStates[ep];
+	if (state->txPending) {
+		// hand the filled buffer over to the usb peripheral which immediately starts sending it
+		usbToggleSwBuf(ep, USB_EP_TX_SW_BUF, USB_EP_TX_CTR);
+		state->txPending = false;
+	} else {
+		// both buffers are empty
+		usbToggleSwBuf(ep, 0, USB_EP_TX_CTR);
+		state->txBusy = false;
+	}
+}
+
+// handle received packet of a double buffered out endpoint, call when the rx ctr flag is set. The usb peripheral
+// naks further packets until the application takes the packet using usbBulkReceive()
+void usbBulkReceiveDone(int ep) {
+	usbToggleSwBuf(ep, 0, USB_EP_RX_CTR);
+	usbBulkStates[ep].rxReady = true;
+}
+
+// check if a received packet is waiting on a double buffered out endpoint
+bool usbBulkReceiveReady(int ep) {
+	return usbBulkStates[ep].rxReady;
+}
+
+// receive data from the host on a double buffered out endpoint, only allowed if usbBulkReceiveReady() returns true.
+// Returns the number of bytes that were received
+int usbBulkReceive(int ep, void *data, int size) {
+	// hand the buffer that was read last time back to the usb peripheral so that it can receive the next packet
+	// while we copy, then SW_BUF indicates the buffer with the received data
+	usbToggleSwBuf(ep, USB_EP_RX_SW_BUF, 0);
+	usbBulkStates[ep].rxReady = false;
+
+	int count;
+	if (GET_REG(USB_EP_REG(ep)) & USB_EP_RX_SW_BUF) {
+		count = min(GET_REG(USB_EP_RX_COUNT(ep)) & 0x3ff, size);
+		pmaRead(data, USB_GET_EP_RX_BUFF(ep), count);
+	} else {
+		count = min(GET_REG(USB_EP_TX_COUNT(ep)) & 0x3ff, size);
+		pmaRead(data, USB_GET_EP_TX_BUFF(ep), count);
+	}
+	return count;
+}
+
+/*
+	Transfers
+	An in transfer is sent as a sequence of packets of max packet size followed by a short packet. If the size is a
+	multiple of the max packet size, a zero length packet ends the transfer. An out transfer ends when a short packet
+	or zero length packet was received or the buffer is full.
+*/
+
+// queue packets of an in transfer into the free buffers, call after usbBulkSendDone()
+void usbBulkWriteNext(int ep) {
+	struct UsbTransfer *transfer = &usbTransfers[ep];
+	int packetSize = usbEndpoints[ep].txSize;
+	while (transfer->active && usbBulkSendReady(ep)) {
+		int size = min(transfer->size - transfer->offset, packetSize);
+		usbBulkSend(ep, transfer->data + transfer->offset, size);
+		transfer->offset += size;
+
+		// done when the short packet or zero length packet was queued (the data is then copied to packet memory),
+		// a full last packet is therefore followed by a zero length packet
+		if (size < packetSize) {
+			transfer->active = false;
+			transfer->done(ep, transfer->offset);
+		}
+	}
+}
+
+// start an in transfer on a double buffered bulk endpoint, done gets called when all data is copied to packet memory
+void usbBulkWrite(int ep, const void *data, int size, UsbTransferDone done) {
+	struct UsbTransfer *transfer = &usbTransfers[ep];
+	transfer->data = (uint8_t*)data;
+	transfer->size = size;
+	transfer->offset = 0;
+	transfer->active = true;
+	transfer->done = done;
+	usbBulkWriteNext(ep);
+}
+
+// take received packets of an out transfer, call after usbBulkReceiveDone()
+void usbBulkReadNext(int ep) {
+	struct UsbTransfer *transfer = &usbTransfers[ep];
+	int packetSize = usbEndpoints[ep].rxSize;
+	if (transfer->active && usbBulkReceiveReady(ep)) {
+		int count = usbBulkReceive(ep, transfer->data + transfer->offset, transfer->size - transfer->offset);
+		transfer->offset += count;
+		if (count < packetSize || transfer->offset == transfer->size) {
+			transfer->active = false;
+			transfer->done(ep, transfer->offset);
+		}
+	}
+}
+
+// start an out transfer on a double buffered bulk endpoint, size should be a multiple of the max packet size.
+// done gets called when the transfer has ended
+void usbBulkRead(int ep, void *data, int size, UsbTransferDone done) {
+	struct UsbTransfer *transfer = &usbTransfers[ep];
+	transfer->data = (uint8_t*)data;
+	transfer->size = size;
+	transfer->offset = 0;
+	transfer->active = true;
+	transfer->done = done;
+
+	// a packet may already wait
+	usbBulkReadNext(ep);
+}
+
+// cancel a transfer, done does not get called
+void usbBulkCancel(int ep) {
+	usbTransfers[ep].active = false;
+}
+
+// the current operating mode of the usb device handler code
+enum UsbMode {
+	IDLE,
+	SET_ADDRESS,
+	AWAIT_TX,
+	GET_DESCRIPTOR,
+	RECEIVE_DATA,
+};
+
+
+// Bulk endpoints
+// ------------------------------------
+
+// operating mode of the bulk endpoints, set by vendor request
+static enum Mode mode = MODE_LED;
+
+// counters that can be read by vendor request
+static struct Counters counters;
+
+// current position in the pattern for source and sink
+static uint8_t sourceOffset;
+static uint8_t sinkOffset;
+
+// send next packet of the pattern on in-endpoint 1
+static void sourceSend() {
+	uint8_t packet[BULK_PACKET_SIZE];
+	uint8_t offset = sourceOffset;
+	for (int i = 0; i < BULK_PACKET_SIZE; ++i) {
+		packet[i] = offset;
+		offset = offset == PATTERN_LENGTH - 1 ? 0 : offset + 1;
+	}
+	sourceOffset = offset;
+	usbBulkSend(1, packet, BULK_PACKET_SIZE);
+	++counters.sourcePackets;
+}
+
+// buffer of the loopback mode
+static uint32_t loopbackBuffer[LOOPBACK_SIZE / 4];
+
+static void loopbackSent(int ep, int length);
+
+// a transfer was received on out-endpoint 2: send it back on in-endpoint 1
+static void loopbackReceived(int ep, int length) {
+	usbBulkWrite(1, loopbackBuffer, length, loopbackSent);
+}
+
+// the transfer was copied into the tx buffers: receive the next transfer
+static void loopbackSent(int ep, int length) {
+	usbBulkRead(2, loopbackBuffer, LOOPBACK_SIZE, loopbackReceived);
+}
+
+// framed mode: writer for the replies on in-endpoint 1 and reader for the packet received on out-endpoint 2
+static struct FrameWriter frameWriter;
+static struct FrameReader frameReader;
+static uint8_t frameRxPacket[FRAME_PACKET_SIZE];
+
+// flush timeout and frames (ms) since the first message was added or since the last packet was sent
+static uint16_t flushTimeout = 1;
+static uint16_t frameAge;
+
+// the last packet was full, a zero length packet ends the transfer if no further messages follow
+static bool frameEndTransfer;
+
+// script uploaded by vendor request and the result of the last run
+static uint8_t scriptCode[SCRIPT_MAX_SIZE];
+static int scriptSize;
+static uint32_t scriptResult[(SCRIPT_RESULT_BUFFER_SIZE + 3) / 4];
+
+// a script is started in the interrupt handler, runs in the main loop and its result is sent in the interrupt handler
+enum ScriptState {
+	SCRIPT_IDLE,
+	SCRIPT_PENDING,
+	SCRIPT_RUNNING,
+	SCRIPT_SENDING
+};
+static volatile enum ScriptState scriptState = SCRIPT_IDLE;
+
+static void scriptSent(int ep, int length) {
+	scriptState = SCRIPT_IDLE;
+}
+
+// configuration of the adc stream, 100 kHz on PA0 by default
+static struct AdcConfig adcConfig = {100000, 0, 1, 0, 0, 0, 0, 0};
+
+// block of the adc stream that is being sent, NULL if all packets were sent
+static const uint8_t *adcBlock;
+static int adcOffset;
+
+// sequence number of the next packet, counts all packets of the stream including the dropped ones
+static uint16_t adcSequence;
+
+// frame number and cycle counter at the last start of frame for the timestamps
+static uint16_t sofFrame;
+static uint32_t sofCycles;
+
+// bytes of samples in each packet
+static int adcPacketData() {
+	return adcConfig.timestamp ? ADC_TIMESTAMP_PACKET_DATA : ADC_PACKET_DATA;
+}
+
+// send packets of the current block while tx buffers are free
+static void adcSendNext() {
+	while (adcBlock != NULL && usbBulkSendReady(1)) {
+		if (adcOffset == ADC_BLOCK_SIZE) {
+			// all samples were sent: the crc ends the block
+			struct StreamCrc crc = {adcSequence++, counters.adcOverflows, crcResult()};
+			usbBulkSend(1, &crc, sizeof(crc));
+			++counters.sourcePackets;
+			adcBlock = NULL;
+			break;
+		}
+
+		uint32_t packet[(sizeof(struct StreamHeader) + ADC_PACKET_DATA) / 4];
+		struct StreamHeader *header = (struct StreamHeader *)packet;
+		header->sequence = adcSequence++;
+		header->overflows = counters.adcOverflows;
+		uint8_t *data = (uint8_t *)(header + 1);
+		if (adcConfig.timestamp) {
+			struct StreamTimestamp *timestamp = (struct StreamTimestamp *)data;
+			timestamp->frame = GET_REG(USB_FNR_REG) & (USB_FNR_FN | USB_FNR_LSOF | USB_FNR_LCK);
+			timestamp->sofFrame = sofFrame;
+			timestamp->sofCycles = sofCycles;
+			timestamp->cycles = dwt_read_cycle_counter();
+			data += sizeof(struct StreamTimestamp);
+		}
+		if (adcConfig.codec == ADC_CODEC_DELTA) {
+			// as many groups of samples as fit into the packet
+			int count = codecEncode((const uint16_t *)(adcBlock + adcOffset), (ADC_BLOCK_SIZE - adcOffset) / 2,
+				adcConfig.dual ? 2 : 1, data, adcPacketData());
+			adcOffset += count * 2;
+		} else {
+			memcpy(data, adcBlock + adcOffset, adcPacketData());
+			adcOffset += adcPacketData();
+		}
+		usbBulkSend(1, packet, sizeof(packet));
+		++counters.sourcePackets;
+		if (adcOffset == ADC_BLOCK_SIZE && !adcConfig.crc)
+			adcBlock = NULL;
+	}
+}
+
+// drop the packets of the current block from offset on including its crc packet, their sequence numbers are skipped
+static void adcDrop(int offset) {
+	++counters.adcOverflows;
+	adcSequence += adcConfig.codec == ADC_CODEC_DELTA ? 1 : (ADC_BLOCK_SIZE - offset) / adcPacketData();
+	if (adcConfig.crc && adcConfig.codec != ADC_CODEC_DELTA)
+		++adcSequence;
+}
+
+// called from the dma interrupt when a block is full, block is NULL if dma overwrote it before
+static void adcBlockReady(const uint8_t *block) {
+	++counters.adcBlocks;
+	if (adcBlock != NULL) {
+		// dma is about to overwrite the block that is still being sent: drop the rest of it
+		adcDrop(adcOffset);
+	} else if (block != NULL && !usbBulkSendReady(1)) {
+		// the host has not yet read the packets of the previous block
+		++counters.adcBackpressure;
+	}
+	adcBlock = block;
+	adcOffset = 0;
+	if (block == NULL) {
+		adcDrop(0);
+		return;
+	}
+	if (adcConfig.crc)
+		crcStart(block, ADC_BLOCK_SIZE);
+	adcSendNext();
+}
+
+// configuration of the uart bridge, 115200 8N1 by default
+static struct UartConfig uartConfig = {115200, UART_PARITY_NONE, 1, 0};
+
+// transfer buffers of the uart bridge: a transfer from out-endpoint 2 is received into one buffer while dma sends
+// the other one
+#define BRIDGE_TRANSFER_SIZE 512
+static uint32_t bridgeBuffers[2][BRIDGE_TRANSFER_SIZE / 4];
+
+// number of bytes in each buffer that wait to be sent or are being sent, 0 if the buffer is free
+static int bridgeSizes[2];
+
+// buffer that receives the next transfer and buffer that gets sent next
+static int bridgeReadIndex;
+static int bridgeSendIndex;
+
+// a transfer from out-endpoint 2 is in progress
+static bool bridgeReading;
+
+// the rx line is idle, the rest of the received data gets sent as short packet
+static bool bridgeIdle;
+
+// the last packet on in-endpoint 1 was full, a zero length packet ends the transfer when the line becomes idle
+static bool bridgeEndTransfer;
+
+static void bridgeReceived(int ep, int length);
+
+// start sending a filled buffer and receiving into a free buffer
+static void bridgeNext() {
+	if (uartSendReady() && bridgeSizes[bridgeSendIndex] > 0) {
+		uartSend(bridgeBuffers[bridgeSendIndex], bridgeSizes[bridgeSendIndex]);
+		counters.uartTxBytes += bridgeSizes[bridgeSendIndex];
+	}
+
+	// while both buffers are filled out-endpoint 2 naks, the host waits until dma has sent a buffer
+	if (!bridgeReading && bridgeSizes[bridgeReadIndex] == 0) {
+		bridgeReading = true;
+		usbBulkRead(2, bridgeBuffers[bridgeReadIndex], BRIDGE_TRANSFER_SIZE, bridgeReceived);
+	}
+}
+
+// a transfer was received on out-endpoint 2
+static void bridgeReceived(int ep, int length) {
+	bridgeReading = false;
+	if (length > 0) {
+		bridgeSizes[bridgeReadIndex] = length;
+		bridgeReadIndex ^= 1;
+	}
+	bridgeNext();
+}
+
+// called from the dma interrupt when a buffer was sent
+static void bridgeSent() {
+	bridgeSizes[bridgeSendIndex] = 0;
+	bridgeSendIndex ^= 1;
+	bridgeNext();
+}
+
+// send received data on in-endpoint 1 while tx buffers are free: full packets, the rest when the line is idle
+static void bridgeSendNext() {
+	while (usbBulkSendReady(1)) {
+		int available = uartAvailable();
+		if (available >= BULK_PACKET_SIZE || (available > 0 && bridgeIdle)) {
+			uint8_t packet[BULK_PACKET_SIZE];
+			int size = uartRead(packet, BULK_PACKET_SIZE);
+			usbBulkSend(1, packet, size);
+			counters.uartRxBytes += size;
+			bridgeEndTransfer = size == BULK_PACKET_SIZE;
+		} else if (available == 0 && bridgeIdle && bridgeEndTransfer) {
+			usbBulkSend(1, NULL, 0);
+			bridgeEndTransfer = false;
+		} else {
+			break;
+		}
+	}
+	counters.uartRxDropped = uartDropped();
+	counters.uartErrors = uartErrors();
+}
+
+// called from the dma and usart interrupts when data was received
+static void bridgeUartReceived(bool idle) {
+	bridgeIdle = idle;
+	bridgeSendNext();
+}
+
+static void setMode(enum Mode m) {
+	mode = m;
+	counters = (struct Counters){0};
+	latency = (struct Latency){0};
+	sourceOffset = 0;
+	sinkOffset = 0;
+	usbBulkCancel(1);
+	usbBulkCancel(2);
+
+	// the result of a script is dropped
+	if (scriptState == SCRIPT_SENDING)
+		scriptState = SCRIPT_IDLE;
+
+	// start or stop the adc stream
+	adcBlock = NULL;
+	adcSequence = 0;
+	if (m == MODE_ADC)
+		adcStart(&adcConfig, adcBlockReady);
+	else
+		adcStop();
+
+	// start or stop the uart bridge
+	bridgeSizes[0] = 0;
+	bridgeSizes[1] = 0;
+	bridgeReadIndex = 0;
+	bridgeSendIndex = 0;
+	bridgeReading = false;
+	bridgeIdle = false;
+	bridgeEndTransfer = false;
+	if (m == MODE_UART)
+		uartStart(&uartConfig, bridgeUartReceived, bridgeSent);
+	else
+		uartStop();
+
+	// discard a packet that waits for the echo
+	if (m != MODE_ECHO && usbBulkReceiveReady(2))
+		usbBulkReceive(2, NULL, 0);
+
+	// the framed mode needs the start of frame interrupt for the flush timeout, the timestamps of the adc stream for
+	// the cycle counter at the start of frame
+	frameWriterInit(&frameWriter);
+	frameReaderInit(&frameReader);
+	frameAge = 0;
+	frameEndTransfer = false;
+	if (m == MODE_FRAMED || (m == MODE_ADC && adcConfig.timestamp))
+		SET_REG(USB_CNTR_REG, GET_REG(USB_CNTR_REG) | USB_CNTR_SOFM);
+	else
+		SET_REG(USB_CNTR_REG, GET_REG(USB_CNTR_REG) & ~USB_CNTR_SOFM);
+
+	// wait for the first transfer
+	if (m == MODE_LOOPBACK)
+		usbBulkRead(2, loopbackBuffer, LOOPBACK_SIZE, loopbackReceived);
+	if (m == MODE_UART)
+		bridgeNext();
+
+	// start streaming, also if the in endpoint is currently idle
+	if (m == MODE_SOURCE_SINK) {
+		while (usbBulkSendReady(1))
+			sourceSend();
+	}
+}
+
+// count and check a packet received on out-endpoint 2
+static void sinkReceive() {
+	uint8_t packet[BULK_PACKET_SIZE];
+	int count = usbBulkReceive(2, packet, BULK_PACKET_SIZE);
+	uint8_t offset = sinkOffset;
+	for (int i = 0; i < count; ++i) {
+		if (packet[i] != offset)
+			++counters.sinkErrors;
+		offset = offset == PATTERN_LENGTH - 1 ? 0 : offset + 1;
+	}
+	sinkOffset = offset;
+	++counters.sinkPackets;
+	counters.sinkBytes += count;
+}
+
+// send a packet received on out-endpoint 2 back on in-endpoint 1, the fields of struct EchoPacket are filled in if
+// the packet is large enough
+static void echo() {
+	uint32_t start = dwt_read_cycle_counter();
+
+	uint32_t buffer[BULK_PACKET_SIZE / 4];
+	int count = usbBulkReceive(2, buffer, BULK_PACKET_SIZE);
+	if (count >= (int)sizeof(struct EchoPacket)) {
+		struct EchoPacket *packet = (struct EchoPacket *)buffer;
+		packet->frame = GET_REG(USB_FNR_REG) & USB_FNR_FN;
+		packet->dispatchCycles = start - eventStart;
+
+		// the turnaround time can only be filled in before the packet is copied into the tx buffer, therefore the
+		// copy itself is not included
+		packet->turnaroundCycles = dwt_read_cycle_counter() - start;
+	}
+	usbBulkSend(1, buffer, count);
+}
+
+// gpio ports of commands, indexed by enum CommandPort
+static const uint32_t commandPorts[] = {GPIOA, GPIOB, GPIOC};
+
+// execute a command of the framed mode
+static struct Completion commandExecute(const struct Command *command) {
+	struct Completion completion = {command->tag, COMMAND_OK, 0, 0};
+	if (command->port > COMMAND_PORT_C || command->opcode > COMMAND_GPIO_READ) {
+		completion.status = COMMAND_INVALID;
+		return completion;
+	}
+	uint32_t port = commandPorts[command->port];
+	uint16_t mask = command->mask;
+	if (command->port == COMMAND_PORT_A && (mask & (GPIO11 | GPIO12)) && command->opcode != COMMAND_GPIO_READ) {
+		// usb data lines
+		completion.status = COMMAND_RESERVED;
+		return completion;
+	}
+	switch (command->opcode) {
+	case COMMAND_GPIO_MODE:
+		gpio_set_mode(port, command->value & 3, (command->value >> 2) & 3, mask);
+		break;
+	case COMMAND_GPIO_WRITE:
+		gpio_set(port, mask & command->value);
+		gpio_clear(port, mask & ~command->value);
+		break;
+	case COMMAND_GPIO_READ:
+		completion.value = gpio_get(port, mask);
+		break;
+	}
+	return completion;
+}
+
+// send the packet of the frame writer if a tx buffer is free, padded if the transfer should continue
+static bool framedFlush(bool pad) {
+	if (!usbBulkSendReady(1))
+		return false;
+	int size = frameFinish(&frameWriter, pad);
+	usbBulkSend(1, frameWriter.packet, size);
+	++counters.sourcePackets;
+	frameAge = 0;
+	frameEndTransfer = size == FRAME_PACKET_SIZE;
+	return true;
+}
+
+// send a partially filled packet or end the transfer when the flush timeout has elapsed
+static void framedTimeout() {
+	if (frameAge < flushTimeout)
+		return;
+	if (frameWriter.size > 0) {
+		framedFlush(false);
+	} else if (frameEndTransfer && usbBulkSendReady(1)) {
+		usbBulkSend(1, NULL, 0);
+		frameEndTransfer = false;
+	}
+}
+
+// handle the messages of received packets, stops when a reply does not fit because both tx buffers are in use. The
+// host then gets nak on out-endpoint 2 until a packet was sent
+static void framedProcess() {
+	while (true) {
+		if (frameReader.offset >= frameReader.size) {
+			// all messages handled, take the next packet
+			if (!usbBulkReceiveReady(2))
+				break;
+			int size = usbBulkReceive(2, frameRxPacket, FRAME_PACKET_SIZE);
+			frameReadPacket(&frameReader, frameRxPacket, size);
+			++counters.sinkPackets;
+			counters.sinkBytes += size;
+		}
+
+		int offset = frameReader.offset;
+		const uint8_t *data;
+		int length;
+		int type = frameRead(&frameReader, &data, &length);
+
+		// make room for the reply before the message gets handled so that a command is executed only once
+		int replyLength = -1;
+		if (type == MESSAGE_ECHO)
+			replyLength = length;
+		else if (type == MESSAGE_COMMAND)
+			replyLength = sizeof(struct Completion);
+		if (replyLength >= 0) {
+			if (!frameFits(&frameWriter, replyLength)) {
+				// packet is full: send it padded so that the transfer continues, then retry the message
+				frameReader.offset = offset;
+				if (!framedFlush(true))
+					break;
+				continue;
+			}
+			if (frameWriter.size == 0)
+				frameAge = 0;
+		}
+
+		if (type == MESSAGE_LED) {
+			if (length > 0 && data[0])
+				ledOn();
+			else
+				ledOff();
+		} else if (type == MESSAGE_ECHO) {
+			frameWrite(&frameWriter, MESSAGE_ECHO, data, length);
+		} else if (type == MESSAGE_COMMAND && length >= (int)sizeof(struct Command)) {
+			// the payload is not aligned
+			struct Command command;
+			memcpy(&command, data, sizeof(command));
+			struct Completion completion = commandExecute(&command);
+			frameWrite(&frameWriter, MESSAGE_COMPLETION, &completion, sizeof(completion));
+		}
+	}
+
+	// without timeout the replies to a packet are sent immediately
+	if (flushTimeout == 0 && frameWriter.size > 0)
+		framedFlush(false);
+}
+
+// the current state of the control endpoint
+static enum UsbMode usbMode = IDLE;
+
+// temp variable for usb address
+static uint8_t usbAddress = 0;
+
+// remaining data of the in data stage of a control transfer
+static const uint8_t *controlData;
+static int controlSize;
+
+// the data stage still has to be ended by a zero length packet
+static bool controlZlp;
+
+// buffer and number of bytes received so far of the out data stage of a control transfer
+static uint8_t *controlBuffer;
+static int controlOffset;
+
+// called when the out data stage is complete, returns false to stall the status stage
+static bool (*controlReceiveDone)(int size);
+
+// receive the out data stage of a control transfer into a buffer
+static void controlReceive(void *data, int size, bool (*done)(int size)) {
+	usbMode = RECEIVE_DATA;
+	controlBuffer = (uint8_t*)data;
+	controlSize = size;
+	controlOffset = 0;
+	controlReceiveDone = done;
+}
+
+static bool scriptUploaded(int size) {
+	scriptSize = size;
+	return true;
+}
+
+// the configuration is received into a temporary buffer so that an unsupported one does not replace the current
+static struct AdcConfig adcConfigReceived;
+
+static bool adcConfigUploaded(int size) {
+	if (size < (int)sizeof(struct AdcConfig) || !adcCheckConfig(&adcConfigReceived))
+		return false;
+	adcConfig = adcConfigReceived;
+	return true;
+}
+
+static struct UartConfig uartConfigReceived;
+
+static bool uartConfigUploaded(int size) {
+	if (size < (int)sizeof(struct UartConfig) || !uartCheckConfig(&uartConfigReceived))
+		return false;
+	uartConfig = uartConfigReceived;
+	return true;
+}
+
+// send the next packet of the in data stage
+static void controlSendNext() {
+	int size = min(controlSize, usbDevice.bMaxPacketSize0);
+	usbSend(0, controlData, size);
+	controlData += size;
+	controlSize -= size;
+
+	// a short packet ends the data stage
+	if (size < usbDevice.bMaxPacketSize0)
+		controlZlp = false;
+}
+
+// start the in data stage of a control transfer, data has to stay valid until the data stage has finished. The data
+// is sent as packets of max packet size, the host ends the data stage after wLength bytes or a short packet
+static void controlSend(const void *data, int size, int wLength) {
+	usbMode = GET_DESCRIPTOR;
+	controlData = (const uint8_t*)data;
+	controlSize = min(size, wLength);
+
+	// a zero length packet is needed if less than requested is sent and the last packet is full
+	controlZlp = controlSize < wLength && controlSize % usbDevice.bMaxPacketSize0 == 0;
+	controlSendNext();
+}
+
+// convert an entry of the string table into a string descriptor, returns the size of the descriptor
+static int usbBuildString(int index) {
+	int length = 0;
+	if (index == USB_STRING_LANGUAGES) {
+		// english (united states)
+		usbStringDescriptor[1] = 0x0409;
+		length = 1;
+	} else {
+		const char *string = usbStrings[index];
+		while (string[length] != 0 && length < USB_STRING_MAX_LENGTH) {
+			usbStringDescriptor[1 + length] = (uint8_t)string[length];
+			++length;
+		}
+	}
+	int size = 2 + length * 2;
+	usbStringDescriptor[0] = size | (USB_DESCRIPTOR_STRING << 8);
+	return size;
+}
+
+void usbInit(void) {
+	// reference manual: 23.4.2 System and power-on reset
+
+	// switch on usb transceiver, but keep reset
+	SET_REG(USB_CNTR_REG, USB_CNTR_FRES);
+
+	// wait for at least 1us (see data sheet: Table 43. USB startup time)
+	for (int i = 0; i < 72; i++)
+		__asm__("nop");
+
+	// exit reset of usb
+	SET_REG(USB_CNTR_REG, 0);
+
+	// serial number from the unique id, lets the host tell identical boards apart
+	desig_get_unique_id_as_string(usbSerial, sizeof(usbSerial));
+
+	// setup in default state
+	usbSetup();
+	usbMode = IDLE;
+	statsRestart();
+
+	// enable interrupts for reset and correct transfer, errors and packet memory overruns only get counted. Double
+	// buffered bulk endpoints also trigger the high priority interrupt (reference manual: 23.4.2 USB interrupts)
+	SET_REG(USB_CNTR_REG, USB_CNTR_CTRM | USB_CNTR_RESETM | USB_CNTR_ERRM | USB_CNTR_PMAOVRM);
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	nvic_enable_irq(NVIC_USB_HP_CAN_TX_IRQ);
+}
+
+// answer a control request with a stall and count it
+static void controlStall() {
+	++stats.stalls;
+	trace(TRACE_STALL, 0, 0);
+	usbSendStall();
+}
+
+// handle a packet received on control endpoint 0
+static void controlReceived(int ep) {
+	if (GET_REG(USB_EP_REG(0)) & USB_EP_SETUP) {
+		// received a setup packet from the host
+		++stats.setups;
+		if ((GET_REG(USB_EP_RX_COUNT(0)) & 0x3ff) >= sizeof(struct UsbRequest)) {
+			struct UsbRequest request;
+
+			// copy request from rx buffer to system memory
+			pmaRead(&request, USB_GET_EP_RX_BUFF(0), sizeof(struct UsbRequest));
+			trace(TRACE_SETUP, request.bmRequestType, request.bRequest);
+
+			// check request type
+			// https://www.beyondlogic.org/usbnutshell/usb6.shtml			
+			switch (request.bmRequestType) {
+			case USB_OUT | USB_REQUEST_TYPE_STANDARD | USB_RECIPIENT_DEVICE:
+				// write request to standard device
+				if (request.bRequest == 0x05) {
+					// set address, but store in memory until zlp was sent
+					usbMode = SET_ADDRESS;
+					usbAddress = request.wValue;
+
+					// setup zero length packet (zlp) in tx buffer for status stage
+					usbSend(0, NULL, 0);
+				} else if (request.bRequest == 0x09) {
+					// set configuration
+					usbMode = AWAIT_TX;
+					uint8_t bConfigurationValue = request.wValue;
+					usbSetupEndpoints();
+
+					// send first data
+					usbBulkSend(1, &usbDevice, 4);
+
+					// setup zero length packet (zlp) in tx buffer for status stage
+					usbSend(0, NULL, 0);
+				} else {
+					// unsupported request: stall
+					controlStall();
+				}
+				break;
+			case USB_IN | USB_REQUEST_TYPE_STANDARD | USB_RECIPIENT_DEVICE:
+				// read request to standard device
+				if (request.bRequest == 0x06) {
+					// get descriptor
+					uint8_t descriptorType = request.wValue >> 8;
+					uint8_t descriptorIndex = request.wValue;
+					if (descriptorType == USB_DESCRIPTOR_DEVICE) {
+						// send device descriptor
+						controlSend(&usbDevice, sizeof(struct UsbDeviceDescriptor), request.wLength);
+					} else if (descriptorType == USB_DESCRIPTOR_CONFIGURATION) {
+						// send configuration descriptor
+						controlSend(&usbConfiguration, sizeof(struct UsbConfiguration), request.wLength);
+ledOn();
+					} else if (descriptorType == USB_DESCRIPTOR_STRING && descriptorIndex < USB_STRING_COUNT) {
+						// send string descriptor, wIndex is the language id
+						int size = usbBuildString(descriptorIndex);
+						controlSend(usbStringDescriptor, size, request.wLength);
+					} else {
+						// unsupported descriptor type: stall
+						controlStall();
+					}
+				} else {
+					// unsupported request: stall
+					controlStall();
+				}
+				break;
+			case USB_OUT | USB_REQUEST_TYPE_STANDARD | USB_RECIPIENT_INTERFACE:
+				// write request to standard interface
+				if (request.bRequest == 0x0b) {
+					// set interface
+					usbMode = AWAIT_TX;
+					uint8_t bInterface = request.wIndex;
+					uint8_t bAlternateSetting = request.wValue;
+
+					// setup zero length packet in tx buffer for status stage
+					usbSend(0, NULL, 0);
+				} else {
+					// unsupported request: stall
+					controlStall();
+				}
+				break;
+			case USB_OUT | USB_REQUEST_TYPE_VENDOR | USB_RECIPIENT_DEVICE:
+				// write request to vendor device
+				if (request.bRequest == VENDOR_SET_MODE && request.wValue <= MODE_UART) {
+					// set mode of bulk endpoints, takes effect with the next packet
+					usbMode = AWAIT_TX;
+					setMode(request.wValue);
+
+					// setup zero length packet in tx buffer for status stage
+					usbSend(0, NULL, 0);
+				} else if (request.bRequest == VENDOR_SET_FLUSH_TIMEOUT) {
+					// set flush timeout of the framed mode
+					usbMode = AWAIT_TX;
+					flushTimeout = request.wValue;
+
+					// setup zero length packet in tx buffer for status stage
+					usbSend(0, NULL, 0);
+				} else if (request.bRequest == VENDOR_UPLOAD_SCRIPT && request.wLength <= SCRIPT_MAX_SIZE
+					&& scriptState == SCRIPT_IDLE)
+				{
+					// receive the script in the out data stage
+					scriptSize = 0;
+					if (request.wLength > 0) {
+						controlReceive(scriptCode, request.wLength, scriptUploaded);
+					} else {
+						usbMode = AWAIT_TX;
+						usbSend(0, NULL, 0);
+					}
+				} else if (request.bRequest == VENDOR_SET_ADC_CONFIG && request.wLength == sizeof(struct AdcConfig)) {
+					// receive the configuration in the out data stage
+					controlReceive(&adcConfigReceived, sizeof(struct AdcConfig), adcConfigUploaded);
+				} else if (request.bRequest == VENDOR_SET_UART_CONFIG && request.wLength == sizeof(struct UartConfig)) {
+					// receive the configuration in the out data stage
+					controlReceive(&uartConfigReceived, sizeof(struct UartConfig), uartConfigUploaded);
+				} else if (request.bRequest == VENDOR_RUN_SCRIPT && mode == MODE_SCRIPT
+					&& scriptState == SCRIPT_IDLE)
+				{
+					// the main loop runs the script
+					usbMode = AWAIT_TX;
+					scriptState = SCRIPT_PENDING;
+
+					// setup zero length packet in tx buffer for status stage
+					usbSend(0, NULL, 0);
+				} else {
+					// unsupported request: stall
+					controlStall();
+				}
+				break;
+			case USB_IN | USB_REQUEST_TYPE_VENDOR | USB_RECIPIENT_DEVICE:
+				// read request to vendor device
+				if (request.bRequest == VENDOR_GET_COUNTERS) {
+					// send counters, in data stage is handled like get descriptor
+					controlSend(&counters, sizeof(struct Counters), request.wLength);
+				} else if (request.bRequest == VENDOR_GET_LATENCY) {
+					// send latency measurements
+					controlSend(&latency, sizeof(struct Latency), request.wLength);
+				} else if (request.bRequest == VENDOR_GET_STATS) {
+					// send a snapshot of the statistics so that the interrupts can keep updating them
+					static struct Stats snapshot;
+					snapshot = stats;
+					if (request.wValue == 1)
+						statsRestart();
+					controlSend(&snapshot, sizeof(struct Stats), request.wLength);
+				} else if (request.bRequest == VENDOR_GET_PMA_BENCHMARK) {
+					// measure the copy routines in the free packet memory and send the result
+					static struct PmaBenchmark benchmark;
+					pmaBenchmark(&benchmark, (uint8_t*)USB_PMA_BASE + USB_PMA_FREE * 2);
+					controlSend(&benchmark, sizeof(struct PmaBenchmark), request.wLength);
+				} else {
+					// unsupported request: stall
+					controlStall();
+				}
+				break;
+			case USB_OUT | USB_REQUEST_TYPE_STANDARD | USB_RECIPIENT_ENDPOINT:
+				// write request to standard endpoint
+				if (request.bRequest == 0x01) {
+					// clear feature
+					usbMode = AWAIT_TX;
+
+					// setup zero length packet in tx buffer for status stage
+					usbSend(0, NULL, 0);
+				} else {
+					// unsupported request: stall
+					controlStall();
+				}
+				break;
+			default:
+				// unsupported request type: stall
+				controlStall();
+			}
+		} else {
+			// request too short: stall
+			controlStall();
+		}
+	} else {
+		// received a packet from the host
+		switch (usbMode) {
+		case GET_DESCRIPTOR:
+			// zlp received (out status stage)
+ledOff();
+			usbMode = IDLE;
+			break;
+		case RECEIVE_DATA: {
+			// packet of the out data stage
+			int count = GET_REG(USB_EP_RX_COUNT(0)) & 0x3ff;
+			int n = min(count, controlSize - controlOffset);
+			pmaRead(controlBuffer + controlOffset, USB_GET_EP_RX_BUFF(0), n);
+			controlOffset += n;
+			if (controlOffset == controlSize || count < usbDevice.bMaxPacketSize0) {
+				if (controlReceiveDone(controlOffset)) {
+					// setup zero length packet in tx buffer for status stage
+					usbMode = AWAIT_TX;
+					usbSend(0, NULL, 0);
+				} else {
+					// request error: stall the status stage
+					usbMode = IDLE;
+					controlStall();
+				}
+			}
+			break;
+		}
+		}
+	}
+
+	// enable receiving again
+	usbReceive(0);
+}
+
+// handle a packet sent on control endpoint 0
+static void controlSent(int ep) {
+	// last send to host has completed
+	switch (usbMode) {
+	case SET_ADDRESS:
+		// zlp sent (out status stage), now we can set the usb address
+		SET_REG(USB_DADDR_REG, USB_DADDR_EF | usbAddress);
+		usbMode = IDLE;
+		usbSendStall();
+		break;
+	case AWAIT_TX:
+		// zlp sent (out status stage)
+		usbMode = IDLE;
+		usbSendStall();
+		break;
+	case GET_DESCRIPTOR:
+		// prepare the next packet of the in data stage, then wait for the zlp of the out status stage
+		if (controlSize > 0 || controlZlp)
+			controlSendNext();
+		else
+			usbClearCtr(0, USB_EP_TX_CTR);
+		break;
+	default:
+		usbSendStall();				
+	}
+}
+
+// echo a received packet if there is space in the tx buffers, otherwise the host gets nak until the next packet
+// was sent
+static void echoNext() {
+	if (usbBulkReceiveReady(2) && usbBulkSendReady(1))
+		echo();
+}
+
+// handle a packet sent on in-endpoint 1
+static void bulkSent(int ep) {
+	// a buffer was sent to the host, the usb peripheral continues with the other buffer if it is filled
+	usbBulkSendDone(ep);
+	if (mode == MODE_SOURCE_SINK) {
+		// stream the pattern, keep both buffers filled
+		while (usbBulkSendReady(1))
+			sourceSend();
+	} else if (mode == MODE_ECHO) {
+		// a packet may wait for a free tx buffer
+		echoNext();
+	} else if (mode == MODE_LOOPBACK) {
+		// queue next packets of the transfer
+		usbBulkWriteNext(ep);
+	} else if (mode == MODE_FRAMED) {
+		// a tx buffer is free: continue with messages that did not fit and send a packet whose timeout has elapsed
+		framedProcess();
+		framedTimeout();
+	} else if (mode == MODE_SCRIPT) {
+		// queue next packets of the script result
+		usbBulkWriteNext(ep);
+	} else if (mode == MODE_ADC) {
+		// continue with the packets of the current block
+		adcSendNext();
+	} else if (mode == MODE_UART) {
+		// continue with received data that did not fit into the tx buffers
+		bridgeSendNext();
+	} else {
+		ledToggle();
+
+		// send next data
+		usbBulkSend(1, &usbDevice, 4);
+	}
+}
+
+// handle a packet received on out-endpoint 2
+static void bulkReceived(int ep) {
+	// received data from the host
+	usbBulkReceiveDone(ep);
+	if (mode == MODE_ECHO) {
+		echoNext();
+	} else if (mode == MODE_LOOPBACK || mode == MODE_UART) {
+		// take the packet into the transfer buffer. In the uart bridge it waits while both buffers are filled
+		usbBulkReadNext(ep);
+	} else if (mode == MODE_FRAMED) {
+		framedProcess();
+	} else if (mode == MODE_SCRIPT || mode == MODE_ADC) {
+		// out-endpoint 2 is not used
+		usbBulkReceive(ep, NULL, 0);
+	} else if (mode == MODE_SOURCE_SINK) {
+		// count and discard
+		sinkReceive();
+	} else {
+		uint8_t data[BULK_PACKET_SIZE];
+		if (usbBulkReceive(ep, data, sizeof(data)) > 0 && data[0])
+			ledOn();
+		else
+			ledOff();
+	}
+}
+
+
+// Event trace
+// ------------------------------------
+
+#ifdef TRACE
+// send the next records of the trace, called at the end of each usb interrupt. The tx buffer is free when the
+// endpoint naks, before set configuration it is disabled
+static void traceSendNext() {
+	if ((GET_REG(USB_EP_REG(TRACE_ENDPOINT)) & USB_EP_TX_STAT) != USB_EP_TX_STAT_NAK)
+		return;
+	struct TraceRecord records[TRACE_PACKET_SIZE / sizeof(struct TraceRecord)];
+	int count = traceRead(records, TRACE_PACKET_SIZE / sizeof(struct TraceRecord));
+	if (count > 0)
+		usbSend(TRACE_ENDPOINT, records, count * sizeof(struct TraceRecord));
+}
+#endif
+
+// handle a packet of the trace sent on in endpoint 3, the next one is sent at the end of the interrupt
+static void traceSent(int ep) {
+	usbClearCtr(ep, USB_EP_TX_CTR);
+}
+
+// packet memory layout
+// offset | size | description
+//      0 |   32 | buffer table for 4 endpoints
+//     32 |   64 | tx buffer of control endpoint 0
+//     96 |   64 | rx buffer of control endpoint 0
+//    160 |   64 | tx buffer 0 of double buffered bulk endpoint 1 (in to host)
+//    224 |   64 | tx buffer 1 of double buffered bulk endpoint 1
+//    288 |   64 | rx buffer 0 of double buffered bulk endpoint 2 (out from host)
+//    352 |   64 | rx buffer 1 of double buffered bulk endpoint 2
+//    416 |   32 | tx buffer of bulk endpoint 3 (event trace)
+//    448 |   64 | free
+static const struct UsbEndpoint usbEndpoints[USB_ENDPOINT_COUNT] = {
+	{USB_EP_TYPE_CONTROL, 32, 96, 64, 64, controlSent, controlReceived},
+	{USB_EP_TYPE_BULK | USB_EP_KIND, 160, 224, BULK_PACKET_SIZE, 0, bulkSent, NULL},
+	{USB_EP_TYPE_BULK | USB_EP_KIND, 288, 352, 0, BULK_PACKET_SIZE, NULL, bulkReceived},
+	{USB_EP_TYPE_BULK, 416, 0, TRACE_PACKET_SIZE, 0, traceSent, NULL}
+};
+
+// start of frame, once per ms while the host keeps the bus active
+static void startOfFrame() {
+	// the F103 can not capture a timer at the sof in hardware, therefore the interrupt latency adds some cycles
+	sofCycles = dwt_read_cycle_counter();
+	sofFrame = GET_REG(USB_FNR_REG) & USB_FNR_FN;
+
+	if (mode == MODE_FRAMED) {
+		++frameAge;
+		framedTimeout();
+	}
+}
+
+// handle all pending usb events, only the endpoint indicated by EP_ID and DIR gets handled in each iteration. The
+// cycles of each handler and of the whole interrupt go into the statistics
+static void usbHandleEvents() {
+	eventStart = dwt_read_cycle_counter();
+	inEvent = true;
+
+	uint16_t istr;
+	while ((istr = GET_REG(USB_ISTR_REG))
+		& (USB_ISTR_CTR | USB_ISTR_RESET | USB_ISTR_SOF | USB_ISTR_ERR | USB_ISTR_PMAOVR))
+	{
+		uint32_t start = dwt_read_cycle_counter();
+		if (istr & (USB_ISTR_ERR | USB_ISTR_PMAOVR)) {
+			// the host retries the transaction, only count the errors. Clear only their flags
+			SET_REG(USB_ISTR_REG, (uint16_t)~(istr & (USB_ISTR_ERR | USB_ISTR_PMAOVR)));
+			if (istr & USB_ISTR_ERR)
+				++stats.errors;
+			if (istr & USB_ISTR_PMAOVR)
+				++stats.overruns;
+			continue;
+		}
+		if (istr & USB_ISTR_RESET) {
+			// reset detected: setup in default state (also clears the interrupt flags)
+			trace(TRACE_RESET, 0, 0);
+			usbSetup();
+			statsAdd(STATS_RESET, dwt_read_cycle_counter() - start);
+			continue;
+		}
+		if (istr & USB_ISTR_SOF) {
+			// clear only the sof flag, the flags of ISTR are cleared by writing 0
+			SET_REG(USB_ISTR_REG, (uint16_t)~USB_ISTR_SOF);
+			startOfFrame();
+			statsAdd(STATS_SOF, dwt_read_cycle_counter() - start);
+			continue;
+		}
+
+		// DIR is set if the rx ctr flag is set (the tx ctr flag may be set too and is handled in the next iteration),
+		// the handler has to clear the ctr flag
+		int ep = istr & USB_ISTR_EP_ID;
+		const struct UsbEndpoint *endpoint = &usbEndpoints[ep];
+		struct UsbBulkState *state = &usbBulkStates[ep];
+#ifdef TRACE
+		enum UsbMode previousMode = usbMode;
+		if (ep != TRACE_ENDPOINT)
+			trace(istr & USB_ISTR_DIR ? TRACE_CTR_RX : TRACE_CTR_TX, ep, GET_REG(USB_EP_REG(ep)));
+#endif
+		if (istr & USB_ISTR_DIR) {
+			endpoint->received(ep);
+			statsAdd(STATS_CTR + 2 * ep + 1, dwt_read_cycle_counter() - start);
+
+			// a double buffered out endpoint naks until the application takes the packet
+			if (state->rxReady)
+				++stats.outNaks;
+		} else {
+			endpoint->sent(ep);
+			statsAdd(STATS_CTR + 2 * ep, dwt_read_cycle_counter() - start);
+
+			// a double buffered in endpoint naks until the application sends the next packet
+			if ((endpoint->type & USB_EP_KIND) && !state->txBusy)
+				++stats.inNaks;
+		}
+#ifdef TRACE
+		if (usbMode != previousMode)
+			trace(TRACE_STATE, usbMode, previousMode);
+#endif
+	}
+#ifdef TRACE
+	traceSendNext();
+#endif
+	inEvent = false;
+	statsAdd(STATS_INTERRUPT, dwt_read_cycle_counter() - eventStart);
+}
+
+void usb_lp_can_rx0_isr(void) {
+	usbHandleEvents();
+}
+
+void usb_hp_can_tx_isr(void) {
+	usbHandleEvents();
+}
+
+bool usbScriptPending(void) {
+	return scriptState == SCRIPT_PENDING;
+}
+
+void usbRunScript(void) {
+	if (scriptState != SCRIPT_PENDING)
+		return;
+	scriptState = SCRIPT_RUNNING;
+	int size = scriptRun(scriptCode, scriptSize, (uint8_t*)scriptResult);
+
+	// the transfer is continued by the interrupt handlers, therefore they must not interrupt its start
+	nvic_disable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	nvic_disable_irq(NVIC_USB_HP_CAN_TX_IRQ);
+	if (mode == MODE_SCRIPT) {
+		scriptState = SCRIPT_SENDING;
+		usbBulkWrite(1, scriptResult, size, scriptSent);
+	} else {
+		// the mode was switched while the script was running
+		scriptState = SCRIPT_IDLE;
+	}
+	nvic_enable_irq(NVIC_USB_LP_CAN_RX0_IRQ);
+	nvic_enable_irq(NVIC_USB_HP_CAN_TX_IRQ);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+// usb device with control endpoint 0, bulk in endpoint 1 and bulk out endpoint 2
+
+#include <stdbool.h>
+
+
+// init usb after power on, usb events are then handled in usb_lp_can_rx0_isr() and usb_hp_can_tx_isr()
+void usbInit(void);
+
+// returns true if a script was started by vendor request and waits to be run by usbRunScript()
+bool usbScriptPending(void);
+
+// run a pending script in the main loop and send its result on in-endpoint 1, the usb interrupts stay active while
+// the script runs
+void usbRunScript(void);